@@ -9,19 +9,19 @@ export const queryDB = async (sql: string): Promise<string> => {
         const client = new net.Socket();
         let responseBuffer = "";
 
+        // the server answers every statement of the input, ends a last one
+        // that has no ';' once the input ends and then closes
         client.connect(DB_PORT, DB_HOST, () => {
-            client.write(sql);
+            client.end(sql);
         });
 
         client.on('data', (chunk) => {
-            const chunkStr = chunk.toString();
-            responseBuffer += chunkStr;
+            responseBuffer += chunk.toString();
+        });
 
-            if (chunkStr.includes('\0')) {
-                const finalData = responseBuffer.replace(/\0/g, '');
-                resolve(finalData);
-                client.destroy(); 
-            }
+        client.on('end', () => {
+            resolve(responseBuffer.replace(/\0/g, ''));
+            client.destroy();
         });
 
         client.on('error', (err) => {
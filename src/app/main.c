@@ -2,14 +2,20 @@
 
 // easier building
 #include "../arena/arena.c"
+#include "../bloom/bloom.c"
 #include "../btree/btree.c"
+#include "../csv/csv.c"
 #include "../db/db.c"
 #include "../executor/executor.c"
+#include "../hash/hash.c"
+#include "../heap/heap.c"
 #include "../lexer/lexer.c"
+#include "../lz/lz.c"
 #include "../pager/pager.c"
 #include "../parser/parser.c"
 #include "../str/str.c"
 #include "../token/token.c"
+#include "vacuum.c"
 #include "server.c"
 #include "threadpool.c"
 
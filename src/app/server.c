@@ -1,9 +1,11 @@
 #include "server.h"
 
 #include "../btree/btree.h"
+#include "vacuum.h"
 #include "threadpool.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -28,33 +30,104 @@ void server_start ()
     Database *db = push_struct_zero (&global_arena, Database);
     db->global_arena = &global_arena;
 
-    db->pager = pager_open (&global_arena, "csql.db");
+    uint32_t page_size = PAGE_SIZE_DEFAULT;
+    char *page_size_env = getenv ("CSQL_PAGE_SIZE");
+    if (page_size_env != NULL)
+    {
+        page_size = (uint32_t) strtoul (page_size_env, NULL, 10);
+        if (!pager_page_size_valid (page_size))
+        {
+            fprintf (stderr, "Error: CSQL_PAGE_SIZE must be 4096, 8192, 16384, "
+                             "32768 or 65536\n");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    size_t cache_size = PAGER_CACHE_DEFAULT;
+    char *cache_env = getenv ("CSQL_CACHE_MB");
+    if (cache_env != NULL)
+    {
+        cache_size = (size_t) strtoul (cache_env, NULL, 10) * SIZE_MB;
+        if (cache_size == 0)
+        {
+            fprintf (stderr, "Error: CSQL_CACHE_MB must be a positive number "
+                             "of MiB\n");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    unsigned long max_pages = UINT32_MAX;
+    char *max_pages_env = getenv ("CSQL_MAX_PAGES");
+    if (max_pages_env != NULL)
+    {
+        max_pages = strtoul (max_pages_env, NULL, 10);
+        if (max_pages <= CATALOG_PAGE || max_pages > UINT32_MAX)
+        {
+            fprintf (stderr, "Error: CSQL_MAX_PAGES must be from %d to %u\n",
+                     CATALOG_PAGE + 1, UINT32_MAX);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    // the page size only applies to a new database
+    db->pager = pager_open (&global_arena, "csql.db", page_size, cache_size);
     if (db->pager == NULL)
     {
         fprintf (stderr, "Error: Could not open file %s\n", "csql.db");
         exit (EXIT_FAILURE);
     }
+    db->pager->max_pages = max_pages;
+    if (getenv ("CSQL_DIRECT_IO") != NULL && !pager_direct_io (db->pager))
+    {
+        perror ("Warning: O_DIRECT not supported, using buffered I/O");
+    }
+    if (getenv ("CSQL_MMAP") != NULL && !pager_map (db->pager))
+    {
+        perror ("Warning: mmap failed, pages are read into memory");
+    }
+
+    // COPY reads and writes files for any client, only in this directory
+    db->copy_dir_fd = -1;
+    char *copy_dir = getenv ("CSQL_COPY_DIR");
+    if (copy_dir != NULL && copy_dir[0] != 0)
+    {
+        db->copy_dir_fd = open (copy_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (db->copy_dir_fd == -1)
+        {
+            perror ("Error: Could not open CSQL_COPY_DIR");
+            exit (EXIT_FAILURE);
+        }
+    }
 
-    if (pthread_mutex_init (&db->lock, NULL) != 0)
+    // a steady stream of readers must not starve a writer
+    pthread_rwlockattr_t lock_attr;
+    pthread_rwlockattr_init (&lock_attr);
+    pthread_rwlockattr_setkind_np (
+        &lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    if (pthread_rwlock_init (&db->lock, &lock_attr) != 0
+        || pthread_mutex_init (&db->filter_lock, NULL) != 0)
     {
         perror ("DB Mutex Init failed");
         exit (EXIT_FAILURE);
     }
+    pthread_rwlockattr_destroy (&lock_attr);
 
-    if (db->pager->num_pages == 0)
+    if (db->pager->num_pages <= CATALOG_PAGE)
     {
-        // page 0 - catalog root
-        void *page_zero = pager_get_page (db->global_arena, db->pager, 0);
-        initialize_leaf_node (page_zero);
-        set_node_root (page_zero, 1);
-        db->pager->num_pages = 1;
+        db->pager->num_pages = CATALOG_PAGE + 1;
+        void *catalog = pager_get_page (db->pager, CATALOG_PAGE);
+        initialize_leaf_node (catalog);
+        set_node_root (catalog, 1);
+        pager_mark_dirty (db->pager, CATALOG_PAGE);
     }
     else
     {
         catalog_init_from_disk (db);
     }
+    pager_unpin_to (db->pager, 0);
 
     thread_pool_init (&conn_pool, db);
+    vacuum_start (db);
 
     struct sockaddr_in server_sockaddr;
     int opt = 1;
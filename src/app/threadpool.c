@@ -6,6 +6,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,10 +67,245 @@ void thread_pool_submit (ThreadPool *pool, int client_fd,
     pthread_mutex_unlock (&pool->queue.lock);
 }
 
+static void conn_buffer_init (ConnBuffer *cb, void *backing, size_t size)
+{
+    arena_init (&cb->arena, backing, size);
+    cb->data =
+        push_array_no_zero (&cb->arena, uint8_t, CONN_BUFFER_INITIAL_SIZE);
+    cb->cap = CONN_BUFFER_INITIAL_SIZE;
+    cb->len = 0;
+    cb->start = 0;
+    cb->scan = 0;
+    cb->quote = 0;
+}
+
+/**
+ * conn_buffer_reserve - makes room for more bytes at the end of the buffer
+ * @cb: connection buffer
+ *
+ * Consumed statements are dropped from the front first, the buffer is only
+ * doubled when a single pending statement fills it.
+ *
+ * Return: false if the pending statement exceeds CONN_BUFFER_MAX_SIZE
+ */
+static bool conn_buffer_reserve (ConnBuffer *cb)
+{
+    if (cb->start > 0)
+    {
+        memmove (cb->data, cb->data + cb->start, cb->len - cb->start);
+        cb->len -= cb->start;
+        cb->scan -= cb->start;
+        cb->start = 0;
+    }
+
+    if (cb->len < cb->cap)
+    {
+        return true;
+    }
+
+    if (cb->cap >= CONN_BUFFER_MAX_SIZE)
+    {
+        return false;
+    }
+
+    // data is the only allocation in the arena so it grows in place
+    size_t new_cap = cb->cap * 2;
+    cb->data = arena_resize (&cb->arena, cb->data, cb->cap, new_cap,
+                             ArenaFlag_NoZero);
+    cb->cap = new_cap;
+    return true;
+}
+
+/**
+ * conn_buffer_next_statement - frames the next complete statement
+ * @cb: connection buffer
+ * @out: set to the statement text, including the terminating ';'
+ *
+ * Scanning resumes where the previous call stopped, so a statement that
+ * arrives over many reads is only scanned once.
+ *
+ * Return: true if a complete statement was framed
+ */
+static bool conn_buffer_next_statement (ConnBuffer *cb, str8 *out)
+{
+    while (cb->scan < cb->len)
+    {
+        uint8_t c = cb->data[cb->scan++];
+
+        if (cb->quote)
+        {
+            if (c == cb->quote)
+            {
+                cb->quote = 0;
+            }
+            continue;
+        }
+
+        if (c == '\'' || c == '"')
+        {
+            cb->quote = c;
+        }
+        else if (c == ';' || c == '\0')
+        {
+            *out = str8_from_range (cb->data + cb->start, cb->data + cb->scan);
+            cb->start = cb->scan;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool statement_is_blank (str8 s)
+{
+    for (size_t i = 0; i < s.len; i++)
+    {
+        uint8_t c = s.str[i];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != ';'
+            && c != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * statement_terminate - copies a statement into the statement arena, one
+ * ended by a '\0' byte or by the end of input gets the ';' the parser
+ * expects
+ */
+static str8 statement_terminate (Arena *arena, str8 raw)
+{
+    while (raw.len > 0
+           && (raw.str[raw.len - 1] == '\0' || raw.str[raw.len - 1] == ' '
+               || raw.str[raw.len - 1] == '\t' || raw.str[raw.len - 1] == '\n'
+               || raw.str[raw.len - 1] == '\r'))
+    {
+        raw.len--;
+    }
+    if (raw.str[raw.len - 1] == ';')
+    {
+        return str8_copy (arena, raw);
+    }
+
+    str8 sql = {push_array_no_zero (arena, uint8_t, raw.len + 2),
+                raw.len + 1};
+    memcpy (sql.str, raw.str, raw.len);
+    sql.str[raw.len] = ';';
+    sql.str[raw.len + 1] = 0;
+    return sql;
+}
+
+static void worker_send_result (int client_fd, ExecuteResult result)
+{
+    switch (result)
+    {
+    case EXECUTE_SUCCESS:
+        send (client_fd, "OK.\n", 4, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_DB_FULL:
+        send (client_fd, "Error: Database full.\n", 22, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_TABLE_EXISTS:
+        send (client_fd, "Error: Table exists.\n", 21, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_TABLE_FULL:
+        send (client_fd, "Error: Table full.\n", 19, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_TABLE_NOT_EXISTS:
+        send (client_fd, "Error: Table not found.\n", 24, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_TABLE_COL_COUNT_MISMATCH:
+        send (client_fd, "Error: Column count mismatch.\n", 30, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_COL_NOT_FOUND:
+        send (client_fd, "Error: Column not found.\n", 25, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_DUPLICATE_KEY:
+        send (client_fd, "Error: Duplicate key.\n", 22, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_ROW_TOO_LARGE:
+        send (client_fd, "Error: Row too large.\n", 22, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_FILE_ERROR:
+        send (client_fd, "Error: Could not access file.\n", 30, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_FILE_NOT_ALLOWED:
+        send (client_fd, "Error: File not allowed.\n", 25, MSG_NOSIGNAL);
+        break;
+    case EXECUTE_INVALID_VALUE:
+        send (client_fd, "Error: Invalid value.\n", 22, MSG_NOSIGNAL);
+        break;
+    default:
+        send (client_fd, "Execution failed.\n", 18, MSG_NOSIGNAL);
+        break;
+    }
+    send (client_fd, "", 1, MSG_NOSIGNAL); // null terminator
+}
+
+/**
+ * worker_run_statement - parses and executes one framed statement and sends
+ * its response
+ *
+ * A blank statement, e.g. the second ';' of "SELECT ...;;", gets an empty
+ * response so that every terminator is answered.
+ */
+static void worker_run_statement (ThreadPool *pool, int client_fd, str8 raw,
+                                  Arena *stmt_arena)
+{
+    if (statement_is_blank (raw))
+    {
+        send (client_fd, "", 1, MSG_NOSIGNAL);
+        return;
+    }
+
+    arena_free_all (stmt_arena);
+    str8 sql = statement_terminate (stmt_arena, raw);
+
+    Parser p;
+    parser_init (&p, stmt_arena, (char *) sql.str);
+    Statement stmt = parser_parse_statement (&p);
+
+    if (stmt.type == STMT_ERROR)
+    {
+        send (client_fd, "Error: ", 7, MSG_NOSIGNAL);
+        send (client_fd, stmt.error.msg, strlen (stmt.error.msg),
+              MSG_NOSIGNAL);
+        send (client_fd, "\n\0", 2, MSG_NOSIGNAL);
+        return;
+    }
+
+    // the catalog does not change while the lock is held shared
+    pthread_rwlock_rdlock (&pool->db->lock);
+    if (!execute_runs_shared (&stmt, pool->db))
+    {
+        pthread_rwlock_unlock (&pool->db->lock);
+        pthread_rwlock_wrlock (&pool->db->lock);
+    }
+    ExecuteResult result =
+        execute_statement (&stmt, pool->db, stmt_arena, client_fd);
+    pager_unpin_to (pool->db->pager, 0); // the pages it read may be evicted
+    pthread_rwlock_unlock (&pool->db->lock);
+
+    worker_send_result (client_fd, result);
+}
+
 static void *worker_loop (void *arg)
 {
     ThreadPool *pool = (ThreadPool *) arg;
-    char buffer[4096];
+
+    void *conn_backing = malloc (CONN_BUFFER_MAX_SIZE);
+    void *stmt_backing = malloc (STMT_ARENA_SIZE);
+    if (conn_backing == NULL || stmt_backing == NULL)
+    {
+        perror ("Worker buffer allocation failed");
+        exit (EXIT_FAILURE);
+    }
+
+    ConnBuffer conn;
+    Arena stmt_arena;
+    arena_init (&stmt_arena, stmt_backing, STMT_ARENA_SIZE);
 
     while (1)
     {
@@ -94,73 +330,42 @@ static void *worker_loop (void *arg)
                 (unsigned long) pthread_self (), client_ip,
                 ntohs (task.client_sockaddr.sin_port));
 
+        conn_buffer_init (&conn, conn_backing, CONN_BUFFER_MAX_SIZE);
+
         while (1)
         {
-            memset (buffer, 0, 4096);
-            int bytes_read = read (task.client_fd, buffer, sizeof (buffer) - 1);
-
-            if (bytes_read <= 0)
+            if (!conn_buffer_reserve (&conn))
             {
+                char *msg = "Error: Statement too large.\n";
+                send (task.client_fd, msg, strlen (msg), MSG_NOSIGNAL);
+                send (task.client_fd, "", 1, MSG_NOSIGNAL);
                 break;
             }
 
-            buffer[bytes_read] = '\0';
+            ssize_t bytes_read = read (task.client_fd, conn.data + conn.len,
+                                       conn.cap - conn.len);
 
-            Parser p;
-            parser_init (&p, buffer);
-            Statement stmt = parser_parse_statement (&p);
-
-            if (stmt.type == STMT_ERROR)
+            if (bytes_read <= 0)
             {
-                send (task.client_fd, "Error: ", 7, MSG_NOSIGNAL);
-                send (task.client_fd, stmt.error.msg, strlen (stmt.error.msg),
-                      MSG_NOSIGNAL);
-                send (task.client_fd, "\n\0", 2, MSG_NOSIGNAL);
-                continue;
+                // the end of input ends a last statement without a ';'
+                str8 rest = str8_from_range (conn.data + conn.start,
+                                             conn.data + conn.len);
+                if (bytes_read == 0 && !statement_is_blank (rest))
+                {
+                    worker_run_statement (pool, task.client_fd, rest,
+                                          &stmt_arena);
+                }
+                break;
             }
 
-            pthread_mutex_lock (&pool->db->lock);
-            ExecuteResult result =
-                execute_statement (&stmt, pool->db, task.client_fd);
-            pthread_mutex_unlock (&pool->db->lock);
+            conn.len += bytes_read;
 
-            switch (result)
+            // execute every complete statement, a partial one stays buffered
+            str8 raw;
+            while (conn_buffer_next_statement (&conn, &raw))
             {
-            case EXECUTE_SUCCESS:
-                send (task.client_fd, "OK.\n", 4, MSG_NOSIGNAL);
-                break;
-            case EXECUTE_DB_FULL:
-                send (task.client_fd, "Error: Database full.\n", 22,
-                      MSG_NOSIGNAL);
-                break;
-            case EXECUTE_TABLE_EXISTS:
-                send (task.client_fd, "Error: Table exists.\n", 21,
-                      MSG_NOSIGNAL);
-                break;
-            case EXECUTE_TABLE_FULL:
-                send (task.client_fd, "Error: Table full.\n", 19, MSG_NOSIGNAL);
-                break;
-            case EXECUTE_TABLE_NOT_EXISTS:
-                send (task.client_fd, "Error: Table not found.\n", 24,
-                      MSG_NOSIGNAL);
-                break;
-            case EXECUTE_TABLE_COL_COUNT_MISMATCH:
-                send (task.client_fd, "Error: Column count mismatch.\n", 30,
-                      MSG_NOSIGNAL);
-                break;
-            case EXECUTE_COL_NOT_FOUND:
-                send (task.client_fd, "Error: Column not found.\n", 25,
-                      MSG_NOSIGNAL);
-                break;
-            case EXECUTE_DUPLICATE_KEY:
-                send (task.client_fd, "Error: Duplicate key.\n", 22,
-                      MSG_NOSIGNAL);
-                break;
-            default:
-                send (task.client_fd, "Execution failed.\n", 18, MSG_NOSIGNAL);
-                break;
+                worker_run_statement (pool, task.client_fd, raw, &stmt_arena);
             }
-            send (task.client_fd, "", 1, MSG_NOSIGNAL); // null terminator
         }
 
         close (task.client_fd);
@@ -9,6 +9,12 @@
 #define THREAD_POOL_SIZE 4
 #define QUEUE_SIZE 256
 
+// per connection input buffer, grows by doubling up to the max
+#define CONN_BUFFER_INITIAL_SIZE 4096
+#define CONN_BUFFER_MAX_SIZE     (SIZE_MB * 16)
+// scratch memory for a single statement, reset after every statement
+#define STMT_ARENA_SIZE (SIZE_MB * 32)
+
 typedef struct
 {
     int client_fd;
@@ -25,6 +31,30 @@ typedef struct
     pthread_cond_t not_empty;
 } Queue;
 
+/**
+ * CONNECTION BUFFER
+ *   0           start             scan                len           cap
+ *   ---------------------------------------------------------------------
+ *   | consumed  | pending statement | unscanned bytes  | free space     |
+ *   ---------------------------------------------------------------------
+ * Statements are framed by a ';' outside of quotes, or by a '\0' byte.
+ * Clients may pipeline any number of statements, responses are sent back
+ * in order, each terminated by '\0'. Every terminator gets a response, a
+ * blank statement an empty one. The end of input ends a last statement
+ * that has no terminator, so a client may also send one statement, shut
+ * down its side and read until the server closes.
+ */
+typedef struct
+{
+    Arena arena;
+    uint8_t *data;
+    size_t cap;
+    size_t len;
+    size_t start;
+    size_t scan;
+    uint8_t quote; // quote character open at scan, 0 if none
+} ConnBuffer;
+
 typedef struct
 {
     Queue queue;
@@ -0,0 +1,71 @@
+#include "vacuum.h"
+
+#include "../executor/executor.h"
+#include "../pager/pager.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void *vacuum_loop (void *arg)
+{
+    Database *db = (Database *) arg;
+    struct timespec interval = {VACUUM_INTERVAL_MS / 1000,
+                                (VACUUM_INTERVAL_MS % 1000) * 1000000L};
+    VacuumState *v = calloc (1, sizeof (VacuumState));
+    int table = 0;
+    if (!v)
+    {
+        return NULL;
+    }
+
+    while (1)
+    {
+        nanosleep (&interval, NULL);
+
+        for (int i = 0; i < VACUUM_STEPS_PER_PASS; i++)
+        {
+            // tables are never dropped, a table number stays valid
+            pthread_rwlock_rdlock (&db->lock);
+            if (table >= db->table_count)
+            {
+                table = 0;
+            }
+            if (db->table_count > 0
+                && !vacuum_step_latched (db, db->tables[table], v))
+            {
+                pthread_rwlock_unlock (&db->lock);
+                pthread_rwlock_wrlock (&db->lock);
+            }
+            if (db->table_count > 0
+                && vacuum_table_step (db, db->tables[table], v))
+            {
+                table++;
+            }
+            pager_unpin_to (db->pager, 0);
+            pthread_rwlock_unlock (&db->lock);
+        }
+
+        // no statement changes pages without latches while it is written
+        pthread_rwlock_rdlock (&db->lock);
+        pager_flush_dirty (db->pager);
+        pthread_rwlock_unlock (&db->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * vacuum_start - starts the background vacuum thread
+ */
+void vacuum_start (Database *db)
+{
+    pthread_t thread;
+    if (pthread_create (&thread, NULL, vacuum_loop, db) != 0)
+    {
+        perror ("Failed to create vacuum thread");
+        exit (EXIT_FAILURE);
+    }
+    pthread_detach (thread);
+}
@@ -0,0 +1,28 @@
+#ifndef VACUUM_H
+#define VACUUM_H
+
+#include "../db/db.h"
+
+/*
+ * BACKGROUND VACUUM
+ * -----------------
+ * Inserts compact the pages they need, pages that only see deletes would
+ * keep their dead cells and scans would keep walking them. A thread wakes
+ * up every VACUUM_INTERVAL_MS and runs VACUUM_STEPS_PER_PASS vacuum steps,
+ * round robin over the tables and their indexes, see vacuum_table_step.
+ *
+ * A step compacts a few leaves, buckets or heap pages, merges sparse btree
+ * leaves and frees the pages it empties. A btree step holds the database
+ * lock shared and latches the pages it changes, so it runs next to the
+ * statements that share the lock, whose cursors find their key again after
+ * a merge. Heap and hash pages have no latches, their steps take the lock
+ * exclusive, one step at a time. While a heap table or a hash index is
+ * vacuumed every statement on every table waits, for up to
+ * HEAP_VACUUM_PAGES pages or HASH_VACUUM_BUCKETS buckets per step.
+ */
+#define VACUUM_INTERVAL_MS    200
+#define VACUUM_STEPS_PER_PASS 4
+
+void vacuum_start (Database *db);
+
+#endif /* VACUUM_H */
@@ -91,6 +91,10 @@ void *arena_resize_align (Arena *a, void *old_memory, size_t old_size,
     {
         if (a->buf + a->prev_offset == old_mem)
         {
+            if (a->prev_offset + new_size > a->buf_len)
+            {
+                return NULL;
+            }
             a->curr_offset = a->prev_offset + new_size;
             if (new_size > old_size)
             {
@@ -106,6 +110,10 @@ void *arena_resize_align (Arena *a, void *old_memory, size_t old_size,
         else
         {
             void *new_memory = arena_alloc_align (a, new_size, align, zero);
+            if (new_memory == NULL)
+            {
+                return NULL;
+            }
             size_t copy_size = old_size < new_size ? old_size : new_size;
             // Copy across old memory to the new memory
             memmove (new_memory, old_memory, copy_size);
@@ -33,6 +33,7 @@ typedef enum
 void arena_init (Arena *a, void *backing_buffer, size_t backing_buffer_length);
 void arena_free_all (Arena *a);
 void *arena_alloc (Arena *a, size_t size, ArenaFlag zero);
+void *arena_alloc_align (Arena *a, size_t size, size_t align, ArenaFlag zero);
 void *arena_resize (Arena *a, void *old_memory, size_t old_size,
                     size_t new_size, ArenaFlag zero);
 Temp_Arena_Memory temp_arena_memory_begin (Arena *a);
@@ -0,0 +1,113 @@
+#include "bloom.h"
+
+#include <stdlib.h>
+
+/**
+ * bloom_hash - FNV-1a over 64 bits with the splitmix64 finalizer, both
+ * halves of the result depend on every byte
+ */
+static uint64_t bloom_hash (void *key, uint32_t len)
+{
+    uint8_t *p = (uint8_t *) key;
+    uint64_t h = 14695981039346656037ull;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+/**
+ * bloom_create - allocates an empty filter for @capacity keys
+ *
+ * Return: the filter, NULL if out of memory
+ */
+BloomFilter *bloom_create (uint32_t capacity)
+{
+    if (capacity < BLOOM_MIN_KEYS)
+    {
+        capacity = BLOOM_MIN_KEYS;
+    }
+
+    uint64_t bit_count = 64;
+    while (bit_count < (uint64_t) capacity * BLOOM_BITS_PER_KEY
+           && bit_count < (1ull << 32))
+    {
+        bit_count <<= 1;
+    }
+
+    BloomFilter *f = malloc (sizeof (BloomFilter));
+    if (!f)
+    {
+        return NULL;
+    }
+    f->bits = calloc (bit_count / 64, sizeof (uint64_t));
+    if (!f->bits)
+    {
+        free (f);
+        return NULL;
+    }
+    f->bit_mask = (uint32_t) (bit_count - 1);
+    f->capacity = capacity;
+    f->key_count = 0;
+    return f;
+}
+
+void bloom_destroy (BloomFilter *f)
+{
+    if (f)
+    {
+        free (f->bits);
+        free (f);
+    }
+}
+
+void bloom_add (BloomFilter *f, void *key, uint32_t len)
+{
+    uint64_t h = bloom_hash (key, len);
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) (h >> 32) | 1; // odd, so the probes differ
+
+    for (int i = 0; i < BLOOM_HASH_COUNT; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & f->bit_mask;
+        f->bits[bit / 64] |= 1ull << (bit % 64);
+    }
+    f->key_count++;
+}
+
+/**
+ * bloom_may_contain - whether the key may have been added
+ *
+ * Return: false if the key was never added, true if it probably was
+ */
+bool bloom_may_contain (BloomFilter *f, void *key, uint32_t len)
+{
+    uint64_t h = bloom_hash (key, len);
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) (h >> 32) | 1;
+
+    for (int i = 0; i < BLOOM_HASH_COUNT; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & f->bit_mask;
+        if (!(f->bits[bit / 64] & (1ull << (bit % 64))))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// past its capacity the false positive rate of a filter climbs quickly
+bool bloom_is_full (BloomFilter *f)
+{
+    return f->key_count > f->capacity;
+}
@@ -0,0 +1,37 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * BLOOM FILTER
+ * ------------
+ * A bit array that answers "is this key in the set" with no false negatives
+ * and about 1% false positives. A key sets BLOOM_HASH_COUNT bits, picked by
+ * two halves of one 64 bit hash (h1 + i * h2), a lookup that finds one of
+ * them clear has never seen the key.
+ *
+ * Keys cannot be taken out. A filter is sized for a number of keys and
+ * reports itself full past it, the owner then builds a bigger one from the
+ * keys that are left.
+ */
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASH_COUNT   7 // ln 2 * bits per key
+#define BLOOM_MIN_KEYS     1024
+
+typedef struct
+{
+    uint64_t *bits;
+    uint32_t bit_mask; // bit count - 1, the count is a power of two
+    uint32_t capacity; // keys the filter was sized for
+    uint32_t key_count;
+} BloomFilter;
+
+BloomFilter *bloom_create (uint32_t capacity);
+void bloom_destroy (BloomFilter *f);
+void bloom_add (BloomFilter *f, void *key, uint32_t len);
+bool bloom_may_contain (BloomFilter *f, void *key, uint32_t len);
+bool bloom_is_full (BloomFilter *f);
+
+#endif /* BLOOM_H */
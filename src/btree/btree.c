@@ -3,6 +3,17 @@
 #include <stdint.h>
 #include <string.h>
 
+typedef struct
+{
+    void *key;
+    uint32_t key_len;
+    void *val;
+    uint32_t val_len;
+} BTreeCell;
+
+static BTreeResult btree_insert_into_node (Database *db, uint32_t *path,
+                                           int depth, int pos, BTreeCell cell);
+
 void initialize_leaf_node (void *node)
 {
     SlottedPageHeader *header = (SlottedPageHeader *) node;
@@ -14,6 +25,12 @@ void initialize_leaf_node (void *node)
     header->data_start = PAGE_SIZE;
 }
 
+void initialize_internal_node (void *node)
+{
+    initialize_leaf_node (node);
+    ((SlottedPageHeader *) node)->node_type = NODE_INTERNAL;
+}
+
 uint32_t *leaf_node_next_leaf (void *node)
 {
     return (uint32_t *) (node + LEAF_NODE_NEXT_LEAF_OFFSET);
@@ -54,45 +71,1702 @@ void *leaf_node_value (void *node, uint32_t cell_num)
     return cell + LEAF_NODE_KEY_SIZE;
 }
 
-int btree_find_key (Database *db, uint32_t root_page_num, void *key,
-                    uint32_t key_len, void **out_page)
+int btree_key_compare (void *a, uint32_t a_len, void *b, uint32_t b_len)
 {
-    void *page = pager_get_page (db->global_arena, db->pager, root_page_num);
-    SlottedPageHeader *header = (SlottedPageHeader *) page;
+    uint32_t n = a_len < b_len ? a_len : b_len;
+    int cmp = memcmp (a, b, n);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
 
-    // TODO Handle internal nodes
-    Slot *slots = (Slot *) ((uint8_t *) page + sizeof (SlottedPageHeader));
+/**
+ * node_lower_bound - binary search for the first slot with a key >= key
+ *
+ * Deleted slots still hold their key, so they take part in the search.
+ */
+static int node_lower_bound (void *node, void *key, uint32_t key_len)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    int lo = 0;
+    int hi = header->num_cells;
 
-    // TODO Binary Search
-    for (int i = 0; i < header->num_cells; i++)
+    while (lo < hi)
     {
-        if (slots[i].size == 0)
+        int mid = lo + (hi - lo) / 2;
+        void *slot_key;
+        uint32_t slot_klen;
+        slot_get_key (node, mid, &slot_key, &slot_klen);
+
+        if (btree_key_compare (slot_key, slot_klen, key, key_len) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
         {
-            continue; // skip deleted
+            hi = mid;
         }
+    }
+    return lo;
+}
+
+/**
+ * internal_child_slot - slot of the child that may hold key, which is the
+ * last separator <= key, or the first child
+ *
+ * The first separator is not compared, keys below it also belong to the
+ * first child and a rebalance may move smaller separators next to it.
+ */
+static int internal_child_slot (void *node, void *key, uint32_t key_len)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    int lo = 1;
+    int hi = header->num_cells;
 
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
         void *slot_key;
         uint32_t slot_klen;
-        void *slot_val;
-        uint32_t slot_vlen;
+        slot_get_key (node, mid, &slot_key, &slot_klen);
+
+        if (btree_key_compare (slot_key, slot_klen, key, key_len) <= 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return hi > 0 ? lo - 1 : 0;
+}
+
+static uint32_t internal_child_page (void *node, int slot)
+{
+    void *key, *val;
+    uint32_t key_len, val_len;
+    slot_get_content (node, slot, &key, &key_len, &val, &val_len);
+
+    uint32_t child;
+    memcpy (&child, val, sizeof (uint32_t));
+    return child;
+}
+
+/**
+ * node_latch - reads a node in and latches it
+ *
+ * The page is read first, a miss latches the frame itself while it reads.
+ */
+static void *node_latch (Database *db, uint32_t page_num, bool exclusive)
+{
+    void *node = pager_get_page (db->pager, page_num);
+    pager_latch (db->pager, page_num, exclusive);
+    return node;
+}
+
+static void node_unlatch (Database *db, uint32_t page_num)
+{
+    pager_unlatch (db->pager, page_num);
+}
+
+/**
+ * node_has_room - whether size bytes and a slot fit in a node once it is
+ * compacted, so inserting them does not split it
+ */
+static bool node_has_room (void *node, uint32_t size)
+{
+    return pager_slotted_free_space (node) + pager_slotted_dead_space (node)
+           >= size + sizeof (Slot);
+}
+
+/**
+ * btree_find_leaf - descends from the root to the leaf that may hold key
+ * @path: if not NULL, filled with the page numbers from root to leaf
+ * @depth: if not NULL, set to the index of the leaf in path
+ * @exclusive: latch the leaf exclusive instead of shared
+ *
+ * Internal nodes are latched shared, each one until its child is latched.
+ * Only the leaf is still latched on return, the rest of path may change.
+ *
+ * Return: leaf page number, latched, the caller unlatches it
+ */
+static uint32_t btree_find_leaf (Database *db, uint32_t root_page_num,
+                                 void *key, uint32_t key_len, uint32_t *path,
+                                 int *depth, bool exclusive)
+{
+    uint32_t page_num = root_page_num;
+    void *node = node_latch (db, page_num, false);
+    int d = 0;
+
+    while (get_node_type (node) == NODE_INTERNAL)
+    {
+        if (path)
+        {
+            path[d] = page_num;
+        }
+        d++;
+
+        int slot = key ? internal_child_slot (node, key, key_len) : 0;
+        uint32_t child_num = internal_child_page (node, slot);
+        void *child = node_latch (db, child_num, false);
+        if (exclusive && get_node_type (child) != NODE_INTERNAL)
+        {
+            // the parent is still latched, the leaf cannot split meanwhile
+            node_unlatch (db, child_num);
+            child = node_latch (db, child_num, true);
+        }
+        node_unlatch (db, page_num);
+        page_num = child_num;
+        node = child;
+    }
+
+    if (exclusive && d == 0)
+    {
+        // a leaf root may have grown a level while it was not latched
+        node_unlatch (db, page_num);
+        node = node_latch (db, page_num, true);
+        if (get_node_type (node) == NODE_INTERNAL)
+        {
+            node_unlatch (db, page_num);
+            return btree_find_leaf (db, root_page_num, key, key_len, path,
+                                    depth, exclusive);
+        }
+    }
+
+    if (path)
+    {
+        path[d] = page_num;
+    }
+    if (depth)
+    {
+        *depth = d;
+    }
+    return page_num;
+}
 
-        slot_get_content (page, i, &slot_key, &slot_klen, &slot_val,
-                          &slot_vlen);
+/**
+ * btree_latch_path - descends to the leaf that may hold key with exclusive
+ * latches, for an insert that may split the leaf
+ * @cell_size: size of the cell to insert
+ * @path: filled with the page numbers from root to leaf
+ * @depth: set to the index of the leaf in path
+ *
+ * A split goes up until a node has room for the separator. Once a node has
+ * room, for the cell at the leaf and for any separator above it, the latches
+ * of the nodes above it are dropped.
+ *
+ * Return: index in path of the first node still latched
+ */
+static int btree_latch_path (Database *db, uint32_t root_page_num, void *key,
+                             uint32_t key_len, uint32_t cell_size,
+                             uint32_t *path, int *depth)
+{
+    uint32_t page_num = root_page_num;
+    void *node = node_latch (db, page_num, true);
+    int top = 0;
+    int d = 0;
+    path[0] = page_num;
+
+    while (true)
+    {
+        bool is_leaf = get_node_type (node) != NODE_INTERNAL;
+        // a separator is a key of the subtree and a child page number
+        uint32_t need =
+            is_leaf ? cell_size : BTREE_MAX_CELL_SIZE + sizeof (uint32_t);
+        if (node_has_room (node, need))
+        {
+            for (int i = top; i < d; i++)
+            {
+                node_unlatch (db, path[i]);
+            }
+            top = d;
+        }
+        if (is_leaf)
+        {
+            break;
+        }
+
+        int slot = internal_child_slot (node, key, key_len);
+        page_num = internal_child_page (node, slot);
+        node = node_latch (db, page_num, true);
+        path[++d] = page_num;
+    }
+
+    *depth = d;
+    return top;
+}
+
+/**
+ * node_find_live - slot of the live cell with key in a leaf, -1 if there is
+ * none
+ */
+static int node_find_live (void *node, void *key, uint32_t key_len)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    int i = node_lower_bound (node, key, key_len);
+    if (i == header->num_cells || PAGE_SLOTS (node)[i].size == 0)
+    {
+        return -1;
+    }
+
+    void *slot_key;
+    uint32_t slot_klen;
+    slot_get_key (node, i, &slot_key, &slot_klen);
+
+    if (btree_key_compare (slot_key, slot_klen, key, key_len) != 0)
+    {
+        return -1;
+    }
+    return i;
+}
+
+/**
+ * btree_find_key - looks a key up and copies its value while the leaf is
+ * latched
+ * @val: BTREE_CELL_BUFFER_SIZE bytes for the value, or NULL
+ * @val_len: set to the length of the value if val is not NULL
+ *
+ * Return: false if the tree has no live cell with the key
+ */
+bool btree_find_key (Database *db, uint32_t root_page_num, void *key,
+                     uint32_t key_len, void *val, uint32_t *val_len)
+{
+    pager_advise (db->pager, PAGER_ACCESS_NORMAL);
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t leaf_num =
+        btree_find_leaf (db, root_page_num, key, key_len, NULL, NULL, false);
+    void *leaf = pager_get_page (db->pager, leaf_num);
+
+    int i = node_find_live (leaf, key, key_len);
+    if (i >= 0 && val)
+    {
+        void *cell_key, *cell_val;
+        uint32_t cell_key_len;
+        slot_get_content (leaf, i, &cell_key, &cell_key_len, &cell_val,
+                          val_len);
+        memcpy (val, cell_val, *val_len);
+    }
+    node_unlatch (db, leaf_num);
+    pager_unpin_to (db->pager, mark);
+    return i >= 0;
+}
+
+static void node_remove_slot (void *node, int slot)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    Slot *slots = PAGE_SLOTS (node);
 
-        if (key_len == slot_klen && memcmp (key, slot_key, key_len) == 0)
+    memmove (&slots[slot], &slots[slot + 1],
+             (header->num_cells - slot - 1) * sizeof (Slot));
+    header->num_cells--;
+}
+
+/**
+ * btree_insert_leaf - inserts a cell into the leaf at the end of path, the
+ * nodes a split reaches are latched exclusive
+ */
+static BTreeResult btree_insert_leaf (Database *db, uint32_t *path, int depth,
+                                      BTreeCell cell)
+{
+    void *leaf = pager_get_page (db->pager, path[depth]);
+    SlottedPageHeader *header = (SlottedPageHeader *) leaf;
+    uint32_t cell_size = sizeof (uint32_t) + cell.key_len + cell.val_len;
+
+    int pos = node_lower_bound (leaf, cell.key, cell.key_len);
+    if (pos < header->num_cells)
+    {
+        void *slot_key;
+        uint32_t slot_klen;
+        slot_get_key (leaf, pos, &slot_key, &slot_klen);
+
+        if (btree_key_compare (slot_key, slot_klen, cell.key, cell.key_len)
+            == 0)
         {
-            if (out_page)
+            if (PAGE_SLOTS (leaf)[pos].size != 0)
             {
-                *out_page = page;
+                return BTREE_DUPLICATE;
             }
-            return i;
+            // drop the tombstone of a deleted cell with the same key
+            node_remove_slot (leaf, pos);
+        }
+    }
+
+    // a split may cascade up to the root, which also needs a new child
+    if (!node_has_room (leaf, cell_size)
+        && pager_pages_left (db->pager) < depth + 2)
+    {
+        return BTREE_FULL;
+    }
+
+    return btree_insert_into_node (db, path, depth, pos, cell);
+}
+
+/**
+ * btree_insert - inserts a key value pair into the tree
+ * @db: database
+ * @root_page_num: root of the tree
+ *
+ * The leaf is found with shared latches and latched exclusive. A leaf
+ * without room is given up and the descent is made again with exclusive
+ * latches, keeping those of the nodes its split reaches.
+ *
+ * Pages that change are marked dirty, the caller flushes them. The pages
+ * read are unpinned on return.
+ *
+ * Return: BTREE_OK, BTREE_DUPLICATE if the key exists or BTREE_FULL if the
+ * cell is too large or there are no pages left for a split
+ */
+BTreeResult btree_insert (Database *db, uint32_t root_page_num, void *key,
+                          uint32_t key_len, void *val, uint32_t val_len)
+{
+    uint32_t cell_size = sizeof (uint32_t) + key_len + val_len;
+    if (cell_size > BTREE_MAX_CELL_SIZE)
+    {
+        return BTREE_FULL;
+    }
+
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t path[BTREE_MAX_DEPTH];
+    int depth;
+    uint32_t leaf_num =
+        btree_find_leaf (db, root_page_num, key, key_len, path, &depth, true);
+    int top = depth;
+
+    if (!node_has_room (pager_get_page (db->pager, leaf_num), cell_size))
+    {
+        node_unlatch (db, leaf_num);
+        top = btree_latch_path (db, root_page_num, key, key_len, cell_size,
+                                path, &depth);
+    }
+
+    BTreeCell cell = {key, key_len, val, val_len};
+    BTreeResult res = btree_insert_leaf (db, path, depth, cell);
+    for (int i = top; i <= depth; i++)
+    {
+        node_unlatch (db, path[i]);
+    }
+    pager_unpin_to (db->pager, mark);
+    return res;
+}
+
+/**
+ * node_collect_cells - live cells of a node in key order, with an extra
+ * cell placed at slot position pos
+ *
+ * Return: number of cells
+ */
+static int node_collect_cells (void *node, int pos, BTreeCell extra,
+                               BTreeCell *out)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    Slot *slots = PAGE_SLOTS (node);
+    int count = 0;
+
+    for (int i = 0; i <= header->num_cells; i++)
+    {
+        if (i == pos)
+        {
+            out[count++] = extra;
+        }
+        if (i == header->num_cells || slots[i].size == 0)
+        {
+            continue;
+        }
+
+        BTreeCell *c = &out[count++];
+        slot_get_content (node, i, &c->key, &c->key_len, &c->val,
+                          &c->val_len);
+    }
+    return count;
+}
+
+/**
+ * btree_split_node - splits path[depth] in two halves by size while adding
+ * a cell, then adds the new right node to the parent
+ */
+static BTreeResult btree_split_node (Database *db, uint32_t *path, int depth,
+                                     int pos, BTreeCell cell)
+{
+    uint32_t page_num = path[depth];
+    void *node = pager_get_page (db->pager, page_num);
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+
+    // cells point into the copy while the node is rewritten
+    uint8_t old_image[PAGE_SIZE_MAX];
+    memcpy (old_image, node, PAGE_SIZE);
+
+    BTreeCell cells[BTREE_MAX_NODE_CELLS + 1];
+    int count = node_collect_cells (old_image, pos, cell, cells);
+
+    uint32_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += sizeof (Slot) + sizeof (uint32_t) + cells[i].key_len
+                 + cells[i].val_len;
+    }
+
+    int split = 1;
+    uint32_t left_size = 0;
+    for (; split < count - 1; split++)
+    {
+        left_size += sizeof (Slot) + sizeof (uint32_t)
+                     + cells[split - 1].key_len + cells[split - 1].val_len;
+        if (left_size >= total / 2)
+        {
+            break;
+        }
+    }
+
+    uint32_t right_num = pager_allocate_page_like (db->pager, path[0]);
+    void *right = pager_get_page (db->pager, right_num);
+
+    uint8_t node_type = header->node_type;
+    uint32_t next_leaf = header->next_leaf;
+
+    if (node_type == NODE_LEAF)
+    {
+        initialize_leaf_node (node);
+        initialize_leaf_node (right);
+        ((SlottedPageHeader *) right)->next_leaf = next_leaf;
+        header->next_leaf = right_num;
+    }
+    else
+    {
+        initialize_internal_node (node);
+        initialize_internal_node (right);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        pager_slotted_insert (i < split ? node : right, cells[i].key,
+                              cells[i].key_len, cells[i].val,
+                              cells[i].val_len);
+    }
+
+    pager_mark_dirty (db->pager, page_num);
+    pager_mark_dirty (db->pager, right_num);
+
+    BTreeCell separator = {0};
+    separator.val = &right_num;
+    separator.val_len = sizeof (uint32_t);
+    slot_get_key (right, 0, &separator.key, &separator.key_len);
+
+    void *parent = pager_get_page (db->pager, path[depth - 1]);
+    int parent_pos =
+        internal_child_slot (parent, separator.key, separator.key_len) + 1;
+
+    return btree_insert_into_node (db, path, depth - 1, parent_pos, separator);
+}
+
+/**
+ * node_compact - drops the tombstones of a node and moves its cells together
+ *
+ * Return: pos, moved down by the tombstones dropped before it
+ */
+static int node_compact (void *node, int pos)
+{
+    Slot *slots = PAGE_SLOTS (node);
+    int dropped = 0;
+    for (int i = 0; i < pos; i++)
+    {
+        dropped += slots[i].size == 0;
+    }
+    pager_slotted_compact (node, false);
+    return pos - dropped;
+}
+
+static BTreeResult btree_insert_into_node (Database *db, uint32_t *path,
+                                           int depth, int pos, BTreeCell cell)
+{
+    uint32_t page_num = path[depth];
+    void *node = pager_get_page (db->pager, page_num);
+
+    if (pager_slotted_insert_at (node, pos, cell.key, cell.key_len, cell.val,
+                                 cell.val_len))
+    {
+        pager_mark_dirty (db->pager, page_num);
+        return BTREE_OK;
+    }
+
+    // a node that only looks full gets its dead space back before it splits
+    if (pager_slotted_dead_space (node) > 0)
+    {
+        pos = node_compact (node, pos);
+        pager_mark_dirty (db->pager, page_num);
+        if (pager_slotted_insert_at (node, pos, cell.key, cell.key_len,
+                                     cell.val, cell.val_len))
+        {
+            return BTREE_OK;
+        }
+    }
+
+    if (depth > 0)
+    {
+        return btree_split_node (db, path, depth, pos, cell);
+    }
+
+    // full root: move its cells to a new child and split that instead
+    uint32_t child_num = pager_allocate_page_like (db->pager, page_num);
+    void *child = pager_get_page (db->pager, child_num);
+    memcpy (child, node, PAGE_SIZE);
+    set_node_root (child, 0);
+
+    initialize_internal_node (node);
+    set_node_root (node, 1);
+
+    void *first_key;
+    uint32_t first_klen;
+    slot_get_key (child, 0, &first_key, &first_klen);
+    pager_slotted_insert (node, first_key, first_klen, &child_num,
+                          sizeof (uint32_t));
+
+    pager_mark_dirty (db->pager, page_num);
+    pager_mark_dirty (db->pager, child_num);
+
+    uint32_t new_path[2] = {page_num, child_num};
+    return btree_split_node (db, new_path, 1, pos, cell);
+}
+
+/**
+ * btree_delete - deletes a key by turning its slot into a tombstone
+ *
+ * Return: true if the key was found
+ */
+bool btree_delete (Database *db, uint32_t root_page_num, void *key,
+                   uint32_t key_len)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t leaf_num =
+        btree_find_leaf (db, root_page_num, key, key_len, NULL, NULL, true);
+    void *leaf = pager_get_page (db->pager, leaf_num);
+
+    int i = node_find_live (leaf, key, key_len);
+    if (i >= 0)
+    {
+        PAGE_SLOTS (leaf)[i].size = 0;
+        pager_mark_dirty (db->pager, leaf_num);
+    }
+    node_unlatch (db, leaf_num);
+    pager_unpin_to (db->pager, mark);
+    return i >= 0;
+}
+
+/**
+ * cursor_read_ahead - asks the pager for up to BTREE_READ_AHEAD leaves after
+ * the one the cursor just moved to
+ *
+ * They are the next children of the internal node above the leaf. It is
+ * found again with a descent whenever the cursor moves past its last child.
+ * Called with no latch held, the parent is latched shared while it is read.
+ */
+static void cursor_read_ahead (BTreeCursor *c)
+{
+    Database *db = c->db;
+    if (c->root_page_num == 0)
+    {
+        return;
+    }
+
+    void *parent = NULL;
+    if (c->ahead_parent != 0)
+    {
+        parent = node_latch (db, c->ahead_parent, false);
+        c->ahead_slot++;
+        if (get_node_type (parent) != NODE_INTERNAL
+            || c->ahead_slot >= ((SlottedPageHeader *) parent)->num_cells
+            || internal_child_page (parent, c->ahead_slot) != c->page_num)
+        {
+            node_unlatch (db, c->ahead_parent);
+            parent = NULL;
+        }
+    }
+
+    if (parent == NULL)
+    {
+        c->ahead_parent = 0;
+
+        // a deleted first cell still has its key
+        uint8_t key[BTREE_CELL_BUFFER_SIZE];
+        uint32_t key_len = 0;
+        void *leaf = node_latch (db, c->page_num, false);
+        if (((SlottedPageHeader *) leaf)->num_cells > 0)
+        {
+            void *first_key;
+            slot_get_key (leaf, 0, &first_key, &key_len);
+            memcpy (key, first_key, key_len);
+        }
+        node_unlatch (db, c->page_num);
+        if (key_len == 0)
+        {
+            return;
+        }
+
+        uint32_t path[BTREE_MAX_DEPTH];
+        int depth;
+        uint32_t leaf_num = btree_find_leaf (db, c->root_page_num, key,
+                                             key_len, path, &depth, false);
+        node_unlatch (db, leaf_num);
+        if (leaf_num != c->page_num || depth == 0)
+        {
+            return;
+        }
+
+        uint32_t parent_num = path[depth - 1];
+        parent = node_latch (db, parent_num, false);
+        if (get_node_type (parent) != NODE_INTERNAL)
+        {
+            node_unlatch (db, parent_num);
+            return;
+        }
+        c->ahead_parent = parent_num;
+        c->ahead_slot = internal_child_slot (parent, key, key_len);
+        c->ahead_end = c->ahead_slot;
+    }
+
+    int last = ((SlottedPageHeader *) parent)->num_cells - 1;
+    if (c->ahead_slot + BTREE_READ_AHEAD < last)
+    {
+        last = c->ahead_slot + BTREE_READ_AHEAD;
+    }
+    for (int i = c->ahead_end + 1; i <= last; i++)
+    {
+        pager_prefetch (db->pager, internal_child_page (parent, i));
+    }
+    if (last > c->ahead_end)
+    {
+        c->ahead_end = last;
+    }
+    node_unlatch (db, c->ahead_parent);
+}
+
+/**
+ * cursor_copy_cell - copies the cell under a cursor on a tree, called with
+ * its leaf latched
+ */
+static void cursor_copy_cell (BTreeCursor *c)
+{
+    void *key, *val;
+    slot_get_content (c->page, c->cell, &key, &c->key_len, &val, &c->val_len);
+    memcpy (c->copy, key, c->key_len);
+    memcpy (c->copy + c->key_len, val, c->val_len);
+    c->epoch = pager_free_epoch (c->db->pager);
+}
+
+/**
+ * cursor_latch - latches the leaf of a cursor again, see CURSORS
+ * @exact: set to whether the cell of the cursor has its copied key, if not
+ * the cursor is on the first key above it
+ *
+ * A cursor on a tree trusts its leaf if no page was freed since the copy
+ * and the cell still has the key, otherwise it descends to the key again.
+ * A cursor on a chain of leaves always trusts it.
+ *
+ * Return: the leaf, latched
+ */
+static void *cursor_latch (BTreeCursor *c, bool exclusive, bool *exact)
+{
+    Database *db = c->db;
+    void *leaf = node_latch (db, c->page_num, exclusive);
+    *exact = true;
+    if (c->root_page_num == 0)
+    {
+        return leaf;
+    }
+
+    SlottedPageHeader *header = (SlottedPageHeader *) leaf;
+    if (pager_free_epoch (db->pager) == c->epoch
+        && get_node_type (leaf) == NODE_LEAF && c->cell < header->num_cells)
+    {
+        void *key;
+        uint32_t key_len;
+        slot_get_key (leaf, c->cell, &key, &key_len);
+        if (btree_key_compare (key, key_len, c->copy, c->key_len) == 0)
+        {
+            return leaf;
         }
     }
+    node_unlatch (db, c->page_num);
+    pager_unpin_to (db->pager, c->mark);
+
+    c->page_num = btree_find_leaf (db, c->root_page_num, c->copy, c->key_len,
+                                   NULL, NULL, exclusive);
+    leaf = pager_get_page (db->pager, c->page_num);
+    header = (SlottedPageHeader *) leaf;
+    c->epoch = pager_free_epoch (db->pager);
+    c->cell = node_lower_bound (leaf, c->copy, c->key_len);
+    c->ahead_parent = 0; // looked up again by the next read-ahead
+
+    *exact = false;
+    if (c->cell < header->num_cells)
+    {
+        void *key;
+        uint32_t key_len;
+        slot_get_key (leaf, c->cell, &key, &key_len);
+        *exact = btree_key_compare (key, key_len, c->copy, c->key_len) == 0;
+    }
+    return leaf;
+}
+
+/**
+ * cursor_skip_deleted - moves the cursor forward to the next live cell,
+ * following the leaf chain, and copies it on a tree
+ *
+ * Called with the leaf of the cursor latched shared. A leaf is let go once
+ * the next one is latched, no latch is held on return. The leaves left
+ * behind are unpinned, a latched leaf is never evicted, so the next one is
+ * pinned again before its latch is let go.
+ */
+static void cursor_skip_deleted (BTreeCursor *c)
+{
+    if (c->page == NULL)
+    {
+        return;
+    }
 
-    if (out_page)
+    bool moved = false;
+    while (true)
     {
-        *out_page = page;
+        SlottedPageHeader *header = (SlottedPageHeader *) c->page;
+        Slot *slots = PAGE_SLOTS (c->page);
+
+        while (c->cell < header->num_cells && slots[c->cell].size == 0)
+        {
+            c->cell++;
+        }
+
+        if (c->cell < header->num_cells)
+        {
+            break;
+        }
+
+        uint32_t next_num = header->next_leaf;
+        void *next = next_num != 0 ? node_latch (c->db, next_num, false) : NULL;
+        node_unlatch (c->db, c->page_num);
+        pager_unpin_to (c->db->pager, c->mark);
+        if (next == NULL)
+        {
+            c->page = NULL;
+            return;
+        }
+
+        c->page_num = next_num;
+        c->page = pager_get_page (c->db->pager, next_num);
+        c->cell = 0;
+        moved = true;
     }
 
-    return -1;
+    if (c->root_page_num != 0)
+    {
+        cursor_copy_cell (c);
+    }
+    node_unlatch (c->db, c->page_num);
+    if (moved)
+    {
+        cursor_read_ahead (c);
+    }
+}
+
+/**
+ * btree_cursor_first - positions the cursor on the smallest key
+ */
+void btree_cursor_first (Database *db, uint32_t root_page_num, BTreeCursor *c)
+{
+    c->mark = pager_pin_mark (db->pager);
+    pager_advise (db->pager, PAGER_ACCESS_SCAN);
+    uint32_t path[BTREE_MAX_DEPTH];
+    int depth;
+    uint32_t leaf_num =
+        btree_find_leaf (db, root_page_num, NULL, 0, path, &depth, false);
+
+    c->db = db;
+    c->page_num = leaf_num;
+    c->page = pager_get_page (db->pager, leaf_num);
+    c->cell = 0;
+    c->root_page_num = root_page_num;
+    c->ahead_parent = depth > 0 ? path[depth - 1] : 0;
+    // the first leaf was just read, read ahead from the second
+    c->ahead_slot = -1;
+    c->ahead_end = 0;
+    cursor_skip_deleted (c);
+    if (c->page != NULL && c->page_num == leaf_num && c->ahead_parent != 0)
+    {
+        cursor_read_ahead (c);
+    }
+}
+
+/**
+ * btree_cursor_from_leaf - positions the cursor on the first live cell of a
+ * leaf or of the leaves chained after it
+ * @page_num: the leaf, 0 for an empty chain
+ *
+ * The cursor does not read ahead, it does not know the tree of the leaf.
+ */
+void btree_cursor_from_leaf (Database *db, uint32_t page_num, BTreeCursor *c)
+{
+    c->mark = pager_pin_mark (db->pager);
+    c->db = db;
+    c->page_num = page_num;
+    c->page = page_num != 0 ? node_latch (db, page_num, false) : NULL;
+    c->cell = 0;
+    c->root_page_num = 0;
+    cursor_skip_deleted (c);
+}
+
+/**
+ * btree_cursor_seek - positions the cursor on the first key >= key
+ */
+void btree_cursor_seek (Database *db, uint32_t root_page_num, void *key,
+                        uint32_t key_len, BTreeCursor *c)
+{
+    pager_advise (db->pager, PAGER_ACCESS_NORMAL);
+    c->mark = pager_pin_mark (db->pager);
+    c->db = db;
+    c->page_num = btree_find_leaf (db, root_page_num, key, key_len, NULL,
+                                   NULL, false);
+    c->page = pager_get_page (db->pager, c->page_num);
+    c->cell = node_lower_bound (c->page, key, key_len);
+    c->root_page_num = root_page_num;
+    c->ahead_parent = 0; // looked up once the scan leaves the first leaf
+    cursor_skip_deleted (c);
+}
+
+/**
+ * btree_cursor_seek_forward - seeks to a key >= the current position
+ *
+ * Searches the current leaf when it covers key and only descends from the
+ * root otherwise, so seeking through sorted keys reads each leaf once. The
+ * leaf covers key while no page was freed and key is between its first and
+ * last key, a split or a merge since the last move may have changed both.
+ */
+void btree_cursor_seek_forward (BTreeCursor *c, uint32_t root_page_num,
+                                void *key, uint32_t key_len)
+{
+    if (c->page)
+    {
+        pager_unpin_to (c->db->pager, c->mark);
+        c->page = node_latch (c->db, c->page_num, false);
+        SlottedPageHeader *header = (SlottedPageHeader *) c->page;
+        if (pager_free_epoch (c->db->pager) == c->epoch
+            && get_node_type (c->page) == NODE_LEAF && header->num_cells > 0)
+        {
+            void *first_key, *last_key;
+            uint32_t first_klen, last_klen;
+            slot_get_key (c->page, 0, &first_key, &first_klen);
+            slot_get_key (c->page, header->num_cells - 1, &last_key,
+                          &last_klen);
+
+            if (btree_key_compare (first_key, first_klen, key, key_len) <= 0
+                && btree_key_compare (last_key, last_klen, key, key_len) >= 0)
+            {
+                c->cell = node_lower_bound (c->page, key, key_len);
+                cursor_skip_deleted (c);
+                return;
+            }
+        }
+        node_unlatch (c->db, c->page_num);
+        pager_unpin_to (c->db->pager, c->mark);
+    }
+
+    btree_cursor_seek (c->db, root_page_num, key, key_len, c);
+}
+
+bool btree_cursor_valid (BTreeCursor *c)
+{
+    return c->page != NULL;
+}
+
+void btree_cursor_next (BTreeCursor *c)
+{
+    if (c->page == NULL)
+    {
+        return;
+    }
+    pager_unpin_to (c->db->pager, c->mark);
+    bool exact;
+    c->page = cursor_latch (c, false, &exact);
+    c->cell += exact; // a key that is gone was followed by the cell it is on
+    cursor_skip_deleted (c);
+}
+
+void btree_cursor_get (BTreeCursor *c, void **key, uint32_t *key_len,
+                       void **val, uint32_t *val_len)
+{
+    if (c->root_page_num != 0)
+    {
+        *key = c->copy;
+        *key_len = c->key_len;
+        *val = c->copy + c->key_len;
+        *val_len = c->val_len;
+        return;
+    }
+
+    // a cursor positioned earlier may have moved and unpinned the leaf
+    c->page = pager_get_page (c->db->pager, c->page_num);
+    slot_get_content (c->page, c->cell, key, key_len, val, val_len);
+}
+
+/**
+ * btree_cursor_delete - turns the current cell into a tombstone
+ *
+ * The cursor stays valid, btree_cursor_next moves on to the next live cell.
+ * A cell another thread deleted or moved meanwhile is found by its key.
+ */
+void btree_cursor_delete (BTreeCursor *c)
+{
+    bool exact;
+    c->page = cursor_latch (c, true, &exact);
+    if (exact)
+    {
+        PAGE_SLOTS (c->page)[c->cell].size = 0;
+        pager_mark_dirty (c->db->pager, c->page_num);
+    }
+    node_unlatch (c->db, c->page_num);
+}
+
+/**
+ * btree_cursor_replace_value - overwrites the value of the current cell
+ *
+ * Return: false if the new value does not fit in the old cell or the cell
+ * was deleted meanwhile
+ */
+bool btree_cursor_replace_value (BTreeCursor *c, void *val, uint32_t val_len)
+{
+    bool exact;
+    c->page = cursor_latch (c, true, &exact);
+    Slot *slot = &PAGE_SLOTS (c->page)[c->cell];
+
+    bool fits = false;
+    if (exact && slot->size != 0)
+    {
+        void *key, *old_val;
+        uint32_t key_len, old_len;
+        slot_get_content (c->page, c->cell, &key, &key_len, &old_val,
+                          &old_len);
+
+        uint32_t new_size = sizeof (uint32_t) + key_len + val_len;
+        fits = new_size <= slot->size;
+        if (fits)
+        {
+            memcpy (old_val, val, val_len);
+            slot->size = new_size;
+            pager_mark_dirty (c->db->pager, c->page_num);
+        }
+    }
+    if (fits && c->root_page_num != 0)
+    {
+        memcpy (c->copy + c->key_len, val, val_len);
+        c->val_len = val_len;
+    }
+    node_unlatch (c->db, c->page_num);
+    return fits;
+}
+
+/**
+ * btree_is_empty - whether the tree has no live cells
+ *
+ * Only a leaf root can be empty, splits never leave an empty node behind.
+ */
+bool btree_is_empty (Database *db, uint32_t root_page_num)
+{
+    BTreeCursor c;
+    btree_cursor_first (db, root_page_num, &c);
+    bool empty = !btree_cursor_valid (&c);
+    pager_unpin_to (db->pager, c.mark);
+    return empty;
+}
+
+/**
+ * btree_first_leaf - page number of the leftmost leaf, the start of the
+ * leaf chain
+ */
+uint32_t btree_first_leaf (Database *db, uint32_t root_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t leaf_num =
+        btree_find_leaf (db, root_page_num, NULL, 0, NULL, NULL, false);
+    node_unlatch (db, leaf_num);
+    pager_unpin_to (db->pager, mark);
+    return leaf_num;
+}
+
+// flags a node and the nodes below it, height 1 is a leaf
+static void btree_mark_node (Database *db, uint32_t page_num, int height)
+{
+    pager_set_compressed (db->pager, page_num, true);
+    if (height == 1)
+    {
+        return;
+    }
+
+    uint32_t mark = pager_pin_mark (db->pager);
+    void *node = pager_get_page (db->pager, page_num);
+    for (int i = 0; i < ((SlottedPageHeader *) node)->num_cells; i++)
+    {
+        btree_mark_node (db, internal_child_page (node, i), height - 1);
+    }
+    pager_unpin_to (db->pager, mark);
+}
+
+/**
+ * btree_mark_compressed - flags every page of a tree to be written
+ * compressed, see COMPRESSION in pager.h
+ *
+ * Only the internal nodes are read, the leaves are flagged from their
+ * parents. Called while the tree is loaded, before other threads use it.
+ */
+void btree_mark_compressed (Database *db, uint32_t root_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    int height = 1;
+    void *node = pager_get_page (db->pager, root_page_num);
+    while (get_node_type (node) == NODE_INTERNAL)
+    {
+        node = pager_get_page (db->pager, internal_child_page (node, 0));
+        height++;
+    }
+    pager_unpin_to (db->pager, mark);
+    btree_mark_node (db, root_page_num, height);
+}
+
+static void btree_free_internal (Database *db, void *node)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    for (int i = 0; i < header->num_cells; i++)
+    {
+        uint32_t mark = pager_pin_mark (db->pager);
+        uint32_t child_num = internal_child_page (node, i);
+        void *child = pager_get_page (db->pager, child_num);
+        if (get_node_type (child) == NODE_INTERNAL)
+        {
+            btree_free_internal (db, child);
+            pager_free_page (db->pager, child_num);
+        }
+        pager_unpin_to (db->pager, mark);
+    }
+}
+
+/**
+ * btree_free_pages - puts every page of a tree but the root on the free
+ * list, the caller reuses or frees the root
+ *
+ * Leaves are found through the leaf chain, so a leaf that a failed bulk
+ * load did not link into its parent is freed too.
+ */
+void btree_free_pages (Database *db, uint32_t root_page_num)
+{
+    // nothing else uses the tree, so nothing is latched
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t leaf_num = root_page_num;
+    void *node = pager_get_page (db->pager, leaf_num);
+    while (get_node_type (node) == NODE_INTERNAL)
+    {
+        leaf_num = internal_child_page (node, 0);
+        node = pager_get_page (db->pager, leaf_num);
+    }
+
+    void *root = pager_get_page (db->pager, root_page_num);
+    if (get_node_type (root) == NODE_INTERNAL)
+    {
+        btree_free_internal (db, root);
+    }
+    pager_unpin_to (db->pager, mark);
+
+    while (leaf_num != 0)
+    {
+        void *leaf = pager_get_page (db->pager, leaf_num);
+        uint32_t next_num = ((SlottedPageHeader *) leaf)->next_leaf;
+        if (leaf_num != root_page_num)
+        {
+            pager_free_page (db->pager, leaf_num);
+        }
+        pager_unpin_to (db->pager, mark);
+        leaf_num = next_num;
+    }
+}
+
+// bytes a node would use once compacted
+static uint32_t node_live_size (void *node)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    uint32_t size = sizeof (SlottedPageHeader);
+    for (int i = 0; i < header->num_cells; i++)
+    {
+        uint16_t cell_size = PAGE_SLOTS (node)[i].size;
+        size += cell_size ? cell_size + sizeof (Slot) : 0;
+    }
+    return size;
+}
+
+/**
+ * btree_rebalance_pair - merges or evens out two latched children, see
+ * btree_rebalance_children
+ */
+static bool btree_rebalance_pair (Database *db, uint32_t parent_num, int slot,
+                                  bool borrow)
+{
+    void *parent = pager_get_page (db->pager, parent_num);
+    uint32_t left_num = internal_child_page (parent, slot);
+    uint32_t right_num = internal_child_page (parent, slot + 1);
+    void *left = pager_get_page (db->pager, left_num);
+    void *right = pager_get_page (db->pager, right_num);
+
+    // cells point into the copies while the children are rewritten
+    uint8_t images[2][PAGE_SIZE_MAX];
+    memcpy (images[0], left, PAGE_SIZE);
+    memcpy (images[1], right, PAGE_SIZE);
+
+    BTreeCell none = {0};
+    BTreeCell cells[2 * BTREE_MAX_NODE_CELLS];
+    int left_count = node_collect_cells (images[0], -1, none, cells);
+    int count = left_count;
+    count += node_collect_cells (images[1], -1, none, cells + left_count);
+
+    uint8_t separator[BTREE_CELL_BUFFER_SIZE];
+    void *sep_key;
+    uint32_t sep_len;
+    slot_get_key (parent, slot + 1, &sep_key, &sep_len);
+    memcpy (separator, sep_key, sep_len);
+
+    bool is_leaf = get_node_type (left) == NODE_LEAF;
+    if (!is_leaf && count > left_count)
+    {
+        cells[left_count].key = separator;
+        cells[left_count].key_len = sep_len;
+    }
+
+    uint32_t total = sizeof (SlottedPageHeader);
+    for (int i = 0; i < count; i++)
+    {
+        total += sizeof (Slot) + sizeof (uint32_t) + cells[i].key_len
+                 + cells[i].val_len;
+    }
+
+    bool merge = total <= PAGE_SIZE * BTREE_MERGE_FILL / 100;
+    int split = count;
+    if (!merge)
+    {
+        if (!borrow || count < 2)
+        {
+            return false;
+        }
+
+        uint32_t left_size = sizeof (SlottedPageHeader);
+        for (split = 1; split < count - 1; split++)
+        {
+            left_size += sizeof (Slot) + sizeof (uint32_t)
+                         + cells[split - 1].key_len + cells[split - 1].val_len;
+            if (left_size >= total / 2)
+            {
+                break;
+            }
+        }
+
+        // the parent must have room for the new separator
+        uint32_t old_size = PAGE_SLOTS (parent)[slot + 1].size;
+        uint32_t new_size = 2 * sizeof (uint32_t) + cells[split].key_len;
+        if (pager_slotted_free_space (parent)
+                + pager_slotted_dead_space (parent) + old_size
+            < new_size)
+        {
+            return false;
+        }
+    }
+
+    uint32_t next_leaf = ((SlottedPageHeader *) images[1])->next_leaf;
+    if (is_leaf)
+    {
+        initialize_leaf_node (left);
+        initialize_leaf_node (right);
+        ((SlottedPageHeader *) left)->next_leaf = merge ? next_leaf : right_num;
+        ((SlottedPageHeader *) right)->next_leaf = next_leaf;
+    }
+    else
+    {
+        initialize_internal_node (left);
+        initialize_internal_node (right);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        pager_slotted_insert (i < split ? left : right, cells[i].key,
+                              cells[i].key_len, cells[i].val,
+                              cells[i].val_len);
+    }
+
+    node_remove_slot (parent, slot + 1);
+    pager_mark_dirty (db->pager, left_num);
+    pager_mark_dirty (db->pager, parent_num);
+    if (merge)
+    {
+        pager_free_page (db->pager, right_num);
+        return true;
+    }
+
+    // the new first key of the right child separates it
+    BTreeCell *sep = &cells[split];
+    pager_mark_dirty (db->pager, right_num);
+    if (!pager_slotted_insert_at (parent, slot + 1, sep->key, sep->key_len,
+                                  &right_num, sizeof (uint32_t)))
+    {
+        pager_slotted_compact (parent, false);
+        pager_slotted_insert_at (parent, slot + 1, sep->key, sep->key_len,
+                                 &right_num, sizeof (uint32_t));
+    }
+    return false;
+}
+
+/**
+ * btree_rebalance_children - merges the children at slot and slot + 1 of a
+ * parent if their live cells fit in BTREE_MERGE_FILL percent of a page,
+ * otherwise evens them out by size if borrow is set
+ *
+ * An internal right child takes the separator of the parent as its first
+ * key. A merged right child leaves the parent and the leaf chain and goes to
+ * the free list, an evened out one gets its new first key as separator.
+ *
+ * Called with the parent latched exclusive, the children are latched
+ * exclusive left to right.
+ *
+ * Return: true if the children were merged
+ */
+static bool btree_rebalance_children (Database *db, uint32_t parent_num,
+                                      int slot, bool borrow)
+{
+    void *parent = pager_get_page (db->pager, parent_num);
+    uint32_t left_num = internal_child_page (parent, slot);
+    uint32_t right_num = internal_child_page (parent, slot + 1);
+    node_latch (db, left_num, true);
+    node_latch (db, right_num, true);
+    bool merged = btree_rebalance_pair (db, parent_num, slot, borrow);
+    node_unlatch (db, right_num);
+    node_unlatch (db, left_num);
+    return merged;
+}
+/**
+ * btree_collapse_root - a root left with a single child takes its place,
+ * the tree gets one level shorter
+ */
+static void btree_collapse_root (Database *db, uint32_t root_page_num)
+{
+    void *root = node_latch (db, root_page_num, true);
+    while (get_node_type (root) == NODE_INTERNAL
+           && ((SlottedPageHeader *) root)->num_cells == 1)
+    {
+        uint32_t child_num = internal_child_page (root, 0);
+        void *child = node_latch (db, child_num, true);
+        memcpy (root, child, PAGE_SIZE);
+        set_node_root (root, 1);
+        pager_mark_dirty (db->pager, root_page_num);
+        pager_free_page (db->pager, child_num);
+        node_unlatch (db, child_num);
+    }
+    node_unlatch (db, root_page_num);
+}
+
+/**
+ * btree_rebalance_node - rebalances the subtree of a node bottom up, a child
+ * left below BTREE_MIN_FILL percent of a page is merged with a neighbour or
+ * takes cells from it
+ *
+ * The node stays latched exclusive while its subtree is rebalanced.
+ */
+static void btree_rebalance_node (Database *db, uint32_t page_num)
+{
+    void *node = node_latch (db, page_num, true);
+    if (get_node_type (node) != NODE_INTERNAL)
+    {
+        node_unlatch (db, page_num);
+        return;
+    }
+
+    // the node is pinned before the mark, its children are let go
+    uint32_t mark = pager_pin_mark (db->pager);
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    for (int i = 0; i < header->num_cells; i++)
+    {
+        btree_rebalance_node (db, internal_child_page (node, i));
+        pager_unpin_to (db->pager, mark);
+    }
+
+    uint32_t min_size = PAGE_SIZE * BTREE_MIN_FILL / 100;
+    for (int i = 0; i < header->num_cells && header->num_cells > 1;)
+    {
+        uint32_t child_num = internal_child_page (node, i);
+        void *child = node_latch (db, child_num, false);
+        uint32_t live_size = node_live_size (child);
+        node_unlatch (db, child_num);
+        pager_unpin_to (db->pager, mark);
+        if (live_size >= min_size)
+        {
+            i++;
+            continue;
+        }
+
+        // a merged child is checked again, it may still be underfull
+        int left = i + 1 < header->num_cells ? i : i - 1;
+        if (!btree_rebalance_children (db, page_num, left, true))
+        {
+            i++;
+        }
+        pager_unpin_to (db->pager, mark);
+    }
+    node_unlatch (db, page_num);
+}
+
+/**
+ * btree_rebalance - merges or evens out the nodes that deletes left sparse,
+ * then collapses a root left with a single child
+ *
+ * Deletes only leave tombstones, so cursors on the tree stay valid. The
+ * caller rebalances once its statement is done with them.
+ */
+void btree_rebalance (Database *db, uint32_t root_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    btree_rebalance_node (db, root_page_num);
+    btree_collapse_root (db, root_page_num);
+    pager_unpin_to (db->pager, mark);
+}
+
+/**
+ * vacuum_step - does the work of btree_vacuum_step, pages pinned after
+ * @mark may be unpinned
+ */
+static bool vacuum_step (Database *db, uint32_t root_page_num,
+                         uint8_t *resume, uint32_t *resume_len, uint32_t mark)
+{
+    uint32_t path[BTREE_MAX_DEPTH];
+    int depth;
+    void *key = *resume_len ? resume : NULL;
+    node_unlatch (db, btree_find_leaf (db, root_page_num, key, *resume_len,
+                                       path, &depth, false));
+
+    if (depth == 0)
+    {
+        void *root = node_latch (db, root_page_num, true);
+        bool is_leaf = get_node_type (root) != NODE_INTERNAL;
+        if (is_leaf && pager_slotted_dead_space (root) > 0)
+        {
+            pager_slotted_compact (root, false);
+            pager_mark_dirty (db->pager, root_page_num);
+        }
+        node_unlatch (db, root_page_num);
+        if (is_leaf)
+        {
+            *resume_len = 0;
+        }
+        return is_leaf; // a root that grew a level is visited again
+    }
+
+    // the parent may have changed once the descent let go of it
+    uint32_t parent_num = path[depth - 1];
+    void *parent = node_latch (db, parent_num, true);
+    if (get_node_type (parent) != NODE_INTERNAL)
+    {
+        node_unlatch (db, parent_num);
+        return false;
+    }
+
+    SlottedPageHeader *header = (SlottedPageHeader *) parent;
+    int first = key ? internal_child_slot (parent, key, *resume_len) : 0;
+    int end = first + BTREE_VACUUM_LEAVES < header->num_cells
+                  ? first + BTREE_VACUUM_LEAVES
+                  : header->num_cells;
+
+    for (int i = first; i < end; i++)
+    {
+        uint32_t child_num = internal_child_page (parent, i);
+        void *child = node_latch (db, child_num, true);
+        if (pager_slotted_dead_space (child) > 0)
+        {
+            pager_slotted_compact (child, false);
+            pager_mark_dirty (db->pager, child_num);
+        }
+        node_unlatch (db, child_num);
+    }
+
+    for (int i = first; i + 1 < end;)
+    {
+        if (btree_rebalance_children (db, parent_num, i, false))
+        {
+            end--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    // the next visit starts at the first leaf with a key to find it by
+    uint32_t leaf_num = internal_child_page (parent, end - 1);
+    void *leaf = node_latch (db, leaf_num, false);
+    node_unlatch (db, parent_num);
+    *resume_len = 0;
+    while (true)
+    {
+        SlottedPageHeader *leaf_header = (SlottedPageHeader *) leaf;
+        uint32_t next_num = leaf_header->next_leaf;
+        void *next = next_num != 0 ? node_latch (db, next_num, false) : NULL;
+        node_unlatch (db, leaf_num);
+        pager_unpin_to (db->pager, mark);
+        if (next == NULL)
+        {
+            break;
+        }
+
+        // latched, so still resident, pinned again before use
+        leaf_num = next_num;
+        leaf = pager_get_page (db->pager, next_num);
+        if (((SlottedPageHeader *) leaf)->num_cells > 0)
+        {
+            void *next_key;
+            slot_get_key (leaf, 0, &next_key, resume_len);
+            memcpy (resume, next_key, *resume_len);
+            node_unlatch (db, leaf_num);
+            return false;
+        }
+    }
+
+    btree_collapse_root (db, root_page_num);
+    return true;
+}
+
+/**
+ * btree_vacuum_step - vacuums up to BTREE_VACUUM_LEAVES leaves of one
+ * parent: compacts them and merges neighbours that fit in BTREE_MERGE_FILL
+ * percent of a page, the emptied leaves go to the free list
+ * @resume: a key of the first leaf to visit, used if *resume_len is not 0
+ * @resume_len: set to the length of a key of the next leaf to visit
+ *
+ * Once the last leaf was visited a root with a single child is collapsed.
+ *
+ * Return: true if the last leaf was visited
+ */
+bool btree_vacuum_step (Database *db, uint32_t root_page_num, uint8_t *resume,
+                        uint32_t *resume_len)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    bool done = vacuum_step (db, root_page_num, resume, resume_len, mark);
+    pager_unpin_to (db->pager, mark);
+    return done;
+}
+
+/**
+ * btree_builder_init - starts a bulk load into an empty tree
+ * @fill_factor: percentage of each page to fill, 10 to 100
+ *
+ * The root page is reset by the first cell, which also drops tombstones.
+ * The other pages of a tree that only holds tombstones go to the free list.
+ */
+void btree_builder_init (BTreeBuilder *b, Database *db, uint32_t root_page_num,
+                         uint32_t fill_factor)
+{
+    if (fill_factor < 10 || fill_factor > 100)
+    {
+        fill_factor = BTREE_DEFAULT_FILL_FACTOR;
+    }
+
+    btree_free_pages (db, root_page_num);
+
+    b->db = db;
+    b->root_page_num = root_page_num;
+    b->fill_limit = PAGE_SIZE * fill_factor / 100;
+    b->levels = 0;
+}
+
+/**
+ * btree_builder_begin - starts a bulk load into a tree other threads use,
+ * if it is empty
+ *
+ * The root stays latched exclusive until btree_builder_end, no other
+ * thread reaches the tree while it is built or reset. Only a leaf root
+ * without live cells counts as empty, it has no other pages to free.
+ *
+ * Return: false if the tree is not empty, nothing is latched then
+ */
+bool btree_builder_begin (BTreeBuilder *b, Database *db,
+                          uint32_t root_page_num, uint32_t fill_factor)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    void *root = node_latch (db, root_page_num, true);
+    bool empty = get_node_type (root) == NODE_LEAF
+                 && node_live_size (root) == sizeof (SlottedPageHeader);
+    pager_unpin_to (db->pager, mark); // latched, so it stays resident
+    if (!empty)
+    {
+        node_unlatch (db, root_page_num);
+        return false;
+    }
+
+    btree_builder_init (b, db, root_page_num, fill_factor);
+    return true;
+}
+
+// lets go of the root once the tree is built or reset
+void btree_builder_end (BTreeBuilder *b)
+{
+    node_unlatch (b->db, b->root_page_num);
+}
+
+static bool builder_node_fits (BTreeBuilder *b, void *node, uint32_t cell_size)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    uint32_t free_space = pager_slotted_free_space (node);
+    uint32_t needed = cell_size + sizeof (Slot);
+
+    if (free_space < needed)
+    {
+        return false;
+    }
+    return header->num_cells == 0
+           || PAGE_SIZE - free_space + needed <= b->fill_limit;
+}
+
+static BTreeResult builder_add_at (BTreeBuilder *b, int level, void *key,
+                                   uint32_t key_len, void *val,
+                                   uint32_t val_len);
+
+/**
+ * builder_add_child - adds the first key of a node to the level above
+ */
+static BTreeResult builder_add_child (BTreeBuilder *b, int level,
+                                      uint32_t page_num)
+{
+    Pager *pager = b->db->pager;
+    void *node = pager_get_page (pager, page_num);
+
+    void *key;
+    uint32_t key_len;
+    slot_get_key (node, 0, &key, &key_len);
+    return builder_add_at (b, level + 1, key, key_len, &page_num,
+                           sizeof (uint32_t));
+}
+
+static BTreeResult builder_add_at (BTreeBuilder *b, int level, void *key,
+                                   uint32_t key_len, void *val,
+                                   uint32_t val_len)
+{
+    Pager *pager = b->db->pager;
+    uint32_t cell_size = sizeof (uint32_t) + key_len + val_len;
+
+    if (level == BTREE_MAX_DEPTH)
+    {
+        return BTREE_FULL;
+    }
+
+    if (level == b->levels)
+    {
+        // new top level, it lives in the root page
+        void *root = pager_get_page (pager, b->root_page_num);
+        if (level == 0)
+        {
+            initialize_leaf_node (root);
+        }
+        else
+        {
+            initialize_internal_node (root);
+        }
+        set_node_root (root, 1);
+        b->nodes[level] = b->root_page_num;
+        b->levels++;
+    }
+
+    uint32_t page_num = b->nodes[level];
+    void *node = pager_get_page (pager, page_num);
+
+    if (!builder_node_fits (b, node, cell_size))
+    {
+        if (page_num == b->root_page_num)
+        {
+            // the top level gets a second node, move the first out of the root
+            uint32_t moved_num =
+                pager_allocate_page_like (pager, b->root_page_num);
+            if (moved_num == 0)
+            {
+                return BTREE_FULL;
+            }
+            void *moved = pager_get_page (pager, moved_num);
+            memcpy (moved, node, PAGE_SIZE);
+            set_node_root (moved, 0);
+            pager_mark_dirty (pager, moved_num);
+
+            b->nodes[level] = moved_num;
+            node = moved;
+
+            BTreeResult res = builder_add_child (b, level, moved_num);
+            if (res != BTREE_OK)
+            {
+                return res;
+            }
+        }
+
+        uint32_t next_num = pager_allocate_page_like (pager, b->root_page_num);
+        if (next_num == 0)
+        {
+            return BTREE_FULL;
+        }
+        void *next = pager_get_page (pager, next_num);
+
+        if (level == 0)
+        {
+            initialize_leaf_node (next);
+            ((SlottedPageHeader *) node)->next_leaf = next_num;
+            pager_mark_dirty (pager, page_num);
+        }
+        else
+        {
+            initialize_internal_node (next);
+        }
+
+        pager_slotted_insert (next, key, key_len, val, val_len);
+        pager_mark_dirty (pager, next_num);
+        b->nodes[level] = next_num;
+
+        return builder_add_child (b, level, next_num);
+    }
+
+    pager_slotted_insert (node, key, key_len, val, val_len);
+    pager_mark_dirty (pager, page_num);
+    return BTREE_OK;
+}
+
+/**
+ * btree_builder_add - appends a cell to the tree being built
+ *
+ * Return: BTREE_OK, BTREE_DUPLICATE if key is not greater than the previous
+ * key, or BTREE_FULL if the cell is too large or there are no pages left
+ */
+BTreeResult btree_builder_add (BTreeBuilder *b, void *key, uint32_t key_len,
+                               void *val, uint32_t val_len)
+{
+    if (sizeof (uint32_t) + key_len + val_len > BTREE_MAX_CELL_SIZE)
+    {
+        return BTREE_FULL;
+    }
+
+    uint32_t mark = pager_pin_mark (b->db->pager);
+    BTreeResult res = BTREE_OK;
+    if (b->levels > 0)
+    {
+        void *leaf = pager_get_page (b->db->pager, b->nodes[0]);
+        SlottedPageHeader *header = (SlottedPageHeader *) leaf;
+
+        void *last_key;
+        uint32_t last_klen;
+        slot_get_key (leaf, header->num_cells - 1, &last_key, &last_klen);
+        if (btree_key_compare (last_key, last_klen, key, key_len) >= 0)
+        {
+            res = BTREE_DUPLICATE;
+        }
+    }
+
+    if (res == BTREE_OK)
+    {
+        res = builder_add_at (b, 0, key, key_len, val, val_len);
+    }
+    pager_unpin_to (b->db->pager, mark);
+    return res;
 }
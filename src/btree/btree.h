@@ -3,12 +3,17 @@
 #include "../db/db.h"
 #include "../pager/pager.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef enum
 {
     NODE_INTERNAL,
-    NODE_LEAF
+    NODE_LEAF,
+    NODE_HASH_DIRECTORY, // see hash.h
+    NODE_HASH_BUCKET,
+    NODE_HEAP_MAP, // see heap.h
+    NODE_HEAP_PAGE
 } NodeType;
 
 /*
@@ -53,7 +58,127 @@ typedef enum
 #define LEAF_NODE_SPACE_FOR_CELLS (PAGE_SIZE - LEAF_NODE_HEADER_SIZE)
 #define LEAF_NODE_MAX_CELLS       (LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE)
 
+/*
+ * SLOTTED BTREE
+ * -------------
+ * Tables and indexes are B+trees of slotted pages. The slot directory of
+ * every node is sorted by key (memcmp order, see key_encode).
+ *
+ * - Leaf cells: [ key | row ] for tables, [ key | pk ] for indexes.
+ *   Leaves are chained left to right through next_leaf.
+ * - Internal cells: [ separator | child page number (4) ]. A child holds the
+ *   keys >= its separator, the first separator of a node acts as -infinity.
+ *
+ * The root page number of a tree never changes, a full root moves its cells
+ * into a new child and becomes an internal node. A full node with deleted
+ * cells is compacted before it splits. Deletes leave tombstones, a sparse
+ * node is merged with a neighbour or evened out with it by btree_rebalance,
+ * and a root left with one child takes its place.
+ */
+/*
+ * LATCHING
+ * --------
+ * Nodes are latched through the pager, see pager_latch. A descent latches
+ * each node shared until its child is latched, the leaf shared to read it or
+ * exclusive to change it. An insert whose leaf has no room descends again
+ * with exclusive latches and keeps those of the nodes its split reaches.
+ * Merges latch the parent, then the children left to right. Latches are
+ * taken down the tree and right along the leaf chain, never up or left.
+ *
+ * A cursor holds no latch between calls, see CURSORS. A bulk load into a
+ * tree others use holds the root exclusive, see btree_builder_begin.
+ * btree_free_pages works on trees no other thread uses.
+ */
+#define BTREE_MAX_DEPTH 16
+// large cells could leave one half of a split without room
+#define BTREE_MAX_CELL_SIZE (PAGE_SIZE / 4)
+// room for the largest cell of any page size
+#define BTREE_CELL_BUFFER_SIZE (PAGE_SIZE_MAX / 4)
+// cells of a node of any page size, each takes a slot and a key length
+#define BTREE_MAX_NODE_CELLS                                                   \
+    (PAGE_SIZE_MAX / (sizeof (Slot) + sizeof (uint32_t)))
+
+// a node below this percentage of a page is rebalanced, see btree_rebalance
+#define BTREE_MIN_FILL 25
+// neighbouring nodes are merged when they fit in this percentage of a page,
+// the rest is left for inserts so the merged node does not split
+#define BTREE_MERGE_FILL 66
+// leaves a vacuum step visits, see btree_vacuum_step
+#define BTREE_VACUUM_LEAVES 32
+// leaves a scan asks the pager for ahead of its cursor
+#define BTREE_READ_AHEAD 16
+
+typedef enum
+{
+    BTREE_OK,
+    BTREE_DUPLICATE,
+    BTREE_FULL,
+} BTreeResult;
+
+/*
+ * CURSORS
+ * -------
+ * A cursor keeps its position as a page number and a cell and holds no
+ * latch between calls, other threads change the tree meanwhile. A cursor
+ * on a tree copies the cell it lands on while the leaf is latched and
+ * returns the copy, valid until the cursor moves. To move, change or delete
+ * the cell it latches the leaf again and trusts it only if no page was
+ * freed since, see pager_free_epoch, and the cell still has the copied key.
+ * Otherwise a split, a merge or a vacuum moved the key and the cursor
+ * descends to it again from the root.
+ *
+ * A cursor on a chain of leaves without a tree, see btree_cursor_from_leaf,
+ * returns pointers into its leaf and relies on no other thread changing
+ * the chain. Heap tables are only changed by one statement at a time.
+ *
+ * The pages a cursor reads stay pinned until it moves: a move unpins back
+ * to the mark taken when the cursor was positioned, pages the caller got
+ * after that mark are valid until then.
+ */
+typedef struct
+{
+    Database *db;
+    uint32_t page_num;
+    void *page; // NULL once the cursor moved past the last leaf
+    int cell;
+    uint32_t mark; // pins of the thread before the cursor was positioned
+
+    // read-ahead along the leaves, see cursor_read_ahead
+    uint32_t root_page_num; // 0 for a chain of leaves without a tree
+    uint32_t ahead_parent;  // internal node above page, 0 if not known
+    int ahead_slot;         // slot of page in ahead_parent
+    int ahead_end;          // last slot of ahead_parent asked for
+
+    // the cell under a cursor on a tree, see cursor_copy_cell
+    uint32_t epoch; // pager_free_epoch while the leaf was latched
+    uint32_t key_len;
+    uint32_t val_len;
+    uint8_t copy[BTREE_CELL_BUFFER_SIZE];
+} BTreeCursor;
+
+/*
+ * BULK LOADING
+ * ------------
+ * Builds an empty tree bottom up from cells in ascending key order. Nodes
+ * are filled left to right up to the fill factor, each new node adds its
+ * first key to the level above. The root page always holds the single node
+ * of the top level, it moves to a new page when a second node is needed.
+ * A page is marked dirty after each change, so a tree no other thread
+ * reaches is built without latches while other threads flush the pool.
+ */
+#define BTREE_DEFAULT_FILL_FACTOR 90
+
+typedef struct
+{
+    Database *db;
+    uint32_t root_page_num;
+    uint32_t fill_limit; // bytes a node may use before a new one is started
+    int levels;
+    uint32_t nodes[BTREE_MAX_DEPTH]; // rightmost node per level, 0 = leaves
+} BTreeBuilder;
+
 void initialize_leaf_node (void *node);
+void initialize_internal_node (void *node);
 uint32_t *leaf_node_num_cells (void *node);
 void *leaf_node_cell (void *node, uint32_t cell_num);
 uint32_t *leaf_node_key (void *node, uint32_t cell_num);
@@ -61,7 +186,41 @@ void *leaf_node_value (void *node, uint32_t cell_num);
 NodeType get_node_type (void *node);
 void set_node_root (void *node, uint8_t is_root);
 uint32_t *leaf_node_next_leaf (void *node);
-int btree_find_key (Database *db, uint32_t root_page_num, void *key,
-                    uint32_t key_len, void **out_page);
+bool btree_find_key (Database *db, uint32_t root_page_num, void *key,
+                     uint32_t key_len, void *val, uint32_t *val_len);
+BTreeResult btree_insert (Database *db, uint32_t root_page_num, void *key,
+                          uint32_t key_len, void *val, uint32_t val_len);
+bool btree_delete (Database *db, uint32_t root_page_num, void *key,
+                   uint32_t key_len);
+
+void btree_cursor_first (Database *db, uint32_t root_page_num,
+                         BTreeCursor *c);
+void btree_cursor_from_leaf (Database *db, uint32_t page_num, BTreeCursor *c);
+void btree_cursor_seek (Database *db, uint32_t root_page_num, void *key,
+                        uint32_t key_len, BTreeCursor *c);
+void btree_cursor_seek_forward (BTreeCursor *c, uint32_t root_page_num,
+                                void *key, uint32_t key_len);
+bool btree_cursor_valid (BTreeCursor *c);
+void btree_cursor_next (BTreeCursor *c);
+void btree_cursor_get (BTreeCursor *c, void **key, uint32_t *key_len,
+                       void **val, uint32_t *val_len);
+void btree_cursor_delete (BTreeCursor *c);
+bool btree_cursor_replace_value (BTreeCursor *c, void *val, uint32_t val_len);
+int btree_key_compare (void *a, uint32_t a_len, void *b, uint32_t b_len);
+bool btree_is_empty (Database *db, uint32_t root_page_num);
+uint32_t btree_first_leaf (Database *db, uint32_t root_page_num);
+void btree_free_pages (Database *db, uint32_t root_page_num);
+void btree_mark_compressed (Database *db, uint32_t root_page_num);
+void btree_rebalance (Database *db, uint32_t root_page_num);
+bool btree_vacuum_step (Database *db, uint32_t root_page_num, uint8_t *resume,
+                        uint32_t *resume_len);
+
+void btree_builder_init (BTreeBuilder *b, Database *db, uint32_t root_page_num,
+                         uint32_t fill_factor);
+bool btree_builder_begin (BTreeBuilder *b, Database *db,
+                          uint32_t root_page_num, uint32_t fill_factor);
+void btree_builder_end (BTreeBuilder *b);
+BTreeResult btree_builder_add (BTreeBuilder *b, void *key, uint32_t key_len,
+                               void *val, uint32_t val_len);
 
 #endif /* BTREE_H */
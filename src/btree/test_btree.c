@@ -0,0 +1,269 @@
+#include "../testing/testing.h"
+#include "btree.h"
+
+// unity includes
+#include "../arena/arena.c"
+#include "../lz/lz.c"
+#include "../pager/pager.c"
+#include "btree.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_WRITERS   4
+#define TEST_READERS   2
+#define TEST_KEYS      6000 // per writer
+#define TEST_VAL_LEN   120
+#define TEST_PAGE_SIZE 4096
+
+// far fewer frames than pages, so pages are evicted under the threads
+#define TEST_CACHE_SIZE (PAGER_MIN_FRAMES * TEST_PAGE_SIZE)
+
+unsigned char test_buffer[SIZE_MB];
+Arena test_arena;
+
+Database db;
+uint32_t root;
+
+// keys of writer w below progress[w] are in the tree unless deleted
+uint32_t progress[TEST_WRITERS];
+int writers_done;
+
+// writer w owns the keys k with k % TEST_WRITERS == w, every third is
+// deleted again a little later
+static uint32_t test_key (int w, uint32_t i)
+{
+    return i * TEST_WRITERS + w;
+}
+
+static bool test_key_deleted (uint32_t k)
+{
+    return (k / TEST_WRITERS) % 3 == 0;
+}
+
+// in the tree once every writer is done, the last keys were not deleted yet
+static bool test_key_kept (uint32_t k)
+{
+    return !test_key_deleted (k) || k / TEST_WRITERS >= TEST_KEYS - 50;
+}
+
+// big endian, so memcmp order is the order of the numbers
+static void encode_key (uint32_t k, uint8_t *out)
+{
+    out[0] = k >> 24;
+    out[1] = k >> 16;
+    out[2] = k >> 8;
+    out[3] = k;
+}
+
+static uint32_t decode_key (uint8_t *in)
+{
+    return (uint32_t) in[0] << 24 | (uint32_t) in[1] << 16
+           | (uint32_t) in[2] << 8 | in[3];
+}
+
+static void fill_val (uint32_t k, uint8_t *val)
+{
+    for (int i = 0; i < TEST_VAL_LEN; i++)
+    {
+        val[i] = (uint8_t) (k * 31 + i);
+    }
+}
+
+static bool val_matches (uint32_t k, void *val, uint32_t val_len)
+{
+    uint8_t expected[TEST_VAL_LEN];
+    fill_val (k, expected);
+    return val_len == TEST_VAL_LEN && memcmp (val, expected, val_len) == 0;
+}
+
+static void *writer (void *arg)
+{
+    int w = (int) (intptr_t) arg;
+    for (uint32_t i = 0; i < TEST_KEYS; i++)
+    {
+        uint8_t key[4], val[TEST_VAL_LEN];
+        uint32_t k = test_key (w, i);
+        encode_key (k, key);
+        fill_val (k, val);
+        BTreeResult res = btree_insert (&db, root, key, 4, val, TEST_VAL_LEN);
+        ASSERT_FMT (res == BTREE_OK,
+                    "tests[concurrent] - insert of %u failed. got=%d", k,
+                    res);
+        __atomic_store_n (&progress[w], i + 1, __ATOMIC_RELEASE);
+
+        // take back an older key, its neighbours stay
+        if (i >= 50 && test_key_deleted (test_key (w, i - 50)))
+        {
+            encode_key (test_key (w, i - 50), key);
+            ASSERT_FMT (btree_delete (&db, root, key, 4),
+                        "tests[concurrent] - delete of %u found nothing",
+                        test_key (w, i - 50));
+        }
+
+        // a key of this writer that stays is found with its value
+        uint32_t back = test_key (w, i / 2);
+        if (!test_key_deleted (back))
+        {
+            uint8_t found[BTREE_CELL_BUFFER_SIZE];
+            uint32_t found_len;
+            encode_key (back, key);
+            ASSERT_FMT (btree_find_key (&db, root, key, 4, found, &found_len)
+                            && val_matches (back, found, found_len),
+                        "tests[concurrent] - key %u not found", back);
+        }
+        pager_unpin_to (db.pager, 0);
+    }
+    __atomic_fetch_add (&writers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *reader (void *arg)
+{
+    (void) arg;
+    int scans = 0;
+    while (scans == 0
+           || __atomic_load_n (&writers_done, __ATOMIC_ACQUIRE) < TEST_WRITERS)
+    {
+        uint32_t seen[TEST_WRITERS];
+        for (int w = 0; w < TEST_WRITERS; w++)
+        {
+            seen[w] = __atomic_load_n (&progress[w], __ATOMIC_ACQUIRE);
+        }
+
+        // every key that was in the tree when the scan started and stays is
+        // returned, in ascending order and once
+        uint32_t expect[TEST_WRITERS] = {0};
+        bool first = true;
+        uint32_t last = 0;
+        BTreeCursor c;
+        for (btree_cursor_first (&db, root, &c); btree_cursor_valid (&c);
+             btree_cursor_next (&c))
+        {
+            void *key, *val;
+            uint32_t key_len, val_len;
+            btree_cursor_get (&c, &key, &key_len, &val, &val_len);
+            ASSERT_FMT (key_len == 4, "tests[concurrent] - key length %u",
+                        key_len);
+            uint32_t k = decode_key (key);
+            ASSERT_FMT (first || k > last,
+                        "tests[concurrent] - scan went from %u to %u", last,
+                        k);
+            ASSERT_FMT (val_matches (k, val, val_len),
+                        "tests[concurrent] - value of %u wrong", k);
+
+            int w = k % TEST_WRITERS;
+            for (uint32_t i = expect[w]; i < k / TEST_WRITERS; i++)
+            {
+                ASSERT_FMT (i >= seen[w] || test_key_deleted (test_key (w, i)),
+                            "tests[concurrent] - scan missed %u",
+                            test_key (w, i));
+            }
+            expect[w] = k / TEST_WRITERS + 1;
+            first = false;
+            last = k;
+        }
+        pager_unpin_to (db.pager, 0);
+
+        for (int w = 0; w < TEST_WRITERS; w++)
+        {
+            for (uint32_t i = expect[w]; i < seen[w]; i++)
+            {
+                ASSERT_FMT (test_key_deleted (test_key (w, i)),
+                            "tests[concurrent] - scan missed %u",
+                            test_key (w, i));
+            }
+        }
+        scans++;
+    }
+    return NULL;
+}
+
+static void *vacuum (void *arg)
+{
+    (void) arg;
+    uint8_t resume[BTREE_CELL_BUFFER_SIZE];
+    uint32_t resume_len = 0;
+    while (__atomic_load_n (&writers_done, __ATOMIC_ACQUIRE) < TEST_WRITERS)
+    {
+        btree_vacuum_step (&db, root, resume, &resume_len);
+        pager_unpin_to (db.pager, 0);
+    }
+    return NULL;
+}
+
+void test_concurrent ()
+{
+    char path[] = "/tmp/test_btree_XXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_FMT (fd != -1, "tests[concurrent] - no temporary file");
+    close (fd);
+
+    db.pager = pager_open (&test_arena, path, TEST_PAGE_SIZE, TEST_CACHE_SIZE);
+    ASSERT_FMT (db.pager != NULL, "tests[concurrent] - pager_open failed");
+    root = pager_allocate_page (db.pager);
+    void *node = pager_get_page (db.pager, root);
+    initialize_leaf_node (node);
+    set_node_root (node, 1);
+    pager_mark_dirty (db.pager, root);
+    pager_unpin_to (db.pager, 0);
+
+    pthread_t threads[TEST_WRITERS + TEST_READERS + 1];
+    int n = 0;
+    for (int w = 0; w < TEST_WRITERS; w++)
+    {
+        pthread_create (&threads[n++], NULL, writer, (void *) (intptr_t) w);
+    }
+    for (int r = 0; r < TEST_READERS; r++)
+    {
+        pthread_create (&threads[n++], NULL, reader, NULL);
+    }
+    pthread_create (&threads[n++], NULL, vacuum, NULL);
+    for (int i = 0; i < n; i++)
+    {
+        pthread_join (threads[i], NULL);
+    }
+
+    // the keys left are exactly the ones not deleted
+    uint32_t count = 0;
+    uint32_t next = 0;
+    BTreeCursor c;
+    for (btree_cursor_first (&db, root, &c); btree_cursor_valid (&c);
+         btree_cursor_next (&c))
+    {
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (&c, &key, &key_len, &val, &val_len);
+        while (!test_key_kept (next))
+        {
+            next++;
+        }
+        ASSERT_FMT (decode_key (key) == next,
+                    "tests[concurrent] - expected key %u. got=%u", next,
+                    decode_key (key));
+        next++;
+        count++;
+    }
+    pager_unpin_to (db.pager, 0);
+
+    uint32_t kept = 0;
+    for (uint32_t k = 0; k < TEST_WRITERS * TEST_KEYS; k++)
+    {
+        kept += test_key_kept (k);
+    }
+    ASSERT_FMT (count == kept, "tests[concurrent] - expected %u keys. got=%u",
+                kept, count);
+
+    pager_close (db.pager);
+    unlink (path);
+    printf ("BTREE: [concurrent] All tests passed!\n");
+}
+
+int main ()
+{
+    arena_init (&test_arena, test_buffer, SIZE_MB);
+    test_concurrent ();
+    return 0;
+}
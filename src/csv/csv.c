@@ -0,0 +1,257 @@
+#include "csv.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void csv_reader_init (CsvReader *r, const uint8_t *start, const uint8_t *end)
+{
+    r->pos = start;
+    r->end = end;
+}
+
+/**
+ * csv_find_special - finds the next ',', '"' or '\n'
+ * @p: start of the search
+ * @end: end of the buffer
+ *
+ * Compares 16 bytes at a time with SSE2 when it is available.
+ *
+ * Return: pointer to the byte, or end if there is none
+ */
+const uint8_t *csv_find_special (const uint8_t *p, const uint8_t *end)
+{
+#ifdef __SSE2__
+    const __m128i comma = _mm_set1_epi8 (',');
+    const __m128i quote = _mm_set1_epi8 ('"');
+    const __m128i newline = _mm_set1_epi8 ('\n');
+
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128 ((const __m128i *) p);
+        __m128i hits = _mm_or_si128 (
+            _mm_or_si128 (_mm_cmpeq_epi8 (chunk, comma),
+                          _mm_cmpeq_epi8 (chunk, quote)),
+            _mm_cmpeq_epi8 (chunk, newline));
+
+        int mask = _mm_movemask_epi8 (hits);
+        if (mask != 0)
+        {
+            return p + __builtin_ctz (mask);
+        }
+        p += 16;
+    }
+#endif
+
+    while (p < end && *p != ',' && *p != '"' && *p != '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * csv_count_quotes - counts the '"' bytes in a range
+ *
+ * An odd count means the range ends inside a quoted field.
+ */
+size_t csv_count_quotes (const uint8_t *p, const uint8_t *end)
+{
+    size_t count = 0;
+    while ((p = memchr (p, '"', end - p)) != NULL)
+    {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+/**
+ * csv_next_record - finds the start of the first record after p
+ * @p: any position in the buffer
+ * @end: end of the buffer
+ * @in_quotes: whether p is inside a quoted field
+ *
+ * Used to split a file into chunks that start on record boundaries.
+ *
+ * Return: pointer past the first '\n' outside of quotes, or end
+ */
+const uint8_t *csv_next_record (const uint8_t *p, const uint8_t *end,
+                                bool in_quotes)
+{
+    while (p < end)
+    {
+        if (*p == '"')
+        {
+            in_quotes = !in_quotes;
+        }
+        else if (*p == '\n' && !in_quotes)
+        {
+            return p + 1;
+        }
+        p++;
+    }
+    return end;
+}
+
+/**
+ * csv_read_record - splits the next record into fields
+ * @r: reader
+ * @arena: storage for quoted fields that contain escaped quotes
+ * @fields: output fields, pointing into the input where possible
+ * @max_fields: capacity of fields
+ *
+ * Return: number of fields, 0 at the end of input, or -1 if the record has
+ * more than max_fields fields
+ */
+int csv_read_record (CsvReader *r, Arena *arena, str8 *fields, int max_fields)
+{
+    // skip blank lines
+    while (r->pos < r->end && (*r->pos == '\n' || *r->pos == '\r'))
+    {
+        r->pos++;
+    }
+
+    if (r->pos >= r->end)
+    {
+        return 0;
+    }
+
+    int count = 0;
+
+    while (1)
+    {
+        if (count == max_fields)
+        {
+            r->pos = csv_next_record (r->pos, r->end, false);
+            return -1;
+        }
+
+        str8 *field = &fields[count++];
+        const uint8_t *p = r->pos;
+
+        if (p < r->end && *p == '"')
+        {
+            // quoted field, "" stands for one quote
+            const uint8_t *start = ++p;
+            const uint8_t *q;
+            size_t escapes = 0;
+
+            while ((q = memchr (p, '"', r->end - p)) != NULL && q + 1 < r->end
+                   && q[1] == '"')
+            {
+                escapes++;
+                p = q + 2;
+            }
+            if (q == NULL)
+            {
+                q = r->end;
+            }
+
+            if (escapes == 0)
+            {
+                *field = str8_from_range ((uint8_t *) start, (uint8_t *) q);
+            }
+            else
+            {
+                uint8_t *out = push_array_no_zero (arena, uint8_t,
+                                                   q - start - escapes);
+                size_t len = 0;
+                for (const uint8_t *c = start; c < q; c++)
+                {
+                    out[len++] = *c;
+                    if (*c == '"')
+                    {
+                        c++;
+                    }
+                }
+                *field = (str8) {out, len};
+            }
+            p = q < r->end ? q + 1 : q;
+
+            // anything up to the separator after the closing quote is ignored
+            while (p < r->end && *p != ',' && *p != '\n')
+            {
+                p++;
+            }
+        }
+        else
+        {
+            const uint8_t *q = csv_find_special (p, r->end);
+            // a stray quote inside an unquoted field is data
+            while (q < r->end && *q == '"')
+            {
+                q = csv_find_special (q + 1, r->end);
+            }
+
+            const uint8_t *field_end = q;
+            if (field_end > p && field_end[-1] == '\r'
+                && (field_end == r->end || *field_end == '\n'))
+            {
+                field_end--;
+            }
+            *field = str8_from_range ((uint8_t *) p, (uint8_t *) field_end);
+            p = q;
+        }
+
+        if (p < r->end && *p == ',')
+        {
+            r->pos = p + 1;
+            continue;
+        }
+
+        r->pos = p < r->end ? p + 1 : p;
+        return count;
+    }
+}
+
+static bool csv_needs_quotes (str8 value)
+{
+    for (size_t i = 0; i < value.len; i++)
+    {
+        uint8_t c = value.str[i];
+        if (c == ',' || c == '"' || c == '\n' || c == '\r')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * csv_field_size - worst case size of a field written by csv_write_field
+ */
+uint32_t csv_field_size (str8 value)
+{
+    return 2 * value.len + 2;
+}
+
+/**
+ * csv_write_field - writes a field, quoting it only when needed
+ * @dest: at least csv_field_size (value) bytes
+ *
+ * Return: bytes written
+ */
+uint32_t csv_write_field (uint8_t *dest, str8 value)
+{
+    if (!csv_needs_quotes (value))
+    {
+        memcpy (dest, value.str, value.len);
+        return value.len;
+    }
+
+    uint32_t len = 0;
+    dest[len++] = '"';
+    for (size_t i = 0; i < value.len; i++)
+    {
+        if (value.str[i] == '"')
+        {
+            dest[len++] = '"';
+        }
+        dest[len++] = value.str[i];
+    }
+    dest[len++] = '"';
+    return len;
+}
@@ -0,0 +1,37 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include "../arena/arena.h"
+#include "../str/str.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CSV FORMAT (RFC 4180)
+ * ---------------------
+ * - Records end with '\n' or "\r\n", fields are separated by ','.
+ * - A field containing ',', '"', '\r' or '\n' is quoted, a '"' inside a
+ *   quoted field is written twice.
+ * - Blank lines are skipped.
+ */
+
+typedef struct
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+} CsvReader;
+
+void csv_reader_init (CsvReader *r, const uint8_t *start, const uint8_t *end);
+int csv_read_record (CsvReader *r, Arena *arena, str8 *fields, int max_fields);
+
+const uint8_t *csv_find_special (const uint8_t *p, const uint8_t *end);
+size_t csv_count_quotes (const uint8_t *p, const uint8_t *end);
+const uint8_t *csv_next_record (const uint8_t *p, const uint8_t *end,
+                                bool in_quotes);
+
+uint32_t csv_field_size (str8 value);
+uint32_t csv_write_field (uint8_t *dest, str8 value);
+
+#endif /* CSV_H */
@@ -0,0 +1,118 @@
+#include "../testing/testing.h"
+#include "csv.h"
+
+// unity includes
+#include "../arena/arena.c"
+#include "../str/str.c"
+#include "csv.c"
+
+#include <stdio.h>
+#include <string.h>
+
+unsigned char test_buffer[SIZE_MB];
+Arena test_arena;
+
+void test_read_records ()
+{
+    const char *input = "1,alice,\"a, b\"\r\n"
+                        "\n"
+                        "2,\"say \"\"hi\"\"\",\n"
+                        "3,a long field past sixteen bytes,\"multi\nline\"";
+
+    CsvReader r;
+    csv_reader_init (&r, (const uint8_t *) input,
+                     (const uint8_t *) input + strlen (input));
+
+    str8 expected[3][3] = {
+        {str8_lit ("1"), str8_lit ("alice"), str8_lit ("a, b")},
+        {str8_lit ("2"), str8_lit ("say \"hi\""), str8_lit ("")},
+        {str8_lit ("3"), str8_lit ("a long field past sixteen bytes"),
+         str8_lit ("multi\nline")},
+    };
+
+    str8 fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int count = csv_read_record (&r, &test_arena, fields, 3);
+        ASSERT_FMT (count == 3,
+                    "tests[read] - record %d field count wrong. expected=3, "
+                    "got=%d",
+                    i, count);
+
+        for (int j = 0; j < 3; j++)
+        {
+            ASSERT_FMT (str8_equals (fields[j], expected[i][j]),
+                        "tests[read] - field %d.%d wrong. expected=%.*s, "
+                        "got=%.*s",
+                        i, j, STR_FMT (expected[i][j]), STR_FMT (fields[j]));
+        }
+    }
+
+    ASSERT_FMT (csv_read_record (&r, &test_arena, fields, 3) == 0,
+                "tests[read] - expected end of input");
+
+    const char *wide = "1,2,3,4\n5,6\n";
+    csv_reader_init (&r, (const uint8_t *) wide,
+                     (const uint8_t *) wide + strlen (wide));
+    ASSERT_FMT (csv_read_record (&r, &test_arena, fields, 3) == -1,
+                "tests[read] - expected too many fields");
+    ASSERT_FMT (csv_read_record (&r, &test_arena, fields, 3) == 2,
+                "tests[read] - expected reader to resume at next record");
+
+    printf ("CSV: [read] All tests passed!\n");
+}
+
+void test_record_boundaries ()
+{
+    const char *input = "1,\"x\ny\"\n2,z\n";
+    const uint8_t *start = (const uint8_t *) input;
+    const uint8_t *end = start + strlen (input);
+
+    // position 5 is inside the quoted field, after its first newline
+    const uint8_t *mid = start + 5;
+    bool in_quotes = csv_count_quotes (start, mid) % 2 == 1;
+
+    ASSERT_FMT (in_quotes, "tests[boundary] - expected to be inside quotes");
+    ASSERT_FMT (csv_next_record (mid, end, in_quotes) == start + 8,
+                "tests[boundary] - wrong record start. expected=8, got=%d",
+                (int) (csv_next_record (mid, end, in_quotes) - start));
+
+    const char *plain = "aaaaaaaaaaaaaaaaaaaaaaaa,bbbb\n";
+    const uint8_t *p = (const uint8_t *) plain;
+    ASSERT_FMT (csv_find_special (p, p + strlen (plain)) == p + 24,
+                "tests[boundary] - separator search wrong");
+
+    printf ("CSV: [boundary] All tests passed!\n");
+}
+
+void test_write_fields ()
+{
+    str8 values[3] = {str8_lit ("plain"), str8_lit ("a,b"),
+                      str8_lit ("say \"hi\"")};
+    str8 expected[3] = {str8_lit ("plain"), str8_lit ("\"a,b\""),
+                        str8_lit ("\"say \"\"hi\"\"\"")};
+
+    uint8_t out[64];
+    for (int i = 0; i < 3; i++)
+    {
+        uint32_t len = csv_write_field (out, values[i]);
+        str8 got = {out, len};
+        ASSERT_FMT (len <= csv_field_size (values[i]),
+                    "tests[write] - field %d larger than reserved", i);
+        ASSERT_FMT (str8_equals (got, expected[i]),
+                    "tests[write] - field %d wrong. expected=%.*s, got=%.*s",
+                    i, STR_FMT (expected[i]), STR_FMT (got));
+    }
+
+    printf ("CSV: [write] All tests passed!\n");
+}
+
+int main ()
+{
+    arena_init (&test_arena, test_buffer, sizeof (test_buffer));
+
+    test_read_records ();
+    test_record_boundaries ();
+    test_write_fields ();
+    return 0;
+}
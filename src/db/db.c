@@ -1,5 +1,7 @@
 #include "db.h"
 
+#include "../btree/btree.h"
+#include "../heap/heap.h"
 #include "../pager/pager.h"
 
 #include <stdbool.h>
@@ -20,12 +22,15 @@
  *  table_count(4bytes) |
  *  table(MAX_TABLE_SIZE(32bytes) + table_page_num(4bytes) = 36bytes), ...
  *
+ * The index of every UNIQUE column is registered again, see
+ * db_add_unique_index.
+ *
  * Return: nothing
  * */
 void catalog_init_from_disk (Database *db)
 {
-    void *page_zero = pager_get_page (db->global_arena, db->pager, 0);
-    SlottedPageHeader *header = (SlottedPageHeader *) page_zero;
+    void *catalog = pager_get_page (db->pager, CATALOG_PAGE);
+    SlottedPageHeader *header = (SlottedPageHeader *) catalog;
 
     db->table_count = 0;
     for (int i = 0; i < header->num_cells; i++)
@@ -35,7 +40,7 @@ void catalog_init_from_disk (Database *db)
         void *val;
         uint32_t val_len;
 
-        slot_get_content (page_zero, i, &key, &key_len, &val, &val_len);
+        slot_get_content (catalog, i, &key, &key_len, &val, &val_len);
 
         Table *t = push_struct_zero (db->global_arena, Table);
         t->table_name.str =
@@ -43,9 +48,27 @@ void catalog_init_from_disk (Database *db)
         memcpy (t->table_name.str, key, key_len);
         t->table_name.str[key_len] = '\0';
         t->table_name.len = key_len;
-        deserialize_table (db->global_arena, val, t);
+        deserialize_table (db->global_arena, val, val_len, t);
 
         t->pager = db->pager;
+        if (t->compression != COMPRESSION_NONE
+            && t->organization == TABLE_HEAP)
+        {
+            heap_mark_compressed (db, t->root_page_num);
+        }
+        else if (t->compression != COMPRESSION_NONE)
+        {
+            btree_mark_compressed (db, t->root_page_num);
+        }
+        for (int c = 0; c < t->col_count; c++)
+        {
+            if (t->unique_roots[c] != 0 && !db_add_unique_index (db, t, c))
+            {
+                printf ("Warning: no index slot left, UNIQUE %.*s.%.*s is "
+                        "not enforced.\n",
+                        STR_FMT (t->table_name), STR_FMT (t->columns[c].name));
+            }
+        }
 
         if (db->table_count < MAX_TABLES)
         {
@@ -83,10 +106,71 @@ Table *db_find_table (Database *db, str8 name)
     return NULL;
 }
 
+/**
+ * db_add_unique_index - registers the index that enforces a UNIQUE column
+ * @col: the column, its index root is t->unique_roots[col]
+ *
+ * It is an ordinary btree index named <table>_<column>_key, or
+ * <table>_<column>_pkey for the primary key of a heap table, so lookups on
+ * the column use it too. Its root page is kept in the table schema.
+ *
+ * Return: false if every index slot is taken
+ */
+bool db_add_unique_index (Database *db, Table *t, int col)
+{
+    if (db->index_count >= MAX_INDEXES)
+    {
+        return false;
+    }
+
+    str8 col_name = t->columns[col].name;
+    const char *suffix = t->columns[col].is_primary_key ? "pkey" : "key";
+    size_t name_len = t->table_name.len + col_name.len + strlen (suffix) + 2;
+    char *name = push_array_no_zero (db->global_arena, char, name_len + 1);
+    snprintf (name, name_len + 1, "%.*s_%.*s_%s", STR_FMT (t->table_name),
+              STR_FMT (col_name), suffix);
+
+    Index *idx = &db->indexes[db->index_count++];
+    *idx = (Index) {0};
+    idx->index_name = str8_from_range ((uint8_t *) name,
+                                       (uint8_t *) name + name_len);
+    idx->table_name = t->table_name;
+    idx->col_count = 1;
+    idx->col_names[0] = col_name;
+    idx->root_page_num = t->unique_roots[col];
+    idx->method = INDEX_BTREE;
+    idx->fill_factor = BTREE_DEFAULT_FILL_FACTOR;
+    idx->is_unique = true;
+    idx->state = INDEX_READY;
+    return true;
+}
+
+/**
+ * table_unique_indexed - whether a column is kept unique by an index, see
+ * db_add_unique_index
+ *
+ * The primary key of a btree table is unique through the table itself,
+ * every other UNIQUE column and the primary key of a heap table need one.
+ */
+bool table_unique_indexed (Table *t, int col)
+{
+    ColumnDef *c = &t->columns[col];
+    if (c->is_primary_key)
+    {
+        return t->organization == TABLE_HEAP;
+    }
+    return c->is_unique;
+}
+
 /**
  * serialize_table - serializes a table and writes it to dest
  * @table: table pointer
  * @dest: destination pointer
+ *
+ * The root pages of the UNIQUE column indexes follow the columns, the
+ * organization of the table is the low nibble of the last byte and its
+ * compression the high nibble.
+ *
  * Returns: offset
  */
 uint32_t serialize_table (Table *table, void *dest)
@@ -126,6 +210,18 @@ uint32_t serialize_table (Table *table, void *dest)
         offset += sizeof (bool);
     }
 
+    for (int i = 0; i < table->col_count; i++)
+    {
+        if (table->unique_roots[i] != 0)
+        {
+            memcpy (d + offset, &table->unique_roots[i], sizeof (uint32_t));
+            offset += sizeof (uint32_t);
+        }
+    }
+
+    d[offset++] =
+        (uint8_t) (table->organization | (table->compression << 4));
+
     return offset;
 }
 
@@ -133,9 +229,13 @@ uint32_t serialize_table (Table *table, void *dest)
  * deserialize_table - serializes a table and writes it to dest
  * @table: table pointer
  * @dest: destination pointer
+ * @val_len: size of the schema, older schemas end after the columns and
+ * their UNIQUE columns have no index, or after the index roots and are
+ * btree tables
  * Returns: offset
  */
-void deserialize_table (Arena *arena, void *val, Table *table)
+void deserialize_table (Arena *arena, void *val, uint32_t val_len,
+                        Table *table)
 {
     uint8_t *src = (uint8_t *) val;
     uint32_t offset = 0;
@@ -175,6 +275,27 @@ void deserialize_table (Arena *arena, void *val, Table *table)
         memcpy (&col->is_unique, src + offset, sizeof (bool));
         offset += sizeof (bool);
     }
+
+    // the roots are whole uint32_t, an odd byte left is the organization
+    // and the compression
+    table->organization = TABLE_BTREE;
+    table->compression = COMPRESSION_NONE;
+    if ((val_len - offset) % sizeof (uint32_t) == 1)
+    {
+        table->organization = (TableOrganization) (src[val_len - 1] & 0x0f);
+        table->compression = (TableCompression) (src[val_len - 1] >> 4);
+    }
+
+    for (int i = 0; i < table->col_count; i++)
+    {
+        table->unique_roots[i] = 0;
+        if (table_unique_indexed (table, i)
+            && offset + sizeof (uint32_t) <= val_len)
+        {
+            memcpy (&table->unique_roots[i], src + offset, sizeof (uint32_t));
+            offset += sizeof (uint32_t);
+        }
+    }
 }
 
 /**
@@ -213,6 +334,27 @@ uint32_t serialize_row (Table *table, str8 *values, void *dest)
     return offset;
 }
 
+/**
+ * serialize_row_size - size of a row once serialized
+ * @table: table pointer
+ * @values: array of table values
+ * Returns: size in bytes
+ */
+uint32_t serialize_row_size (Table *table, str8 *values)
+{
+    uint32_t size = 0;
+
+    for (int i = 0; i < table->col_count; i++)
+    {
+        size += sizeof (int32_t);
+        if (table->columns[i].type == TYPE_TEXT)
+        {
+            size += values[i].len;
+        }
+    }
+    return size;
+}
+
 void deserialize_print_row (Table *table, void *row_data, int client_fd)
 {
     uint8_t *ptr = (uint8_t *) row_data;
@@ -355,3 +497,120 @@ int table_find_primary_key_index (Table *t)
 
     return -1;
 }
+
+/**
+ * key_encode - encodes a column value as a memcomparable btree key
+ * @type: column type
+ * @value: value as a string
+ * @dest: destination, at least KEY_ENCODED_MAX (value.len) bytes
+ *
+ * Keys compare with memcmp in the same order as their values:
+ * - INT: big endian with the sign bit flipped (4 bytes)
+ * - TEXT: bytes with 0x00 escaped as 0x00 0xFF, terminated by 0x00 0x01
+ *
+ * Encoded keys are self delimiting, so they can be concatenated.
+ *
+ * Return: encoded length
+ */
+uint32_t key_encode (DataType type, str8 value, void *dest)
+{
+    uint8_t *d = (uint8_t *) dest;
+
+    if (type == TYPE_INT)
+    {
+        char temp[32];
+        snprintf (temp, sizeof (temp), "%.*s", STR_FMT (value));
+        uint32_t u = (uint32_t) atoi (temp) ^ 0x80000000u;
+
+        d[0] = (uint8_t) (u >> 24);
+        d[1] = (uint8_t) (u >> 16);
+        d[2] = (uint8_t) (u >> 8);
+        d[3] = (uint8_t) u;
+        return 4;
+    }
+
+    uint32_t len = 0;
+    for (size_t i = 0; i < value.len; i++)
+    {
+        d[len++] = value.str[i];
+        if (value.str[i] == 0x00)
+        {
+            d[len++] = 0xFF;
+        }
+    }
+    d[len++] = 0x00;
+    d[len++] = 0x01;
+    return len;
+}
+
+/**
+ * key_decode - decodes a value encoded by key_encode
+ * @src: the encoded value
+ * @out: set to the value as a string, may be NULL to only skip it
+ * @arena: arena for the string
+ *
+ * Return: encoded length
+ */
+uint32_t key_decode (DataType type, void *src, str8 *out, Arena *arena)
+{
+    uint8_t *s = (uint8_t *) src;
+
+    if (type == TYPE_INT)
+    {
+        if (out)
+        {
+            uint32_t u = ((uint32_t) s[0] << 24) | ((uint32_t) s[1] << 16)
+                         | ((uint32_t) s[2] << 8) | (uint32_t) s[3];
+            char *buf = push_array_no_zero (arena, char, 32);
+            int len =
+                snprintf (buf, 32, "%d", (int32_t) (u ^ 0x80000000u));
+            *out = str8_from_range ((uint8_t *) buf, (uint8_t *) buf + len);
+        }
+        return 4;
+    }
+
+    // the length of the value is at most the length of its encoding
+    uint32_t end = 0;
+    while (s[end] != 0x00 || s[end + 1] != 0x01)
+    {
+        end += s[end] == 0x00 ? 2 : 1;
+    }
+
+    if (out)
+    {
+        uint8_t *d = push_array_no_zero (arena, uint8_t, end);
+        uint32_t len = 0;
+        for (uint32_t i = 0; i < end; i++)
+        {
+            d[len++] = s[i];
+            if (s[i] == 0x00)
+            {
+                i++; // skip the 0xFF escape
+            }
+        }
+        *out = str8_from_range (d, d + len);
+    }
+    return end + 2;
+}
+
+/**
+ * table_row_key - encodes the btree key of a row
+ * @t: table
+ * @values: row values
+ * @dest: destination
+ *
+ * Rows are keyed by the primary key, or by the first column if the table
+ * has none.
+ *
+ * Return: encoded length
+ */
+uint32_t table_row_key (Table *t, str8 *values, void *dest)
+{
+    int pk_idx = table_find_primary_key_index (t);
+    if (pk_idx == -1)
+    {
+        pk_idx = 0;
+    }
+
+    return key_encode (t->columns[pk_idx].type, values[pk_idx], dest);
+}
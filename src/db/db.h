@@ -1,6 +1,7 @@
 #ifndef DB_H
 #define DB_H
 
+#include "../bloom/bloom.h"
 #include "../pager/pager.h"
 #include "../parser/parser.h"
 #include "../str/str.h"
@@ -12,22 +13,52 @@
 #define MAX_TABLES     100
 #define MAX_INDEXES    20
 #define MAX_TABLE_NAME 32
+#define CATALOG_PAGE   1 // root of the catalog, page 0 is the database header
+
+// worst case size of an encoded key for a value of len bytes
+#define KEY_ENCODED_MAX(len) (2 * (len) + 4)
 
 typedef struct
 {
     str8 table_name;
-    uint32_t root_page_num;
+    uint32_t root_page_num; // a free-space map for TABLE_HEAP
+    TableOrganization organization;
+    TableCompression compression;
     uint32_t col_count;
     ColumnDef columns[MAX_COLUMNS];
+    uint32_t unique_roots[MAX_COLUMNS]; // index of a UNIQUE column, or 0
     Pager *pager;
+    BloomFilter *key_filter; // primary keys, built on first use or NULL
 } Table;
 
+typedef enum
+{
+    INDEX_READY,
+    INDEX_BUILDING, // changes to the table go to the side log
+    INDEX_INVALID,  // a concurrent build failed, the index is never used
+} IndexState;
+
 typedef struct
 {
     str8 index_name;
     str8 table_name;
-    str8 col_name;
-    uint32_t root_page_num;
+    int col_count;
+    str8 col_names[MAX_INDEX_COLUMNS]; // the key is their values in order
+    int include_count;
+    str8 include_names[MAX_COLUMNS]; // stored after the pk in cell values
+    WhereClause where; // partial index: only rows that match are indexed
+    uint32_t root_page_num; // a hash directory for INDEX_HASH
+    IndexMethod method;
+    uint32_t fill_factor; // used when the index is built bottom up
+    bool is_unique;       // enforces a UNIQUE column, see db_add_unique_index
+    BloomFilter *filter;  // leading column values, see index_filter
+
+    IndexState state;
+    // changes made while building, a chain of pages, see index_log_change
+    uint32_t log_head;
+    uint32_t log_tail;
+    uint32_t log_count;
+    bool log_overflow; // a change was lost, the build fails
 } Index;
 
 typedef struct
@@ -35,11 +66,14 @@ typedef struct
     Pager *pager;
     Table *tables[MAX_TABLES];
     int table_count;
-    pthread_mutex_t lock;
+    pthread_rwlock_t lock; // shared for statements execute_runs_shared allows
+    pthread_mutex_t filter_lock; // the Bloom filters of tables and indexes
 
     int index_count;
     Index indexes[MAX_INDEXES];
 
+    int copy_dir_fd; // COPY files live here, -1 if COPY is off
+
     Arena *global_arena;
 } Database;
 
@@ -48,8 +82,11 @@ void db_create_table (str8 name);
 
 void catalog_init_from_disk (Database *db);
 uint32_t serialize_table (Table *table, void *dest);
-void deserialize_table (Arena *arena, void *val, Table *t);
+void deserialize_table (Arena *arena, void *val, uint32_t val_len, Table *t);
+bool db_add_unique_index (Database *db, Table *t, int col);
+bool table_unique_indexed (Table *t, int col);
 uint32_t serialize_row (Table *table, str8 *values, void *dest);
+uint32_t serialize_row_size (Table *table, str8 *values);
 void deserialize_print_row (Table *table, void *row_data, int client_fd);
 void deserialize_row_to_strings (Table *t, void *row_data, str8 *out_values,
                                  Arena *arena);
@@ -57,5 +94,8 @@ int table_find_col_index (Table *t, str8 col_name);
 int resolve_column (Table *t1, Table *t2, ColumnRef ref, Table **out_table,
                     int *out_col_idx);
 int table_find_primary_key_index (Table *t);
+uint32_t key_encode (DataType type, str8 value, void *dest);
+uint32_t key_decode (DataType type, void *src, str8 *out, Arena *arena);
+uint32_t table_row_key (Table *t, str8 *values, void *dest);
 
 #endif /* DB_H */
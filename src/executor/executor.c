@@ -2,27 +2,294 @@
 
 #include "../arena/arena.h"
 #include "../btree/btree.h"
+#include "../csv/csv.h"
+#include "../hash/hash.h"
+#include "../heap/heap.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+// threads that parse, extract and sort in COPY and CREATE INDEX
+#define BUILD_MAX_THREADS      8
+#define COPY_MIN_CHUNK_SIZE    (SIZE_MB) // smaller files use fewer threads
+#define COPY_WRITE_BUFFER_SIZE (64 * 1024)
+#define INDEX_MIN_RUN_SIZE     (256 * 1024) // row bytes per thread at least
+#define INDEX_BUILD_MEMORY     (SIZE_MB * 64) // a batch of rows, see IndexBuild
+#define INDEX_MERGE_WAYS       16 // sorted runs merged at once
+#define INDEX_SCAN_STEP        (SIZE_MB) // row bytes copied per shared lock
+#define INDEX_LOG_CATCH_UP     1024 // log changes left for the exclusive lock
+#define INDEX_CATCH_UP_ROUNDS  8 // shared replays of the side log at most
+#define INDEX_READ_AHEAD       32 // heap rows an index scan asks for at once
+#define WHERE_KEY_MAX          (2 * PAGE_SIZE_MAX) // longest search key
+
+typedef struct
+{
+    Table *t;
+    int idx;
+} ColMap;
+
+// a key value pair waiting to be inserted, see execute_insert
+typedef struct
+{
+    uint8_t *key;
+    uint32_t key_len;
+    uint8_t *val;
+    uint32_t val_len;
+    str8 *row;
+} BatchEntry;
+
+// a newline aligned part of a COPY FROM file, parsed by one thread
+typedef struct
+{
+    Table *t;
+    const uint8_t *start;
+    const uint8_t *end;
+
+    void *backing;
+    Arena arena;
+    BatchEntry *entries; // sorted by key once parsed
+    int entry_count;
+    ExecuteResult result;
+} CopyChunk;
+
+// a range of the rows of a batch that one thread turns into sorted index
+// entries
+typedef struct
+{
+    Table *t;
+    Index *idx;
+    BatchEntry *rows;
+    int row_count;
+
+    Arena arena;
+    BatchEntry *entries; // this run's part of the shared entry array
+    int entry_count;
+} IndexRun;
+
+/*
+ * The extraction of the entries of a new index, see execute_create_index.
+ * The rows are copied in batches that fit INDEX_BUILD_MEMORY with their
+ * entries. The sorted entries of a batch are written out as a run on
+ * temporary pages unless it is the only batch, the runs are merged into
+ * the index at the end.
+ */
+typedef struct
+{
+    void *backing; // INDEX_BUILD_MEMORY, reset for every batch
+    Arena arena;
+    BatchEntry *rows; // the batch, copied out of the table
+    int row_count;
+    int row_cap;
+    size_t batch_size; // what the batch takes once its entries are extracted
+
+    // the key of the last row copied, the scan goes on after it
+    uint8_t resume[BTREE_CELL_BUFFER_SIZE];
+    uint32_t resume_len; // 0 before the first batch
+    bool full;           // the batch takes INDEX_BUILD_MEMORY
+    bool scanned;        // the last row of the table was copied
+
+    BatchEntry *entries; // sorted once the runs are merged
+    BatchEntry *tmp;
+    int entry_count;
+    IndexRun runs[BUILD_MAX_THREADS];
+    int bounds[BUILD_MAX_THREADS + 1];
+    int run_count;
+
+    uint32_t *spilled; // first pages of the runs written out
+    int spilled_count;
+    int spilled_cap;
+} IndexBuild;
+
+// the end of a run being written out, see run_write
+typedef struct
+{
+    uint32_t head;
+    uint32_t tail;
+} RunWriter;
+
+// starts the key of a side log cell, the key of the entry follows up to its
+// primary key, which starts the value of the entry in the cell value, so a
+// copy of the cell past it is the entry. See index_log_change
+typedef struct
+{
+    uint8_t is_delete;
+    uint32_t pk_len; // the trailing primary key starts the entry value
+} IndexLogRecord;
+
+// the next entry of a run being merged, see index_merge
+typedef struct
+{
+    uint32_t page_num; // 0 once the run is done
+    int cell;
+    uint32_t key_len;
+    uint32_t val_len;
+    uint8_t copy[PAGE_SIZE_MAX]; // the key then the value
+} RunReader;
+
+// two neighbouring sorted runs of src merged into the same range of dst
+typedef struct
+{
+    BatchEntry *src;
+    BatchEntry *dst;
+    int lo;
+    int mid;
+    int hi;
+} MergeTask;
+
+// a WHERE condition resolved against a table of the statement
+typedef struct
+{
+    Table *t;
+    int col_idx;
+    str8 value;
+    int32_t int_value; // for INT columns
+} WherePred;
+
+// the entries of an index whose columns equal values, see index_scan_begin
+typedef struct
+{
+    Table *t;
+    Index *idx;
+    uint8_t *prefix; // encoded value, must outlive the scan
+    uint32_t prefix_len;
+    BTreeCursor btree;
+    HashCursor hash;
+    int ahead; // matches whose heap pages were asked for, see index_scan_ahead
+} IndexScan;
+
+// the rows a DELETE or UPDATE visits, every row or the rows of a key list
+typedef struct
+{
+    Database *db;
+    Table *t;
+    BTreeCursor c;
+    str8 *keys; // NULL to visit every row
+    int key_count;
+    int next_key;
+    uint32_t mark; // pins before the scan, let go before each keyed seek
+} RowScan;
+
 static ExecuteResult execute_create_table (Statement *stmt, Database *db);
 static ExecuteResult execute_create_index (Statement *stmt, Database *db);
-static ExecuteResult execute_insert (Statement *stmt, Database *db);
+static ExecuteResult execute_insert (Statement *stmt, Database *db,
+                                     Arena *arena);
+static ExecuteResult table_insert_batch (Database *db, Table *t,
+                                         BatchEntry *batch, int row_count,
+                                         Arena *arena);
+static ExecuteResult index_insert_batch (Database *db, Table *t,
+                                         BatchEntry *batch, int row_count,
+                                         Arena *arena);
+static void tree_reset (Database *db, uint32_t root_page_num);
+static void batch_rollback (Database *db, Table *t, BatchEntry *batch,
+                            int row_count, int index_end);
 static ExecuteResult execute_select (Statement *stmt, Database *db,
                                      int client_fd);
-static ExecuteResult execute_delete (Statement *stmt, Database *db);
-static ExecuteResult execute_update (Statement *stmt, Database *db);
+static ExecuteResult execute_delete (Statement *stmt, Database *db,
+                                     Arena *arena);
+static ExecuteResult execute_update (Statement *stmt, Database *db,
+                                     Arena *arena);
+static ExecuteResult execute_copy (Statement *stmt, Database *db,
+                                   int client_fd);
+static ExecuteResult execute_vacuum (Statement *stmt, Database *db);
 static bool row_matches_predicate (Table *t, void *row_data, int target_col_idx,
                                    void *target_val);
-
-ExecuteResult execute_statement (Statement *s, Database *db, int client_fd)
+static bool index_encode_entry (Table *t, Index *idx, str8 *row_vals,
+                                str8 row_key, uint8_t *out, uint32_t *key_len,
+                                uint32_t *pk_len, uint32_t *val_len);
+static bool index_insert_row (Database *db, Table *t, Index *idx,
+                              str8 *row_vals, str8 row_key);
+static void index_delete_row (Database *db, Table *t, Index *idx,
+                              str8 *row_vals, str8 row_key);
+static bool index_update_row (Database *db, Table *t, str8 *old_vals,
+                              str8 old_key, str8 *new_vals, str8 new_key);
+static bool index_store_insert (Database *db, Index *idx, uint8_t *key,
+                                uint32_t key_len, uint8_t *val,
+                                uint32_t val_len);
+static void index_store_delete (Database *db, Index *idx, uint8_t *key,
+                                uint32_t key_len, uint32_t pk_len);
+static bool table_may_contain (Database *db, Table *t, void *key,
+                               uint32_t key_len);
+static void table_filter_add (Database *db, Table *t, void *key,
+                              uint32_t key_len);
+static bool index_may_contain (Database *db, Table *t, Index *idx,
+                               uint8_t *prefix, uint32_t prefix_len);
+static void index_filter_add (Database *db, Table *t, Index *idx, uint8_t *key,
+                              uint32_t key_len);
+static bool index_entry_changed (Table *t, Index *idx, str8 *old_vals,
+                                 str8 *new_vals);
+static bool index_has_row (Table *t, Index *idx, str8 *row_vals);
+static bool unique_taken (Database *db, Table *t, Index *idx, uint8_t *value,
+                          uint32_t value_len, str8 *own_pk);
+static bool unique_conflict (Database *db, Table *t, str8 *new_vals,
+                             str8 *old_vals, str8 row_key);
+static ExecuteResult unique_check_batch (Database *db, Table *t,
+                                         BatchEntry *batch, int row_count,
+                                         Arena *arena);
+static bool where_implies (Table *t, WherePred *preds, int pred_count,
+                           Index *idx);
+static ExecuteResult where_resolve (Table *t1, Table *t2, WhereClause *where,
+                                    WherePred *preds);
+static bool row_matches_where (Table *t, void *row_data, WherePred *preds,
+                               int pred_count);
+static Index *where_plan (Database *db, Table *t, WherePred *preds,
+                          int pred_count, ColMap *select_cols,
+                          int select_col_count, uint8_t *key,
+                          uint32_t *key_len);
+static str8 *where_row_keys (Database *db, Table *t, WherePred *preds,
+                             int pred_count, uint8_t *search_key,
+                             str8 *lookup, Arena *arena, int *key_count);
+static void index_scan_begin (Database *db, Table *t, Index *idx,
+                              uint8_t *prefix, uint32_t prefix_len,
+                              IndexScan *s);
+static bool index_scan_valid (IndexScan *s);
+static void index_scan_next (IndexScan *s);
+static void index_scan_pk (IndexScan *s, void **pk, uint32_t *pk_len);
+static void index_scan_ahead (Database *db, IndexScan *s);
+static bool index_covers (Table *t, Index *idx, ColMap *cols, int col_count,
+                          WherePred *preds, int pred_count);
+static void index_scan_values (IndexScan *s, str8 *row_vals, Arena *arena);
+static bool values_match_where (Table *t, str8 *row_vals, WherePred *preds,
+                                int pred_count);
+static str8 *index_collect_keys (Database *db, Table *t, Index *idx,
+                                 uint8_t *prefix, uint32_t prefix_len,
+                                 Arena *arena, int *key_count);
+static void table_cursor_first (Database *db, Table *t, BTreeCursor *c);
+static void table_cursor_seek (Database *db, Table *t, void *key,
+                               uint32_t key_len, BTreeCursor *c);
+static bool table_find_row (Database *db, Table *t, void *key,
+                            uint32_t key_len, void *row, uint32_t *row_len);
+static bool table_store_row (Database *db, Table *t, BatchEntry *e);
+static ExecuteResult update_row_values (Table *t, Statement *stmt,
+                                        int *assign_idxs, int pk_idx,
+                                        void *row, str8 **old_values,
+                                        str8 **new_values, uint8_t **new_row,
+                                        uint32_t *new_size, uint8_t **new_key,
+                                        uint32_t *new_key_len, Arena *arena);
+static ExecuteResult update_move_row (Database *db, Table *t, Statement *stmt,
+                                      int *assign_idxs, int pk_idx,
+                                      void *key, uint32_t key_len, void *row,
+                                      uint32_t row_len, Arena *arena);
+static uint32_t table_first_page (Database *db, Table *t);
+static void table_reclaim (Database *db, Table *t);
+static void row_scan_begin (RowScan *s, Database *db, Table *t, str8 *keys,
+                            int key_count);
+static void row_scan_next (RowScan *s);
+static bool send_row (int client_fd, ColMap *cols, int col_count, Table *t1,
+                      str8 *t1_vals, str8 *t2_vals);
+
+ExecuteResult execute_statement (Statement *s, Database *db, Arena *arena,
+                                 int client_fd)
 {
     switch (s->type)
     {
@@ -33,16 +300,64 @@ ExecuteResult execute_statement (Statement *s, Database *db, int client_fd)
     case STMT_SELECT:
         return execute_select (s, db, client_fd);
     case STMT_INSERT:
-        return execute_insert (s, db);
+        return execute_insert (s, db, arena);
     case STMT_UPDATE:
-        return execute_update (s, db);
+        return execute_update (s, db, arena);
     case STMT_DELETE:
-        return execute_delete (s, db);
+        return execute_delete (s, db, arena);
+    case STMT_COPY:
+        return execute_copy (s, db, client_fd);
+    case STMT_VACUUM:
+        return execute_vacuum (s, db);
     default:
         return EXECUTE_FAIL;
     }
 }
 
+/**
+ * execute_runs_shared - tells if a statement may run with db->lock held
+ * shared, called with it held shared
+ *
+ * SELECT reads through latched pages. INSERT into a btree table whose
+ * indexes are btrees is latched too, duplicate keys are caught by
+ * btree_insert. A UNIQUE check reads the index before it is written, a
+ * building index keeps a side log, and heap tables and hash indexes have
+ * no latches, those inserts are exclusive. UPDATE and DELETE read a row and
+ * change it and its index entries in separate steps, and an INSERT stores
+ * its rows before their index entries, so two of them on one row could
+ * leave entries behind: they run exclusive, like statements that change
+ * the catalog or every page.
+ */
+bool execute_runs_shared (Statement *stmt, Database *db)
+{
+    if (stmt->type == STMT_SELECT)
+    {
+        return true;
+    }
+    if (stmt->type != STMT_INSERT)
+    {
+        return false;
+    }
+
+    Table *t = db_find_table (db, stmt->insert.table_name);
+    if (!t || t->organization != TABLE_BTREE)
+    {
+        return t == NULL; // fails without touching a page
+    }
+    for (int i = 0; i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (str8_match (idx->table_name, t->table_name, true)
+            && idx->state != INDEX_INVALID
+            && (idx->state == INDEX_BUILDING || idx->method != INDEX_BTREE
+                || idx->is_unique))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 static ExecuteResult execute_create_table (Statement *stmt, Database *db)
 {
     if (db_find_table (db, stmt->create.table_name) != NULL)
@@ -50,28 +365,74 @@ static ExecuteResult execute_create_table (Statement *stmt, Database *db)
         return EXECUTE_TABLE_EXISTS;
     }
 
-    uint32_t new_root_page = db->pager->num_pages++;
+    Table table = {0};
+    table.organization = stmt->create.organization;
+    table.compression = stmt->create.compression;
+    table.col_count = stmt->create.col_count;
+    for (int i = 0; i < table.col_count; i++)
+    {
+        table.columns[i] = stmt->create.columns[i];
+    }
 
-    void *data_node =
-        pager_get_page (db->global_arena, db->pager, new_root_page);
-    initialize_leaf_node (data_node);
-    set_node_root (data_node, 1);
+    int unique_count = 0;
+    for (int i = 0; i < table.col_count; i++)
+    {
+        unique_count += table_unique_indexed (&table, i);
+    }
+    if (db->index_count + unique_count > MAX_INDEXES)
+    {
+        return EXECUTE_DB_FULL;
+    }
 
-    pager_flush (db->pager, new_root_page);
+    uint32_t new_root_page = pager_allocate_page (db->pager);
+    if (new_root_page == 0)
+    {
+        return EXECUTE_DB_FULL;
+    }
 
-    Table table = {0};
+    // the pages the table allocates inherit it from the root
+    pager_set_compressed (db->pager, new_root_page,
+                          table.compression != COMPRESSION_NONE);
+
+    void *data_node = pager_get_page (db->pager, new_root_page);
+    if (table.organization == TABLE_HEAP)
+    {
+        heap_init (db, new_root_page);
+    }
+    else
+    {
+        initialize_leaf_node (data_node);
+        set_node_root (data_node, 1);
+    }
+
+    pager_flush (db->pager, new_root_page);
     table.root_page_num = new_root_page;
-    table.col_count = stmt->create.col_count;
 
+    // the primary key of a btree table is unique through the table, every
+    // other UNIQUE column gets an index that writes check
     for (int i = 0; i < table.col_count; i++)
     {
-        table.columns[i] = stmt->create.columns[i];
+        if (!table_unique_indexed (&table, i))
+        {
+            continue;
+        }
+
+        uint32_t root = pager_allocate_page (db->pager);
+        if (root == 0)
+        {
+            return EXECUTE_DB_FULL;
+        }
+        void *node = pager_get_page (db->pager, root);
+        initialize_leaf_node (node);
+        set_node_root (node, 1);
+        pager_flush (db->pager, root);
+        table.unique_roots[i] = root;
     }
 
-    uint8_t schema_blob[PAGE_SIZE];
+    uint8_t schema_blob[PAGE_SIZE_MAX];
     uint32_t blob_size = serialize_table (&table, schema_blob);
 
-    void *catalog_root = pager_get_page (db->global_arena, db->pager, 0);
+    void *catalog_root = pager_get_page (db->pager, CATALOG_PAGE);
 
     bool success = pager_slotted_insert (
         catalog_root, stmt->create.table_name.str, stmt->create.table_name.len,
@@ -87,6 +448,8 @@ static ExecuteResult execute_create_table (Statement *stmt, Database *db)
         Table *t = push_struct_zero (db->global_arena, Table);
         t->table_name = str8_copy (db->global_arena, stmt->create.table_name);
         t->root_page_num = new_root_page;
+        t->organization = table.organization;
+        t->compression = table.compression;
         t->pager = db->pager;
         t->col_count = table.col_count;
 
@@ -95,955 +458,4052 @@ static ExecuteResult execute_create_table (Statement *stmt, Database *db)
             t->columns[i] = stmt->create.columns[i];
             t->columns[i].name =
                 str8_copy (db->global_arena, stmt->create.columns[i].name);
+            t->unique_roots[i] = table.unique_roots[i];
         }
 
         db->tables[db->table_count++] = t;
+        for (int i = 0; i < t->col_count; i++)
+        {
+            if (t->unique_roots[i] != 0)
+            {
+                db_add_unique_index (db, t, i);
+            }
+        }
     }
     else
     {
         return EXECUTE_TABLE_FULL;
     }
 
-    pager_flush (db->pager, 0);
-    db->pager->file_len = db->pager->num_pages * PAGE_SIZE;
+    pager_flush (db->pager, CATALOG_PAGE);
+    db->pager->file_len = (uint64_t) db->pager->num_pages * PAGE_SIZE;
 
     return EXECUTE_SUCCESS;
 }
 
-static ExecuteResult execute_create_index (Statement *stmt, Database *db)
+static int batch_entry_compare (const void *a, const void *b)
 {
-    unsigned char local_buffer[PAGE_SIZE];
-    Arena local_arena;
-    arena_init (&local_arena, local_buffer, sizeof (local_buffer));
+    const BatchEntry *x = (const BatchEntry *) a;
+    const BatchEntry *y = (const BatchEntry *) b;
+    return btree_key_compare (x->key, x->key_len, y->key, y->key_len);
+}
 
-    Table *t = db_find_table (db, stmt->create_index.table_name);
-    if (!t)
+/**
+ * build_thread_count - threads worth starting for bytes of input
+ * @min_per_thread: smallest share of the input a thread is started for
+ */
+static int build_thread_count (size_t bytes, size_t min_per_thread)
+{
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    size_t count = bytes / min_per_thread + 1;
+
+    if (count > BUILD_MAX_THREADS)
     {
-        return EXECUTE_TABLE_EXISTS;
+        count = BUILD_MAX_THREADS;
     }
+    if (cpus > 0 && count > (size_t) cpus)
+    {
+        count = cpus;
+    }
+    return (int) count;
+}
 
-    int col_idx = -1;
-    for (int i = 0; i < t->col_count; i++)
+static void *batch_merge_pair (void *arg)
+{
+    MergeTask *m = (MergeTask *) arg;
+    int i = m->lo;
+    int j = m->mid;
+    int k = m->lo;
+
+    while (i < m->mid && j < m->hi)
     {
-        if (str8_match (t->columns[i].name, stmt->create_index.col_name, true))
+        if (batch_entry_compare (&m->src[j], &m->src[i]) < 0)
         {
-            col_idx = i;
-            break;
+            m->dst[k++] = m->src[j++];
+        }
+        else
+        {
+            m->dst[k++] = m->src[i++];
         }
     }
-
-    if (col_idx == -1)
+    while (i < m->mid)
     {
-        return EXECUTE_COL_NOT_FOUND;
+        m->dst[k++] = m->src[i++];
     }
-    if (db->index_count >= MAX_INDEXES)
+    while (j < m->hi)
     {
-        return EXECUTE_DB_FULL;
+        m->dst[k++] = m->src[j++];
     }
+    return NULL;
+}
 
-    Index *idx = &db->indexes[db->index_count++];
-    idx->index_name =
-        str8_copy (db->global_arena, stmt->create_index.index_name);
-    idx->table_name =
-        str8_copy (db->global_arena, stmt->create_index.table_name);
-    idx->col_name = str8_copy (db->global_arena, stmt->create_index.col_name);
-    idx->root_page_num = db->pager->num_pages++;
-
-    void *idx_root =
-        pager_get_page (db->global_arena, db->pager, idx->root_page_num);
-    initialize_leaf_node (idx_root);
-    set_node_root (idx_root, 1);
-    pager_flush (db->pager, idx->root_page_num);
-
-    void *table_root =
-        pager_get_page (db->global_arena, db->pager, t->root_page_num);
-    SlottedPageHeader *header = (SlottedPageHeader *) table_root;
-    Slot *slots =
-        (Slot *) ((uint8_t *) table_root + sizeof (SlottedPageHeader));
+/**
+ * batch_merge_runs - merges sorted runs pairwise, every pair of a round in
+ * its own thread
+ * @entries: the runs back to back
+ * @tmp: scratch array as large as entries
+ * @bounds: run_count + 1 run boundaries, overwritten
+ * @run_count: at most BUILD_MAX_THREADS
+ *
+ * Return: entries or tmp, whichever holds the merged result
+ */
+static BatchEntry *batch_merge_runs (BatchEntry *entries, BatchEntry *tmp,
+                                     int *bounds, int run_count)
+{
+    BatchEntry *src = entries;
+    BatchEntry *dst = tmp;
 
-    int pk_idx = table_find_primary_key_index (t);
-    if (pk_idx == -1)
+    while (run_count > 1)
     {
-        pk_idx = 0;
-    }
+        MergeTask tasks[BUILD_MAX_THREADS / 2];
+        pthread_t threads[BUILD_MAX_THREADS / 2];
+        bool started[BUILD_MAX_THREADS / 2] = {0};
+        int pairs = run_count / 2;
 
-    for (int i = 0; i < header->num_cells; i++)
-    {
-        if (slots[i].size == 0)
+        for (int p = 0; p < pairs; p++)
         {
-            continue;
+            tasks[p] = (MergeTask) {src, dst, bounds[2 * p], bounds[2 * p + 1],
+                                    bounds[2 * p + 2]};
+            if (p > 0)
+            {
+                started[p] = pthread_create (&threads[p], NULL,
+                                             batch_merge_pair, &tasks[p])
+                             == 0;
+            }
         }
 
-        Temp_Arena_Memory scratch = temp_arena_memory_begin (&local_arena);
-
-        void *key, *val;
-        uint32_t klen, val_len;
-        slot_get_content (table_root, i, &key, &klen, &val, &val_len);
-
-        str8 row_strings[MAX_COLUMNS];
-        deserialize_row_to_strings (t, val, row_strings, &local_arena);
+        if (run_count % 2 == 1)
+        {
+            int lo = bounds[run_count - 1];
+            memcpy (dst + lo, src + lo,
+                    (bounds[run_count] - lo) * sizeof (BatchEntry));
+        }
 
-        str8 index_key = row_strings[col_idx];
-        str8 pk_val = row_strings[pk_idx];
+        for (int p = 0; p < pairs; p++)
+        {
+            if (started[p])
+            {
+                pthread_join (threads[p], NULL);
+            }
+            else
+            {
+                batch_merge_pair (&tasks[p]);
+            }
+        }
 
-        pager_slotted_insert (idx_root, index_key.str, index_key.len,
-                              pk_val.str, pk_val.len);
+        int n = 0;
+        for (int i = 0; i <= run_count; i += 2)
+        {
+            bounds[n++] = bounds[i];
+        }
+        if (run_count % 2 == 1)
+        {
+            bounds[n++] = bounds[run_count];
+        }
+        run_count = n - 1;
 
-        temp_arena_memory_end (scratch);
+        BatchEntry *swap = src;
+        src = dst;
+        dst = swap;
     }
-
-    pager_flush (db->pager, idx->root_page_num);
-    return EXECUTE_SUCCESS;
+    return src;
 }
 
-static ExecuteResult execute_insert (Statement *stmt, Database *db)
+/**
+ * index_build_run - thread entry, turns a range of the rows of a batch into
+ * sorted index entries
+ */
+static void *index_build_run (void *arg)
 {
-    Table *t = db_find_table (db, stmt->insert.table_name);
-    if (!t)
-    {
-        return EXECUTE_TABLE_NOT_EXISTS;
-    }
-
-    if (stmt->insert.val_count != t->col_count)
-    {
-        return EXECUTE_TABLE_COL_COUNT_MISMATCH;
-    }
+    IndexRun *run = (IndexRun *) arg;
+    run->entry_count = 0;
 
-    int pk_idx = table_find_primary_key_index (t);
-    if (pk_idx == -1)
+    for (int r = 0; r < run->row_count; r++)
     {
-        pk_idx = 0; // if pk table has no pk, pk=first column;
-    }
+        BatchEntry *row = &run->rows[r];
+        uint8_t entry[2 * PAGE_SIZE_MAX];
+        uint32_t key_len, pk_len, entry_val_len;
 
-    void *key_ptr = NULL;
-    uint32_t key_len = 0;
-    uint32_t id_key;
-
-    if (t->columns[pk_idx].type == TYPE_INT)
-    {
-        char temp[32];
-        snprintf (temp, 32, "%.*s", STR_FMT (stmt->insert.values[pk_idx]));
-        id_key = atoi (temp);
+        Temp_Arena_Memory scratch = temp_arena_memory_begin (&run->arena);
+        str8 row_strings[MAX_COLUMNS];
+        deserialize_row_to_strings (run->t, row->val, row_strings, &run->arena);
+        if (!index_has_row (run->t, run->idx, row_strings))
+        {
+            temp_arena_memory_end (scratch);
+            continue;
+        }
+        index_encode_entry (run->t, run->idx, row_strings,
+                            (str8) {row->key, row->key_len}, entry, &key_len,
+                            &pk_len, &entry_val_len);
+        temp_arena_memory_end (scratch);
 
-        key_ptr = &id_key;
-        key_len = sizeof (uint32_t);
-    }
-    else // TYPE_TEXT - validated earlier by the parser
-    {
-        key_ptr = stmt->insert.values[pk_idx].str;
-        key_len = stmt->insert.values[pk_idx].len;
+        uint32_t entry_len = key_len - pk_len + entry_val_len;
+        BatchEntry *e = &run->entries[run->entry_count++];
+        e->key = push_array_no_zero (&run->arena, uint8_t, entry_len);
+        memcpy (e->key, entry, entry_len);
+        e->key_len = key_len;
+        e->val = e->key + (key_len - pk_len);
+        e->val_len = entry_val_len;
     }
 
-    if (btree_find_key (db, t->root_page_num, key_ptr, key_len, NULL) != -1)
+    // hash indexes are built in any order
+    if (run->idx->method == INDEX_BTREE)
     {
-        return EXECUTE_DUPLICATE_KEY;
+        qsort (run->entries, run->entry_count, sizeof (BatchEntry),
+               batch_entry_compare);
     }
+    return NULL;
+}
 
-    uint8_t row_buffer[PAGE_SIZE];
-    uint32_t row_size = serialize_row (t, stmt->insert.values, row_buffer);
-
-    void *root_node =
-        pager_get_page (db->global_arena, db->pager, t->root_page_num);
-
-    if (!pager_slotted_insert (root_node, key_ptr, key_len, row_buffer,
-                               row_size))
+/**
+ * index_build_copy_row - adds a row to the batch
+ *
+ * An entry key encodes the indexed values and the primary key, which may be
+ * one of them, so at most four times the row plus the escape terminators,
+ * and the included values add at most the row again. Deserializing a row
+ * needs scratch on top, and the sort a second entry array.
+ *
+ * Return: false if the batch is full, the row goes to the next one
+ */
+static bool index_build_copy_row (IndexBuild *build, void *key,
+                                  uint32_t key_len, void *val,
+                                  uint32_t val_len)
+{
+    size_t row_bytes = key_len + val_len;
+    size_t size = 6 * row_bytes + 4 * sizeof (BatchEntry) + 64;
+    if (build->row_count > 0
+        && build->batch_size + size
+               > INDEX_BUILD_MEMORY - BUILD_MAX_THREADS * (size_t) SIZE_MB)
     {
-        return EXECUTE_TABLE_FULL;
+        return false;
     }
 
-    pager_flush (db->pager, t->root_page_num);
-
-    for (int i = 0; i < db->index_count; i++)
+    if (build->row_count == build->row_cap)
     {
-        Index *idx = &db->indexes[i];
-        if (str8_match (idx->table_name, t->table_name, true))
+        int cap = build->row_cap ? 2 * build->row_cap : 1024;
+        BatchEntry *grown = realloc (build->rows, cap * sizeof (BatchEntry));
+        if (!grown)
         {
-            int target_col_idx = table_find_col_index (t, idx->col_name);
-            if (target_col_idx == -1)
-            {
-                continue;
-            }
-
-            str8 idx_key_val = stmt->insert.values[target_col_idx];
-
-            str8 pk_val_str = stmt->insert.values[pk_idx];
-
-            void *idx_page = pager_get_page (db->global_arena, db->pager,
-                                             idx->root_page_num);
-
-            pager_slotted_insert (idx_page, idx_key_val.str, idx_key_val.len,
-                                  pk_val_str.str, pk_val_str.len);
-
-            pager_flush (db->pager, idx->root_page_num);
+            return false;
         }
+        build->rows = grown;
+        build->row_cap = cap;
     }
 
-    return EXECUTE_SUCCESS;
+    BatchEntry *row = &build->rows[build->row_count++];
+    row->key = push_array_no_zero (&build->arena, uint8_t, row_bytes);
+    memcpy (row->key, key, key_len);
+    row->key_len = key_len;
+    row->val = row->key + key_len;
+    memcpy (row->val, val, val_len);
+    row->val_len = val_len;
+    build->batch_size += size;
+    return true;
 }
 
-static ExecuteResult execute_select (Statement *stmt, Database *db,
-                                     int client_fd)
+// whether a row comes after the rows of the batches before
+static bool index_build_after_resume (IndexBuild *build, void *key,
+                                      uint32_t key_len)
 {
-    unsigned char local_buffer[PAGE_SIZE];
-    Arena local_arena;
-    arena_init (&local_arena, local_buffer, sizeof (local_buffer));
-
-    Table *t1 = db_find_table (db, stmt->select.table_name);
-    if (!t1)
-        return EXECUTE_TABLE_NOT_EXISTS;
+    return build->resume_len == 0
+           || btree_key_compare (key, key_len, build->resume,
+                                 build->resume_len)
+                  > 0;
+}
 
-    Table *t2 = NULL;
-    if (stmt->select.has_join)
+/**
+ * index_build_plan - splits the rows of a batch into ranges of about the
+ * same number of bytes, one run per thread
+ */
+static void index_build_plan (Table *t, Index *idx, IndexBuild *build)
+{
+    size_t row_bytes = 0;
+    for (int r = 0; r < build->row_count; r++)
     {
-        t2 = db_find_table (db, stmt->select.join_table);
-        if (!t2)
-            return EXECUTE_TABLE_NOT_EXISTS;
+        row_bytes += build->rows[r].key_len + build->rows[r].val_len;
     }
 
-    typedef struct
-    {
-        Table *t;
-        int idx;
-    } ColMap;
-    ColMap output_cols[MAX_COLUMNS];
-    int output_count = 0;
+    int row_count = build->row_count;
+    int run_count = build_thread_count (row_bytes, INDEX_MIN_RUN_SIZE);
+    build->entries = push_array_no_zero (&build->arena, BatchEntry, row_count);
+    build->tmp = push_array_no_zero (&build->arena, BatchEntry, row_count);
 
-    if (stmt->select.field_count == 0)
-    {
-        for (int i = 0; i < t1->col_count; i++)
-            output_cols[output_count++] = (ColMap) {t1, i};
-        if (t2)
-            for (int i = 0; i < t2->col_count; i++)
-                output_cols[output_count++] = (ColMap) {t2, i};
-    }
-    else
-    {
-        for (int i = 0; i < stmt->select.field_count; i++)
-        {
-            Table *target_t;
-            int target_idx;
-            if (resolve_column (t1, t2, stmt->select.fields[i], &target_t,
-                                &target_idx)
-                == -1)
-                return EXECUTE_COL_NOT_FOUND;
-            output_cols[output_count++] = (ColMap) {target_t, target_idx};
-        }
-    }
+    IndexRun *runs = build->runs;
+    int *bounds = build->bounds;
+    int run = 0;
+    size_t run_bytes = 0;
+    size_t run_scratch = 0;
 
-    Index *use_index = NULL;
-    if (stmt->select.has_where && !stmt->select.has_join)
+    runs[0] = (IndexRun) {t, idx, build->rows, 0};
+    runs[0].entries = build->entries;
+    bounds[0] = 0;
+
+    for (int r = 0; r < row_count; r++)
     {
-        for (int i = 0; i < db->index_count; i++)
+        size_t cell_size = build->rows[r].key_len + build->rows[r].val_len;
+        run_bytes += cell_size;
+        run_scratch += 5 * cell_size + 32;
+        runs[run].row_count++;
+
+        bool last = r == row_count - 1;
+        if (last
+            || (run + 1 < run_count
+                && run_bytes * run_count >= row_bytes * (run + 1)))
         {
-            if (str8_match (db->indexes[i].index_name, t1->table_name, true)
-                && str8_match (db->indexes[i].col_name,
-                               stmt->select.where_column.col_name, true))
+            size_t arena_size = run_scratch + SIZE_MB;
+            void *run_backing =
+                push_array_no_zero (&build->arena, uint8_t, arena_size);
+            arena_init (&runs[run].arena, run_backing, arena_size);
+            bounds[run + 1] = bounds[run] + runs[run].row_count;
+
+            if (!last)
             {
-                use_index = &db->indexes[i];
-                break;
+                run++;
+                runs[run] = (IndexRun) {t, idx, build->rows + r + 1, 0};
+                runs[run].entries = build->entries + bounds[run];
+                run_scratch = 0;
             }
         }
     }
 
-    if (use_index)
-    {
-        void *idx_page = pager_get_page (db->global_arena, db->pager,
-                                         use_index->root_page_num);
-        SlottedPageHeader *idx_h = (SlottedPageHeader *) idx_page;
-        Slot *idx_slots =
-            (Slot *) ((uint8_t *) idx_page + sizeof (SlottedPageHeader));
+    build->run_count = row_count > 0 ? run + 1 : 0;
+    build->entry_count = row_count;
+}
 
-        str8 search_key = stmt->select.where_value;
+// empties the batch for the next rows of the table
+static void index_build_reset (IndexBuild *build)
+{
+    arena_free_all (&build->arena);
+    build->row_count = 0;
+    build->batch_size = 0;
+    build->full = false;
+}
 
-        for (int k = 0; k < idx_h->num_cells; k++)
-        {
-            if (idx_slots[k].size == 0)
-                continue;
-            void *ik, *iv;
-            uint32_t ikl, ivl;
-            slot_get_content (idx_page, k, &ik, &ikl, &iv, &ivl);
+/**
+ * index_build_scan - copies rows of a table into the batch until it is
+ * full, the table ends or @step bytes were copied
+ *
+ * A btree table is read in key order, a heap table in page number order,
+ * which is the order of its row IDs. The scan goes on after the key of the
+ * last row copied before, the table may change between calls. A btree
+ * table is read through a cursor, which latches each leaf while it copies
+ * a cell, so a vacuum step may run meanwhile.
+ */
+static ExecuteResult index_build_scan (Database *db, Table *t,
+                                       IndexBuild *build, size_t step)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    size_t copied = 0;
+    bool stop = false;
 
-            if (ikl == search_key.len && memcmp (ik, search_key.str, ikl) == 0)
+    if (t->organization == TABLE_HEAP)
+    {
+        uint32_t from =
+            build->resume_len > 0 ? heap_row_id_page (build->resume) : 1;
+        uint32_t page_num = heap_next_page (db, t->root_page_num, from);
+        while (!stop && page_num != 0)
+        {
+            void *node = pager_get_page (db->pager, page_num);
+            SlottedPageHeader *header = (SlottedPageHeader *) node;
+            for (int i = 0; !stop && i < header->num_cells; i++)
             {
-                void *t1_page = pager_get_page (db->global_arena, db->pager,
-                                                t1->root_page_num);
-                SlottedPageHeader *t1_h = (SlottedPageHeader *) t1_page;
-
-                for (int m = 0; m < t1_h->num_cells; m++)
+                void *key, *val;
+                uint32_t key_len, val_len;
+                if (PAGE_SLOTS (node)[i].size == 0)
+                {
+                    continue;
+                }
+                slot_get_content (node, i, &key, &key_len, &val, &val_len);
+                if (!index_build_after_resume (build, key, key_len))
                 {
-                    void *rk, *rv;
-                    uint32_t rkl, rvl;
-                    slot_get_content (t1_page, m, &rk, &rkl, &rv, &rvl);
-
-                    if (rkl == ivl && memcmp (rk, iv, rkl) == 0)
-                    {
-                        Temp_Arena_Memory print_scratch =
-                            temp_arena_memory_begin (&local_arena);
-
-                        str8 row_vals[MAX_COLUMNS];
-                        deserialize_row_to_strings (t1, rv, row_vals,
-                                                    &local_arena);
-
-                        char buffer[4096];
-                        int b = 0;
-                        b += snprintf (buffer + b, sizeof (buffer) - b, "(");
-
-                        for (int c = 0; c < output_count; c++)
-                        {
-                            if (b >= sizeof (buffer) - 10)
-                                break;
-                            ColMap map = output_cols[c];
-                            str8 val = row_vals[output_cols[c].idx];
-                            bool is_text = output_cols[c]
-                                               .t->columns[output_cols[c].idx]
-                                               .type
-                                           == TYPE_TEXT;
-
-                            if (c > 0)
-                                b += snprintf (buffer + b, sizeof (buffer) - b,
-                                               ", ");
-                            if (is_text)
-                                b += snprintf (buffer + b, sizeof (buffer) - b,
-                                               "\"%.*s\"", STR_FMT (val));
-                            else
-                                b += snprintf (buffer + b, sizeof (buffer) - b,
-                                               "%.*s", STR_FMT (val));
-                        }
-
-                        if (b < sizeof (buffer) - 2)
-                            b += snprintf (buffer + b, sizeof (buffer) - b,
-                                           ")\n");
-                        else
-                        {
-                            buffer[sizeof (buffer) - 2] = ')';
-                            buffer[sizeof (buffer) - 1] = '\n';
-                        }
-
-                        if (send (client_fd, buffer, b, MSG_NOSIGNAL) == -1)
-                        {
-                            temp_arena_memory_end (print_scratch);
-                            return EXECUTE_SUCCESS;
-                        }
-                        // Reset local arena
-                        temp_arena_memory_end (print_scratch);
-                    }
+                    continue;
                 }
+                build->full =
+                    !index_build_copy_row (build, key, key_len, val, val_len);
+                copied += key_len + val_len;
+                stop = build->full || copied >= step;
+            }
+            pager_unpin_to (db->pager, mark);
+            if (!stop)
+            {
+                page_num = heap_next_page (db, t->root_page_num, page_num + 1);
             }
         }
     }
     else
     {
-        Table *where_table = NULL;
-        int where_col_idx = -1;
-        void *where_val_ptr = NULL;
-        int32_t where_val_int;
-        str8 where_val_str;
-
-        if (stmt->select.has_where)
+        BTreeCursor c;
+        if (build->resume_len > 0)
         {
-            if (resolve_column (t1, t2, stmt->select.where_column, &where_table,
-                                &where_col_idx)
-                == -1)
-                return EXECUTE_COL_NOT_FOUND;
-            if (where_table->columns[where_col_idx].type == TYPE_INT)
+            btree_cursor_seek (db, t->root_page_num, build->resume,
+                               build->resume_len, &c);
+        }
+        else
+        {
+            btree_cursor_first (db, t->root_page_num, &c);
+        }
+        while (!stop && btree_cursor_valid (&c))
+        {
+            void *key, *val;
+            uint32_t key_len, val_len;
+            btree_cursor_get (&c, &key, &key_len, &val, &val_len);
+            if (index_build_after_resume (build, key, key_len))
             {
-                char temp[32];
-                snprintf (temp, 32, "%.*s", STR_FMT (stmt->select.where_value));
-                where_val_int = atoi (temp);
-                where_val_ptr = &where_val_int;
+                build->full =
+                    !index_build_copy_row (build, key, key_len, val, val_len);
+                copied += key_len + val_len;
+                stop = build->full || copied >= step;
             }
-            else
+            if (!stop)
             {
-                where_val_str = stmt->select.where_value;
-                where_val_ptr = &where_val_str;
+                btree_cursor_next (&c);
             }
         }
+        pager_unpin_to (db->pager, mark);
+    }
 
-        Table *join_l_t = NULL;
-        int join_l_idx = -1;
-        Table *join_r_t = NULL;
-        int join_r_idx = -1;
-        if (stmt->select.has_join)
-        {
-            if (resolve_column (t1, t2, stmt->select.left_join_col, &join_l_t,
-                                &join_l_idx)
-                == -1)
-                return EXECUTE_COL_NOT_FOUND;
-            if (resolve_column (t1, t2, stmt->select.right_join_col, &join_r_t,
-                                &join_r_idx)
-                == -1)
-                return EXECUTE_COL_NOT_FOUND;
-        }
+    if (build->full && build->row_count == 0)
+    {
+        return EXECUTE_FAIL; // not even one row, the row array did not grow
+    }
+    if (build->row_count > 0)
+    {
+        BatchEntry *last = &build->rows[build->row_count - 1];
+        memcpy (build->resume, last->key, last->key_len);
+        build->resume_len = last->key_len;
+    }
+    build->scanned = !stop;
+    return EXECUTE_SUCCESS;
+}
 
-        SlottedPageHeader *h1 = (SlottedPageHeader *) pager_get_page (
-            db->global_arena, db->pager, t1->root_page_num);
-        Slot *slots1 = (Slot *) ((uint8_t *) h1 + sizeof (SlottedPageHeader));
-        SlottedPageHeader *h2 = NULL;
-        Slot *slots2 = NULL;
-        if (t2)
-        {
-            h2 = (SlottedPageHeader *) pager_get_page (
-                db->global_arena, db->pager, t2->root_page_num);
-            slots2 = (Slot *) ((uint8_t *) h2 + sizeof (SlottedPageHeader));
-        }
+/**
+ * index_build_sort - extracts and sorts the entries of a batch, one thread
+ * per run, then merges the runs pairwise in parallel
+ *
+ * Only reads the copied rows, the pager is not used.
+ */
+static void index_build_sort (IndexBuild *build)
+{
+    pthread_t threads[BUILD_MAX_THREADS];
+    bool started[BUILD_MAX_THREADS] = {0};
 
-        for (int i = 0; i < h1->num_cells; i++)
+    for (int r = 1; r < build->run_count; r++)
+    {
+        started[r] = pthread_create (&threads[r], NULL, index_build_run,
+                                     &build->runs[r])
+                     == 0;
+    }
+    for (int r = 0; r < build->run_count; r++)
+    {
+        if (started[r])
         {
-            if (slots1[i].size == 0)
-                continue;
-            void *key1, *val1;
-            uint32_t klen1, vlen1;
-            slot_get_content (h1, i, &key1, &klen1, &val1, &vlen1);
-
-            if (stmt->select.has_where && where_table == t1)
-            {
-                if (!row_matches_predicate (t1, val1, where_col_idx,
-                                            where_val_ptr))
-                    continue;
-            }
-
-            Temp_Arena_Memory outer_scratch =
-                temp_arena_memory_begin (&local_arena);
-
-            str8 t1_vals[MAX_COLUMNS];
-            deserialize_row_to_strings (t1, val1, t1_vals, &local_arena);
-            int loop_count = (t2) ? h2->num_cells : 1;
+            pthread_join (threads[r], NULL);
+        }
+        else
+        {
+            index_build_run (&build->runs[r]);
+        }
+    }
 
-            for (int j = 0; j < loop_count; j++)
-            {
-                Temp_Arena_Memory inner_scratch =
-                    temp_arena_memory_begin (&local_arena);
-                str8 *t2_vals = NULL;
+    // a partial index skips rows, close the gaps the runs left
+    int entry_count = 0;
+    for (int r = 0; r < build->run_count; r++)
+    {
+        IndexRun *run = &build->runs[r];
+        memmove (build->entries + entry_count, run->entries,
+                 run->entry_count * sizeof (BatchEntry));
+        build->bounds[r] = entry_count;
+        entry_count += run->entry_count;
+    }
+    build->bounds[build->run_count] = entry_count;
+    build->entry_count = entry_count;
 
-                if (t2)
-                {
-                    if (slots2[j].size == 0)
-                    {
-                        temp_arena_memory_end (inner_scratch);
-                        continue;
-                    }
-                    void *key2, *val2;
-                    uint32_t klen2, vlen2;
-                    slot_get_content (h2, j, &key2, &klen2, &val2, &vlen2);
-
-                    if (stmt->select.has_where && where_table == t2)
-                    {
-                        if (!row_matches_predicate (t2, val2, where_col_idx,
-                                                    where_val_ptr))
-                        {
-                            temp_arena_memory_end (inner_scratch);
-                            continue;
-                        }
-                    }
-                    t2_vals = push_array_zero (&local_arena, str8, MAX_COLUMNS);
-                    deserialize_row_to_strings (t2, val2, t2_vals,
-                                                &local_arena);
-
-                    if (stmt->select.has_join)
-                    {
-                        str8 val_l = (join_l_t == t1) ? t1_vals[join_l_idx]
-                                                      : t2_vals[join_l_idx];
-                        str8 val_r = (join_r_t == t1) ? t1_vals[join_r_idx]
-                                                      : t2_vals[join_r_idx];
-                        if (!str8_match (val_l, val_r, false))
-                        {
-                            temp_arena_memory_end (inner_scratch);
-                            continue;
-                        }
-                    }
-                }
+    if (build->run_count > 0 && build->runs[0].idx->method == INDEX_BTREE)
+    {
+        build->entries = batch_merge_runs (build->entries, build->tmp,
+                                           build->bounds, build->run_count);
+    }
+}
 
-                char buffer[4096];
-                int b = 0;
-                b += snprintf (buffer + b, sizeof (buffer) - b, "(");
+/**
+ * run_write - appends a cell to a run of temporary pages chained through
+ * next_leaf like the leaves of a btree, a sorted run or a side log
+ *
+ * Return: false if the cell does not fit a page or the database is out of
+ * pages
+ */
+static bool run_write (Database *db, RunWriter *w, void *key,
+                       uint32_t key_len, void *val, uint32_t val_len)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    if (w->tail != 0
+        && pager_slotted_insert (pager_get_page (db->pager, w->tail), key,
+                                 key_len, val, val_len))
+    {
+        pager_mark_dirty (db->pager, w->tail);
+        pager_unpin_to (db->pager, mark);
+        return true;
+    }
 
-                for (int k = 0; k < output_count; k++)
-                {
-                    if (b >= sizeof (buffer) - 10)
-                        break;
-
-                    ColMap map = output_cols[k];
-                    str8 val =
-                        (map.t == t1) ? t1_vals[map.idx] : t2_vals[map.idx];
-                    bool is_text = map.t->columns[map.idx].type == TYPE_TEXT;
-
-                    if (k > 0)
-                        b += snprintf (buffer + b, sizeof (buffer) - b, ", ");
-                    if (is_text)
-                        b += snprintf (buffer + b, sizeof (buffer) - b,
-                                       "\"%.*s\"", STR_FMT (val));
-                    else
-                        b += snprintf (buffer + b, sizeof (buffer) - b, "%.*s",
-                                       STR_FMT (val));
-                }
+    uint32_t page_num = pager_allocate_page (db->pager);
+    if (page_num == 0)
+    {
+        pager_unpin_to (db->pager, mark);
+        return false;
+    }
+    void *node = pager_get_page (db->pager, page_num);
+    initialize_leaf_node (node);
+    if (!pager_slotted_insert (node, key, key_len, val, val_len))
+    {
+        pager_unpin_to (db->pager, mark);
+        pager_free_page (db->pager, page_num);
+        return false;
+    }
+    pager_mark_dirty (db->pager, page_num);
 
-                if (b < sizeof (buffer) - 2)
-                    b += snprintf (buffer + b, sizeof (buffer) - b, ")\n");
-                else
-                {
-                    buffer[sizeof (buffer) - 2] = ')';
-                    buffer[sizeof (buffer) - 1] = '\n';
-                }
+    if (w->tail != 0)
+    {
+        SlottedPageHeader *tail =
+            (SlottedPageHeader *) pager_get_page (db->pager, w->tail);
+        tail->next_leaf = page_num;
+        pager_mark_dirty (db->pager, w->tail);
+    }
+    else
+    {
+        w->head = page_num;
+    }
+    w->tail = page_num;
+    pager_unpin_to (db->pager, mark);
+    return true;
+}
 
-                if (send (client_fd, buffer, b, MSG_NOSIGNAL) == -1)
-                {
-                    temp_arena_memory_end (inner_scratch);
-                    temp_arena_memory_end (outer_scratch);
-                    return EXECUTE_SUCCESS;
-                }
+// gives the pages of a run from page_num on back to the free list
+static void run_free (Database *db, uint32_t page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    while (page_num != 0)
+    {
+        SlottedPageHeader *header =
+            (SlottedPageHeader *) pager_get_page (db->pager, page_num);
+        uint32_t next = header->next_leaf;
+        pager_unpin_to (db->pager, mark);
+        pager_free_page (db->pager, page_num);
+        page_num = next;
+    }
+}
 
-                temp_arena_memory_end (inner_scratch);
-            }
-            temp_arena_memory_end (outer_scratch);
+/**
+ * run_reader_load - copies the entry a reader is on, a page that is done is
+ * freed and the reader goes on to the next one
+ */
+static void run_reader_load (Database *db, RunReader *r)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    while (r->page_num != 0)
+    {
+        void *node = pager_get_page (db->pager, r->page_num);
+        SlottedPageHeader *header = (SlottedPageHeader *) node;
+        if (r->cell < header->num_cells)
+        {
+            void *key, *val;
+            slot_get_content (node, r->cell, &key, &r->key_len, &val,
+                              &r->val_len);
+            memcpy (r->copy, key, r->key_len);
+            memcpy (r->copy + r->key_len, val, r->val_len);
+            break;
         }
-    }
 
-    return EXECUTE_SUCCESS;
+        uint32_t next = header->next_leaf;
+        pager_unpin_to (db->pager, mark);
+        pager_free_page (db->pager, r->page_num);
+        r->page_num = next;
+        r->cell = 0;
+    }
+    pager_unpin_to (db->pager, mark);
 }
 
-static ExecuteResult execute_delete (Statement *stmt, Database *db)
+/**
+ * index_merge - merges sorted runs into one run, or into the index
+ * @heads: first pages of the runs, set to 0 as the merge takes them over
+ * @out: the run to write, NULL to add the entries to @b
+ *
+ * A reader holds a copy of its entry and no pin, since the pins of a thread
+ * are released in the order they were taken. The pages of the runs are
+ * freed as they are read, the rest once the merge fails.
+ */
+static ExecuteResult index_merge (Database *db, uint32_t *heads, int count,
+                                  RunWriter *out, BTreeBuilder *b)
 {
-    unsigned char local_buffer[PAGE_SIZE];
-    Arena local_arena;
-    arena_init (&local_arena, local_buffer, sizeof (local_buffer));
-
-    Table *t = db_find_table (db, stmt->delete.table_name);
-    if (!t)
+    RunReader *readers = malloc (count * sizeof (RunReader));
+    if (!readers)
     {
-        return EXECUTE_TABLE_NOT_EXISTS;
+        return EXECUTE_FAIL;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        readers[i].page_num = heads[i];
+        readers[i].cell = 0;
+        heads[i] = 0;
+        run_reader_load (db, &readers[i]);
     }
 
-    int target_col_idx = -1;
-    if (stmt->delete.has_where)
+    ExecuteResult result = EXECUTE_SUCCESS;
+    while (result == EXECUTE_SUCCESS)
     {
-        for (int i = 0; i < t->col_count; i++)
+        RunReader *min = NULL;
+        for (int i = 0; i < count; i++)
         {
-            if (str8_match (t->columns[i].name, stmt->delete.where_col.col_name,
-                            true))
+            RunReader *r = &readers[i];
+            if (r->page_num != 0
+                && (!min
+                    || btree_key_compare (r->copy, r->key_len, min->copy,
+                                          min->key_len)
+                           < 0))
             {
-                target_col_idx = i;
-                break;
+                min = r;
             }
         }
+        if (!min)
+        {
+            break;
+        }
 
-        if (target_col_idx == -1)
+        uint8_t *val = min->copy + min->key_len;
+        bool added = out ? run_write (db, out, min->copy, min->key_len, val,
+                                      min->val_len)
+                         : btree_builder_add (b, min->copy, min->key_len, val,
+                                              min->val_len)
+                               == BTREE_OK;
+        if (!added)
         {
-            return EXECUTE_COL_NOT_FOUND;
+            result = EXECUTE_DB_FULL;
+            break;
         }
+        min->cell++;
+        run_reader_load (db, min);
     }
 
-    void *root_node =
-        pager_get_page (db->global_arena, db->pager, t->root_page_num);
-    SlottedPageHeader *header = (SlottedPageHeader *) root_node;
-    Slot *slots = (Slot *) ((uint8_t *) root_node + sizeof (SlottedPageHeader));
-
-    int32_t target_int_val;
-    str8 target_str_val;
-    void *target_ptr = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        run_free (db, readers[i].page_num);
+    }
+    free (readers);
+    return result;
+}
 
-    if (stmt->delete.has_where)
+/**
+ * index_build_spill - takes the entries of a batch out of memory: a hash
+ * index gets them, a btree index writes them out as a sorted run
+ *
+ * The entries of a btree index built from a single batch stay in memory,
+ * index_build_tree adds them.
+ */
+static ExecuteResult index_build_spill (Database *db, Index *idx,
+                                        IndexBuild *build)
+{
+    if (idx->method == INDEX_HASH)
     {
-        ColumnDef *col = &t->columns[target_col_idx];
-        if (col->type == TYPE_INT)
-        {
-            char temp[32];
-            snprintf (temp, sizeof (temp), "%.*s",
-                      STR_FMT (stmt->delete.where_value));
-            target_int_val = atoi (temp);
-            target_ptr = &target_int_val;
-        }
-        else
+        for (int i = 0; i < build->entry_count; i++)
         {
-            target_str_val = stmt->delete.where_value;
-            target_ptr = &target_str_val;
+            BatchEntry *e = &build->entries[i];
+            if (!index_store_insert (db, idx, e->key, e->key_len, e->val,
+                                     e->val_len))
+            {
+                return EXECUTE_DB_FULL;
+            }
         }
+        build->entry_count = 0;
+        return EXECUTE_SUCCESS;
     }
-
-    int delete_count = 0;
-    int pk_idx = table_find_primary_key_index (t);
-    if (pk_idx == -1)
+    if ((build->scanned && build->spilled_count == 0)
+        || build->entry_count == 0)
     {
-        pk_idx = 0;
+        return EXECUTE_SUCCESS;
     }
 
-    for (int i = 0; i < header->num_cells; i++)
+    if (build->spilled_count == build->spilled_cap)
     {
-        if (slots[i].size == 0)
+        int cap = build->spilled_cap ? 2 * build->spilled_cap : 16;
+        uint32_t *grown = realloc (build->spilled, cap * sizeof (uint32_t));
+        if (!grown)
         {
-            continue;
+            return EXECUTE_FAIL;
         }
+        build->spilled = grown;
+        build->spilled_cap = cap;
+    }
 
-        void *key, *val;
-        uint32_t key_len, val_len;
-        slot_get_content (root_node, i, &key, &key_len, &val, &val_len);
-
-        bool should_delete =
-            !stmt->delete.has_where
-            || row_matches_predicate (t, val, target_col_idx, target_ptr);
-        ;
-
-        if (should_delete)
+    RunWriter w = {0};
+    for (int i = 0; i < build->entry_count; i++)
+    {
+        BatchEntry *e = &build->entries[i];
+        if (!run_write (db, &w, e->key, e->key_len, e->val, e->val_len))
         {
-            Temp_Arena_Memory scratch = temp_arena_memory_begin (&local_arena);
-            str8 row_vals[MAX_COLUMNS];
-            deserialize_row_to_strings (t, val, row_vals, &local_arena);
-
-            for (int idx_i = 0; idx_i < db->index_count; idx_i++)
-            {
-                Index *idx = &db->indexes[idx_i];
-                if (str8_match (idx->table_name, t->table_name, true))
-                {
-                    int idx_col = table_find_col_index (t, idx->col_name);
-                    if (idx_col == -1)
-                    {
-                        continue;
-                    }
-
-                    str8 val_to_remove = row_vals[idx_col];
-                    str8 pk_val = row_vals[pk_idx];
-
-                    void *idx_page = pager_get_page (
-                        db->global_arena, db->pager, idx->root_page_num);
-                    SlottedPageHeader *idx_h = (SlottedPageHeader *) idx_page;
-                    Slot *idx_slots = (Slot *) ((uint8_t *) idx_page
-                                                + sizeof (SlottedPageHeader));
-
-                    for (int k = 0; k < idx_h->num_cells; k++)
-                    {
-                        if (idx_slots[k].size == 0)
-                        {
-                            continue;
-                        }
-
-                        void *ikey, *ival;
-                        uint32_t iklen, ivlen;
-                        slot_get_content (idx_page, k, &ikey, &iklen, &ival,
-                                          &ivlen);
-
-                        if (iklen == val_to_remove.len
-                            && memcmp (ikey, val_to_remove.str, iklen) == 0
-                            && ivlen == pk_val.len
-                            && memcmp (ival, pk_val.str, ivlen) == 0)
-                        {
-                            idx_slots[k].size = 0;
-                            pager_flush (db->pager, idx->root_page_num);
-                            break;
-                        }
-                    }
-                }
-            }
-            temp_arena_memory_end (scratch);
-
-            slots[i].size = 0;
-            slots[i].offset = 0;
-            delete_count++;
+            run_free (db, w.head);
+            return EXECUTE_DB_FULL;
         }
     }
+    build->spilled[build->spilled_count++] = w.head;
+    build->entry_count = 0;
+    return EXECUTE_SUCCESS;
+}
 
-    if (delete_count > 0)
+/**
+ * index_build_merge - merges the runs INDEX_MERGE_WAYS at a time into
+ * longer runs, until one merge into the index is left
+ */
+static ExecuteResult index_build_merge (Database *db, IndexBuild *build,
+                                        BTreeBuilder *b)
+{
+    while (build->spilled_count > INDEX_MERGE_WAYS)
     {
-        pager_flush (db->pager, t->root_page_num);
-    }
+        RunWriter w = {0};
+        ExecuteResult result =
+            index_merge (db, build->spilled, INDEX_MERGE_WAYS, &w, NULL);
+        if (result != EXECUTE_SUCCESS)
+        {
+            run_free (db, w.head);
+            return result;
+        }
 
-    return EXECUTE_SUCCESS;
+        build->spilled_count -= INDEX_MERGE_WAYS;
+        memmove (build->spilled, build->spilled + INDEX_MERGE_WAYS,
+                 build->spilled_count * sizeof (uint32_t));
+        build->spilled[build->spilled_count++] = w.head;
+    }
+    return index_merge (db, build->spilled, build->spilled_count, NULL, b);
 }
 
-static ExecuteResult execute_update (Statement *stmt, Database *db)
+// lets go of the memory of a build and of the runs it did not merge
+static void index_build_free (Database *db, IndexBuild *build)
 {
-    unsigned char local_buffer[131072]; // 128 KB for pending updates
-    Arena local_arena;
-    arena_init (&local_arena, local_buffer, sizeof (local_buffer));
+    for (int i = 0; i < build->spilled_count; i++)
+    {
+        run_free (db, build->spilled[i]);
+    }
+    free (build->spilled);
+    free (build->rows);
+    free (build->backing);
+}
 
-    Table *t = db_find_table (db, stmt->update.table_name);
-    if (!t)
+/**
+ * index_abandon - gives up on an index whose build failed
+ *
+ * Its pages go to the free list. The last index is removed. An earlier slot
+ * may be in use by another concurrent build, so it is only marked invalid.
+ */
+static void index_abandon (Database *db, Index *idx)
+{
+    void *root = pager_get_page (db->pager, idx->root_page_num);
+    if (get_node_type (root) == NODE_HASH_DIRECTORY)
     {
-        return EXECUTE_TABLE_NOT_EXISTS;
+        hash_free_pages (db, idx->root_page_num);
+    }
+    else
+    {
+        btree_free_pages (db, idx->root_page_num);
+    }
+    pager_free_page (db->pager, idx->root_page_num);
+    idx->root_page_num = 0;
+    pager_flush_dirty (db->pager);
+
+    run_free (db, idx->log_head);
+    idx->log_head = 0;
+    idx->log_tail = 0;
+    idx->log_count = 0;
+    bloom_destroy (idx->filter);
+    idx->filter = NULL;
+
+    if (idx == &db->indexes[db->index_count - 1])
+    {
+        db->index_count--;
+    }
+    else
+    {
+        idx->state = INDEX_INVALID;
     }
+}
 
-    int where_col_idx = -1;
-    void *target_ptr = NULL;
-    int32_t target_int_val;
-    str8 target_str_val;
+/**
+ * index_build_tree - builds a btree index bottom up, from the entries in
+ * memory or by merging the runs written out
+ *
+ * A hash index got its entries batch by batch.
+ */
+static ExecuteResult index_build_tree (Database *db, Index *idx,
+                                       IndexBuild *build)
+{
+    if (idx->method != INDEX_BTREE)
+    {
+        return EXECUTE_SUCCESS;
+    }
 
-    if (stmt->update.has_where)
+    BTreeBuilder b;
+    btree_builder_init (&b, db, idx->root_page_num, idx->fill_factor);
+    if (build->spilled_count > 0)
     {
-        for (int i = 0; i < t->col_count; i++)
+        return index_build_merge (db, build, &b);
+    }
+    for (int i = 0; i < build->entry_count; i++)
+    {
+        BatchEntry *e = &build->entries[i];
+        if (btree_builder_add (&b, e->key, e->key_len, e->val, e->val_len)
+            != BTREE_OK)
         {
-            if (str8_match (t->columns[i].name, stmt->update.where_col.col_name,
-                            true))
-            {
-                where_col_idx = i;
-                break;
-            }
+            return EXECUTE_DB_FULL;
         }
+    }
+    return EXECUTE_SUCCESS;
+}
 
-        if (where_col_idx == -1)
-            return EXECUTE_COL_NOT_FOUND;
+/**
+ * index_log_replay - applies the side log of an index to it and empties
+ * the log
+ *
+ * Called with db->lock held, writers append to the log only under the
+ * exclusive lock. The build may have seen a change already: an insert
+ * then finds its entry and a delete finds none, which leaves the index as
+ * the change did, and later changes of the same entry follow in the log.
+ *
+ * Return: false if the database is out of pages
+ */
+static bool index_log_replay (Database *db, Index *idx)
+{
+    RunReader r = {idx->log_head, 0};
+    idx->log_head = 0;
+    idx->log_tail = 0;
+    idx->log_count = 0;
+
+    bool replayed = true;
+    for (run_reader_load (db, &r); replayed && r.page_num != 0;
+         run_reader_load (db, &r))
+    {
+        IndexLogRecord rec;
+        memcpy (&rec, r.copy, sizeof (rec));
+        uint8_t *entry = r.copy + sizeof (rec);
+        uint32_t prefix_len = r.key_len - sizeof (rec);
+        uint32_t key_len = prefix_len + rec.pk_len;
 
-        if (t->columns[where_col_idx].type == TYPE_INT)
+        if (rec.is_delete)
         {
-            char temp_buf[32];
-            snprintf (temp_buf, 32, "%.*s", STR_FMT (stmt->update.where_value));
-            target_int_val = atoi (temp_buf);
-            target_ptr = &target_int_val;
+            index_store_delete (db, idx, entry, key_len, rec.pk_len);
         }
         else
         {
-            target_str_val = stmt->update.where_value;
-            target_ptr = &target_str_val;
+            replayed = index_store_insert (db, idx, entry, key_len,
+                                           entry + prefix_len, r.val_len);
         }
+        r.cell++;
     }
+    run_free (db, r.page_num);
+    return replayed;
+}
 
-    int assign_idxs[MAX_COLUMNS];
-    for (int j = 0; j < stmt->update.assign_col_count; j++)
+/**
+ * execute_create_index - builds an index over the rows of a table
+ *
+ * The rows are copied in batches of bounded size. One thread per range of
+ * a batch extracts and sorts the (key, pk) entries and the ranges are
+ * merged. A table larger than one batch has each batch written out as a
+ * sorted run, the runs are merged INDEX_MERGE_WAYS at a time, so memory
+ * stays at INDEX_BUILD_MEMORY whatever the size of the table. The index is
+ * built bottom up with its nodes filled to the index's fill factor.
+ *
+ * Called with db->lock held exclusive. CONCURRENTLY registers the index and
+ * releases the lock, writers then record their index changes in its side
+ * log. Rows are copied holding the lock shared for INDEX_SCAN_STEP bytes at
+ * a time, which leaves the table to writers in between. The entries are
+ * sorted, written out and merged into the index without the lock, no one
+ * else uses the index or its runs. The side log is replayed under the
+ * shared lock until little is left, then the last of it under the
+ * exclusive lock, which the index becomes ready under. The index is used by
+ * reads only once it is ready.
+ */
+static ExecuteResult execute_create_index (Statement *stmt, Database *db)
+{
+    Table *t = db_find_table (db, stmt->create_index.table_name);
+    if (!t)
     {
-        assign_idxs[j] = -1;
-        for (int i = 0; i < t->col_count; i++)
-        {
-            if (str8_match (t->columns[i].name,
-                            stmt->update.assignments[j].col_name, true))
-            {
-                assign_idxs[j] = i;
-                break;
-            }
-        }
-        if (assign_idxs[j] == -1)
-        {
-            return EXECUTE_COL_NOT_FOUND;
-        }
+        return EXECUTE_TABLE_EXISTS;
     }
 
-    void *root_node =
-        pager_get_page (db->global_arena, db->pager, t->root_page_num);
-    SlottedPageHeader *header = (SlottedPageHeader *) root_node;
-    Slot *slots = (Slot *) ((uint8_t *) root_node + sizeof (SlottedPageHeader));
-
-    typedef struct
+    // key columns then included columns, each column at most once
+    CreateIndexStmt *ci = &stmt->create_index;
+    str8 names[MAX_INDEX_COLUMNS + MAX_COLUMNS];
+    int name_count = 0;
+    for (int i = 0; i < ci->col_count; i++)
     {
-        uint8_t *data;
-        uint32_t len;
-
-        uint32_t key_val_int;
-        void *key_ptr;
-        uint32_t key_len;
-    } PendingRows;
-
-    PendingRows *pending_inserts =
-        push_array_no_zero (&local_arena, PendingRows, 100);
-    int pending_count = 0;
-    int updated_count = 0;
-
-    int pk_idx = table_find_primary_key_index (t);
-    if (pk_idx == -1)
+        names[name_count++] = ci->col_names[i];
+    }
+    for (int i = 0; i < ci->include_count; i++)
     {
-        pk_idx = 0;
+        names[name_count++] = ci->include_names[i];
     }
 
-    for (int i = 0; i < header->num_cells; i++)
+    for (int i = 0; i < name_count; i++)
     {
-        if (slots[i].size == 0)
+        if (table_find_col_index (t, names[i]) == -1)
         {
-            continue;
+            return EXECUTE_COL_NOT_FOUND;
         }
-
-        void *key, *val;
-        uint32_t key_len, val_len;
-        slot_get_content (root_node, i, &key, &key_len, &val, &val_len);
-
-        bool match =
-            !stmt->update.has_where
-            || row_matches_predicate (t, val, where_col_idx, target_ptr);
-
-        if (match)
+        for (int j = 0; j < i; j++)
         {
-            Temp_Arena_Memory row_scratch =
-                temp_arena_memory_begin (&local_arena);
-            str8 row_values[MAX_COLUMNS];
-            deserialize_row_to_strings (t, val, row_values, &local_arena);
-
-            for (int idx_i = 0; idx_i < db->index_count; idx_i++)
+            if (str8_match (names[i], names[j], true))
             {
-                Index *idx = &db->indexes[idx_i];
-                if (!str8_match (idx->table_name, t->table_name, true))
-                {
-                    continue;
-                }
-
-                int idx_col = table_find_col_index (t, idx->col_name);
+                return EXECUTE_INVALID_VALUE;
+            }
+        }
+    }
+    WherePred preds[MAX_WHERE_CONDS];
+    ExecuteResult resolved = where_resolve (t, NULL, &ci->where, preds);
+    if (resolved != EXECUTE_SUCCESS)
+    {
+        return resolved;
+    }
 
-                int assign_entry = -1;
-                for (int a = 0; a < stmt->update.assign_col_count; a++)
-                {
-                    if (assign_idxs[a] == idx_col)
-                    {
-                        assign_entry = a;
-                        break;
-                    }
-                }
+    if (db->index_count >= MAX_INDEXES)
+    {
+        return EXECUTE_DB_FULL;
+    }
 
-                if (assign_entry != -1)
-                {
-                    str8 old_val = row_values[idx_col];
-                    str8 new_val = stmt->update.assignments[assign_entry].value;
-                    str8 pk_val = row_values[pk_idx];
-
-                    void *idx_page = pager_get_page (
-                        db->global_arena, db->pager, idx->root_page_num);
-                    SlottedPageHeader *idx_h = (SlottedPageHeader *) idx_page;
-                    Slot *idx_slots = (Slot *) ((uint8_t *) idx_page
-                                                + sizeof (SlottedPageHeader));
-
-                    for (int k = 0; k < idx_h->num_cells; k++)
-                    {
-                        if (idx_slots[k].size == 0)
-                        {
-                            continue;
-                        }
-                        void *ik, *iv;
-                        uint32_t ikl, ivl;
-                        slot_get_content (idx_page, k, &ik, &ikl, &iv, &ivl);
-                        if (ikl == old_val.len
-                            && memcmp (ik, old_val.str, ikl) == 0
-                            && ivl == pk_val.len
-                            && memcmp (iv, pk_val.str, ivl) == 0)
-                        {
-                            idx_slots[k].size = 0; // Tombstone
-                            break;
-                        }
-                    }
-                    pager_slotted_insert (idx_page, new_val.str, new_val.len,
-                                          pk_val.str, pk_val.len);
-                    pager_flush (db->pager, idx->root_page_num);
-                }
-            }
+    uint32_t root_page_num = pager_allocate_page (db->pager);
+    if (root_page_num == 0)
+    {
+        return EXECUTE_DB_FULL;
+    }
 
-            for (int j = 0; j < stmt->update.assign_col_count; j++)
-            {
-                int col_idx = assign_idxs[j];
-                row_values[col_idx] = stmt->update.assignments[j].value;
-            }
+    Index *idx = &db->indexes[db->index_count++];
+    *idx = (Index) {0};
+    idx->index_name =
+        str8_copy (db->global_arena, stmt->create_index.index_name);
+    idx->table_name =
+        str8_copy (db->global_arena, stmt->create_index.table_name);
+    idx->col_count = ci->col_count;
+    for (int i = 0; i < ci->col_count; i++)
+    {
+        idx->col_names[i] = str8_copy (db->global_arena, ci->col_names[i]);
+    }
+    idx->include_count = ci->include_count;
+    for (int i = 0; i < ci->include_count; i++)
+    {
+        idx->include_names[i] =
+            str8_copy (db->global_arena, ci->include_names[i]);
+    }
+    idx->where.count = ci->where.count;
+    for (int i = 0; i < ci->where.count; i++)
+    {
+        WhereCond *cond = &idx->where.conds[i];
+        cond->col.table_name =
+            str8_copy (db->global_arena, ci->where.conds[i].col.table_name);
+        cond->col.col_name =
+            str8_copy (db->global_arena, ci->where.conds[i].col.col_name);
+        cond->value = str8_copy (db->global_arena, ci->where.conds[i].value);
+    }
+    idx->root_page_num = root_page_num;
+    idx->method = stmt->create_index.method;
+    idx->fill_factor = stmt->create_index.fill_factor
+                           ? stmt->create_index.fill_factor
+                           : BTREE_DEFAULT_FILL_FACTOR;
+    idx->state = INDEX_BUILDING;
+
+    void *idx_root = pager_get_page (db->pager, idx->root_page_num);
+    initialize_leaf_node (idx_root);
+    set_node_root (idx_root, 1);
+    pager_mark_dirty (db->pager, idx->root_page_num);
 
-            uint8_t *new_row_buf =
-                push_array_zero (&local_arena, uint8_t, PAGE_SIZE);
-            if (!new_row_buf)
-                return EXECUTE_DB_FULL; // buffer full
+    if (idx->method == INDEX_HASH
+        && hash_init (db, idx->root_page_num) != HASH_OK)
+    {
+        index_abandon (db, idx);
+        return EXECUTE_DB_FULL;
+    }
 
-            uint32_t new_size = serialize_row (t, row_values, new_row_buf);
+    IndexBuild build = {0};
+    build.backing = malloc (INDEX_BUILD_MEMORY);
+    if (!build.backing)
+    {
+        index_abandon (db, idx);
+        return EXECUTE_FAIL;
+    }
+    arena_init (&build.arena, build.backing, INDEX_BUILD_MEMORY);
 
-            uint32_t cell_header_size = sizeof (uint32_t) + key_len;
-            uint32_t total_new_size = cell_header_size + new_size;
+    // from here on writers log their changes instead
+    bool concurrently = stmt->create_index.concurrently;
+    if (concurrently)
+    {
+        pthread_rwlock_unlock (&db->lock);
+    }
 
-            if (total_new_size <= slots[i].size)
+    ExecuteResult result = EXECUTE_SUCCESS;
+    while (result == EXECUTE_SUCCESS && !build.scanned)
+    {
+        index_build_reset (&build);
+        do
+        {
+            if (concurrently)
             {
-                uint8_t *dest =
-                    (uint8_t *) root_node + slots[i].offset + cell_header_size;
-                memcpy (dest, new_row_buf, new_size);
-                slots[i].size = total_new_size;
-
-                temp_arena_memory_end (row_scratch);
+                pthread_rwlock_rdlock (&db->lock);
             }
-            else
+            result = index_build_scan (db, t, &build,
+                                       concurrently ? INDEX_SCAN_STEP
+                                                    : SIZE_MAX);
+            if (concurrently)
             {
-                slots[i].size = 0;
-                if (pending_count < 100)
-                {
-                    pending_inserts[pending_count].data = new_row_buf;
-                    pending_inserts[pending_count].len = new_size;
-                    if (t->columns[pk_idx].type == TYPE_INT)
-                    {
-                        char temp[32];
-                        snprintf (temp, 32, "%.*s",
-                                  STR_FMT (row_values[pk_idx]));
-                        pending_inserts[pending_count].key_val_int =
-                            atoi (temp);
-                        pending_inserts[pending_count].key_ptr =
-                            &pending_inserts[pending_count].key_val_int;
-                        pending_inserts[pending_count].key_len = 4;
-                    }
-                    else
-                    {
-                        pending_inserts[pending_count].key_ptr =
-                            row_values[pk_idx].str;
-                        pending_inserts[pending_count].key_len =
-                            row_values[pk_idx].len;
-                    }
-                    pending_count++;
-                }
-                else
-                {
-                    temp_arena_memory_end (row_scratch);
-                }
+                pthread_rwlock_unlock (&db->lock);
             }
-            updated_count++;
+        } while (result == EXECUTE_SUCCESS && !build.full && !build.scanned);
+
+        if (result == EXECUTE_SUCCESS)
+        {
+            index_build_plan (t, idx, &build);
+            index_build_sort (&build);
+            result = index_build_spill (db, idx, &build);
         }
     }
-
-    if (updated_count > 0)
+    if (result == EXECUTE_SUCCESS)
     {
-        pager_flush (db->pager, t->root_page_num);
+        result = index_build_tree (db, idx, &build);
     }
-
-    for (int k = 0; k < pending_count; k++)
+    if (concurrently)
     {
-        pager_slotted_insert (root_node, pending_inserts[k].key_ptr,
-                              pending_inserts[k].key_len,
-                              pending_inserts[k].data, pending_inserts[k].len);
+        pager_flush_dirty (db->pager); // not while writers wait for the lock
     }
 
-    if (pending_count > 0)
+    // catch up on the side log while writers wait only for a round each,
+    // the exclusive lock is left with the changes of the last round
+    for (int round = 0; concurrently && result == EXECUTE_SUCCESS
+                        && round < INDEX_CATCH_UP_ROUNDS;
+         round++)
     {
-        pager_flush (db->pager, t->root_page_num);
+        pthread_rwlock_rdlock (&db->lock);
+        bool caught_up = idx->log_count <= INDEX_LOG_CATCH_UP;
+        if (!caught_up && !idx->log_overflow && !index_log_replay (db, idx))
+        {
+            result = EXECUTE_DB_FULL;
+        }
+        pthread_rwlock_unlock (&db->lock);
+        if (caught_up)
+        {
+            break;
+        }
+    }
+    if (concurrently)
+    {
+        pthread_rwlock_wrlock (&db->lock);
+    }
+
+    if (result == EXECUTE_SUCCESS
+        && (idx->log_overflow || !index_log_replay (db, idx)))
+    {
+        result = EXECUTE_DB_FULL;
+    }
+    if (result == EXECUTE_SUCCESS)
+    {
+        idx->state = INDEX_READY;
+        pager_flush_dirty (db->pager);
+    }
+    else
+    {
+        index_abandon (db, idx);
+    }
+    index_build_free (db, &build);
+    return result;
+}
+
+/**
+ * batch_entry_init - serializes a row and encodes its key
+ * @row: table values, must stay alive as long as the entry
+ *
+ * The key of a row of a heap table is its row ID, set once it is stored.
+ */
+static ExecuteResult batch_entry_init (BatchEntry *e, Table *t, str8 *row,
+                                       int pk_idx, Arena *arena)
+{
+    e->row = row;
+
+    uint32_t row_size = serialize_row_size (t, row);
+    if (row_size > BTREE_MAX_CELL_SIZE)
+    {
+        return EXECUTE_ROW_TOO_LARGE;
+    }
+
+    bool heap = t->organization == TABLE_HEAP;
+    e->val = push_array_no_zero (arena, uint8_t, row_size);
+    e->key = push_array_no_zero (arena, uint8_t,
+                                 heap ? HEAP_ROW_ID_SIZE
+                                      : KEY_ENCODED_MAX (row[pk_idx].len));
+    if (!e->val || !e->key)
+    {
+        return EXECUTE_FAIL;
+    }
+
+    e->val_len = serialize_row (t, row, e->val);
+    e->key_len = heap ? HEAP_ROW_ID_SIZE : table_row_key (t, row, e->key);
+
+    if (sizeof (uint32_t) + e->key_len + e->val_len > BTREE_MAX_CELL_SIZE)
+    {
+        return EXECUTE_ROW_TOO_LARGE;
     }
-
     return EXECUTE_SUCCESS;
 }
 
-static bool row_matches_predicate (Table *t, void *row_data, int target_col_idx,
-                                   void *target_val)
+/**
+ * execute_insert - inserts every row of an INSERT as one batch
+ */
+static ExecuteResult execute_insert (Statement *stmt, Database *db,
+                                     Arena *arena)
 {
-    uint8_t *ptr = (uint8_t *) row_data;
+    Table *t = db_find_table (db, stmt->insert.table_name);
+    if (!t)
+    {
+        return EXECUTE_TABLE_NOT_EXISTS;
+    }
 
-    for (int i = 0; i < t->col_count; i++)
+    if (stmt->insert.val_count != t->col_count)
     {
-        ColumnDef *col = &t->columns[i];
+        return EXECUTE_TABLE_COL_COUNT_MISMATCH;
+    }
 
-        if (i == target_col_idx)
+    int pk_idx = table_find_primary_key_index (t);
+    if (pk_idx == -1)
+    {
+        pk_idx = 0; // if pk table has no pk, pk=first column;
+    }
+
+    int row_count = stmt->insert.row_count;
+    BatchEntry *batch = push_array_no_zero (arena, BatchEntry, row_count);
+    if (!batch)
+    {
+        return EXECUTE_FAIL;
+    }
+
+    for (int r = 0; r < row_count; r++)
+    {
+        str8 *row = stmt->insert.values + (r * t->col_count);
+        ExecuteResult res = batch_entry_init (&batch[r], t, row, pk_idx, arena);
+        if (res != EXECUTE_SUCCESS)
         {
-            if (col->type == TYPE_INT)
+            return res;
+        }
+    }
+
+    if (t->organization == TABLE_BTREE)
+    {
+        qsort (batch, row_count, sizeof (BatchEntry), batch_entry_compare);
+    }
+    return table_insert_batch (db, t, batch, row_count, arena);
+}
+
+/**
+ * table_insert_batch - inserts rows sorted by key into a table and its
+ * indexes
+ * @arena: scratch space for the index entries
+ *
+ * Duplicates inside the batch are neighbours and the existing keys are
+ * checked in one forward pass over the tree, UNIQUE columns through their
+ * index. Keys missing from the filter of the table are not looked up.
+ * Nothing is written if any key or UNIQUE value is a duplicate, a key that
+ * another statement inserts after the check makes the batch take back its
+ * rows. An empty tree is built bottom up, otherwise rows and index entries
+ * are inserted in key order. Every page they touched is flushed once.
+ *
+ * The rows of a heap table are in no order and have no key to check, they
+ * get their row IDs as they are stored.
+ */
+static ExecuteResult table_insert_batch (Database *db, Table *t,
+                                         BatchEntry *batch, int row_count,
+                                         Arena *arena)
+{
+    if (row_count == 0)
+    {
+        return EXECUTE_SUCCESS;
+    }
+
+    for (int r = 1; t->organization == TABLE_BTREE && r < row_count; r++)
+    {
+        if (batch_entry_compare (&batch[r - 1], &batch[r]) == 0)
+        {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+    }
+
+    ExecuteResult unique = unique_check_batch (db, t, batch, row_count, arena);
+    if (unique != EXECUTE_SUCCESS)
+    {
+        return unique;
+    }
+
+    if (t->organization == TABLE_HEAP)
+    {
+        for (int r = 0; r < row_count; r++)
+        {
+            if (!table_store_row (db, t, &batch[r]))
             {
-                int32_t row_int;
-                memcpy (&row_int, ptr, sizeof (int32_t));
+                // out of pages, take back the rows stored so far
+                batch_rollback (db, t, batch, r, 0);
+                pager_flush_dirty (db->pager);
+                return EXECUTE_TABLE_FULL;
+            }
+        }
+        return index_insert_batch (db, t, batch, row_count, arena);
+    }
 
-                int32_t target_int = *(int32_t *) target_val;
-                return row_int == target_int;
+    BTreeBuilder b;
+    if (btree_builder_begin (&b, db, t->root_page_num,
+                             BTREE_DEFAULT_FILL_FACTOR))
+    {
+        for (int r = 0; r < row_count; r++)
+        {
+            BatchEntry *e = &batch[r];
+            if (btree_builder_add (&b, e->key, e->key_len, e->val, e->val_len)
+                != BTREE_OK)
+            {
+                // out of pages, start over from an empty root
+                tree_reset (db, t->root_page_num);
+                btree_builder_end (&b);
+                pager_flush_dirty (db->pager);
+                return EXECUTE_TABLE_FULL;
             }
-            else if (col->type == TYPE_TEXT)
+        }
+        btree_builder_end (&b);
+
+        for (int r = 0; r < row_count; r++)
+        {
+            table_filter_add (db, t, batch[r].key, batch[r].key_len);
+        }
+        return index_insert_batch (db, t, batch, row_count, arena);
+    }
+
+    // only keys the filter may have seen are looked up
+    uint32_t mark = pager_pin_mark (db->pager);
+    BTreeCursor c = {db, 0, NULL, 0}; // the first seek descends
+    for (int r = 0; r < row_count; r++)
+    {
+        if (!table_may_contain (db, t, batch[r].key, batch[r].key_len))
+        {
+            continue;
+        }
+
+        btree_cursor_seek_forward (&c, t->root_page_num, batch[r].key,
+                                   batch[r].key_len);
+        if (!btree_cursor_valid (&c))
+        {
+            break; // every remaining key is past the end of the tree
+        }
+
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (&c, &key, &key_len, &val, &val_len);
+        if (btree_key_compare (key, key_len, batch[r].key, batch[r].key_len)
+            == 0)
+        {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+    }
+
+    pager_unpin_to (db->pager, mark);
+
+    // another statement may have taken a key since it was checked
+    for (int r = 0; r < row_count; r++)
+    {
+        BatchEntry *e = &batch[r];
+        BTreeResult res = btree_insert (db, t->root_page_num, e->key,
+                                        e->key_len, e->val, e->val_len);
+        if (res != BTREE_OK)
+        {
+            // take back the rows inserted so far
+            batch_rollback (db, t, batch, r, 0);
+            pager_flush_dirty (db->pager);
+            return res == BTREE_DUPLICATE ? EXECUTE_DUPLICATE_KEY
+                                          : EXECUTE_TABLE_FULL;
+        }
+        table_filter_add (db, t, e->key, e->key_len);
+    }
+
+    return index_insert_batch (db, t, batch, row_count, arena);
+}
+
+/**
+ * tree_reset - frees the pages of a btree and leaves an empty leaf root,
+ * e.g. after a bottom up build ran out of pages
+ */
+static void tree_reset (Database *db, uint32_t root_page_num)
+{
+    btree_free_pages (db, root_page_num);
+    void *root = pager_get_page (db->pager, root_page_num);
+    initialize_leaf_node (root);
+    set_node_root (root, 1);
+    pager_mark_dirty (db->pager, root_page_num);
+}
+
+/**
+ * batch_rollback - takes back a batch that could not be stored whole: its
+ * entries in the indexes of the table before @index_end, then its rows
+ *
+ * Entries and rows that were never stored are not found and skipped.
+ */
+static void batch_rollback (Database *db, Table *t, BatchEntry *batch,
+                            int row_count, int index_end)
+{
+    for (int i = 0; i < index_end; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (!str8_match (idx->table_name, t->table_name, true))
+        {
+            continue;
+        }
+        for (int r = 0; r < row_count; r++)
+        {
+            index_delete_row (db, t, idx, batch[r].row,
+                              (str8) {batch[r].key, batch[r].key_len});
+        }
+    }
+
+    for (int r = 0; r < row_count; r++)
+    {
+        if (t->organization == TABLE_HEAP)
+        {
+            heap_delete (db, t->root_page_num, batch[r].key);
+        }
+        else
+        {
+            btree_delete (db, t->root_page_num, batch[r].key,
+                          batch[r].key_len);
+        }
+    }
+    table_reclaim (db, t);
+}
+
+/**
+ * index_store_batch - adds sorted entries to a btree index, bottom up if
+ * it is empty
+ *
+ * A build that runs out of pages leaves the index empty again, inserts
+ * are taken back by the caller.
+ *
+ * Return: EXECUTE_TABLE_FULL if the database is out of pages
+ */
+static ExecuteResult index_store_batch (Database *db, Index *idx,
+                                        BatchEntry *entries, int entry_count)
+{
+    BTreeBuilder b;
+    if (btree_builder_begin (&b, db, idx->root_page_num, idx->fill_factor))
+    {
+        ExecuteResult result = EXECUTE_SUCCESS;
+        for (int r = 0; result == EXECUTE_SUCCESS && r < entry_count; r++)
+        {
+            if (btree_builder_add (&b, entries[r].key, entries[r].key_len,
+                                   entries[r].val, entries[r].val_len)
+                != BTREE_OK)
             {
-                uint32_t len;
-                memcpy (&len, ptr, sizeof (uint32_t));
-                ptr += sizeof (uint32_t);
+                tree_reset (db, idx->root_page_num);
+                result = EXECUTE_TABLE_FULL;
+            }
+        }
+        btree_builder_end (&b);
+        return result;
+    }
 
-                str8 *target_str = (str8 *) target_val;
-                if (len != target_str->len)
+    for (int r = 0; r < entry_count; r++)
+    {
+        if (btree_insert (db, idx->root_page_num, entries[r].key,
+                          entries[r].key_len, entries[r].val,
+                          entries[r].val_len)
+            != BTREE_OK)
+        {
+            return EXECUTE_TABLE_FULL;
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * index_insert_batch - adds the rows of a batch to every index of the table,
+ * then flushes
+ *
+ * The rows are already stored. If an index runs out of pages the entries
+ * and the rows of the batch are taken back, like a table that runs out.
+ *
+ * Return: EXECUTE_TABLE_FULL if the database is out of pages
+ */
+static ExecuteResult index_insert_batch (Database *db, Table *t,
+                                         BatchEntry *batch, int row_count,
+                                         Arena *arena)
+{
+    ExecuteResult result = EXECUTE_SUCCESS;
+    int i;
+    for (i = 0; result == EXECUTE_SUCCESS && i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (!str8_match (idx->table_name, t->table_name, true)
+            || idx->state == INDEX_INVALID)
+        {
+            continue;
+        }
+
+        // a hash index gains nothing from sorted entries
+        if (idx->state == INDEX_BUILDING || idx->method == INDEX_HASH)
+        {
+            for (int r = 0; result == EXECUTE_SUCCESS && r < row_count; r++)
+            {
+                if (!index_insert_row (db, t, idx, batch[r].row,
+                                       (str8) {batch[r].key,
+                                               batch[r].key_len}))
                 {
-                    return false;
+                    result = EXECUTE_TABLE_FULL;
                 }
+            }
+            continue;
+        }
 
-                return memcmp (ptr, target_str->str, len) == 0;
+        Temp_Arena_Memory scratch = temp_arena_memory_begin (arena);
+        BatchEntry *entries = push_array_no_zero (arena, BatchEntry, row_count);
+        int entry_count = 0;
+        if (!entries)
+        {
+            result = EXECUTE_FAIL;
+        }
+
+        for (int r = 0; result == EXECUTE_SUCCESS && r < row_count; r++)
+        {
+            if (!index_has_row (t, idx, batch[r].row))
+            {
+                continue;
+            }
+
+            uint8_t entry[2 * PAGE_SIZE_MAX];
+            uint32_t key_len, pk_len, val_len;
+            if (!index_encode_entry (t, idx, batch[r].row,
+                                     (str8) {batch[r].key, batch[r].key_len},
+                                     entry, &key_len, &pk_len, &val_len))
+            {
+                result = EXECUTE_FAIL;
+                break;
+            }
+
+            uint32_t entry_len = key_len - pk_len + val_len;
+            BatchEntry *e = &entries[entry_count];
+            e->key = push_array_no_zero (arena, uint8_t, entry_len);
+            if (!e->key)
+            {
+                result = EXECUTE_FAIL;
+                break;
             }
+            memcpy (e->key, entry, entry_len);
+            e->key_len = key_len;
+            e->val = e->key + (key_len - pk_len);
+            e->val_len = val_len;
+            entry_count++;
         }
 
-        if (col->type == TYPE_INT)
+        if (result == EXECUTE_SUCCESS)
         {
-            ptr += sizeof (int32_t);
+            qsort (entries, entry_count, sizeof (BatchEntry),
+                   batch_entry_compare);
+            result = index_store_batch (db, idx, entries, entry_count);
         }
-        else if (col->type == TYPE_TEXT)
+        for (int r = 0; result == EXECUTE_SUCCESS && r < entry_count; r++)
         {
-            uint32_t len;
-            memcpy (&len, ptr, sizeof (uint32_t));
-            ptr += sizeof (uint32_t) + len;
+            index_filter_add (db, t, idx, entries[r].key,
+                              entries[r].key_len);
         }
+
+        temp_arena_memory_end (scratch);
     }
 
-    return false;
+    if (result != EXECUTE_SUCCESS)
+    {
+        batch_rollback (db, t, batch, row_count, i);
+    }
+    pager_flush_dirty (db->pager);
+
+    return result;
+}
+
+static ExecuteResult execute_select (Statement *stmt, Database *db,
+                                     int client_fd)
+{
+    unsigned char local_buffer[PAGE_SIZE_MAX];
+    Arena local_arena;
+    arena_init (&local_arena, local_buffer, sizeof (local_buffer));
+
+    Table *t1 = db_find_table (db, stmt->select.table_name);
+    if (!t1)
+        return EXECUTE_TABLE_NOT_EXISTS;
+
+    Table *t2 = NULL;
+    if (stmt->select.has_join)
+    {
+        t2 = db_find_table (db, stmt->select.join_table);
+        if (!t2)
+            return EXECUTE_TABLE_NOT_EXISTS;
+    }
+
+    ColMap output_cols[MAX_COLUMNS * 2];
+    int output_count = 0;
+
+    if (stmt->select.field_count == 0)
+    {
+        for (int i = 0; i < t1->col_count; i++)
+            output_cols[output_count++] = (ColMap) {t1, i};
+        if (t2)
+            for (int i = 0; i < t2->col_count; i++)
+                output_cols[output_count++] = (ColMap) {t2, i};
+    }
+    else
+    {
+        for (int i = 0; i < stmt->select.field_count; i++)
+        {
+            Table *target_t;
+            int target_idx;
+            if (resolve_column (t1, t2, stmt->select.fields[i], &target_t,
+                                &target_idx)
+                == -1)
+                return EXECUTE_COL_NOT_FOUND;
+            output_cols[output_count++] = (ColMap) {target_t, target_idx};
+        }
+    }
+
+    WherePred preds[MAX_WHERE_CONDS];
+    int pred_count = stmt->select.where.count;
+    ExecuteResult resolved =
+        where_resolve (t1, t2, &stmt->select.where, preds);
+    if (resolved != EXECUTE_SUCCESS)
+    {
+        return resolved;
+    }
+
+    if (pred_count > 0 && !stmt->select.has_join)
+    {
+        uint8_t search_key[WHERE_KEY_MAX];
+        uint32_t search_len;
+        Index *use_index =
+            where_plan (db, t1, preds, pred_count, output_cols, output_count,
+                        search_key, &search_len);
+
+        // WHERE on the key column, descend straight to the row
+        if (!use_index && search_len > 0)
+        {
+            if (!table_may_contain (db, t1, search_key, search_len))
+            {
+                return EXECUTE_SUCCESS;
+            }
+
+            uint8_t rv[BTREE_CELL_BUFFER_SIZE];
+            uint32_t rvl;
+            if (btree_find_key (db, t1->root_page_num, search_key, search_len,
+                                rv, &rvl))
+            {
+                if (!row_matches_where (t1, rv, preds, pred_count))
+                {
+                    return EXECUTE_SUCCESS;
+                }
+
+                str8 row_vals[MAX_COLUMNS];
+                deserialize_row_to_strings (t1, rv, row_vals, &local_arena);
+                send_row (client_fd, output_cols, output_count, t1, row_vals,
+                          NULL);
+            }
+            return EXECUTE_SUCCESS;
+        }
+
+        // every column is in the index entries, the rows are not read
+        if (use_index
+            && index_covers (t1, use_index, output_cols, output_count, preds,
+                             pred_count))
+        {
+            IndexScan is;
+            for (index_scan_begin (db, t1, use_index, search_key, search_len,
+                                   &is);
+                 index_scan_valid (&is); index_scan_next (&is))
+            {
+                Temp_Arena_Memory print_scratch =
+                    temp_arena_memory_begin (&local_arena);
+
+                str8 row_vals[MAX_COLUMNS];
+                index_scan_values (&is, row_vals, &local_arena);
+                if (!values_match_where (t1, row_vals, preds, pred_count))
+                {
+                    temp_arena_memory_end (print_scratch);
+                    continue;
+                }
+
+                bool sent = send_row (client_fd, output_cols, output_count,
+                                      t1, row_vals, NULL);
+                temp_arena_memory_end (print_scratch);
+                if (!sent)
+                {
+                    break;
+                }
+            }
+            return EXECUTE_SUCCESS;
+        }
+
+        if (use_index)
+        {
+            IndexScan is;
+            for (index_scan_begin (db, t1, use_index, search_key, search_len,
+                                   &is);
+                 index_scan_valid (&is); index_scan_next (&is))
+            {
+                index_scan_ahead (db, &is);
+
+                void *iv;
+                uint32_t ivl;
+                index_scan_pk (&is, &iv, &ivl);
+
+                uint8_t rv[BTREE_CELL_BUFFER_SIZE];
+                uint32_t rvl;
+                if (!table_find_row (db, t1, iv, ivl, rv, &rvl)
+                    || !row_matches_where (t1, rv, preds, pred_count))
+                {
+                    continue;
+                }
+
+                Temp_Arena_Memory print_scratch =
+                    temp_arena_memory_begin (&local_arena);
+
+                str8 row_vals[MAX_COLUMNS];
+                deserialize_row_to_strings (t1, rv, row_vals, &local_arena);
+                bool sent = send_row (client_fd, output_cols, output_count,
+                                      t1, row_vals, NULL);
+
+                temp_arena_memory_end (print_scratch);
+                if (!sent)
+                {
+                    break;
+                }
+            }
+            return EXECUTE_SUCCESS;
+        }
+    }
+
+    Table *join_l_t = NULL;
+    int join_l_idx = -1;
+    Table *join_r_t = NULL;
+    int join_r_idx = -1;
+    if (stmt->select.has_join)
+    {
+        if (resolve_column (t1, t2, stmt->select.left_join_col, &join_l_t,
+                            &join_l_idx)
+            == -1)
+            return EXECUTE_COL_NOT_FOUND;
+        if (resolve_column (t1, t2, stmt->select.right_join_col, &join_r_t,
+                            &join_r_idx)
+            == -1)
+            return EXECUTE_COL_NOT_FOUND;
+    }
+
+    BTreeCursor c1;
+    for (table_cursor_first (db, t1, &c1); btree_cursor_valid (&c1);
+         btree_cursor_next (&c1))
+    {
+        void *key1, *val1;
+        uint32_t klen1, vlen1;
+        btree_cursor_get (&c1, &key1, &klen1, &val1, &vlen1);
+
+        if (!row_matches_where (t1, val1, preds, pred_count))
+        {
+            continue;
+        }
+
+        Temp_Arena_Memory outer_scratch =
+            temp_arena_memory_begin (&local_arena);
+
+        str8 t1_vals[MAX_COLUMNS];
+        deserialize_row_to_strings (t1, val1, t1_vals, &local_arena);
+
+        if (!t2)
+        {
+            bool sent = send_row (client_fd, output_cols, output_count, t1,
+                                  t1_vals, NULL);
+            temp_arena_memory_end (outer_scratch);
+            if (!sent)
+                return EXECUTE_SUCCESS;
+            continue;
+        }
+
+        BTreeCursor c2;
+        for (table_cursor_first (db, t2, &c2); btree_cursor_valid (&c2);
+             btree_cursor_next (&c2))
+        {
+            void *key2, *val2;
+            uint32_t klen2, vlen2;
+            btree_cursor_get (&c2, &key2, &klen2, &val2, &vlen2);
+
+            if (!row_matches_where (t2, val2, preds, pred_count))
+            {
+                continue;
+            }
+
+            Temp_Arena_Memory inner_scratch =
+                temp_arena_memory_begin (&local_arena);
+
+            str8 t2_vals[MAX_COLUMNS];
+            deserialize_row_to_strings (t2, val2, t2_vals, &local_arena);
+
+            str8 val_l = (join_l_t == t1) ? t1_vals[join_l_idx]
+                                          : t2_vals[join_l_idx];
+            str8 val_r = (join_r_t == t1) ? t1_vals[join_r_idx]
+                                          : t2_vals[join_r_idx];
+            if (!str8_match (val_l, val_r, false))
+            {
+                temp_arena_memory_end (inner_scratch);
+                continue;
+            }
+
+            bool sent = send_row (client_fd, output_cols, output_count, t1,
+                                  t1_vals, t2_vals);
+            temp_arena_memory_end (inner_scratch);
+            if (!sent)
+            {
+                temp_arena_memory_end (outer_scratch);
+                return EXECUTE_SUCCESS;
+            }
+        }
+        temp_arena_memory_end (outer_scratch);
+    }
+
+    return EXECUTE_SUCCESS;
+}
+
+static ExecuteResult execute_delete (Statement *stmt, Database *db,
+                                     Arena *arena)
+{
+    unsigned char local_buffer[PAGE_SIZE_MAX];
+    Arena local_arena;
+    arena_init (&local_arena, local_buffer, sizeof (local_buffer));
+
+    Table *t = db_find_table (db, stmt->delete.table_name);
+    if (!t)
+    {
+        return EXECUTE_TABLE_NOT_EXISTS;
+    }
+
+    WherePred preds[MAX_WHERE_CONDS];
+    int pred_count = stmt->delete.where.count;
+    ExecuteResult resolved =
+        where_resolve (t, NULL, &stmt->delete.where, preds);
+    if (resolved != EXECUTE_SUCCESS)
+    {
+        return resolved;
+    }
+
+    uint8_t search_key[WHERE_KEY_MAX];
+    str8 key_lookup;
+    int key_count = 0;
+    str8 *keys = where_row_keys (db, t, preds, pred_count, search_key,
+                                 &key_lookup, arena, &key_count);
+
+    RowScan scan;
+    for (row_scan_begin (&scan, db, t, keys, key_count);
+         btree_cursor_valid (&scan.c); row_scan_next (&scan))
+    {
+        BTreeCursor *c = &scan.c;
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (c, &key, &key_len, &val, &val_len);
+
+        if (row_matches_where (t, val, preds, pred_count))
+        {
+            Temp_Arena_Memory scratch = temp_arena_memory_begin (&local_arena);
+            str8 row_vals[MAX_COLUMNS];
+            deserialize_row_to_strings (t, val, row_vals, &local_arena);
+
+            for (int idx_i = 0; idx_i < db->index_count; idx_i++)
+            {
+                Index *idx = &db->indexes[idx_i];
+                if (str8_match (idx->table_name, t->table_name, true))
+                {
+                    index_delete_row (db, t, idx, row_vals,
+                                      (str8) {key, key_len});
+                }
+            }
+            temp_arena_memory_end (scratch);
+
+            if (t->organization == TABLE_HEAP)
+            {
+                heap_delete (db, t->root_page_num, key);
+            }
+            else
+            {
+                btree_cursor_delete (c);
+            }
+        }
+    }
+
+    table_reclaim (db, t);
+    pager_flush_dirty (db->pager);
+
+    return EXECUTE_SUCCESS;
+}
+
+static ExecuteResult execute_update (Statement *stmt, Database *db,
+                                     Arena *arena)
+{
+    Table *t = db_find_table (db, stmt->update.table_name);
+    if (!t)
+    {
+        return EXECUTE_TABLE_NOT_EXISTS;
+    }
+
+    WherePred preds[MAX_WHERE_CONDS];
+    int pred_count = stmt->update.where.count;
+    ExecuteResult resolved =
+        where_resolve (t, NULL, &stmt->update.where, preds);
+    if (resolved != EXECUTE_SUCCESS)
+    {
+        return resolved;
+    }
+
+    int assign_idxs[MAX_COLUMNS];
+    for (int j = 0; j < stmt->update.assign_col_count; j++)
+    {
+        assign_idxs[j] = -1;
+        for (int i = 0; i < t->col_count; i++)
+        {
+            if (str8_match (t->columns[i].name,
+                            stmt->update.assignments[j].col_name, true))
+            {
+                assign_idxs[j] = i;
+                break;
+            }
+        }
+        if (assign_idxs[j] == -1)
+        {
+            return EXECUTE_COL_NOT_FOUND;
+        }
+    }
+
+    int pk_idx = table_find_primary_key_index (t);
+    if (pk_idx == -1)
+    {
+        pk_idx = 0;
+    }
+
+    // rows whose key changes or that outgrow their cell are moved once the
+    // scan is done, so it does not meet them again. They wait as old key and
+    // row in a btree of their own, whose pages the pool can evict, so no
+    // number of rows runs the arena out. A heap row keeps its cell until its
+    // new copy is stored, it has no key another row could take meanwhile
+    uint32_t moved_root = pager_allocate_page (db->pager);
+    if (moved_root == 0)
+    {
+        return EXECUTE_TABLE_FULL;
+    }
+    void *moved_node = pager_get_page (db->pager, moved_root);
+    initialize_leaf_node (moved_node);
+    set_node_root (moved_node, 1);
+    pager_mark_dirty (db->pager, moved_root);
+
+    ExecuteResult failed = EXECUTE_SUCCESS;
+    bool duplicate = false;
+    bool full = false;
+
+    uint8_t search_key[WHERE_KEY_MAX];
+    str8 key_lookup;
+    int key_count = 0;
+    str8 *keys = where_row_keys (db, t, preds, pred_count, search_key,
+                                 &key_lookup, arena, &key_count);
+
+    RowScan scan;
+    for (row_scan_begin (&scan, db, t, keys, key_count);
+         btree_cursor_valid (&scan.c); row_scan_next (&scan))
+    {
+        BTreeCursor *c = &scan.c;
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (c, &key, &key_len, &val, &val_len);
+
+        if (!row_matches_where (t, val, preds, pred_count))
+        {
+            continue;
+        }
+
+        Temp_Arena_Memory row_scratch = temp_arena_memory_begin (arena);
+        str8 *old_values, *new_values;
+        uint8_t *new_row, *new_key;
+        uint32_t new_size, new_key_len;
+        failed = update_row_values (t, stmt, assign_idxs, pk_idx, val,
+                                    &old_values, &new_values, &new_row,
+                                    &new_size, &new_key, &new_key_len, arena);
+        if (failed != EXECUTE_SUCCESS)
+        {
+            temp_arena_memory_end (row_scratch);
+            break;
+        }
+
+        // a UNIQUE value taken by another row, keep the old row
+        if (unique_conflict (db, t, new_values, old_values,
+                             (str8) {key, key_len}))
+        {
+            duplicate = true;
+            temp_arena_memory_end (row_scratch);
+            continue;
+        }
+
+        bool heap = t->organization == TABLE_HEAP;
+        bool key_changed =
+            !heap
+            && btree_key_compare (key, key_len, new_key, new_key_len) != 0;
+
+        // a value that fits in the cell is written in place once the
+        // index entries have moved, an index out of pages keeps the old row
+        if (!key_changed && new_size <= val_len)
+        {
+            str8 row_key = {key, key_len};
+            if (index_update_row (db, t, old_values, row_key, new_values,
+                                  row_key))
+            {
+                btree_cursor_replace_value (c, new_row, new_size);
+            }
+            else
+            {
+                full = true;
+            }
+        }
+        else if (btree_insert (db, moved_root, key, key_len, val, val_len)
+                 != BTREE_OK)
+        {
+            // out of pages, the rows set aside so far are still moved
+            full = true;
+            temp_arena_memory_end (row_scratch);
+            break;
+        }
+        else if (!heap)
+        {
+            btree_cursor_delete (c);
+        }
+        temp_arena_memory_end (row_scratch);
+    }
+
+    BTreeCursor mc;
+    for (btree_cursor_first (db, moved_root, &mc); btree_cursor_valid (&mc);
+         btree_cursor_next (&mc))
+    {
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (&mc, &key, &key_len, &val, &val_len);
+
+        Temp_Arena_Memory row_scratch = temp_arena_memory_begin (arena);
+        ExecuteResult moved =
+            update_move_row (db, t, stmt, assign_idxs, pk_idx, key, key_len,
+                             val, val_len, arena);
+        temp_arena_memory_end (row_scratch);
+
+        duplicate |= moved == EXECUTE_DUPLICATE_KEY;
+        full |= moved == EXECUTE_TABLE_FULL;
+        if (moved == EXECUTE_DB_FULL)
+        {
+            failed = moved;
+        }
+    }
+    pager_unpin_to (db->pager, mc.mark);
+    btree_free_pages (db, moved_root);
+    pager_free_page (db->pager, moved_root);
+
+    table_reclaim (db, t);
+    pager_flush_dirty (db->pager);
+
+    if (failed != EXECUTE_SUCCESS)
+    {
+        return failed;
+    }
+    if (full)
+    {
+        return EXECUTE_TABLE_FULL;
+    }
+    return duplicate ? EXECUTE_DUPLICATE_KEY : EXECUTE_SUCCESS;
+}
+
+/**
+ * update_row_values - the old and the new values of a row an UPDATE
+ * changes, the new row and its key
+ * @new_key: HEAP_ROW_ID_SIZE bytes for a heap row, set when it is stored
+ *
+ * Return: EXECUTE_DB_FULL if the arena is out of memory,
+ * EXECUTE_ROW_TOO_LARGE if the new row does not fit in a cell
+ */
+static ExecuteResult update_row_values (Table *t, Statement *stmt,
+                                        int *assign_idxs, int pk_idx,
+                                        void *row, str8 **old_values,
+                                        str8 **new_values, uint8_t **new_row,
+                                        uint32_t *new_size, uint8_t **new_key,
+                                        uint32_t *new_key_len, Arena *arena)
+{
+    *old_values = push_array_no_zero (arena, str8, MAX_COLUMNS);
+    *new_values = push_array_no_zero (arena, str8, MAX_COLUMNS);
+    if (!*old_values || !*new_values)
+    {
+        return EXECUTE_DB_FULL;
+    }
+
+    deserialize_row_to_strings (t, row, *old_values, arena);
+    memcpy (*new_values, *old_values, t->col_count * sizeof (str8));
+    for (int j = 0; j < stmt->update.assign_col_count; j++)
+    {
+        (*new_values)[assign_idxs[j]] = stmt->update.assignments[j].value;
+    }
+
+    *new_size = serialize_row_size (t, *new_values);
+    if (*new_size > BTREE_MAX_CELL_SIZE)
+    {
+        return EXECUTE_ROW_TOO_LARGE;
+    }
+
+    bool heap = t->organization == TABLE_HEAP;
+    *new_row = push_array_no_zero (arena, uint8_t, *new_size);
+    *new_key = push_array_no_zero (
+        arena, uint8_t,
+        heap ? HEAP_ROW_ID_SIZE
+             : KEY_ENCODED_MAX ((*new_values)[pk_idx].len));
+    if (!*new_row || !*new_key)
+    {
+        return EXECUTE_DB_FULL;
+    }
+    serialize_row (t, *new_values, *new_row);
+    *new_key_len =
+        heap ? HEAP_ROW_ID_SIZE : table_row_key (t, *new_values, *new_key);
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * update_move_row - stores the new version of a row the UPDATE scan set
+ * aside and moves its index entries, see execute_update
+ * @key: key of the row as it was
+ * @row: the row as it was, a btree row is no longer in the table
+ *
+ * A row that cannot be moved is put back as it was.
+ *
+ * Return: EXECUTE_DUPLICATE_KEY if the new key or a UNIQUE value is taken,
+ * EXECUTE_TABLE_FULL if an index is out of pages, EXECUTE_DB_FULL if the
+ * arena is out of memory
+ */
+static ExecuteResult update_move_row (Database *db, Table *t, Statement *stmt,
+                                      int *assign_idxs, int pk_idx,
+                                      void *key, uint32_t key_len, void *row,
+                                      uint32_t row_len, Arena *arena)
+{
+    bool heap = t->organization == TABLE_HEAP;
+    BatchEntry old_row = {key, key_len, row, row_len, NULL};
+    str8 old_key = {key, key_len};
+
+    BatchEntry new_row = {0};
+    ExecuteResult result = update_row_values (
+        t, stmt, assign_idxs, pk_idx, row, &old_row.row, &new_row.row,
+        &new_row.val, &new_row.val_len, &new_row.key, &new_row.key_len, arena);
+    if (result != EXECUTE_SUCCESS)
+    {
+        if (!heap)
+        {
+            table_store_row (db, t, &old_row);
+        }
+        return result;
+    }
+
+    if (unique_conflict (db, t, new_row.row, old_row.row, old_key)
+        || !table_store_row (db, t, &new_row))
+    {
+        if (!heap)
+        {
+            table_store_row (db, t, &old_row);
+        }
+        return EXECUTE_DUPLICATE_KEY;
+    }
+
+    if (!index_update_row (db, t, old_row.row, old_key, new_row.row,
+                           (str8) {new_row.key, new_row.key_len}))
+    {
+        batch_rollback (db, t, &new_row, 1, 0);
+        if (!heap)
+        {
+            table_store_row (db, t, &old_row);
+        }
+        return EXECUTE_TABLE_FULL;
+    }
+
+    if (heap)
+    {
+        heap_delete (db, t->root_page_num, key);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * copy_int_field - checks that a CSV field is a 32 bit integer and copies it
+ *
+ * Fields point into the mapped file, the copy is NUL terminated for atoi.
+ *
+ * Return: false if the field is not an integer
+ */
+static bool copy_int_field (str8 *field, Arena *arena)
+{
+    if (field->len == 0 || field->len > 11)
+    {
+        return false;
+    }
+
+    char *copy = push_array_no_zero (arena, char, field->len + 1);
+    memcpy (copy, field->str, field->len);
+    copy[field->len] = 0;
+
+    char *end;
+    long long v = strtoll (copy, &end, 10);
+    if (*end != 0 || v < INT32_MIN || v > INT32_MAX)
+    {
+        return false;
+    }
+
+    field->str = (uint8_t *) copy;
+    return true;
+}
+
+/**
+ * copy_parse_chunk - thread entry, turns the records of a chunk into sorted
+ * batch entries, heap rows stay in file order
+ */
+static void *copy_parse_chunk (void *arg)
+{
+    CopyChunk *chunk = (CopyChunk *) arg;
+    Table *t = chunk->t;
+    Arena *arena = &chunk->arena;
+
+    int pk_idx = table_find_primary_key_index (t);
+    if (pk_idx == -1)
+    {
+        pk_idx = 0;
+    }
+
+    // every record takes at least one byte per column
+    size_t max_rows = (chunk->end - chunk->start) / t->col_count + 1;
+    chunk->entries = push_array_no_zero (arena, BatchEntry, max_rows);
+    chunk->entry_count = 0;
+    chunk->result = EXECUTE_SUCCESS;
+
+    CsvReader r;
+    csv_reader_init (&r, chunk->start, chunk->end);
+
+    while (1)
+    {
+        str8 *row = push_array_no_zero (arena, str8, t->col_count);
+        int count = csv_read_record (&r, arena, row, t->col_count);
+        if (count == 0)
+        {
+            break;
+        }
+        if (count != t->col_count)
+        {
+            chunk->result = EXECUTE_TABLE_COL_COUNT_MISMATCH;
+            return NULL;
+        }
+
+        for (int i = 0; i < t->col_count; i++)
+        {
+            if (t->columns[i].type == TYPE_INT
+                && !copy_int_field (&row[i], arena))
+            {
+                chunk->result = EXECUTE_INVALID_VALUE;
+                return NULL;
+            }
+        }
+
+        BatchEntry *e = &chunk->entries[chunk->entry_count++];
+        chunk->result = batch_entry_init (e, t, row, pk_idx, arena);
+        if (chunk->result != EXECUTE_SUCCESS)
+        {
+            return NULL;
+        }
+    }
+
+    if (t->organization == TABLE_BTREE)
+    {
+        qsort (chunk->entries, chunk->entry_count, sizeof (BatchEntry),
+               batch_entry_compare);
+    }
+    return NULL;
+}
+
+/**
+ * copy_split_chunks - splits a file into record aligned chunks
+ *
+ * Quotes are counted up to each split point to know whether it falls inside
+ * a quoted field, which may span lines.
+ *
+ * Return: number of chunks
+ */
+static int copy_split_chunks (const uint8_t *data, size_t len, Table *t,
+                              CopyChunk *chunks)
+{
+    size_t count = build_thread_count (len, COPY_MIN_CHUNK_SIZE);
+
+    const uint8_t *end = data + len;
+    const uint8_t *prev = data;
+    const uint8_t *counted = data;
+    size_t quotes = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        chunks[i].t = t;
+        chunks[i].start = prev;
+
+        const uint8_t *split = data + (len * (i + 1) / count);
+        if (i + 1 < count && split > prev)
+        {
+            quotes += csv_count_quotes (counted, split);
+            counted = split;
+            prev = csv_next_record (split, end, quotes % 2 == 1);
+        }
+        else if (i + 1 == count)
+        {
+            prev = end;
+        }
+        chunks[i].end = prev;
+    }
+    return (int) count;
+}
+
+/**
+ * execute_copy_from - loads a CSV file into a table
+ *
+ * The file is mapped and split into chunks that are parsed and sorted by
+ * parallel threads. The sorted chunks are merged into one batch, so an empty
+ * table is built bottom up. The chunks of a heap table are appended in file
+ * order. The load is all or nothing.
+ *
+ * Return: number of rows loaded through rows_out
+ */
+static ExecuteResult execute_copy_from (Database *db, Table *t, int fd,
+                                        int *rows_out)
+{
+    struct stat st;
+    if (fstat (fd, &st) == -1)
+    {
+        return EXECUTE_FILE_ERROR;
+    }
+    if (st.st_size == 0)
+    {
+        *rows_out = 0;
+        return EXECUTE_SUCCESS;
+    }
+
+    size_t len = st.st_size;
+    uint8_t *data = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return EXECUTE_FILE_ERROR;
+    }
+    madvise (data, len, MADV_SEQUENTIAL);
+
+    CopyChunk chunks[BUILD_MAX_THREADS];
+    int chunk_count = copy_split_chunks (data, len, t, chunks);
+    pthread_t threads[BUILD_MAX_THREADS];
+    bool started[BUILD_MAX_THREADS] = {0};
+    ExecuteResult result = EXECUTE_SUCCESS;
+
+    for (int i = 0; i < chunk_count; i++)
+    {
+        // bounded by the chunk size, pages are only touched as they are used
+        size_t chunk_len = chunks[i].end - chunks[i].start;
+        size_t max_rows = chunk_len / t->col_count + 1;
+        size_t size = 4 * chunk_len
+                      + max_rows
+                            * (2 * sizeof (BatchEntry)
+                               + t->col_count * (sizeof (str8) + 64) + 64);
+
+        chunks[i].backing = malloc (size);
+        if (!chunks[i].backing)
+        {
+            result = EXECUTE_FAIL;
+            chunk_count = i;
+            break;
+        }
+        arena_init (&chunks[i].arena, chunks[i].backing, size);
+    }
+
+    for (int i = 1; result == EXECUTE_SUCCESS && i < chunk_count; i++)
+    {
+        started[i] = pthread_create (&threads[i], NULL, copy_parse_chunk,
+                                     &chunks[i])
+                     == 0;
+        if (!started[i])
+        {
+            copy_parse_chunk (&chunks[i]);
+        }
+    }
+    if (result == EXECUTE_SUCCESS && chunk_count > 0)
+    {
+        copy_parse_chunk (&chunks[0]);
+    }
+
+    int total = 0;
+    for (int i = 0; i < chunk_count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join (threads[i], NULL);
+        }
+        if (result == EXECUTE_SUCCESS)
+        {
+            result = chunks[i].result;
+        }
+        total += chunks[i].entry_count;
+    }
+
+    if (result == EXECUTE_SUCCESS)
+    {
+        // the merged batch and the index entries need a larger arena than
+        // the statement one
+        size_t size = (size_t) total * (3 * sizeof (BatchEntry) + 64)
+                      + 4 * len + SIZE_MB;
+        void *backing = malloc (size);
+        if (backing)
+        {
+            Arena load_arena;
+            arena_init (&load_arena, backing, size);
+
+            BatchEntry *batch =
+                push_array_no_zero (&load_arena, BatchEntry, total);
+            BatchEntry *tmp =
+                push_array_no_zero (&load_arena, BatchEntry, total);
+
+            int bounds[BUILD_MAX_THREADS + 1];
+            bounds[0] = 0;
+            for (int i = 0; i < chunk_count; i++)
+            {
+                memcpy (batch + bounds[i], chunks[i].entries,
+                        chunks[i].entry_count * sizeof (BatchEntry));
+                bounds[i + 1] = bounds[i] + chunks[i].entry_count;
+            }
+
+            if (t->organization == TABLE_BTREE)
+            {
+                batch = batch_merge_runs (batch, tmp, bounds, chunk_count);
+            }
+            result = table_insert_batch (db, t, batch, total, &load_arena);
+            free (backing);
+        }
+        else
+        {
+            result = EXECUTE_FAIL;
+        }
+    }
+
+    for (int i = 0; i < chunk_count; i++)
+    {
+        free (chunks[i].backing);
+    }
+    munmap (data, len);
+
+    *rows_out = total;
+    return result;
+}
+
+static bool copy_write_all (int fd, uint8_t *buffer, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write (fd, buffer, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * execute_copy_to - writes every row of a table to a CSV file in key order,
+ * or in storage order for a heap table
+ *
+ * Rows are formatted straight from the leaf cells into a write buffer.
+ *
+ * Return: number of rows written through rows_out
+ */
+static ExecuteResult execute_copy_to (Database *db, Table *t, int fd,
+                                      int *rows_out)
+{
+    uint8_t buffer[COPY_WRITE_BUFFER_SIZE];
+    size_t len = 0;
+    int rows = 0;
+
+    BTreeCursor c;
+    for (table_cursor_first (db, t, &c); btree_cursor_valid (&c);
+         btree_cursor_next (&c))
+    {
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (&c, &key, &key_len, &val, &val_len);
+
+        // worst case: every text byte quoted, 12 bytes per int and separators
+        size_t row_max = 2 * val_len + t->col_count * 16;
+        if (len + row_max > sizeof (buffer))
+        {
+            if (!copy_write_all (fd, buffer, len))
+            {
+                return EXECUTE_FILE_ERROR;
+            }
+            len = 0;
+        }
+
+        uint8_t *ptr = (uint8_t *) val;
+        for (int i = 0; i < t->col_count; i++)
+        {
+            if (i > 0)
+            {
+                buffer[len++] = ',';
+            }
+
+            if (t->columns[i].type == TYPE_INT)
+            {
+                int32_t v;
+                memcpy (&v, ptr, sizeof (int32_t));
+                ptr += sizeof (int32_t);
+                len += snprintf ((char *) buffer + len, 16, "%d", v);
+            }
+            else
+            {
+                uint32_t text_len;
+                memcpy (&text_len, ptr, sizeof (uint32_t));
+                ptr += sizeof (uint32_t);
+                len += csv_write_field (buffer + len, (str8) {ptr, text_len});
+                ptr += text_len;
+            }
+        }
+        buffer[len++] = '\n';
+        rows++;
+    }
+
+    if (!copy_write_all (fd, buffer, len))
+    {
+        return EXECUTE_FILE_ERROR;
+    }
+
+    *rows_out = rows;
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * copy_open - opens the file of a COPY in the COPY directory
+ * @name: a file name, not a path
+ *
+ * Any client can send a COPY, so it only names a regular file directly in
+ * the directory set by CSQL_COPY_DIR and a symlink is not followed. An
+ * export creates a new file and never truncates one, and the database file
+ * is never read.
+ *
+ * Return: the file descriptor, -1 with *result set if it was not opened
+ */
+static int copy_open (Database *db, str8 name, bool is_from,
+                      ExecuteResult *result)
+{
+    *result = EXECUTE_FILE_NOT_ALLOWED;
+    if (db->copy_dir_fd == -1 || name.len == 0 || name.len > NAME_MAX
+        || memchr (name.str, '/', name.len) || memchr (name.str, 0, name.len))
+    {
+        return -1;
+    }
+
+    char path[NAME_MAX + 1];
+    snprintf (path, sizeof (path), "%.*s", STR_FMT (name));
+
+    int fd = is_from ? openat (db->copy_dir_fd, path,
+                               O_RDONLY | O_NOFOLLOW | O_CLOEXEC)
+                     : openat (db->copy_dir_fd, path,
+                               O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW
+                                   | O_CLOEXEC,
+                               0644);
+    if (fd == -1)
+    {
+        *result = EXECUTE_FILE_ERROR;
+        return -1;
+    }
+
+    struct stat st, db_st;
+    if (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode)
+        || (fstat (db->pager->fd, &db_st) == 0 && st.st_dev == db_st.st_dev
+            && st.st_ino == db_st.st_ino))
+    {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * execute_copy - COPY FROM loads a CSV file into a table, COPY TO exports it
+ *
+ * Files are opened by the server process, see copy_open. A failed export
+ * removes the file it created. On success "COPY <rows>" is sent before the
+ * result.
+ */
+static ExecuteResult execute_copy (Statement *stmt, Database *db,
+                                   int client_fd)
+{
+    Table *t = db_find_table (db, stmt->copy.table_name);
+    if (!t)
+    {
+        return EXECUTE_TABLE_NOT_EXISTS;
+    }
+
+    ExecuteResult result;
+    int fd = copy_open (db, stmt->copy.file_path, stmt->copy.is_from, &result);
+    if (fd == -1)
+    {
+        return result;
+    }
+
+    int rows = 0;
+    result = stmt->copy.is_from ? execute_copy_from (db, t, fd, &rows)
+                                : execute_copy_to (db, t, fd, &rows);
+    close (fd);
+
+    if (result != EXECUTE_SUCCESS && !stmt->copy.is_from)
+    {
+        char path[NAME_MAX + 1];
+        snprintf (path, sizeof (path), "%.*s",
+                  STR_FMT (stmt->copy.file_path));
+        unlinkat (db->copy_dir_fd, path, 0);
+    }
+
+    if (result == EXECUTE_SUCCESS)
+    {
+        char msg[32];
+        int msg_len = snprintf (msg, sizeof (msg), "COPY %d\n", rows);
+        send (client_fd, msg, msg_len, MSG_NOSIGNAL);
+    }
+    return result;
+}
+
+// the first ready index of a table from slot i on, index_count if none
+static int vacuum_next_index (Database *db, Table *t, int i)
+{
+    while (i < db->index_count
+           && (db->indexes[i].state != INDEX_READY
+               || !str8_match (db->indexes[i].table_name, t->table_name,
+                               true)))
+    {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * vacuum_step_latched - tells if the next vacuum_table_step of a table
+ * works on a btree, which it changes under page latches only, so it may run
+ * with db->lock held shared. Heap and hash steps need it exclusive.
+ */
+bool vacuum_step_latched (Database *db, Table *t, VacuumState *v)
+{
+    if (v->tree == 0)
+    {
+        return t->organization == TABLE_BTREE;
+    }
+    int i = vacuum_next_index (db, t, v->tree - 1);
+    return i == db->index_count || db->indexes[i].method == INDEX_BTREE;
+}
+
+/**
+ * vacuum_table_step - vacuums the next part of a table or of one of its ready
+ * indexes, see btree_vacuum_step, hash_vacuum_step and heap_vacuum_step
+ *
+ * The state only holds positions, the table can change between steps.
+ *
+ * Return: true once the table and all of its indexes were visited
+ */
+bool vacuum_table_step (Database *db, Table *t, VacuumState *v)
+{
+    bool done;
+    if (v->tree == 0)
+    {
+        done = t->organization == TABLE_HEAP
+                   ? heap_vacuum_step (db, t->root_page_num, &v->pos)
+                   : btree_vacuum_step (db, t->root_page_num, v->key,
+                                        &v->key_len);
+    }
+    else
+    {
+        int i = vacuum_next_index (db, t, v->tree - 1);
+        if (i == db->index_count)
+        {
+            *v = (VacuumState) {0};
+            return true;
+        }
+
+        // the index may have moved on since the last step
+        if (v->tree != i + 1)
+        {
+            v->tree = i + 1;
+            v->pos = 0;
+            v->key_len = 0;
+        }
+        Index *idx = &db->indexes[i];
+        done = idx->method == INDEX_HASH
+                   ? hash_vacuum_step (db, idx->root_page_num, &v->pos)
+                   : btree_vacuum_step (db, idx->root_page_num, v->key,
+                                        &v->key_len);
+    }
+
+    if (done)
+    {
+        v->tree++;
+        v->pos = 0;
+        v->key_len = 0;
+    }
+    return false;
+}
+
+/**
+ * execute_vacuum - vacuums one table or every table with their indexes: dead
+ * cells are dropped, sparse btree leaves merged and the emptied pages freed
+ */
+static ExecuteResult execute_vacuum (Statement *stmt, Database *db)
+{
+    Table *only = NULL;
+    if (stmt->vacuum.table_name.len > 0)
+    {
+        only = db_find_table (db, stmt->vacuum.table_name);
+        if (!only)
+        {
+            return EXECUTE_TABLE_NOT_EXISTS;
+        }
+    }
+
+    VacuumState *v = malloc (sizeof (VacuumState));
+    if (!v)
+    {
+        return EXECUTE_FAIL;
+    }
+
+    for (int i = 0; i < db->table_count; i++)
+    {
+        Table *t = db->tables[i];
+        if (only && t != only)
+        {
+            continue;
+        }
+
+        *v = (VacuumState) {0};
+        while (!vacuum_table_step (db, t, v))
+        {
+        }
+    }
+
+    free (v);
+    pager_flush_dirty (db->pager);
+    return EXECUTE_SUCCESS;
+}
+
+static bool row_matches_predicate (Table *t, void *row_data, int target_col_idx,
+                                   void *target_val)
+{
+    uint8_t *ptr = (uint8_t *) row_data;
+
+    for (int i = 0; i < t->col_count; i++)
+    {
+        ColumnDef *col = &t->columns[i];
+
+        if (i == target_col_idx)
+        {
+            if (col->type == TYPE_INT)
+            {
+                int32_t row_int;
+                memcpy (&row_int, ptr, sizeof (int32_t));
+
+                int32_t target_int = *(int32_t *) target_val;
+                return row_int == target_int;
+            }
+            else if (col->type == TYPE_TEXT)
+            {
+                uint32_t len;
+                memcpy (&len, ptr, sizeof (uint32_t));
+                ptr += sizeof (uint32_t);
+
+                str8 *target_str = (str8 *) target_val;
+                if (len != target_str->len)
+                {
+                    return false;
+                }
+
+                return memcmp (ptr, target_str->str, len) == 0;
+            }
+        }
+
+        if (col->type == TYPE_INT)
+        {
+            ptr += sizeof (int32_t);
+        }
+        else if (col->type == TYPE_TEXT)
+        {
+            uint32_t len;
+            memcpy (&len, ptr, sizeof (uint32_t));
+            ptr += sizeof (uint32_t) + len;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * where_resolve - resolves the columns of a WHERE clause
+ * @t2: the JOIN table, or NULL
+ *
+ * Return: EXECUTE_COL_NOT_FOUND if a column is in neither table
+ */
+static ExecuteResult where_resolve (Table *t1, Table *t2, WhereClause *where,
+                                    WherePred *preds)
+{
+    for (int i = 0; i < where->count; i++)
+    {
+        WherePred *pred = &preds[i];
+        if (resolve_column (t1, t2, where->conds[i].col, &pred->t,
+                            &pred->col_idx)
+            == -1)
+        {
+            return EXECUTE_COL_NOT_FOUND;
+        }
+
+        pred->value = where->conds[i].value;
+        if (pred->t->columns[pred->col_idx].type == TYPE_INT)
+        {
+            char temp[32];
+            snprintf (temp, sizeof (temp), "%.*s", STR_FMT (pred->value));
+            pred->int_value = atoi (temp);
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * row_matches_where - whether a row of t passes every condition on t
+ */
+static bool row_matches_where (Table *t, void *row_data, WherePred *preds,
+                               int pred_count)
+{
+    for (int i = 0; i < pred_count; i++)
+    {
+        WherePred *pred = &preds[i];
+        if (pred->t != t)
+        {
+            continue;
+        }
+
+        void *val = t->columns[pred->col_idx].type == TYPE_INT
+                        ? (void *) &pred->int_value
+                        : (void *) &pred->value;
+        if (!row_matches_predicate (t, row_data, pred->col_idx, val))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static WherePred *where_find (WherePred *preds, int pred_count, Table *t,
+                              int col_idx)
+{
+    for (int i = 0; i < pred_count; i++)
+    {
+        if (preds[i].t == t && preds[i].col_idx == col_idx)
+        {
+            return &preds[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * where_implies - whether the rows that pass a WHERE clause all pass the
+ * predicate of a partial index, so that the index has all of them
+ *
+ * Both are equalities joined by AND, every condition of the index has to be
+ * in the clause.
+ */
+static bool where_implies (Table *t, WherePred *preds, int pred_count,
+                           Index *idx)
+{
+    WherePred need[MAX_WHERE_CONDS];
+    if (where_resolve (t, NULL, &idx->where, need) != EXECUTE_SUCCESS)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < idx->where.count; i++)
+    {
+        WherePred *have =
+            where_find (preds, pred_count, t, need[i].col_idx);
+        if (!have)
+        {
+            return false;
+        }
+
+        bool same = t->columns[need[i].col_idx].type == TYPE_INT
+                        ? have->int_value == need[i].int_value
+                        : str8_match (have->value, need[i].value, false);
+        if (!same)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * where_plan - picks how a WHERE clause on one table finds its rows
+ * @select_cols: the columns a SELECT projects, NULL for DELETE and UPDATE
+ * @key: WHERE_KEY_MAX bytes, set to the encoded primary key or to the
+ * encoded values of the leading index columns the clause fixes
+ * @key_len: set to the length of @key, 0 for a full scan
+ *
+ * An equality on the primary key of a btree table visits one row, the
+ * primary key of a heap table has an index. Otherwise the index with
+ * the most leading columns fixed by equalities is used, a hash index only
+ * if all of its columns are fixed since it hashes them together. A partial
+ * index is only used if the clause implies its predicate. On a tie
+ * an index that covers the SELECT wins, then the hash index. The other
+ * conditions are checked on the rows.
+ *
+ * Return: the index to scan, NULL for a key lookup or a full scan
+ */
+static Index *where_plan (Database *db, Table *t, WherePred *preds,
+                          int pred_count, ColMap *select_cols,
+                          int select_col_count, uint8_t *key,
+                          uint32_t *key_len)
+{
+    *key_len = 0;
+
+    int pk_idx = table_find_primary_key_index (t);
+    if (pk_idx == -1)
+    {
+        pk_idx = 0;
+    }
+
+    WherePred *pk = t->organization == TABLE_BTREE
+                        ? where_find (preds, pred_count, t, pk_idx)
+                        : NULL;
+    if (pk && KEY_ENCODED_MAX (pk->value.len) <= WHERE_KEY_MAX)
+    {
+        *key_len = key_encode (t->columns[pk_idx].type, pk->value, key);
+        return NULL;
+    }
+
+    Index *best = NULL;
+    WherePred *best_preds[MAX_INDEX_COLUMNS];
+    int best_cols = 0;
+    int best_rank = 0;
+    for (int i = 0; i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (idx->state != INDEX_READY
+            || !str8_match (idx->table_name, t->table_name, true)
+            || !where_implies (t, preds, pred_count, idx))
+        {
+            continue;
+        }
+
+        WherePred *fixed[MAX_INDEX_COLUMNS];
+        size_t size = 0;
+        int cols = 0;
+        while (cols < idx->col_count)
+        {
+            int col = table_find_col_index (t, idx->col_names[cols]);
+            WherePred *pred = where_find (preds, pred_count, t, col);
+            if (!pred || (size += KEY_ENCODED_MAX (pred->value.len))
+                             > WHERE_KEY_MAX)
+            {
+                break;
+            }
+            fixed[cols++] = pred;
+        }
+
+        if (cols == 0 || (idx->method == INDEX_HASH && cols < idx->col_count))
+        {
+            continue;
+        }
+
+        int rank = cols * 4 + (idx->method == INDEX_HASH);
+        if (select_cols
+            && index_covers (t, idx, select_cols, select_col_count, preds,
+                             pred_count))
+        {
+            rank += 2;
+        }
+        if (rank > best_rank)
+        {
+            best = idx;
+            best_rank = rank;
+            best_cols = cols;
+            memcpy (best_preds, fixed, cols * sizeof (WherePred *));
+        }
+    }
+
+    for (int i = 0; i < best_cols; i++)
+    {
+        WherePred *pred = best_preds[i];
+        *key_len += key_encode (t->columns[pred->col_idx].type, pred->value,
+                                key + *key_len);
+    }
+    return best;
+}
+
+/**
+ * where_row_keys - the primary keys of the rows a DELETE or UPDATE visits,
+ * see where_plan
+ * @search_key: WHERE_KEY_MAX bytes for the planned key
+ * @lookup: storage for the key of a primary key lookup
+ *
+ * Return: the keys, NULL to visit every row
+ */
+static str8 *where_row_keys (Database *db, Table *t, WherePred *preds,
+                             int pred_count, uint8_t *search_key,
+                             str8 *lookup, Arena *arena, int *key_count)
+{
+    uint32_t search_len;
+    Index *idx =
+        where_plan (db, t, preds, pred_count, NULL, 0, search_key,
+                    &search_len);
+
+    if (idx)
+    {
+        return index_collect_keys (db, t, idx, search_key, search_len,
+                                   arena, key_count);
+    }
+    if (search_len > 0)
+    {
+        *lookup = (str8) {search_key, search_len};
+        *key_count = table_may_contain (db, t, search_key, search_len);
+        return lookup;
+    }
+    return NULL;
+}
+
+/**
+ * index_encode_entry - encodes the index cell of a row
+ * @row_key: the key of the row in the table, its encoded primary key or
+ * the row ID in a heap table
+ * @out: set to [ encoded column values | row key | included ]
+ * @key_len: set to the length of the key, the values and the row key
+ * @pk_len: set to the length of the trailing row key
+ * @val_len: set to the length of the cell value, which starts at the
+ * primary key and runs to the end of @out
+ *
+ * Appending the primary key keeps keys unique when values repeat. The
+ * included columns are laid out like in a row.
+ *
+ * Return: false if an index column does not exist
+ */
+static bool index_encode_entry (Table *t, Index *idx, str8 *row_vals,
+                                str8 row_key, uint8_t *out, uint32_t *key_len,
+                                uint32_t *pk_len, uint32_t *val_len)
+{
+    // encoded values are self delimiting, so the concatenation sorts like
+    // the values compared column by column
+    uint32_t len = 0;
+    for (int i = 0; i < idx->col_count; i++)
+    {
+        int col = table_find_col_index (t, idx->col_names[i]);
+        if (col == -1)
+        {
+            return false;
+        }
+        len += key_encode (t->columns[col].type, row_vals[col], out + len);
+    }
+    memcpy (out + len, row_key.str, row_key.len);
+    *pk_len = row_key.len;
+    *key_len = len + *pk_len;
+
+    len = *key_len;
+    for (int i = 0; i < idx->include_count; i++)
+    {
+        int col = table_find_col_index (t, idx->include_names[i]);
+        if (col == -1)
+        {
+            return false;
+        }
+
+        str8 val = row_vals[col];
+        if (t->columns[col].type == TYPE_INT)
+        {
+            char temp[32];
+            snprintf (temp, sizeof (temp), "%.*s", STR_FMT (val));
+            int32_t v = atoi (temp);
+            memcpy (out + len, &v, sizeof (int32_t));
+            len += sizeof (int32_t);
+        }
+        else
+        {
+            uint32_t text_len = val.len;
+            memcpy (out + len, &text_len, sizeof (uint32_t));
+            memcpy (out + len + sizeof (uint32_t), val.str, val.len);
+            len += sizeof (uint32_t) + val.len;
+        }
+    }
+    *val_len = *pk_len + (len - *key_len);
+    return true;
+}
+
+/**
+ * index_entry_changed - whether an update changes a key or an included
+ * column of an index, or whether the row of a partial index moves in or
+ * out of it
+ */
+static bool index_entry_changed (Table *t, Index *idx, str8 *old_vals,
+                                 str8 *new_vals)
+{
+    for (int i = 0; i < idx->col_count + idx->include_count; i++)
+    {
+        str8 name = i < idx->col_count
+                        ? idx->col_names[i]
+                        : idx->include_names[i - idx->col_count];
+        int col = table_find_col_index (t, name);
+        if (col != -1 && !str8_match (old_vals[col], new_vals[col], false))
+        {
+            return true;
+        }
+    }
+    return index_has_row (t, idx, old_vals) != index_has_row (t, idx, new_vals);
+}
+
+static int encoded_compare (const void *a, const void *b)
+{
+    const str8 *x = (const str8 *) a;
+    const str8 *y = (const str8 *) b;
+    return btree_key_compare (x->str, x->len, y->str, y->len);
+}
+
+/**
+ * unique_taken - whether a row other than own_pk has a value in the index
+ * of a UNIQUE column
+ * @value: the encoded value
+ * @own_pk: row key of the row being updated, NULL for a new row
+ *
+ * The keys of the row with the value start with it, one seek finds them.
+ */
+static bool unique_taken (Database *db, Table *t, Index *idx, uint8_t *value,
+                          uint32_t value_len, str8 *own_pk)
+{
+    IndexScan s;
+    for (index_scan_begin (db, t, idx, value, value_len, &s);
+         index_scan_valid (&s); index_scan_next (&s))
+    {
+        void *pk;
+        uint32_t pk_len;
+        index_scan_pk (&s, &pk, &pk_len);
+        if (!own_pk
+            || btree_key_compare (pk, pk_len, own_pk->str, own_pk->len) != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * unique_conflict - whether an updated row repeats the value of a UNIQUE
+ * column of another row
+ * @row_key: the key of the row before the update
+ */
+static bool unique_conflict (Database *db, Table *t, str8 *new_vals,
+                             str8 *old_vals, str8 row_key)
+{
+    for (int i = 0; i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (!idx->is_unique
+            || !str8_match (idx->table_name, t->table_name, true))
+        {
+            continue;
+        }
+
+        int col = table_find_col_index (t, idx->col_names[0]);
+        if (str8_match (old_vals[col], new_vals[col], false))
+        {
+            continue;
+        }
+
+        uint8_t value[KEY_ENCODED_MAX (BTREE_CELL_BUFFER_SIZE)];
+        uint32_t value_len =
+            key_encode (t->columns[col].type, new_vals[col], value);
+        if (unique_taken (db, t, idx, value, value_len, &row_key))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * unique_check_batch - checks the UNIQUE columns of a batch of new rows
+ * @arena: scratch for the encoded values
+ *
+ * The values of a column are sorted, so repeats in the batch are
+ * neighbours, then each is looked up in the column's index.
+ *
+ * Return: EXECUTE_DUPLICATE_KEY if a value repeats or already exists
+ */
+static ExecuteResult unique_check_batch (Database *db, Table *t,
+                                         BatchEntry *batch, int row_count,
+                                         Arena *arena)
+{
+    for (int i = 0; i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (!idx->is_unique
+            || !str8_match (idx->table_name, t->table_name, true))
+        {
+            continue;
+        }
+
+        int col = table_find_col_index (t, idx->col_names[0]);
+        DataType type = t->columns[col].type;
+
+        Temp_Arena_Memory scratch = temp_arena_memory_begin (arena);
+        str8 *values = push_array_no_zero (arena, str8, row_count);
+        for (int r = 0; values && r < row_count; r++)
+        {
+            str8 value = batch[r].row[col];
+            values[r].str = push_array_no_zero (arena, uint8_t,
+                                                KEY_ENCODED_MAX (value.len));
+            if (!values[r].str)
+            {
+                values = NULL;
+                break;
+            }
+            values[r].len = key_encode (type, value, values[r].str);
+        }
+        if (!values)
+        {
+            temp_arena_memory_end (scratch);
+            return EXECUTE_FAIL;
+        }
+
+        qsort (values, row_count, sizeof (str8), encoded_compare);
+
+        ExecuteResult result = EXECUTE_SUCCESS;
+        for (int r = 0; r < row_count; r++)
+        {
+            if ((r > 0 && encoded_compare (&values[r - 1], &values[r]) == 0)
+                || unique_taken (db, t, idx, values[r].str, values[r].len,
+                                 NULL))
+            {
+                result = EXECUTE_DUPLICATE_KEY;
+                break;
+            }
+        }
+
+        temp_arena_memory_end (scratch);
+        if (result != EXECUTE_SUCCESS)
+        {
+            return result;
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * index_has_row - whether a row belongs in an index, every row unless the
+ * index is partial
+ */
+static bool index_has_row (Table *t, Index *idx, str8 *row_vals)
+{
+    WherePred preds[MAX_WHERE_CONDS];
+    if (where_resolve (t, NULL, &idx->where, preds) != EXECUTE_SUCCESS)
+    {
+        return false;
+    }
+    return values_match_where (t, row_vals, preds, idx->where.count);
+}
+
+/**
+ * index_log_change - records an index change in the side log of an index
+ * that is being built, see execute_create_index
+ *
+ * Writers hold db->lock exclusive, the log is only read with the lock held.
+ * The log is kept on pages, so it grows with the database instead of in
+ * memory. A change that cannot be logged fails the build.
+ */
+static void index_log_change (Database *db, Index *idx, bool is_delete,
+                              uint8_t *key, uint32_t key_len, uint32_t pk_len,
+                              uint32_t val_len)
+{
+    uint8_t cell_key[sizeof (IndexLogRecord) + 2 * PAGE_SIZE_MAX];
+    IndexLogRecord rec = {is_delete, pk_len};
+    uint32_t prefix_len = key_len - pk_len;
+    memcpy (cell_key, &rec, sizeof (rec));
+    memcpy (cell_key + sizeof (rec), key, prefix_len);
+
+    RunWriter w = {idx->log_head, idx->log_tail};
+    if (idx->log_overflow
+        || !run_write (db, &w, cell_key, sizeof (rec) + prefix_len,
+                       key + prefix_len, val_len))
+    {
+        idx->log_overflow = true;
+        return;
+    }
+    idx->log_head = w.head;
+    idx->log_tail = w.tail;
+    idx->log_count++;
+}
+
+/**
+ * index_insert_row - adds the entry of a row to an index, or logs it while
+ * the index is being built
+ *
+ * Return: false if the database is out of pages
+ */
+static bool index_insert_row (Database *db, Table *t, Index *idx,
+                              str8 *row_vals, str8 row_key)
+{
+    uint8_t key[2 * PAGE_SIZE_MAX];
+    uint32_t key_len, pk_len, val_len;
+
+    if (idx->state == INDEX_INVALID || !index_has_row (t, idx, row_vals)
+        || !index_encode_entry (t, idx, row_vals, row_key, key, &key_len,
+                                &pk_len, &val_len))
+    {
+        return true;
+    }
+
+    if (idx->state == INDEX_BUILDING)
+    {
+        index_log_change (db, idx, false, key, key_len, pk_len, val_len);
+        return true;
+    }
+
+    if (!index_store_insert (db, idx, key, key_len, key + (key_len - pk_len),
+                             val_len))
+    {
+        return false;
+    }
+    index_filter_add (db, t, idx, key, key_len);
+    return true;
+}
+
+static void index_delete_row (Database *db, Table *t, Index *idx,
+                              str8 *row_vals, str8 row_key)
+{
+    uint8_t key[2 * PAGE_SIZE_MAX];
+    uint32_t key_len, pk_len, val_len;
+
+    if (idx->state == INDEX_INVALID || !index_has_row (t, idx, row_vals)
+        || !index_encode_entry (t, idx, row_vals, row_key, key, &key_len,
+                                &pk_len, &val_len))
+    {
+        return;
+    }
+
+    if (idx->state == INDEX_BUILDING)
+    {
+        index_log_change (db, idx, true, key, key_len, pk_len, val_len);
+        return;
+    }
+
+    index_store_delete (db, idx, key, key_len, pk_len);
+}
+
+/**
+ * index_update_row - moves the entries of an updated row in the indexes
+ * of its table
+ * @old_key: the row key before the update
+ * @new_key: the row key after it, a heap row moves to a new row ID
+ *
+ * Return: false if the database is out of pages, every index then holds
+ * the old entries again
+ */
+static bool index_update_row (Database *db, Table *t, str8 *old_vals,
+                              str8 old_key, str8 *new_vals, str8 new_key)
+{
+    bool same_key = btree_key_compare (old_key.str, old_key.len, new_key.str,
+                                       new_key.len)
+                    == 0;
+    for (int i = 0; i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (!str8_match (idx->table_name, t->table_name, true)
+            || (same_key && !index_entry_changed (t, idx, old_vals, new_vals)))
+        {
+            continue;
+        }
+
+        index_delete_row (db, t, idx, old_vals, old_key);
+        if (index_insert_row (db, t, idx, new_vals, new_key))
+        {
+            continue;
+        }
+
+        // the old entries free the space the new ones took
+        index_insert_row (db, t, idx, old_vals, old_key);
+        for (int k = 0; k < i; k++)
+        {
+            Index *done = &db->indexes[k];
+            if (!str8_match (done->table_name, t->table_name, true)
+                || (same_key
+                    && !index_entry_changed (t, done, old_vals, new_vals)))
+            {
+                continue;
+            }
+            index_delete_row (db, t, done, new_vals, new_key);
+            index_insert_row (db, t, done, old_vals, old_key);
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * index_store_insert - adds an entry to the pages of an index
+ * @val: the cell value, which starts at the trailing primary key of @key,
+ * see index_encode_entry
+ *
+ * A hash index hashes the column values in front of the primary key.
+ *
+ * Return: false if the database is out of pages
+ */
+static bool index_store_insert (Database *db, Index *idx, uint8_t *key,
+                                uint32_t key_len, uint8_t *val,
+                                uint32_t val_len)
+{
+    if (idx->method == INDEX_HASH)
+    {
+        return hash_insert (db, idx->root_page_num, key, key_len,
+                            (uint32_t) (val - key), val, val_len)
+               != HASH_FULL;
+    }
+    return btree_insert (db, idx->root_page_num, key, key_len, val, val_len)
+           != BTREE_FULL;
+}
+
+static void index_store_delete (Database *db, Index *idx, uint8_t *key,
+                                uint32_t key_len, uint32_t pk_len)
+{
+    if (idx->method == INDEX_HASH)
+    {
+        hash_delete (db, idx->root_page_num, key, key_len, key_len - pk_len);
+    }
+    else
+    {
+        btree_delete (db, idx->root_page_num, key, key_len);
+    }
+}
+
+/**
+ * filter_add_key - adds a key of a tree to a filter
+ * @idx: the index the tree belongs to, NULL for a table
+ *
+ * Table keys are primary keys. An index adds every leading run of column
+ * values of an entry, so a lookup on any prefix of the columns can ask.
+ */
+static void filter_add_key (BloomFilter *f, Table *t, Index *idx, void *key,
+                            uint32_t key_len)
+{
+    if (!idx)
+    {
+        bloom_add (f, key, key_len);
+        return;
+    }
+
+    uint8_t *k = (uint8_t *) key;
+    uint32_t offset = 0;
+    for (int i = 0; i < idx->col_count; i++)
+    {
+        int col = table_find_col_index (t, idx->col_names[i]);
+        offset += key_decode (t->columns[col].type, k + offset, NULL, NULL);
+        bloom_add (f, k, offset);
+    }
+}
+
+/**
+ * filter_build - builds the filter of a table or an index from its tree
+ * @idx: the index the tree belongs to, NULL for a table
+ *
+ * The filter gets room for twice the keys there are now, writes fill it
+ * up and it is built again from the live keys once it is full. Writers
+ * may change the tree meanwhile, a key they add after the cursor passed
+ * it is added by them once the filter is in place.
+ *
+ * Return: the filter, NULL if out of memory
+ */
+static BloomFilter *filter_build (Database *db, Table *t, Index *idx,
+                                  uint32_t root_page_num)
+{
+    uint32_t key_count = 0;
+    BTreeCursor c;
+    for (btree_cursor_first (db, root_page_num, &c); btree_cursor_valid (&c);
+         btree_cursor_next (&c))
+    {
+        key_count++;
+    }
+    pager_unpin_to (db->pager, c.mark);
+
+    uint32_t per_key = idx ? (uint32_t) idx->col_count : 1;
+    BloomFilter *f = bloom_create (2 * key_count * per_key);
+    if (!f)
+    {
+        return NULL;
+    }
+
+    for (btree_cursor_first (db, root_page_num, &c); btree_cursor_valid (&c);
+         btree_cursor_next (&c))
+    {
+        void *key, *val;
+        uint32_t key_len, val_len;
+        btree_cursor_get (&c, &key, &key_len, &val, &val_len);
+        filter_add_key (f, t, idx, key, key_len);
+    }
+    pager_unpin_to (db->pager, c.mark);
+    return f;
+}
+
+/*
+ * The filters are built, replaced and read under db->filter_lock. It is
+ * taken with no latch held, building a filter latches the leaves of its
+ * tree.
+ */
+
+/**
+ * table_filter - the filter of the primary keys of a table, a key it does
+ * not contain is not in the table
+ *
+ * Return: the filter, NULL if it could not be built
+ */
+static BloomFilter *table_filter (Database *db, Table *t)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        return NULL; // rows are only found through their row IDs
+    }
+    if (!t->key_filter)
+    {
+        t->key_filter = filter_build (db, t, NULL, t->root_page_num);
+    }
+    return t->key_filter;
+}
+
+/**
+ * table_may_contain - asks the filter of a table for a primary key
+ *
+ * Return: false if the table has no row with the key
+ */
+static bool table_may_contain (Database *db, Table *t, void *key,
+                               uint32_t key_len)
+{
+    pthread_mutex_lock (&db->filter_lock);
+    BloomFilter *filter = table_filter (db, t);
+    bool found = !filter || bloom_may_contain (filter, key, key_len);
+    pthread_mutex_unlock (&db->filter_lock);
+    return found;
+}
+
+static void table_filter_add (Database *db, Table *t, void *key,
+                              uint32_t key_len)
+{
+    pthread_mutex_lock (&db->filter_lock);
+    // without a filter it is built with the key when first needed
+    if (t->key_filter)
+    {
+        filter_add_key (t->key_filter, t, NULL, key, key_len);
+        if (bloom_is_full (t->key_filter))
+        {
+            bloom_destroy (t->key_filter);
+            t->key_filter = NULL;
+        }
+    }
+    pthread_mutex_unlock (&db->filter_lock);
+}
+
+/**
+ * index_filter - the filter of the column values of a btree index, values
+ * it does not contain are in no entry
+ *
+ * Hash indexes have none, a lookup already reads a single bucket. An index
+ * gets its filter once it is ready.
+ *
+ * Return: the filter, NULL if the index has none
+ */
+static BloomFilter *index_filter (Database *db, Table *t, Index *idx)
+{
+    if (idx->method == INDEX_HASH || idx->state != INDEX_READY)
+    {
+        return NULL;
+    }
+    if (!idx->filter)
+    {
+        idx->filter = filter_build (db, t, idx, idx->root_page_num);
+    }
+    return idx->filter;
+}
+
+/**
+ * index_may_contain - asks the filter of an index for encoded values of its
+ * leading columns
+ *
+ * Return: false if no entry starts with the values
+ */
+static bool index_may_contain (Database *db, Table *t, Index *idx,
+                               uint8_t *prefix, uint32_t prefix_len)
+{
+    pthread_mutex_lock (&db->filter_lock);
+    BloomFilter *filter = index_filter (db, t, idx);
+    bool found = !filter || bloom_may_contain (filter, prefix, prefix_len);
+    pthread_mutex_unlock (&db->filter_lock);
+    return found;
+}
+
+// @key: an entry of the index, see index_encode_entry
+static void index_filter_add (Database *db, Table *t, Index *idx,
+                              uint8_t *key, uint32_t key_len)
+{
+    pthread_mutex_lock (&db->filter_lock);
+    if (idx->filter)
+    {
+        filter_add_key (idx->filter, t, idx, key, key_len);
+        if (bloom_is_full (idx->filter))
+        {
+            bloom_destroy (idx->filter);
+            idx->filter = NULL;
+        }
+    }
+    pthread_mutex_unlock (&db->filter_lock);
+}
+
+/**
+ * index_scan_begin - positions a scan on the first entry of an index whose
+ * leading columns equal the encoded values in @prefix
+ *
+ * Index keys are [ values | pk ], btree matches share the prefix and are
+ * next to each other. A hash index is only scanned with all of its columns,
+ * the matches are in the bucket of their values.
+ */
+static void index_scan_begin (Database *db, Table *t, Index *idx,
+                              uint8_t *prefix, uint32_t prefix_len,
+                              IndexScan *s)
+{
+    s->t = t;
+    s->idx = idx;
+    s->prefix = prefix;
+    s->prefix_len = prefix_len;
+    s->ahead = 0;
+
+    if (idx->method == INDEX_HASH)
+    {
+        hash_cursor_seek (db, idx->root_page_num, prefix, prefix_len,
+                          &s->hash);
+    }
+    else
+    {
+        // values the filter has never seen are in no entry
+        if (!index_may_contain (db, t, idx, prefix, prefix_len))
+        {
+            s->btree.page = NULL;
+            return;
+        }
+        btree_cursor_seek (db, idx->root_page_num, prefix, prefix_len,
+                           &s->btree);
+    }
+}
+
+static bool index_scan_valid (IndexScan *s)
+{
+    if (s->idx->method == INDEX_HASH)
+    {
+        return hash_cursor_valid (&s->hash);
+    }
+    if (!btree_cursor_valid (&s->btree))
+    {
+        return false;
+    }
+
+    void *key, *val;
+    uint32_t key_len, val_len;
+    btree_cursor_get (&s->btree, &key, &key_len, &val, &val_len);
+    return key_len >= s->prefix_len
+           && memcmp (key, s->prefix, s->prefix_len) == 0;
+}
+
+static void index_scan_next (IndexScan *s)
+{
+    if (s->idx->method == INDEX_HASH)
+    {
+        hash_cursor_next (&s->hash);
+    }
+    else
+    {
+        btree_cursor_next (&s->btree);
+    }
+}
+
+static void index_scan_get (IndexScan *s, void **key, uint32_t *key_len,
+                            void **val, uint32_t *val_len)
+{
+    if (s->idx->method == INDEX_HASH)
+    {
+        hash_cursor_get (&s->hash, key, key_len, val, val_len);
+    }
+    else
+    {
+        btree_cursor_get (&s->btree, key, key_len, val, val_len);
+    }
+}
+
+/**
+ * table_row_key_len - the length of the row key at the start of @key
+ */
+static uint32_t table_row_key_len (Table *t, void *key)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        return HEAP_ROW_ID_SIZE;
+    }
+    int pk_idx = table_find_primary_key_index (t);
+    return key_decode (t->columns[pk_idx == -1 ? 0 : pk_idx].type, key, NULL,
+                       NULL);
+}
+
+/**
+ * index_scan_pk - the row key of the entry under the scan, the encoded
+ * primary key or the row ID in a heap table
+ */
+static void index_scan_pk (IndexScan *s, void **pk, uint32_t *pk_len)
+{
+    void *key;
+    uint32_t key_len;
+    index_scan_get (s, &key, &key_len, pk, pk_len);
+
+    // the included columns follow the primary key in the value
+    if (s->idx->include_count > 0)
+    {
+        *pk_len = table_row_key_len (s->t, *pk);
+    }
+}
+
+/**
+ * index_scan_ahead - asks the pager for the heap pages of the next
+ * INDEX_READ_AHEAD matches once the rows asked for before are used up, so
+ * they are read while the scan works through them
+ *
+ * Called once per match. A btree table is left alone, finding the leaf of
+ * a primary key takes a descent.
+ */
+static void index_scan_ahead (Database *db, IndexScan *s)
+{
+    if (s->t->organization != TABLE_HEAP || s->ahead-- > 0)
+    {
+        return;
+    }
+
+    IndexScan ahead = *s;
+    s->ahead = 0;
+    while (s->ahead < INDEX_READ_AHEAD && index_scan_valid (&ahead))
+    {
+        void *row_id;
+        uint32_t row_id_len;
+        index_scan_pk (&ahead, &row_id, &row_id_len);
+        pager_prefetch (db->pager, heap_row_id_page (row_id));
+        index_scan_next (&ahead);
+        s->ahead++;
+    }
+    s->ahead--; // this match
+}
+
+/**
+ * index_covers - whether an index stores every column a SELECT on t
+ * projects or filters on, so that the rows need not be read
+ *
+ * The key holds the index columns and the primary key, the value the
+ * included columns. Entries of a heap table hold a row ID instead.
+ */
+static bool index_covers (Table *t, Index *idx, ColMap *cols, int col_count,
+                          WherePred *preds, int pred_count)
+{
+    int pk_idx = table_find_primary_key_index (t);
+    bool stored[MAX_COLUMNS] = {0};
+    stored[pk_idx == -1 ? 0 : pk_idx] = t->organization == TABLE_BTREE;
+    for (int i = 0; i < idx->col_count + idx->include_count; i++)
+    {
+        str8 name = i < idx->col_count
+                        ? idx->col_names[i]
+                        : idx->include_names[i - idx->col_count];
+        int col = table_find_col_index (t, name);
+        if (col != -1)
+        {
+            stored[col] = true;
+        }
+    }
+
+    for (int i = 0; i < col_count; i++)
+    {
+        if (cols[i].t != t || !stored[cols[i].idx])
+        {
+            return false;
+        }
+    }
+    for (int i = 0; i < pred_count; i++)
+    {
+        if (preds[i].t != t || !stored[preds[i].col_idx])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * index_scan_values - decodes the columns stored in the entry under the
+ * scan, see index_covers
+ * @row_vals: indexed by table column, the other columns are left unset
+ */
+static void index_scan_values (IndexScan *s, str8 *row_vals, Arena *arena)
+{
+    Table *t = s->t;
+    Index *idx = s->idx;
+    void *key, *val;
+    uint32_t key_len, val_len;
+    index_scan_get (s, &key, &key_len, &val, &val_len);
+
+    uint8_t *p = (uint8_t *) key;
+    for (int i = 0; i < idx->col_count; i++)
+    {
+        int col = table_find_col_index (t, idx->col_names[i]);
+        p += key_decode (t->columns[col].type, p, &row_vals[col], arena);
+    }
+
+    if (t->organization == TABLE_BTREE)
+    {
+        int pk_idx = table_find_primary_key_index (t);
+        key_decode (t->columns[pk_idx == -1 ? 0 : pk_idx].type, p,
+                    &row_vals[pk_idx == -1 ? 0 : pk_idx], arena);
+    }
+
+    p = (uint8_t *) val;
+    p += table_row_key_len (t, p);
+    for (int i = 0; i < idx->include_count; i++)
+    {
+        int col = table_find_col_index (t, idx->include_names[i]);
+        if (t->columns[col].type == TYPE_INT)
+        {
+            int32_t v;
+            memcpy (&v, p, sizeof (int32_t));
+            p += sizeof (int32_t);
+
+            char *buf = push_array_no_zero (arena, char, 32);
+            int len = snprintf (buf, 32, "%d", v);
+            row_vals[col] =
+                str8_from_range ((uint8_t *) buf, (uint8_t *) buf + len);
+        }
+        else
+        {
+            uint32_t len;
+            memcpy (&len, p, sizeof (uint32_t));
+            p += sizeof (uint32_t);
+            row_vals[col] = str8_from_range (p, p + len);
+            p += len;
+        }
+    }
+}
+
+/**
+ * values_match_where - row_matches_where on decoded values
+ */
+static bool values_match_where (Table *t, str8 *row_vals, WherePred *preds,
+                                int pred_count)
+{
+    for (int i = 0; i < pred_count; i++)
+    {
+        WherePred *pred = &preds[i];
+        if (pred->t != t)
+        {
+            continue;
+        }
+
+        str8 val = row_vals[pred->col_idx];
+        if (t->columns[pred->col_idx].type == TYPE_INT)
+        {
+            char temp[32];
+            snprintf (temp, sizeof (temp), "%.*s", STR_FMT (val));
+            if (atoi (temp) != pred->int_value)
+            {
+                return false;
+            }
+        }
+        else if (!str8_match (val, pred->value, false))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * index_collect_keys - copies the primary keys of the rows whose indexed
+ * column equals a value, so that the rows can change while they are visited
+ *
+ * Return: the keys, NULL if they do not fit in the arena
+ */
+static str8 *index_collect_keys (Database *db, Table *t, Index *idx,
+                                 uint8_t *prefix, uint32_t prefix_len,
+                                 Arena *arena, int *key_count)
+{
+    int count = 0;
+    IndexScan s;
+    for (index_scan_begin (db, t, idx, prefix, prefix_len, &s);
+         index_scan_valid (&s); index_scan_next (&s))
+    {
+        count++;
+    }
+
+    Temp_Arena_Memory mark = temp_arena_memory_begin (arena);
+    str8 *keys = push_array_no_zero (arena, str8, count + 1);
+    if (!keys)
+    {
+        return NULL;
+    }
+
+    int i = 0;
+    for (index_scan_begin (db, t, idx, prefix, prefix_len, &s);
+         index_scan_valid (&s); index_scan_next (&s))
+    {
+        void *pk;
+        uint32_t pk_len;
+        index_scan_pk (&s, &pk, &pk_len);
+
+        keys[i].str = push_array_no_zero (arena, uint8_t, pk_len);
+        if (!keys[i].str)
+        {
+            temp_arena_memory_end (mark);
+            return NULL;
+        }
+        memcpy (keys[i].str, pk, pk_len);
+        keys[i].len = pk_len;
+        i++;
+    }
+
+    *key_count = count;
+    return keys;
+}
+
+/**
+ * table_cursor_first - positions a cursor on the first row of a table, in
+ * key order for a btree table and storage order for a heap table
+ */
+static void table_cursor_first (Database *db, Table *t, BTreeCursor *c)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        heap_cursor_first (db, t->root_page_num, c);
+    }
+    else
+    {
+        btree_cursor_first (db, t->root_page_num, c);
+    }
+}
+
+/**
+ * table_cursor_seek - positions a cursor on the row with a row key
+ *
+ * A btree cursor lands on the first key not below @key, a heap cursor is
+ * invalid if the row is gone.
+ */
+static void table_cursor_seek (Database *db, Table *t, void *key,
+                               uint32_t key_len, BTreeCursor *c)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        heap_cursor_seek (db, key, c);
+    }
+    else
+    {
+        btree_cursor_seek (db, t->root_page_num, key, key_len, c);
+    }
+}
+
+/**
+ * table_find_row - copies the row with a row key
+ * @row: BTREE_CELL_BUFFER_SIZE bytes for the row
+ *
+ * Return: false if there is no such row
+ */
+static bool table_find_row (Database *db, Table *t, void *key,
+                            uint32_t key_len, void *row, uint32_t *row_len)
+{
+    if (t->organization == TABLE_BTREE)
+    {
+        return btree_find_key (db, t->root_page_num, key, key_len, row,
+                               row_len);
+    }
+
+    BTreeCursor c;
+    heap_cursor_seek (db, key, &c);
+    bool found = btree_cursor_valid (&c);
+    if (found)
+    {
+        void *row_key, *val;
+        uint32_t row_key_len;
+        btree_cursor_get (&c, &row_key, &row_key_len, &val, row_len);
+        memcpy (row, val, *row_len);
+    }
+    pager_unpin_to (db->pager, c.mark);
+    return found;
+}
+
+/**
+ * table_store_row - stores a new row
+ *
+ * A heap table writes the row ID it picks into e->key.
+ *
+ * Return: false if the key is taken or the table is full
+ */
+static bool table_store_row (Database *db, Table *t, BatchEntry *e)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        return heap_insert (db, t->root_page_num, e->val, e->val_len, e->key)
+               == HEAP_OK;
+    }
+
+    if (btree_insert (db, t->root_page_num, e->key, e->key_len, e->val,
+                      e->val_len)
+        != BTREE_OK)
+    {
+        return false;
+    }
+    table_filter_add (db, t, e->key, e->key_len);
+    return true;
+}
+
+// the first page of the rows of a table, 0 if there is none
+static uint32_t table_first_page (Database *db, Table *t)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        return heap_first_page (db, t->root_page_num);
+    }
+    return btree_first_leaf (db, t->root_page_num);
+}
+
+/**
+ * table_reclaim - gives back the space deletes left in a table and its
+ * indexes once the statement is done with its cursors: heap pages without
+ * rows are freed, sparse btree nodes merged or evened out
+ */
+static void table_reclaim (Database *db, Table *t)
+{
+    if (t->organization == TABLE_HEAP)
+    {
+        heap_free_empty_pages (db, t->root_page_num);
+    }
+    else
+    {
+        btree_rebalance (db, t->root_page_num);
+    }
+
+    for (int i = 0; i < db->index_count; i++)
+    {
+        Index *idx = &db->indexes[i];
+        if (idx->state == INDEX_READY && idx->method == INDEX_BTREE
+            && str8_match (idx->table_name, t->table_name, true))
+        {
+            btree_rebalance (db, idx->root_page_num);
+        }
+    }
+}
+
+/**
+ * row_scan_begin - positions a scan on the first row of a table to visit
+ * @keys: primary keys of the rows to visit, NULL to visit every row
+ *
+ * Keys whose row is gone are skipped.
+ */
+static void row_scan_begin (RowScan *s, Database *db, Table *t, str8 *keys,
+                            int key_count)
+{
+    s->db = db;
+    s->t = t;
+    s->keys = keys;
+    s->key_count = key_count;
+    s->next_key = 0;
+    s->mark = pager_pin_mark (db->pager);
+
+    if (keys)
+    {
+        row_scan_next (s);
+    }
+    else
+    {
+        table_cursor_first (db, t, &s->c);
+    }
+}
+
+static void row_scan_next (RowScan *s)
+{
+    if (!s->keys)
+    {
+        btree_cursor_next (&s->c);
+        return;
+    }
+
+    while (s->next_key < s->key_count)
+    {
+        str8 key = s->keys[s->next_key++];
+        pager_unpin_to (s->db->pager, s->mark);
+        table_cursor_seek (s->db, s->t, key.str, key.len, &s->c);
+        if (!btree_cursor_valid (&s->c))
+        {
+            continue;
+        }
+
+        void *row_key, *row;
+        uint32_t row_key_len, row_len;
+        btree_cursor_get (&s->c, &row_key, &row_key_len, &row, &row_len);
+        if (btree_key_compare (row_key, row_key_len, key.str, key.len) == 0)
+        {
+            return;
+        }
+    }
+    s->c.page = NULL;
+}
+
+/**
+ * send_row - formats the projected columns of a row and sends them
+ * @t1_vals: values of the FROM table
+ * @t2_vals: values of the JOIN table, or NULL
+ *
+ * Return: false if the client is gone
+ */
+static bool send_row (int client_fd, ColMap *cols, int col_count, Table *t1,
+                      str8 *t1_vals, str8 *t2_vals)
+{
+    char buffer[4096];
+    int b = 0;
+    b += snprintf (buffer + b, sizeof (buffer) - b, "(");
+
+    for (int k = 0; k < col_count; k++)
+    {
+        if (b >= sizeof (buffer) - 10)
+            break;
+
+        ColMap map = cols[k];
+        str8 val = (map.t == t1) ? t1_vals[map.idx] : t2_vals[map.idx];
+        bool is_text = map.t->columns[map.idx].type == TYPE_TEXT;
+
+        if (k > 0)
+            b += snprintf (buffer + b, sizeof (buffer) - b, ", ");
+        if (is_text)
+            b += snprintf (buffer + b, sizeof (buffer) - b, "\"%.*s\"",
+                           STR_FMT (val));
+        else
+            b += snprintf (buffer + b, sizeof (buffer) - b, "%.*s",
+                           STR_FMT (val));
+    }
+
+    if (b < sizeof (buffer) - 2)
+        b += snprintf (buffer + b, sizeof (buffer) - b, ")\n");
+    else
+    {
+        b = sizeof (buffer);
+        buffer[sizeof (buffer) - 2] = ')';
+        buffer[sizeof (buffer) - 1] = '\n';
+    }
+
+    return send (client_fd, buffer, b, MSG_NOSIGNAL) != -1;
 }
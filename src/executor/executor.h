@@ -1,6 +1,7 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
+#include "../btree/btree.h"
 #include "../db/db.h"
 #include "../parser/parser.h"
 
@@ -17,10 +18,28 @@ typedef enum
     EXECUTE_COL_NOT_FOUND,
 
     EXECUTE_DUPLICATE_KEY,
+    EXECUTE_ROW_TOO_LARGE,
+
+    EXECUTE_FILE_ERROR,
+    EXECUTE_FILE_NOT_ALLOWED,
+    EXECUTE_INVALID_VALUE,
 
     EXECUTE_FAIL
 } ExecuteResult;
 
-ExecuteResult execute_statement (Statement *stmt, Database *db, int client_fd);
+// where a vacuum of a table and its indexes is, zeroed to start one
+typedef struct
+{
+    int tree;         // 0 for the table, i + 1 for index slot i
+    uint32_t pos;     // heap data page or hash directory entry to visit next
+    uint32_t key_len; // btree leaf to visit next, 0 for the first one
+    uint8_t key[BTREE_CELL_BUFFER_SIZE];
+} VacuumState;
+
+ExecuteResult execute_statement (Statement *stmt, Database *db, Arena *arena,
+                                 int client_fd);
+bool execute_runs_shared (Statement *stmt, Database *db);
+bool vacuum_step_latched (Database *db, Table *t, VacuumState *v);
+bool vacuum_table_step (Database *db, Table *t, VacuumState *v);
 
 #endif /* EXECUTOR_H */
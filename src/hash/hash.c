@@ -0,0 +1,613 @@
+#include "hash.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// hash bits that may ever address the directory
+#define HASH_MAX_MASK ((1u << HASH_MAX_GLOBAL_DEPTH) - 1)
+
+/**
+ * hash_bytes - FNV-1a with a final avalanche, so that the low bits that
+ * address the directory depend on every byte
+ */
+uint32_t hash_bytes (void *data, uint32_t len)
+{
+    uint8_t *p = (uint8_t *) data;
+    uint32_t h = 2166136261u;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static void hash_bucket_init (void *node, uint8_t local_depth)
+{
+    initialize_leaf_node (node);
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    header->node_type = NODE_HASH_BUCKET;
+    header->is_root = local_depth;
+}
+
+static SlottedPageHeader *hash_page (Database *db, uint32_t page_num)
+{
+    return (SlottedPageHeader *) pager_get_page (db->pager, page_num);
+}
+
+static uint32_t hash_bucket_num (HashDirectory *dir, uint32_t hash)
+{
+    return dir->buckets[hash & ((1u << dir->global_depth) - 1)];
+}
+
+/**
+ * hash_cell_code - the hash stored in front of the value of a cell
+ */
+static uint32_t hash_cell_code (void *node, int slot)
+{
+    void *key, *val;
+    uint32_t key_len, val_len;
+    slot_get_content (node, slot, &key, &key_len, &val, &val_len);
+
+    uint32_t hash;
+    memcpy (&hash, val, HASH_CODE_SIZE);
+    return hash;
+}
+
+/**
+ * hash_chain_find - looks for a live cell with exactly this key in a bucket
+ * and its overflow pages
+ * @out_page_num: set to the page of the cell
+ *
+ * Return: slot of the cell, -1 if there is none
+ */
+static int hash_chain_find (Database *db, uint32_t page_num, uint32_t hash,
+                            void *key, uint32_t key_len,
+                            uint32_t *out_page_num)
+{
+    while (page_num != 0)
+    {
+        SlottedPageHeader *header = hash_page (db, page_num);
+
+        for (int i = 0; i < header->num_cells; i++)
+        {
+            if (PAGE_SLOTS (header)[i].size == 0)
+            {
+                continue;
+            }
+
+            void *cell_key, *val;
+            uint32_t cell_klen, val_len;
+            slot_get_content (header, i, &cell_key, &cell_klen, &val,
+                              &val_len);
+            if (cell_klen == key_len && hash_cell_code (header, i) == hash
+                && memcmp (cell_key, key, key_len) == 0)
+            {
+                *out_page_num = page_num;
+                return i;
+            }
+        }
+        page_num = header->next_leaf;
+    }
+    return -1;
+}
+
+/**
+ * hash_init - turns a page into the directory of an empty hash index with
+ * one bucket
+ */
+HashResult hash_init (Database *db, uint32_t dir_page_num)
+{
+    uint32_t bucket_num = pager_allocate_page (db->pager);
+    if (bucket_num == 0)
+    {
+        return HASH_FULL;
+    }
+
+    uint32_t mark = pager_pin_mark (db->pager);
+    hash_bucket_init (hash_page (db, bucket_num), 0);
+    pager_mark_dirty (db->pager, bucket_num);
+
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+    dir->node_type = NODE_HASH_DIRECTORY;
+    dir->global_depth = 0;
+    dir->reserved = 0;
+    dir->buckets[0] = bucket_num;
+    pager_mark_dirty (db->pager, dir_page_num);
+    pager_unpin_to (db->pager, mark);
+    return HASH_OK;
+}
+
+/**
+ * hash_bucket_rebuild - rewrites the live cells of a bucket chain, dropping
+ * its tombstones
+ * @split: move the cells whose next hash bit is set to a new bucket, both
+ * buckets get one more bit of local depth
+ * @heads: set to the first page of the bucket and of the new bucket
+ *
+ * The pages of the chain are reused before new ones are allocated, the
+ * bucket keeps its first page. Pages left over go to the free list.
+ *
+ * Return: HASH_FULL, with the chain untouched, if pages run out
+ */
+static HashResult hash_bucket_rebuild (Database *db, uint32_t bucket_num,
+                                       bool split, uint32_t heads[2])
+{
+    // no page pointer is kept, each page is let go once it was read
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t *chain = NULL;
+    int chain_len = 0;
+    int chain_cap = 0;
+    for (uint32_t page_num = bucket_num; page_num != 0;)
+    {
+        if (chain_len == chain_cap)
+        {
+            chain_cap = chain_cap ? 2 * chain_cap : 16;
+            uint32_t *grown = realloc (chain, chain_cap * sizeof (uint32_t));
+            if (!grown)
+            {
+                free (chain);
+                return HASH_FULL;
+            }
+            chain = grown;
+        }
+        chain[chain_len++] = page_num;
+        page_num = hash_page (db, page_num)->next_leaf;
+        pager_unpin_to (db->pager, mark);
+    }
+
+    uint8_t depth = hash_page (db, bucket_num)->is_root;
+    pager_unpin_to (db->pager, mark);
+    uint8_t new_depth = split ? depth + 1 : depth;
+
+    uint8_t *copy = malloc ((size_t) chain_len * PAGE_SIZE);
+    if (!copy)
+    {
+        free (chain);
+        return HASH_FULL;
+    }
+
+    // count the pages of each side, filled in chain order like below
+    int needed[2] = {1, split ? 1 : 0};
+    uint32_t used[2] = {sizeof (SlottedPageHeader),
+                        sizeof (SlottedPageHeader)};
+    for (int p = 0; p < chain_len; p++)
+    {
+        void *node = copy + (size_t) p * PAGE_SIZE;
+        memcpy (node, hash_page (db, chain[p]), PAGE_SIZE);
+        pager_unpin_to (db->pager, mark);
+
+        SlottedPageHeader *header = (SlottedPageHeader *) node;
+        for (int i = 0; i < header->num_cells; i++)
+        {
+            uint32_t cell_size = PAGE_SLOTS (node)[i].size;
+            if (cell_size == 0)
+            {
+                continue;
+            }
+
+            int side = split && (hash_cell_code (node, i) >> depth) & 1;
+            cell_size += sizeof (Slot);
+            if (used[side] + cell_size > PAGE_SIZE)
+            {
+                needed[side]++;
+                used[side] = sizeof (SlottedPageHeader);
+            }
+            used[side] += cell_size;
+        }
+    }
+
+    uint32_t *lists[2];
+    lists[0] = malloc ((size_t) (needed[0] + needed[1]) * sizeof (uint32_t));
+    if (!lists[0])
+    {
+        free (copy);
+        free (chain);
+        return HASH_FULL;
+    }
+    lists[1] = lists[0] + needed[0];
+    int lens[2] = {0, 0};
+    int next_chain = 0;
+    for (int side = 0; side < 2; side++)
+    {
+        for (int n = 0; n < needed[side]; n++)
+        {
+            uint32_t page_num = next_chain < chain_len
+                                    ? chain[next_chain++]
+                                    : pager_allocate_page (db->pager);
+            if (page_num == 0)
+            {
+                free (lists[0]);
+                free (copy);
+                free (chain);
+                return HASH_FULL;
+            }
+            lists[side][lens[side]++] = page_num;
+        }
+    }
+    while (next_chain < chain_len)
+    {
+        pager_free_page (db->pager, chain[next_chain++]);
+    }
+
+    for (int side = 0; side < 2; side++)
+    {
+        for (int n = 0; n < lens[side]; n++)
+        {
+            SlottedPageHeader *header = hash_page (db, lists[side][n]);
+            hash_bucket_init (header, new_depth);
+            header->next_leaf = n + 1 < lens[side] ? lists[side][n + 1] : 0;
+            pager_mark_dirty (db->pager, lists[side][n]);
+            pager_unpin_to (db->pager, mark);
+        }
+    }
+
+    int tails[2] = {0, 0};
+    for (int p = 0; p < chain_len; p++)
+    {
+        void *node = copy + (size_t) p * PAGE_SIZE;
+        SlottedPageHeader *header = (SlottedPageHeader *) node;
+
+        for (int i = 0; i < header->num_cells; i++)
+        {
+            if (PAGE_SLOTS (node)[i].size == 0)
+            {
+                continue;
+            }
+
+            void *key, *val;
+            uint32_t key_len, val_len;
+            slot_get_content (node, i, &key, &key_len, &val, &val_len);
+
+            int side = split && (hash_cell_code (node, i) >> depth) & 1;
+            void *dest = hash_page (db, lists[side][tails[side]]);
+            if (!pager_slotted_insert (dest, key, key_len, val, val_len))
+            {
+                dest = hash_page (db, lists[side][++tails[side]]);
+                pager_slotted_insert (dest, key, key_len, val, val_len);
+            }
+            pager_mark_dirty (db->pager, lists[side][tails[side]]);
+            pager_unpin_to (db->pager, mark);
+        }
+    }
+
+    heads[0] = lists[0][0];
+    heads[1] = split ? lists[1][0] : 0;
+    free (lists[0]);
+    free (copy);
+    free (chain);
+    return HASH_OK;
+}
+
+/**
+ * hash_bucket_split - splits a bucket on its next hash bit, doubling the
+ * directory first if the bucket uses all of its bits
+ */
+static HashResult hash_bucket_split (Database *db, uint32_t dir_page_num,
+                                     uint32_t bucket_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint8_t depth = hash_page (db, bucket_num)->is_root;
+    pager_unpin_to (db->pager, mark);
+
+    uint32_t heads[2];
+    HashResult result = hash_bucket_rebuild (db, bucket_num, true, heads);
+    if (result != HASH_OK)
+    {
+        return result;
+    }
+
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+    if (depth == dir->global_depth)
+    {
+        uint32_t size = 1u << dir->global_depth;
+        memcpy (dir->buckets + size, dir->buckets, size * sizeof (uint32_t));
+        dir->global_depth++;
+    }
+
+    for (uint32_t i = 0; i < (1u << dir->global_depth); i++)
+    {
+        if (dir->buckets[i] == bucket_num && (i >> depth) & 1)
+        {
+            dir->buckets[i] = heads[1];
+        }
+    }
+    pager_mark_dirty (db->pager, dir_page_num);
+    pager_unpin_to (db->pager, mark);
+    return HASH_OK;
+}
+
+/**
+ * hash_insert_cell - does the work of hash_insert, the pages it reads stay
+ * pinned
+ */
+static HashResult hash_insert_cell (Database *db, uint32_t dir_page_num,
+                                    void *key, uint32_t key_len,
+                                    uint32_t hash, void *cell_val,
+                                    uint32_t cell_val_len)
+{
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+    uint32_t found_page;
+    if (hash_chain_find (db, hash_bucket_num (dir, hash), hash, key, key_len,
+                         &found_page)
+        != -1)
+    {
+        return HASH_DUPLICATE;
+    }
+
+    for (;;)
+    {
+        uint32_t bucket_num = hash_bucket_num (dir, hash);
+        uint32_t last_num = bucket_num;
+        bool has_tombstones = false;
+        bool splittable = false;
+
+        for (uint32_t page_num = bucket_num; page_num != 0;)
+        {
+            SlottedPageHeader *header = hash_page (db, page_num);
+            if (pager_slotted_insert (header, key, key_len, cell_val,
+                                      cell_val_len))
+            {
+                pager_mark_dirty (db->pager, page_num);
+                return HASH_OK;
+            }
+
+            for (int i = 0; i < header->num_cells; i++)
+            {
+                if (PAGE_SLOTS (header)[i].size == 0)
+                {
+                    has_tombstones = true;
+                }
+                else if ((hash_cell_code (header, i) ^ hash) & HASH_MAX_MASK)
+                {
+                    splittable = true;
+                }
+            }
+            last_num = page_num;
+            page_num = header->next_leaf;
+        }
+
+        uint8_t depth = hash_page (db, bucket_num)->is_root;
+        HashResult result;
+        if (has_tombstones)
+        {
+            uint32_t heads[2];
+            result = hash_bucket_rebuild (db, bucket_num, false, heads);
+        }
+        else if (splittable && depth < HASH_MAX_GLOBAL_DEPTH)
+        {
+            result = hash_bucket_split (db, dir_page_num, bucket_num);
+        }
+        else
+        {
+            uint32_t overflow_num = pager_allocate_page (db->pager);
+            if (overflow_num == 0)
+            {
+                return HASH_FULL;
+            }
+            hash_bucket_init (hash_page (db, overflow_num), depth);
+            pager_mark_dirty (db->pager, overflow_num);
+
+            hash_page (db, last_num)->next_leaf = overflow_num;
+            pager_mark_dirty (db->pager, last_num);
+            result = HASH_OK;
+        }
+
+        if (result != HASH_OK)
+        {
+            return result;
+        }
+    }
+}
+
+/**
+ * hash_insert - inserts a cell into a hash index
+ * @hash_len: length of the key prefix that is hashed
+ *
+ * A full bucket is compacted if it has tombstones, split if its keys differ
+ * in a hash bit it does not use yet, and given an overflow page otherwise.
+ *
+ * Return: HASH_DUPLICATE if the key exists, HASH_FULL if pages run out
+ */
+HashResult hash_insert (Database *db, uint32_t dir_page_num, void *key,
+                        uint32_t key_len, uint32_t hash_len, void *val,
+                        uint32_t val_len)
+{
+    if (val_len > HASH_MAX_VALUE_SIZE)
+    {
+        return HASH_FULL;
+    }
+
+    uint32_t hash = hash_bytes (key, hash_len);
+    uint8_t cell_val[HASH_CODE_SIZE + HASH_VALUE_BUFFER_SIZE];
+    memcpy (cell_val, &hash, HASH_CODE_SIZE);
+    memcpy (cell_val + HASH_CODE_SIZE, val, val_len);
+
+    uint32_t mark = pager_pin_mark (db->pager);
+    HashResult result =
+        hash_insert_cell (db, dir_page_num, key, key_len, hash, cell_val,
+                          HASH_CODE_SIZE + val_len);
+    pager_unpin_to (db->pager, mark);
+    return result;
+}
+
+/**
+ * hash_free_pages - puts every bucket page of an index on the free list, the
+ * caller reuses or frees the directory
+ */
+void hash_free_pages (Database *db, uint32_t dir_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+    uint32_t bucket_mark = pager_pin_mark (db->pager);
+    for (uint32_t i = 0; i < (1u << dir->global_depth); i++)
+    {
+        // a bucket of local depth d is first listed at entry i < 2^d
+        uint32_t page_num = dir->buckets[i];
+        uint8_t local_depth = hash_page (db, page_num)->is_root;
+        pager_unpin_to (db->pager, bucket_mark);
+        if (i >= (1u << local_depth))
+        {
+            continue;
+        }
+
+        while (page_num != 0)
+        {
+            uint32_t next_num = hash_page (db, page_num)->next_leaf;
+            pager_unpin_to (db->pager, bucket_mark);
+            pager_free_page (db->pager, page_num);
+            page_num = next_num;
+        }
+    }
+    pager_unpin_to (db->pager, mark);
+}
+
+/**
+ * hash_vacuum_step - rebuilds the buckets of up to HASH_VACUUM_BUCKETS
+ * directory entries that have tombstones, emptied overflow pages go to the
+ * free list
+ * @entry: the first directory entry to visit, set to the next one
+ *
+ * Return: true if the last entry was visited
+ */
+bool hash_vacuum_step (Database *db, uint32_t dir_page_num, uint32_t *entry)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+    uint32_t size = 1u << dir->global_depth;
+    uint32_t end = *entry + HASH_VACUUM_BUCKETS < size
+                       ? *entry + HASH_VACUUM_BUCKETS
+                       : size;
+
+    for (uint32_t i = *entry; i < end; i++)
+    {
+        uint32_t bucket_num = dir->buckets[i];
+        if (i >= (1u << hash_page (db, bucket_num)->is_root))
+        {
+            continue;
+        }
+
+        for (uint32_t page_num = bucket_num; page_num != 0;)
+        {
+            SlottedPageHeader *header = hash_page (db, page_num);
+            if (pager_slotted_dead_space (header) > 0)
+            {
+                uint32_t heads[2];
+                hash_bucket_rebuild (db, bucket_num, false, heads);
+                break;
+            }
+            page_num = header->next_leaf;
+        }
+    }
+
+    *entry = end;
+    pager_unpin_to (db->pager, mark);
+    return end == size;
+}
+
+/**
+ * hash_delete - deletes a key by turning its slot into a tombstone
+ *
+ * Return: true if the key was found
+ */
+bool hash_delete (Database *db, uint32_t dir_page_num, void *key,
+                  uint32_t key_len, uint32_t hash_len)
+{
+    uint32_t hash = hash_bytes (key, hash_len);
+    uint32_t mark = pager_pin_mark (db->pager);
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+
+    uint32_t page_num;
+    int slot = hash_chain_find (db, hash_bucket_num (dir, hash), hash, key,
+                                key_len, &page_num);
+    if (slot != -1)
+    {
+        PAGE_SLOTS (hash_page (db, page_num))[slot].size = 0;
+        pager_mark_dirty (db->pager, page_num);
+    }
+    pager_unpin_to (db->pager, mark);
+    return slot != -1;
+}
+
+/**
+ * hash_cursor_seek - positions a cursor on the first cell whose key starts
+ * with a prefix, the prefix that was hashed when the cells were inserted
+ */
+void hash_cursor_seek (Database *db, uint32_t dir_page_num, void *prefix,
+                       uint32_t prefix_len, HashCursor *c)
+{
+    c->mark = pager_pin_mark (db->pager);
+    HashDirectory *dir = (HashDirectory *) hash_page (db, dir_page_num);
+
+    c->db = db;
+    c->hash = hash_bytes (prefix, prefix_len);
+    c->prefix = prefix;
+    c->prefix_len = prefix_len;
+    c->page_num = hash_bucket_num (dir, c->hash);
+    c->page = hash_page (db, c->page_num);
+    c->cell = -1;
+    hash_cursor_next (c);
+}
+
+bool hash_cursor_valid (HashCursor *c)
+{
+    return c->page != NULL;
+}
+
+/**
+ * hash_cursor_next - moves to the next matching cell of the bucket chain,
+ * the pages read since the seek are unpinned
+ */
+void hash_cursor_next (HashCursor *c)
+{
+    pager_unpin_to (c->db->pager, c->mark);
+    c->page = c->page ? hash_page (c->db, c->page_num) : NULL;
+    while (c->page)
+    {
+        SlottedPageHeader *header = (SlottedPageHeader *) c->page;
+
+        while (++c->cell < header->num_cells)
+        {
+            if (PAGE_SLOTS (c->page)[c->cell].size == 0
+                || hash_cell_code (c->page, c->cell) != c->hash)
+            {
+                continue;
+            }
+
+            void *key;
+            uint32_t key_len;
+            slot_get_key (c->page, c->cell, &key, &key_len);
+            if (key_len >= c->prefix_len
+                && memcmp (key, c->prefix, c->prefix_len) == 0)
+            {
+                return;
+            }
+        }
+
+        c->page_num = header->next_leaf;
+        pager_unpin_to (c->db->pager, c->mark);
+        c->page = c->page_num ? hash_page (c->db, c->page_num) : NULL;
+        c->cell = -1;
+    }
+}
+
+/**
+ * hash_cursor_get - reads the cell under the cursor, without its hash
+ */
+void hash_cursor_get (HashCursor *c, void **key, uint32_t *key_len,
+                      void **val, uint32_t *val_len)
+{
+    // a cursor positioned earlier may have moved and unpinned the page
+    c->page = hash_page (c->db, c->page_num);
+    slot_get_content (c->page, c->cell, key, key_len, val, val_len);
+    *val = (uint8_t *) *val + HASH_CODE_SIZE;
+    *val_len -= HASH_CODE_SIZE;
+}
@@ -0,0 +1,89 @@
+#ifndef HASH_H
+#define HASH_H
+#include "../btree/btree.h"
+#include "../db/db.h"
+#include "../pager/pager.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * EXTENDIBLE HASH INDEX
+ * ---------------------
+ * The root page of a hash index is its directory: 2^global_depth bucket
+ * page numbers, addressed by the low bits of the hash of a key.
+ *
+ * - Directory: [ header | bucket page number (4) ... ]
+ * - Buckets are slotted pages of unordered cells [ key | hash (4) | pk ].
+ *   is_root holds the local depth of a bucket, the number of low hash bits
+ *   all its keys share, next_leaf chains its overflow pages.
+ *
+ * Only a prefix of a key is hashed, for indexes that is the column value,
+ * so all the rows with one value are in the same bucket.
+ *
+ * A full bucket splits in two on its next hash bit, the directory doubles
+ * when the bucket already uses all global_depth bits. A bucket whose keys
+ * all have the same hash cannot be split and grows an overflow chain
+ * instead. A lookup reads the directory and one bucket page.
+ *
+ * The directory is a single page, so global_depth stops at
+ * HASH_MAX_GLOBAL_DEPTH: 4096 buckets with 32 KiB pages, 512 with 4 KiB.
+ * Past that a full bucket grows an overflow chain even when its keys could
+ * be split, which happens once the index holds about 4096 pages of entries.
+ * From there each bucket holds 1/4096 of the keys, so the chain a lookup,
+ * insert or delete walks grows linearly with the index, O(n) pages with a
+ * large constant. Directory pages are not chained.
+ */
+// 2^depth entries fill half the directory page, 4096 for 32 KiB pages
+#define HASH_MAX_GLOBAL_DEPTH  (__builtin_ctz (PAGE_SIZE) - 3)
+#define HASH_CODE_SIZE         sizeof (uint32_t)
+#define HASH_MAX_VALUE_SIZE    KEY_ENCODED_MAX (BTREE_MAX_CELL_SIZE)
+#define HASH_VALUE_BUFFER_SIZE KEY_ENCODED_MAX (BTREE_CELL_BUFFER_SIZE)
+#define HASH_VACUUM_BUCKETS    32 // directory entries a vacuum step visits
+
+typedef struct
+{
+    uint8_t node_type; // NODE_HASH_DIRECTORY
+    uint8_t global_depth;
+    uint16_t reserved;
+    uint32_t buckets[];
+} HashDirectory;
+
+typedef enum
+{
+    HASH_OK,
+    HASH_DUPLICATE,
+    HASH_FULL,
+} HashResult;
+
+// visits the cells whose key starts with a hashed prefix
+typedef struct
+{
+    Database *db;
+    uint32_t hash;
+    void *prefix; // must outlive the cursor
+    uint32_t prefix_len;
+    uint32_t page_num;
+    void *page; // NULL once no match is left
+    int cell;
+    uint32_t mark; // pins of the thread before the seek, a move unpins to it
+} HashCursor;
+
+uint32_t hash_bytes (void *data, uint32_t len);
+HashResult hash_init (Database *db, uint32_t dir_page_num);
+HashResult hash_insert (Database *db, uint32_t dir_page_num, void *key,
+                        uint32_t key_len, uint32_t hash_len, void *val,
+                        uint32_t val_len);
+bool hash_delete (Database *db, uint32_t dir_page_num, void *key,
+                  uint32_t key_len, uint32_t hash_len);
+void hash_free_pages (Database *db, uint32_t dir_page_num);
+bool hash_vacuum_step (Database *db, uint32_t dir_page_num, uint32_t *entry);
+
+void hash_cursor_seek (Database *db, uint32_t dir_page_num, void *prefix,
+                       uint32_t prefix_len, HashCursor *c);
+bool hash_cursor_valid (HashCursor *c);
+void hash_cursor_next (HashCursor *c);
+void hash_cursor_get (HashCursor *c, void **key, uint32_t *key_len,
+                      void **val, uint32_t *val_len);
+
+#endif /* HASH_H */
@@ -0,0 +1,809 @@
+#include "heap.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// levels of directory pages a map of PAGE_SIZE_MIN pages needs to cover
+// every page number is 3
+#define HEAP_MAP_MAX_DEPTH 4
+
+static HeapMap *heap_map (Database *db, uint32_t map_page_num)
+{
+    return (HeapMap *) pager_get_page (db->pager, map_page_num);
+}
+
+static void heap_row_id_encode (uint32_t page_num, uint16_t slot,
+                                uint8_t *row_id)
+{
+    row_id[0] = (uint8_t) (page_num >> 24);
+    row_id[1] = (uint8_t) (page_num >> 16);
+    row_id[2] = (uint8_t) (page_num >> 8);
+    row_id[3] = (uint8_t) page_num;
+    row_id[4] = (uint8_t) (slot >> 8);
+    row_id[5] = (uint8_t) slot;
+}
+
+static void heap_row_id_decode (void *row_id, uint32_t *page_num,
+                                uint16_t *slot)
+{
+    uint8_t *r = (uint8_t *) row_id;
+    *page_num = ((uint32_t) r[0] << 24) | ((uint32_t) r[1] << 16)
+                | ((uint32_t) r[2] << 8) | (uint32_t) r[3];
+    *slot = (uint16_t) ((r[4] << 8) | r[5]);
+}
+
+// page numbers under one child of a directory page of the map at @level
+static uint64_t heap_map_span (int level)
+{
+    uint64_t span = HEAP_MAP_ENTRIES;
+    for (int l = 1; l < level; l++)
+    {
+        span *= HEAP_MAP_FANOUT;
+    }
+    return span;
+}
+
+/**
+ * heap_map_children - the children of a directory page of the map, the
+ * root has fewer as its header is larger
+ * @fanout: set to how many the page has room for
+ */
+static uint32_t *heap_map_children (HeapMapHeader *node, uint32_t node_num,
+                                    uint32_t map_page_num, uint32_t *fanout)
+{
+    if (node_num == map_page_num)
+    {
+        *fanout = HEAP_MAP_ROOT_FANOUT;
+        return ((HeapMap *) node)->children;
+    }
+    *fanout = HEAP_MAP_FANOUT;
+    return (uint32_t *) (node + 1);
+}
+
+static HeapMapEntry *heap_map_entries (HeapMapHeader *node)
+{
+    return (HeapMapEntry *) (node + 1);
+}
+
+/**
+ * heap_map_node_new - allocates an empty page of the map
+ *
+ * Return: page number, 0 if pages run out
+ */
+static uint32_t heap_map_node_new (Database *db, uint32_t map_page_num,
+                                   uint8_t level)
+{
+    uint32_t page_num = pager_allocate_page_like (db->pager, map_page_num);
+    if (page_num == 0)
+    {
+        return 0;
+    }
+    HeapMapHeader *node =
+        (HeapMapHeader *) pager_get_page (db->pager, page_num);
+    memset (node, 0, PAGE_SIZE);
+    node->node_type = NODE_HEAP_MAP;
+    node->level = level;
+    pager_mark_dirty (db->pager, page_num);
+    return page_num;
+}
+
+/**
+ * heap_map_grow - pushes the children of the root down into a new directory
+ * page, its only child, so the map covers HEAP_MAP_FANOUT times as many
+ * page numbers
+ *
+ * Return: false if pages run out
+ */
+static bool heap_map_grow (Database *db, uint32_t map_page_num)
+{
+    HeapMap *map = heap_map (db, map_page_num);
+    if (map->header.count > 0)
+    {
+        uint32_t page_num =
+            heap_map_node_new (db, map_page_num, map->header.level);
+        if (page_num == 0)
+        {
+            return false;
+        }
+        HeapMapHeader *node =
+            (HeapMapHeader *) pager_get_page (db->pager, page_num);
+        memcpy (node + 1, map->children,
+                HEAP_MAP_ROOT_FANOUT * sizeof (uint32_t));
+        node->count = map->header.count;
+        memset (map->children, 0, HEAP_MAP_ROOT_FANOUT * sizeof (uint32_t));
+        map->children[0] = page_num;
+        map->header.count = 1;
+    }
+    map->header.level++;
+    pager_mark_dirty (db->pager, map_page_num);
+    return true;
+}
+
+/**
+ * heap_entry - finds the map entry of a data page, pinned
+ * @add: the page joins the table, the map pages its entry needs are added
+ * and the entry is counted
+ * @leaf_num: set to the map page of the entry if not NULL, for marking it
+ * dirty
+ *
+ * Return: the entry, NULL if the map has no page for it or pages run out
+ */
+static HeapMapEntry *heap_entry (Database *db, uint32_t map_page_num,
+                                 uint32_t page_num, bool add,
+                                 uint32_t *leaf_num)
+{
+    HeapMap *map = heap_map (db, map_page_num);
+    while (page_num >= HEAP_MAP_ROOT_FANOUT * heap_map_span (map->header.level))
+    {
+        if (!add || !heap_map_grow (db, map_page_num))
+        {
+            return NULL;
+        }
+    }
+
+    uint32_t node_num = map_page_num;
+    HeapMapHeader *node = &map->header;
+    uint64_t rest = page_num;
+    while (node->level > 0)
+    {
+        uint32_t fanout;
+        uint32_t *children =
+            heap_map_children (node, node_num, map_page_num, &fanout);
+        uint64_t span = heap_map_span (node->level);
+        uint32_t i = rest / span;
+        rest %= span;
+        if (children[i] == 0)
+        {
+            uint32_t child = add ? heap_map_node_new (db, map_page_num,
+                                                      node->level - 1)
+                                 : 0;
+            if (child == 0)
+            {
+                return NULL;
+            }
+            children[i] = child;
+            node->count++;
+            pager_mark_dirty (db->pager, node_num);
+        }
+        node_num = children[i];
+        node = (HeapMapHeader *) pager_get_page (db->pager, node_num);
+    }
+
+    HeapMapEntry *entry = &heap_map_entries (node)[rest];
+    if (add)
+    {
+        memset (entry, 0, sizeof (HeapMapEntry));
+        entry->used = 1;
+        node->count++;
+        pager_mark_dirty (db->pager, node_num);
+    }
+    if (leaf_num != NULL)
+    {
+        *leaf_num = node_num;
+    }
+    return entry;
+}
+
+/**
+ * heap_entry_release - clears the entry of a data page that leaves the
+ * table
+ *
+ * A map page left without entries is freed, and so is a directory page
+ * left without children, up to the root.
+ */
+static void heap_entry_release (Database *db, uint32_t map_page_num,
+                                uint32_t page_num)
+{
+    uint32_t path[HEAP_MAP_MAX_DEPTH];
+    uint32_t slots[HEAP_MAP_MAX_DEPTH];
+    int depth = 0;
+
+    uint32_t node_num = map_page_num;
+    HeapMapHeader *node = &heap_map (db, map_page_num)->header;
+    uint64_t rest = page_num;
+    uint32_t fanout;
+    while (node->level > 0)
+    {
+        uint32_t *children =
+            heap_map_children (node, node_num, map_page_num, &fanout);
+        uint64_t span = heap_map_span (node->level);
+        path[depth] = node_num;
+        slots[depth++] = rest / span;
+        rest %= span;
+        node_num = children[slots[depth - 1]];
+        node = (HeapMapHeader *) pager_get_page (db->pager, node_num);
+    }
+
+    memset (&heap_map_entries (node)[rest], 0, sizeof (HeapMapEntry));
+    node->count--;
+    pager_mark_dirty (db->pager, node_num);
+    while (node->count == 0 && depth > 0)
+    {
+        pager_free_page (db->pager, node_num);
+        node_num = path[--depth];
+        node = (HeapMapHeader *) pager_get_page (db->pager, node_num);
+        uint32_t *children =
+            heap_map_children (node, node_num, map_page_num, &fanout);
+        children[slots[depth]] = 0;
+        node->count--;
+        pager_mark_dirty (db->pager, node_num);
+    }
+}
+
+// the free list a data page belongs on, see HEAP TABLES in heap.h
+static uint8_t heap_free_list (HeapMapEntry *entry)
+{
+    if (entry->live == 0)
+    {
+        return HEAP_FREE_CLASSES;
+    }
+    return entry->free * HEAP_FREE_CLASSES / (PAGE_SIZE + 1);
+}
+
+// takes a data page off its free list
+static void heap_list_unlink (Database *db, uint32_t map_page_num,
+                              HeapMapEntry *entry)
+{
+    uint32_t leaf_num;
+    if (entry->list_prev != 0)
+    {
+        heap_entry (db, map_page_num, entry->list_prev, false, &leaf_num)
+            ->list_next = entry->list_next;
+        pager_mark_dirty (db->pager, leaf_num);
+    }
+    else
+    {
+        heap_map (db, map_page_num)->free_lists[entry->list] =
+            entry->list_next;
+        pager_mark_dirty (db->pager, map_page_num);
+    }
+    if (entry->list_next != 0)
+    {
+        heap_entry (db, map_page_num, entry->list_next, false, &leaf_num)
+            ->list_prev = entry->list_prev;
+        pager_mark_dirty (db->pager, leaf_num);
+    }
+}
+
+// puts a data page at the head of the free list it belongs on
+static void heap_list_push (Database *db, uint32_t map_page_num,
+                            uint32_t page_num, HeapMapEntry *entry)
+{
+    HeapMap *map = heap_map (db, map_page_num);
+    entry->list = heap_free_list (entry);
+    entry->list_prev = 0;
+    entry->list_next = map->free_lists[entry->list];
+    if (entry->list_next != 0)
+    {
+        uint32_t leaf_num;
+        heap_entry (db, map_page_num, entry->list_next, false, &leaf_num)
+            ->list_prev = page_num;
+        pager_mark_dirty (db->pager, leaf_num);
+    }
+    map->free_lists[entry->list] = page_num;
+    pager_mark_dirty (db->pager, map_page_num);
+}
+
+/**
+ * heap_entry_refile - moves a data page to another free list if its free
+ * bytes or live rows changed its class, the caller marks its entry dirty
+ */
+static void heap_entry_refile (Database *db, uint32_t map_page_num,
+                               uint32_t page_num, HeapMapEntry *entry)
+{
+    if (heap_free_list (entry) != entry->list)
+    {
+        heap_list_unlink (db, map_page_num, entry);
+        heap_list_push (db, map_page_num, page_num, entry);
+    }
+}
+
+/**
+ * heap_find_room - a data page with @need free bytes
+ *
+ * Every page on the list of a class above the one of @need has room, the
+ * head of its own list may. The lists are looked at from the fullest
+ * class up, so the large gaps are left for large rows, and the pages
+ * without live rows last.
+ *
+ * Return: page number, 0 if no page has room
+ */
+static uint32_t heap_find_room (Database *db, uint32_t map_page_num,
+                                uint32_t need)
+{
+    HeapMap *map = heap_map (db, map_page_num);
+    uint32_t first = need * HEAP_FREE_CLASSES / (PAGE_SIZE + 1);
+    for (uint32_t list = first; list < HEAP_FREE_LISTS; list++)
+    {
+        uint32_t page_num = map->free_lists[list];
+        if (page_num != 0
+            && heap_entry (db, map_page_num, page_num, false, NULL)->free
+                   >= need)
+        {
+            return page_num;
+        }
+    }
+    return 0;
+}
+
+/**
+ * heap_map_next - the first data page of the table at or after @from, in
+ * page number order, under the page of the map @node_num whose first entry
+ * is for page @base
+ *
+ * Return: 0 if there is none
+ */
+static uint32_t heap_map_next (Database *db, uint32_t map_page_num,
+                               uint32_t node_num, uint64_t base, uint64_t from)
+{
+    HeapMapHeader *node =
+        (HeapMapHeader *) pager_get_page (db->pager, node_num);
+    uint64_t skip = from > base ? from - base : 0;
+    if (node->level == 0)
+    {
+        HeapMapEntry *entries = heap_map_entries (node);
+        for (uint64_t i = skip; i < HEAP_MAP_ENTRIES; i++)
+        {
+            if (entries[i].used)
+            {
+                return base + i;
+            }
+        }
+        return 0;
+    }
+
+    uint32_t fanout;
+    uint32_t *children =
+        heap_map_children (node, node_num, map_page_num, &fanout);
+    uint64_t span = heap_map_span (node->level);
+    for (uint64_t i = skip / span; i < fanout; i++)
+    {
+        if (children[i] != 0)
+        {
+            uint32_t page_num = heap_map_next (db, map_page_num, children[i],
+                                               base + i * span, from);
+            if (page_num != 0)
+            {
+                return page_num;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * heap_init - turns a page into the free-space map of an empty heap
+ */
+void heap_init (Database *db, uint32_t map_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    HeapMap *map = heap_map (db, map_page_num);
+    memset (map, 0, PAGE_SIZE);
+    map->header.node_type = NODE_HEAP_MAP;
+    map->header.level = 1;
+    pager_mark_dirty (db->pager, map_page_num);
+    pager_unpin_to (db->pager, mark);
+}
+
+/**
+ * heap_add_page - allocates a data page and chains it after the last one
+ *
+ * Return: page number, 0 if pages run out
+ */
+static uint32_t heap_add_page (Database *db, uint32_t map_page_num)
+{
+    uint32_t page_num = pager_allocate_page_like (db->pager, map_page_num);
+    if (page_num == 0)
+    {
+        return 0;
+    }
+    uint32_t leaf_num;
+    HeapMapEntry *entry =
+        heap_entry (db, map_page_num, page_num, true, &leaf_num);
+    if (entry == NULL)
+    {
+        pager_free_page (db->pager, page_num);
+        return 0;
+    }
+
+    void *node = pager_get_page (db->pager, page_num);
+    initialize_leaf_node (node);
+    ((SlottedPageHeader *) node)->node_type = NODE_HEAP_PAGE;
+    pager_mark_dirty (db->pager, page_num);
+
+    HeapMap *map = heap_map (db, map_page_num);
+    entry->free = pager_slotted_free_space (node);
+    entry->prev = map->last_page;
+    if (map->last_page != 0)
+    {
+        uint32_t last_leaf;
+        heap_entry (db, map_page_num, map->last_page, false, &last_leaf)
+            ->next = page_num;
+        pager_mark_dirty (db->pager, last_leaf);
+        void *last_node = pager_get_page (db->pager, map->last_page);
+        ((SlottedPageHeader *) last_node)->next_leaf = page_num;
+        pager_mark_dirty (db->pager, map->last_page);
+    }
+    else
+    {
+        map->first_page = page_num;
+    }
+    map->last_page = page_num;
+    map->page_count++;
+    pager_mark_dirty (db->pager, map_page_num);
+    heap_list_push (db, map_page_num, page_num, entry);
+    return page_num;
+}
+
+/**
+ * heap_remove_page - unlinks a data page from the chain and frees it
+ */
+static void heap_remove_page (Database *db, uint32_t map_page_num,
+                              uint32_t page_num)
+{
+    HeapMap *map = heap_map (db, map_page_num);
+    HeapMapEntry entry = *heap_entry (db, map_page_num, page_num, false, NULL);
+    heap_list_unlink (db, map_page_num, &entry);
+    uint32_t leaf_num;
+    if (entry.prev != 0)
+    {
+        heap_entry (db, map_page_num, entry.prev, false, &leaf_num)->next =
+            entry.next;
+        pager_mark_dirty (db->pager, leaf_num);
+        SlottedPageHeader *prev =
+            (SlottedPageHeader *) pager_get_page (db->pager, entry.prev);
+        prev->next_leaf = entry.next;
+        pager_mark_dirty (db->pager, entry.prev);
+    }
+    else
+    {
+        map->first_page = entry.next;
+    }
+    if (entry.next != 0)
+    {
+        heap_entry (db, map_page_num, entry.next, false, &leaf_num)->prev =
+            entry.prev;
+        pager_mark_dirty (db->pager, leaf_num);
+    }
+    else
+    {
+        map->last_page = entry.prev;
+    }
+    map->page_count--;
+    pager_mark_dirty (db->pager, map_page_num);
+
+    heap_entry_release (db, map_page_num, page_num);
+    pager_free_page (db->pager, page_num);
+}
+
+/**
+ * heap_dead_slot - the first deleted slot of a page, num_cells if there is
+ * none
+ */
+static uint16_t heap_dead_slot (void *node, HeapMapEntry *entry)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    uint16_t slot = 0;
+    if (entry->live < header->num_cells)
+    {
+        while (slot < header->num_cells && PAGE_SLOTS (node)[slot].size != 0)
+        {
+            slot++;
+        }
+        return slot;
+    }
+    return header->num_cells;
+}
+
+/**
+ * heap_insert - stores a row on a data page with room for it
+ * @row_id: HEAP_ROW_ID_SIZE bytes, set to the ID of the new row
+ *
+ * The page is taken from the free lists, see heap_find_room. A new page is
+ * only allocated when no page has room. The row
+ * takes the slot of a deleted row if the page has one, and the page is
+ * compacted first if its free bytes are scattered.
+ *
+ * Return: HEAP_FULL if the database is out of pages
+ */
+HeapResult heap_insert (Database *db, uint32_t map_page_num, void *row,
+                        uint32_t row_len, uint8_t *row_id)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t payload = sizeof (uint32_t) + HEAP_ROW_ID_SIZE + row_len;
+    uint32_t need = payload + sizeof (Slot);
+
+    uint32_t page_num = heap_find_room (db, map_page_num, need);
+    if (page_num == 0)
+    {
+        page_num = heap_add_page (db, map_page_num);
+        if (page_num == 0)
+        {
+            pager_unpin_to (db->pager, mark);
+            return HEAP_FULL;
+        }
+    }
+    uint32_t leaf_num;
+    HeapMapEntry *entry =
+        heap_entry (db, map_page_num, page_num, false, &leaf_num);
+
+    void *node = pager_get_page (db->pager, page_num);
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+
+    if (pager_slotted_free_space (node) < need)
+    {
+        pager_slotted_compact (node, true);
+    }
+
+    uint16_t slot = heap_dead_slot (node, entry);
+    bool appended = slot == header->num_cells;
+    heap_row_id_encode (page_num, slot, row_id);
+    bool stored = appended ? pager_slotted_insert (node, row_id,
+                                                   HEAP_ROW_ID_SIZE, row,
+                                                   row_len)
+                           : pager_slotted_insert_into (node, slot, row_id,
+                                                        HEAP_ROW_ID_SIZE, row,
+                                                        row_len);
+    if (!stored)
+    {
+        pager_unpin_to (db->pager, mark);
+        return HEAP_FULL; // larger than an empty page
+    }
+
+    entry->free -= appended ? need : payload;
+    entry->live++;
+    heap_entry_refile (db, map_page_num, page_num, entry);
+    pager_mark_dirty (db->pager, page_num);
+    pager_mark_dirty (db->pager, leaf_num);
+    pager_unpin_to (db->pager, mark);
+    return HEAP_OK;
+}
+
+/**
+ * heap_delete - turns the cell of a row into a tombstone
+ *
+ * A page left without live rows stays in the chain, scans may be on it.
+ * heap_free_empty_pages releases it once the statement is done.
+ *
+ * Return: false if the row does not exist
+ */
+bool heap_delete (Database *db, uint32_t map_page_num, void *row_id)
+{
+    BTreeCursor c;
+    heap_cursor_seek (db, row_id, &c);
+    if (!btree_cursor_valid (&c))
+    {
+        return false;
+    }
+    uint16_t size = PAGE_SLOTS (c.page)[c.cell].size;
+    btree_cursor_delete (&c);
+
+    uint32_t leaf_num;
+    HeapMapEntry *entry =
+        heap_entry (db, map_page_num, c.page_num, false, &leaf_num);
+    if (entry != NULL)
+    {
+        entry->free += size;
+        entry->live--;
+        heap_entry_refile (db, map_page_num, c.page_num, entry);
+        pager_mark_dirty (db->pager, leaf_num);
+    }
+    pager_unpin_to (db->pager, c.mark);
+    return true;
+}
+
+/**
+ * heap_free_empty_pages - unlinks the data pages without live rows and puts
+ * them on the free list
+ *
+ * The last page is kept as the target of the next insert.
+ */
+void heap_free_empty_pages (Database *db, uint32_t map_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    HeapMap *map = heap_map (db, map_page_num);
+
+    // the map stays pinned, the other pages are let go one at a time
+    uint32_t page_mark = pager_pin_mark (db->pager);
+    uint32_t page_num = map->free_lists[HEAP_FREE_CLASSES];
+    while (page_num != 0)
+    {
+        pager_unpin_to (db->pager, page_mark);
+        uint32_t next =
+            heap_entry (db, map_page_num, page_num, false, NULL)->list_next;
+        if (page_num != map->last_page)
+        {
+            heap_remove_page (db, map_page_num, page_num);
+        }
+        page_num = next;
+    }
+    pager_unpin_to (db->pager, mark);
+}
+
+/**
+ * heap_vacuum_step - compacts up to HEAP_VACUUM_PAGES data pages that have
+ * dead space, keeping the slots of their rows
+ * @pos: page number to start at, set to the one after the last visited
+ *
+ * Pages are visited in page number order, so a page that joins or leaves
+ * the table between steps does not throw the position off. After the last
+ * page the pages without live rows are freed.
+ *
+ * Return: true if the last page was visited
+ */
+bool heap_vacuum_step (Database *db, uint32_t map_page_num, uint32_t *pos)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t page_num = *pos;
+    for (int i = 0; i < HEAP_VACUUM_PAGES; i++)
+    {
+        page_num = heap_map_next (db, map_page_num, map_page_num, 0, page_num);
+        if (page_num == 0)
+        {
+            break;
+        }
+
+        uint32_t leaf_num;
+        HeapMapEntry *entry =
+            heap_entry (db, map_page_num, page_num, false, &leaf_num);
+        void *node = pager_get_page (db->pager, page_num);
+        if (pager_slotted_dead_space (node) > 0)
+        {
+            pager_slotted_compact (node, true);
+            entry->free = pager_slotted_free_space (node);
+            heap_entry_refile (db, map_page_num, page_num, entry);
+            pager_mark_dirty (db->pager, page_num);
+            pager_mark_dirty (db->pager, leaf_num);
+        }
+        page_num++;
+    }
+
+    *pos = page_num;
+    bool done = page_num == 0;
+    pager_unpin_to (db->pager, mark);
+    if (done)
+    {
+        heap_free_empty_pages (db, map_page_num);
+    }
+    return done;
+}
+
+// flags a page of the map and the pages under it, see heap_mark_compressed
+static void heap_mark_node (Database *db, uint32_t map_page_num,
+                            uint32_t node_num, uint64_t base)
+{
+    pager_set_compressed (db->pager, node_num, true);
+    HeapMapHeader *node =
+        (HeapMapHeader *) pager_get_page (db->pager, node_num);
+    if (node->level == 0)
+    {
+        HeapMapEntry *entries = heap_map_entries (node);
+        for (uint64_t i = 0; i < HEAP_MAP_ENTRIES; i++)
+        {
+            if (entries[i].used)
+            {
+                pager_set_compressed (db->pager, base + i, true);
+            }
+        }
+        return;
+    }
+
+    uint32_t fanout;
+    uint32_t *children =
+        heap_map_children (node, node_num, map_page_num, &fanout);
+    uint64_t span = heap_map_span (node->level);
+    for (uint32_t i = 0; i < fanout; i++)
+    {
+        if (children[i] != 0)
+        {
+            heap_mark_node (db, map_page_num, children[i], base + i * span);
+        }
+    }
+}
+
+/**
+ * heap_mark_compressed - flags the map and every data page of a heap to be
+ * written compressed, see COMPRESSION in pager.h
+ *
+ * The data pages are found in the map, they are not read.
+ */
+void heap_mark_compressed (Database *db, uint32_t map_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    heap_mark_node (db, map_page_num, map_page_num, 0);
+    pager_unpin_to (db->pager, mark);
+}
+
+/**
+ * heap_first_page - the start of the chain of data pages, 0 if there is
+ * none
+ */
+uint32_t heap_first_page (Database *db, uint32_t map_page_num)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t page_num = heap_map (db, map_page_num)->first_page;
+    pager_unpin_to (db->pager, mark);
+    return page_num;
+}
+
+/**
+ * heap_next_page - the first data page at or after @from in page number
+ * order, 0 if there is none
+ *
+ * Pages keep their place in this order while others are added and freed,
+ * unlike in the chain, so a scan can stop and go on from a page number.
+ */
+uint32_t heap_next_page (Database *db, uint32_t map_page_num, uint32_t from)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    uint32_t page_num =
+        heap_map_next (db, map_page_num, map_page_num, 0, from);
+    pager_unpin_to (db->pager, mark);
+    return page_num;
+}
+
+/**
+ * heap_cursor_first - positions the cursor on the first row of the heap
+ *
+ * The scan visits every data page, so the pages of the chain are asked for
+ * up front, as many as the pool holds.
+ */
+void heap_cursor_first (Database *db, uint32_t map_page_num, BTreeCursor *c)
+{
+    uint32_t mark = pager_pin_mark (db->pager);
+    pager_advise (db->pager, PAGER_ACCESS_SCAN);
+    uint32_t first = heap_first_page (db, map_page_num);
+    uint32_t page_num = first;
+    for (uint32_t i = 1; i < db->pager->pool_size && page_num != 0; i++)
+    {
+        page_num = heap_entry (db, map_page_num, page_num, false, NULL)->next;
+        pager_unpin_to (db->pager, mark);
+        if (page_num != 0)
+        {
+            pager_prefetch (db->pager, page_num);
+        }
+    }
+    btree_cursor_from_leaf (db, first, c);
+}
+
+// the data page of a row, for prefetching
+uint32_t heap_row_id_page (void *row_id)
+{
+    uint32_t page_num;
+    uint16_t slot;
+    heap_row_id_decode (row_id, &page_num, &slot);
+    return page_num;
+}
+
+/**
+ * heap_cursor_seek - positions the cursor on the cell of a row, the cursor
+ * is invalid if the row was deleted
+ */
+void heap_cursor_seek (Database *db, void *row_id, BTreeCursor *c)
+{
+    uint32_t page_num;
+    uint16_t slot;
+    heap_row_id_decode (row_id, &page_num, &slot);
+    pager_advise (db->pager, PAGER_ACCESS_NORMAL);
+
+    c->mark = pager_pin_mark (db->pager);
+    c->db = db;
+    c->page_num = page_num;
+    c->page = NULL;
+    c->cell = slot;
+    c->root_page_num = 0;
+    if (page_num == 0 || page_num >= db->pager->num_pages)
+    {
+        return;
+    }
+
+    void *node = pager_get_page (db->pager, page_num);
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    if (header->node_type == NODE_HEAP_PAGE && slot < header->num_cells
+        && PAGE_SLOTS (node)[slot].size != 0)
+    {
+        c->page = node;
+        return;
+    }
+    pager_unpin_to (db->pager, c->mark);
+}
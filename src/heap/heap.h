@@ -0,0 +1,109 @@
+#ifndef HEAP_H
+#define HEAP_H
+#include "../btree/btree.h"
+#include "../db/db.h"
+#include "../pager/pager.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * HEAP TABLES
+ * -----------
+ * A heap table keeps its rows in no particular order. A row goes to any
+ * data page with room for it and is addressed by its row ID, the page
+ * number and the slot of its cell, which indexes store in place of a
+ * primary key.
+ *
+ * - The root page of the table is its free-space map, a radix tree over
+ *   page numbers: the entry of data page p is found by splitting p into
+ *   child indexes, so a row ID leads to its entry with one read per level.
+ *   A page of entries covers HEAP_MAP_ENTRIES consecutive page numbers,
+ *   each directory level above multiplies that by HEAP_MAP_FANOUT. The
+ *   tree starts one level deep and the root is pushed down a level when
+ *   a page number outgrows it, so a heap grows as large as the file.
+ * - An entry holds the free bytes and live rows of its page and its
+ *   neighbours in the chain. A page whose rows are all deleted goes back to
+ *   the pager's free list, a map page left without entries does too.
+ * - Every data page is on one of the free lists of the root, linked through
+ *   the entries: pages with live rows by their free bytes in
+ *   HEAP_FREE_CLASSES steps of PAGE_SIZE / HEAP_FREE_CLASSES, pages without
+ *   on the last list. An insert finds a page with room by looking at the
+ *   heads of the lists, and the empty pages are freed without a search.
+ * - Data pages are laid out like btree leaves, cells [ row ID | row ]
+ *   chained through next_leaf, so a BTreeCursor walks them.
+ *
+ * Data pages of different tables share the page numbers, so a map page
+ * covering a run the table has few pages in is mostly empty entries.
+ *
+ * A row ID is encoded big endian, page number (4) then slot (2), and never
+ * changes while the row lives. Compacting a page keeps the slot of every
+ * live row, the slot of a deleted row is given to the next row stored on
+ * the page.
+ */
+#define HEAP_ROW_ID_SIZE  6
+#define HEAP_VACUUM_PAGES 32 // data pages a vacuum step visits
+#define HEAP_FREE_CLASSES 16 // free lists by free bytes
+#define HEAP_FREE_LISTS   (HEAP_FREE_CLASSES + 1) // and one of empty pages
+
+// every page of the map starts with it, a directory page below the root
+// goes on with its children, a page of entries with HEAP_MAP_ENTRIES entries
+typedef struct
+{
+    uint8_t node_type; // NODE_HEAP_MAP
+    uint8_t level;     // 0 for a page of entries
+    uint16_t reserved;
+    uint32_t count; // entries or children in use
+} HeapMapHeader;
+
+typedef struct
+{
+    uint16_t free; // bytes an insert can use once the page is compacted
+    uint16_t live; // cells that are not tombstones
+    uint8_t used;  // the page is a data page of the table
+    uint8_t list;  // free list the page is on
+    uint16_t reserved;
+    uint32_t prev; // data pages before and after it in the chain
+    uint32_t next;
+    uint32_t list_prev; // pages before and after it on its free list
+    uint32_t list_next;
+} HeapMapEntry;
+
+typedef struct
+{
+    HeapMapHeader header;
+    uint32_t page_count;
+    uint32_t first_page;
+    uint32_t last_page;
+    uint32_t free_lists[HEAP_FREE_LISTS];
+    uint32_t children[];
+} HeapMap;
+
+#define HEAP_MAP_ENTRIES                                                       \
+    ((PAGE_SIZE - sizeof (HeapMapHeader)) / sizeof (HeapMapEntry))
+#define HEAP_MAP_FANOUT                                                        \
+    ((PAGE_SIZE - sizeof (HeapMapHeader)) / sizeof (uint32_t))
+#define HEAP_MAP_ROOT_FANOUT                                                   \
+    ((PAGE_SIZE - sizeof (HeapMap)) / sizeof (uint32_t))
+
+typedef enum
+{
+    HEAP_OK,
+    HEAP_FULL,
+} HeapResult;
+
+void heap_init (Database *db, uint32_t map_page_num);
+HeapResult heap_insert (Database *db, uint32_t map_page_num, void *row,
+                        uint32_t row_len, uint8_t *row_id);
+bool heap_delete (Database *db, uint32_t map_page_num, void *row_id);
+void heap_free_empty_pages (Database *db, uint32_t map_page_num);
+bool heap_vacuum_step (Database *db, uint32_t map_page_num, uint32_t *pos);
+uint32_t heap_first_page (Database *db, uint32_t map_page_num);
+uint32_t heap_next_page (Database *db, uint32_t map_page_num, uint32_t from);
+void heap_mark_compressed (Database *db, uint32_t map_page_num);
+
+void heap_cursor_first (Database *db, uint32_t map_page_num, BTreeCursor *c);
+void heap_cursor_seek (Database *db, void *row_id, BTreeCursor *c);
+uint32_t heap_row_id_page (void *row_id);
+
+#endif /* HEAP_H */
@@ -0,0 +1,205 @@
+#include "../testing/testing.h"
+#include "heap.h"
+
+// unity includes
+#include "../arena/arena.c"
+#include "../lz/lz.c"
+#include "../pager/pager.c"
+#include "../btree/btree.c"
+#include "heap.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ROWS       3000
+#define TEST_ROW_MAX    700
+#define TEST_PAGE_SIZE  4096
+#define TEST_CACHE_SIZE (PAGER_MIN_FRAMES * TEST_PAGE_SIZE)
+
+unsigned char test_buffer[SIZE_MB];
+Arena test_arena;
+
+Database db;
+uint32_t map_num;
+uint8_t row_ids[TEST_ROWS][HEAP_ROW_ID_SIZE];
+
+static uint32_t row_len (int i)
+{
+    return (i * 37) % TEST_ROW_MAX + 1;
+}
+
+// the chain agrees with the map, and every data page is on the free list
+// of its class exactly once
+static void check_heap (const char *test)
+{
+    HeapMap *map = heap_map (&db, map_num);
+    uint32_t pages = 0, prev = 0;
+    for (uint32_t p = map->first_page; p != 0;)
+    {
+        HeapMapEntry *entry = heap_entry (&db, map_num, p, false, NULL);
+        ASSERT_FMT (entry != NULL && entry->used && entry->prev == prev,
+                    "tests[%s] - entry of page %u wrong", test, p);
+
+        void *node = pager_get_page (db.pager, p);
+        SlottedPageHeader *header = (SlottedPageHeader *) node;
+        uint16_t live = 0;
+        for (uint16_t slot = 0; slot < header->num_cells; slot++)
+        {
+            live += PAGE_SLOTS (node)[slot].size != 0;
+        }
+        ASSERT_FMT (header->next_leaf == entry->next && live == entry->live,
+                    "tests[%s] - page %u has %u rows, the map %u", test, p,
+                    live, entry->live);
+        prev = p;
+        p = entry->next;
+        pages++;
+    }
+    ASSERT_FMT (prev == map->last_page && pages == map->page_count,
+                "tests[%s] - expected %u pages in the chain. got=%u", test,
+                map->page_count, pages);
+
+    uint32_t listed = 0;
+    for (uint32_t list = 0; list < HEAP_FREE_LISTS; list++)
+    {
+        prev = 0;
+        for (uint32_t p = map->free_lists[list]; p != 0;)
+        {
+            HeapMapEntry *entry = heap_entry (&db, map_num, p, false, NULL);
+            ASSERT_FMT (entry->list == list && heap_free_list (entry) == list
+                            && entry->list_prev == prev,
+                        "tests[%s] - page %u on the wrong free list", test, p);
+            prev = p;
+            p = entry->list_next;
+            listed++;
+        }
+    }
+    ASSERT_FMT (listed == pages,
+                "tests[%s] - expected %u pages on the free lists. got=%u",
+                test, pages, listed);
+    pager_unpin_to (db.pager, 0);
+}
+
+static uint32_t count_rows ()
+{
+    uint32_t rows = 0;
+    BTreeCursor c;
+    for (heap_cursor_first (&db, map_num, &c); btree_cursor_valid (&c);
+         btree_cursor_next (&c))
+    {
+        rows++;
+    }
+    pager_unpin_to (db.pager, 0);
+    return rows;
+}
+
+void test_free_lists ()
+{
+    uint8_t row[TEST_ROW_MAX];
+    memset (row, 'r', sizeof (row));
+    for (int i = 0; i < TEST_ROWS; i++)
+    {
+        ASSERT_FMT (heap_insert (&db, map_num, row, row_len (i), row_ids[i])
+                        == HEAP_OK,
+                    "tests[free lists] - insert %d failed", i);
+    }
+    check_heap ("free lists");
+
+    // a run of rows empties whole pages, every third row leaves gaps
+    for (int i = 0; i < TEST_ROWS; i++)
+    {
+        if ((i >= 1000 && i < 2000) || i % 3 == 0)
+        {
+            ASSERT_FMT (heap_delete (&db, map_num, row_ids[i]),
+                        "tests[free lists] - row %d not found", i);
+        }
+    }
+    check_heap ("free lists");
+    uint32_t pages = heap_map (&db, map_num)->page_count;
+    heap_free_empty_pages (&db, map_num);
+    pager_unpin_to (db.pager, 0);
+    check_heap ("free lists");
+    ASSERT_FMT (heap_map (&db, map_num)->page_count < pages,
+                "tests[free lists] - no empty page was freed");
+    pager_unpin_to (db.pager, 0);
+
+    // the gaps and the freed pages take the new rows
+    uint32_t file_pages = db.pager->num_pages;
+    for (int i = 1000; i < 2000; i++)
+    {
+        ASSERT_FMT (heap_insert (&db, map_num, row, row_len (i), row_ids[i])
+                        == HEAP_OK,
+                    "tests[free lists] - insert %d failed", i);
+    }
+    check_heap ("free lists");
+    ASSERT_FMT (db.pager->num_pages == file_pages,
+                "tests[free lists] - the file grew from %u to %u pages",
+                file_pages, db.pager->num_pages);
+
+    uint32_t pos = 0;
+    while (!heap_vacuum_step (&db, map_num, &pos))
+    {
+        pager_unpin_to (db.pager, 0);
+    }
+    check_heap ("free lists");
+    uint32_t expected = 1000; // put back
+    for (int i = 0; i < TEST_ROWS; i++)
+    {
+        expected += !((i >= 1000 && i < 2000) || i % 3 == 0);
+    }
+    ASSERT_FMT (count_rows () == expected,
+                "tests[free lists] - expected %u rows. got=%u", expected,
+                count_rows ());
+    printf ("HEAP: [free lists] All tests passed!\n");
+}
+
+void test_grow ()
+{
+    // past what a map one level deep covers, and past the first child of the
+    // root once it is pushed down, so a directory page is added as well
+    uint32_t far = HEAP_MAP_FANOUT * HEAP_MAP_ENTRIES;
+    uint32_t first = heap_first_page (&db, map_num);
+    ASSERT_FMT (heap_entry (&db, map_num, far, false, NULL) == NULL,
+                "tests[grow] - page %u has an entry", far);
+    ASSERT_FMT (heap_entry (&db, map_num, far, true, NULL) != NULL,
+                "tests[grow] - no entry added for page %u", far);
+    ASSERT_FMT (heap_map (&db, map_num)->header.level == 2,
+                "tests[grow] - expected a map two levels deep. got=%u",
+                heap_map (&db, map_num)->header.level);
+    ASSERT_FMT (heap_map_next (&db, map_num, map_num, 0, 0) == first,
+                "tests[grow] - first page moved");
+    ASSERT_FMT (heap_map_next (&db, map_num, map_num, 0, first + 1000) == far,
+                "tests[grow] - page %u not found", far);
+    pager_unpin_to (db.pager, 0);
+
+    // the two map pages added for it go again, the data pages stay
+    uint32_t freed = pager_free_epoch (db.pager);
+    heap_entry_release (&db, map_num, far);
+    freed = pager_free_epoch (db.pager) - freed;
+    ASSERT_FMT (freed == 2, "tests[grow] - expected 2 map pages freed. got=%u",
+                freed);
+    pager_unpin_to (db.pager, 0);
+    check_heap ("grow");
+    printf ("HEAP: [grow] All tests passed!\n");
+}
+
+int main ()
+{
+    arena_init (&test_arena, test_buffer, SIZE_MB);
+
+    char path[] = "/tmp/test_heap_XXXXXX";
+    int fd = mkstemp (path);
+    ASSERT_FMT (fd != -1, "tests - no temporary file");
+    close (fd);
+    db.pager = pager_open (&test_arena, path, TEST_PAGE_SIZE, TEST_CACHE_SIZE);
+    ASSERT_FMT (db.pager != NULL, "tests - pager_open failed");
+    map_num = pager_allocate_page (db.pager);
+    heap_init (&db, map_num);
+
+    test_free_lists ();
+    test_grow ();
+
+    pager_close (db.pager);
+    unlink (path);
+    return 0;
+}
@@ -174,6 +174,20 @@ static TokenType lookup_ident (str8 ident)
         return TOKEN_SET;
     if (str8_match (ident, str8_lit ("DELETE"), true))
         return TOKEN_DELETE;
+    if (str8_match (ident, str8_lit ("COPY"), true))
+        return TOKEN_COPY;
+    if (str8_match (ident, str8_lit ("TO"), true))
+        return TOKEN_TO;
+    if (str8_match (ident, str8_lit ("WITH"), true))
+        return TOKEN_WITH;
+    if (str8_match (ident, str8_lit ("CONCURRENTLY"), true))
+        return TOKEN_CONCURRENTLY;
+    if (str8_match (ident, str8_lit ("USING"), true))
+        return TOKEN_USING;
+    if (str8_match (ident, str8_lit ("INCLUDE"), true))
+        return TOKEN_INCLUDE;
+    if (str8_match (ident, str8_lit ("VACUUM"), true))
+        return TOKEN_VACUUM;
 
     if (str8_match (ident, str8_lit ("WHERE"), true))
         return TOKEN_WHERE;
@@ -13,7 +13,8 @@ int main ()
 {
     char *input = "CREATE TABLE int text ( ) , ; . * = "
                   "PRIMARY KEY UNIQUE INSERT INTO VALUES "
-                  "SELECT FROM UPDATE SET DELETE "
+                  "SELECT FROM UPDATE SET DELETE COPY TO WITH CONCURRENTLY "
+                  "USING INCLUDE VACUUM "
                   "WHERE AND OR JOIN ON "
                   "123 'hello' my_var #";
 
@@ -51,6 +52,13 @@ int main ()
         {TOKEN_UPDATE, str8_lit ("UPDATE")},
         {TOKEN_SET, str8_lit ("SET")},
         {TOKEN_DELETE, str8_lit ("DELETE")},
+        {TOKEN_COPY, str8_lit ("COPY")},
+        {TOKEN_TO, str8_lit ("TO")},
+        {TOKEN_WITH, str8_lit ("WITH")},
+        {TOKEN_CONCURRENTLY, str8_lit ("CONCURRENTLY")},
+        {TOKEN_USING, str8_lit ("USING")},
+        {TOKEN_INCLUDE, str8_lit ("INCLUDE")},
+        {TOKEN_VACUUM, str8_lit ("VACUUM")},
 
         {TOKEN_WHERE, str8_lit ("WHERE")},
         {TOKEN_AND, str8_lit ("AND")},
@@ -0,0 +1,226 @@
+#include "lz.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+static uint32_t lz_read32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+}
+
+// Fibonacci hashing, the top bits of the product index the table
+static uint32_t lz_hash (uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// bytes a length of @len takes after its nibble
+static uint32_t lz_length_size (uint32_t len)
+{
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+static uint8_t *lz_write_length (uint8_t *op, uint32_t len)
+{
+    if (len < 15)
+    {
+        return op;
+    }
+    for (len -= 15; len >= 255; len -= 255)
+    {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+/**
+ * lz_emit - writes one sequence, a match length of 0 ends the block
+ *
+ * Return: false if it does not fit before @op_end
+ */
+static bool lz_emit (uint8_t **op, uint8_t *op_end, const uint8_t *literals,
+                     uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint32_t need = 1 + lz_length_size (lit_len) + lit_len;
+    if (match_len > 0)
+    {
+        need += 2 + lz_length_size (match_len - LZ_MIN_MATCH);
+    }
+    if ((uint32_t) (op_end - *op) < need)
+    {
+        return false;
+    }
+
+    uint8_t *p = *op;
+    uint32_t ml = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t *token = p++;
+    *token = (uint8_t) ((lit_len < 15 ? lit_len : 15) << 4);
+    p = lz_write_length (p, lit_len);
+    memcpy (p, literals, lit_len);
+    p += lit_len;
+
+    if (match_len > 0)
+    {
+        *token |= (uint8_t) (ml < 15 ? ml : 15);
+        *p++ = (uint8_t) offset;
+        *p++ = (uint8_t) (offset >> 8);
+        p = lz_write_length (p, ml);
+    }
+    *op = p;
+    return true;
+}
+
+/**
+ * lz_compress - compresses a block
+ * @dst_cap: bytes @dst can take, compressing stops once they run out
+ *
+ * Return: length of the compressed block, 0 if it does not fit in @dst_cap
+ */
+uint32_t lz_compress (const void *src, uint32_t src_len, void *dst,
+                      uint32_t dst_cap)
+{
+    const uint8_t *base = (const uint8_t *) src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *end = base + src_len;
+    uint8_t *op = (uint8_t *) dst;
+    uint8_t *op_end = op + dst_cap;
+    uint32_t table[1 << LZ_HASH_BITS] = {0};
+
+    while (src_len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+        uint32_t seq = lz_read32 (ip);
+        uint32_t h = lz_hash (seq);
+        const uint8_t *ref = base + table[h];
+        table[h] = (uint32_t) (ip - base);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32 (ref) != seq)
+        {
+            ip++;
+            continue;
+        }
+
+        uint32_t offset = (uint32_t) (ip - ref);
+        const uint8_t *match_end = ip + LZ_MIN_MATCH;
+        ref += LZ_MIN_MATCH;
+        while (match_end < end && *match_end == *ref)
+        {
+            match_end++;
+            ref++;
+        }
+
+        if (!lz_emit (&op, op_end, anchor, (uint32_t) (ip - anchor), offset,
+                      (uint32_t) (match_end - ip)))
+        {
+            return 0;
+        }
+        ip = match_end;
+        anchor = ip;
+    }
+
+    if (!lz_emit (&op, op_end, anchor, (uint32_t) (end - anchor), 0, 0))
+    {
+        return 0;
+    }
+    return (uint32_t) (op - (uint8_t *) dst);
+}
+
+static bool lz_read_length (const uint8_t **ip, const uint8_t *end,
+                            uint32_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= end)
+        {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+/**
+ * lz_decompress - expands a block made by lz_compress
+ * @dst_len: length of the expanded block, the caller knows it
+ *
+ * Every length and offset is checked against both buffers, a corrupt block
+ * never reads or writes outside them. A block cut short at a sequence
+ * boundary still decodes, it is caught by missing its last sequence or by
+ * expanding to less than @dst_len.
+ *
+ * Return: @dst_len, 0 if the block is corrupt or does not expand to exactly
+ * @dst_len bytes
+ */
+uint32_t lz_decompress (const void *src, uint32_t src_len, void *dst,
+                        uint32_t dst_len)
+{
+    const uint8_t *ip = (const uint8_t *) src;
+    const uint8_t *end = ip + src_len;
+    uint8_t *base = (uint8_t *) dst;
+    uint8_t *op = base;
+    uint8_t *op_end = base + dst_len;
+
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15 && !lz_read_length (&ip, end, &lit_len))
+        {
+            return 0;
+        }
+        if (lit_len > (uint32_t) (end - ip)
+            || lit_len > (uint32_t) (op_end - op))
+        {
+            return 0;
+        }
+        memcpy (op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == end)
+        {
+            break; // the last sequence has no match
+        }
+
+        if (end - ip < 2)
+        {
+            return 0;
+        }
+        uint32_t offset = ip[0] | ((uint32_t) ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t) (op - base))
+        {
+            return 0;
+        }
+
+        uint32_t match_len = token & 15;
+        if (match_len == 15 && !lz_read_length (&ip, end, &match_len))
+        {
+            return 0;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (uint32_t) (op_end - op))
+        {
+            return 0;
+        }
+
+        // byte by byte, the match may overlap the bytes it produces
+        const uint8_t *ref = op - offset;
+        for (uint32_t i = 0; i < match_len; i++)
+        {
+            op[i] = ref[i];
+        }
+        op += match_len;
+        if (ip == end)
+        {
+            return 0; // cut before the last sequence
+        }
+    }
+    return op == op_end ? dst_len : 0;
+}
@@ -0,0 +1,32 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+/*
+ * LZ CODEC
+ * --------
+ * A byte oriented LZ77 block codec in the LZ4 family, small and fast enough
+ * to run on every page read and write. A block is a run of sequences:
+ *
+ *   [token] [literal length+] [literals] [offset (2, LE)] [match length+]
+ *
+ * The high nibble of the token is the literal count, the low nibble the
+ * match length less LZ_MIN_MATCH. A nibble of 15 is followed by bytes that
+ * are added to it until one is below 255. The last sequence of a block is
+ * literals only, it ends at the end of the input.
+ *
+ * Matches are found with a hash table of 4 byte prefixes and reach back
+ * LZ_MAX_OFFSET bytes. A match may overlap the bytes it produces, a long
+ * run of one byte is a literal and a match at offset 1.
+ */
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS  12
+
+uint32_t lz_compress (const void *src, uint32_t src_len, void *dst,
+                      uint32_t dst_cap);
+uint32_t lz_decompress (const void *src, uint32_t src_len, void *dst,
+                        uint32_t dst_len);
+
+#endif /* LZ_H */
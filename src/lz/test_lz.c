@@ -0,0 +1,240 @@
+#include "../testing/testing.h"
+#include "lz.h"
+
+// unity includes
+#include "lz.c"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_PAGE_MAX 65536
+#define TEST_GUARD    64
+
+// literals only, one length byte per 255 bytes and a token
+#define TEST_BOUND(n) ((n) + (n) / 255 + 16)
+
+uint8_t src[TEST_PAGE_MAX];
+uint8_t packed[TEST_BOUND (TEST_PAGE_MAX) + TEST_GUARD];
+uint8_t out[TEST_PAGE_MAX + TEST_GUARD];
+
+static uint32_t rng_state = 1;
+
+// xorshift, bytes that have no repeats worth a match
+static uint8_t rng_byte ()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (uint8_t) (rng_state >> 24);
+}
+
+typedef enum
+{
+    FILL_RANDOM,
+    FILL_ZERO,
+    FILL_REPEAT,
+} Fill;
+
+static const char *fill_names[] = {"random", "zero", "repeat"};
+
+static void fill_page (Fill fill, uint32_t len)
+{
+    const char *row = "42,alice,\"some text\",1700000000;";
+    for (uint32_t i = 0; i < len; i++)
+    {
+        switch (fill)
+        {
+        case FILL_RANDOM:
+            src[i] = rng_byte ();
+            break;
+        case FILL_ZERO:
+            src[i] = 0;
+            break;
+        case FILL_REPEAT:
+            src[i] = (uint8_t) row[i % strlen (row)] + (uint8_t) (i / 997);
+            break;
+        }
+    }
+}
+
+void test_round_trip ()
+{
+    uint32_t sizes[] = {4096, TEST_PAGE_MAX};
+    for (int s = 0; s < 2; s++)
+    {
+        uint32_t n = sizes[s];
+        for (Fill fill = FILL_RANDOM; fill <= FILL_REPEAT; fill++)
+        {
+            fill_page (fill, n);
+            uint32_t len = lz_compress (src, n, packed, TEST_BOUND (n));
+            ASSERT_FMT (len > 0,
+                        "tests[round trip] - %s %u bytes did not compress",
+                        fill_names[fill], n);
+            if (fill != FILL_RANDOM)
+            {
+                ASSERT_FMT (len < n / 8,
+                            "tests[round trip] - %s %u bytes barely "
+                            "compressed. got=%u",
+                            fill_names[fill], n, len);
+            }
+
+            memset (out, 0xaa, sizeof (out));
+            uint32_t got = lz_decompress (packed, len, out, n);
+            ASSERT_FMT (got == n,
+                        "tests[round trip] - %s %u bytes wrong length. "
+                        "got=%u",
+                        fill_names[fill], n, got);
+            ASSERT_FMT (memcmp (src, out, n) == 0,
+                        "tests[round trip] - %s %u bytes differ",
+                        fill_names[fill], n);
+            ASSERT_FMT (out[n] == 0xaa,
+                        "tests[round trip] - %s %u bytes wrote past the end",
+                        fill_names[fill], n);
+        }
+    }
+
+    uint8_t one = 7;
+    uint32_t len = lz_compress (&one, 1, packed, sizeof (packed));
+    ASSERT_FMT (len == 2 && lz_decompress (packed, len, out, 1) == 1
+                    && out[0] == 7,
+                "tests[round trip] - single byte block wrong");
+
+    printf ("LZ: [round trip] All tests passed!\n");
+}
+
+void test_overlapping_match ()
+{
+    // "ab" then a match at offset 2 of 10 bytes that reads what it writes,
+    // then an empty last sequence
+    uint8_t block[] = {(2 << 4) | (10 - LZ_MIN_MATCH), 'a', 'b', 2, 0, 0};
+    const char *expected = "abababababab";
+
+    uint32_t got = lz_decompress (block, sizeof (block), out, 12);
+    ASSERT_FMT (got == 12 && memcmp (out, expected, 12) == 0,
+                "tests[overlap] - offset 2 wrong. got=%u %.*s", got, 12,
+                (char *) out);
+
+    // a run of one byte is a literal and a match at offset 1 with an
+    // extended length: 15 + 255 + 10 + LZ_MIN_MATCH bytes
+    uint8_t run[] = {(1 << 4) | 15, 'x', 1, 0, 255, 10, 0};
+    uint32_t run_len = 1 + 15 + 255 + 10 + LZ_MIN_MATCH;
+    got = lz_decompress (run, sizeof (run), out, run_len);
+    ASSERT_FMT (got == run_len, "tests[overlap] - offset 1 length. got=%u",
+                got);
+    for (uint32_t i = 0; i < run_len; i++)
+    {
+        ASSERT_FMT (out[i] == 'x', "tests[overlap] - offset 1 byte %u wrong",
+                    i);
+    }
+
+    // the compressor finds the same matches
+    memset (src, 'x', run_len);
+    uint32_t len = lz_compress (src, run_len, packed, sizeof (packed));
+    ASSERT_FMT (len > 0 && len < 16,
+                "tests[overlap] - run not compressed to a match. got=%u",
+                len);
+    ASSERT_FMT (lz_decompress (packed, len, out, run_len) == run_len
+                    && memcmp (src, out, run_len) == 0,
+                "tests[overlap] - run round trip wrong");
+
+    printf ("LZ: [overlap] All tests passed!\n");
+}
+
+void test_dst_cap ()
+{
+    for (Fill fill = FILL_RANDOM; fill <= FILL_REPEAT; fill++)
+    {
+        uint32_t n = 4096;
+        fill_page (fill, n);
+        uint32_t len = lz_compress (src, n, packed, TEST_BOUND (n));
+
+        // every smaller buffer fails and nothing is written past it
+        for (uint32_t cap = 0; cap < len; cap++)
+        {
+            memset (packed, 0xaa, sizeof (packed));
+            ASSERT_FMT (lz_compress (src, n, packed, cap) == 0,
+                        "tests[dst cap] - %s fit in %u of %u bytes",
+                        fill_names[fill], cap, len);
+            ASSERT_FMT (packed[cap] == 0xaa,
+                        "tests[dst cap] - %s wrote past %u bytes",
+                        fill_names[fill], cap);
+        }
+        ASSERT_FMT (lz_compress (src, n, packed, len) == len,
+                    "tests[dst cap] - %s does not fit its own length",
+                    fill_names[fill]);
+
+        // the block expands to n bytes, not fewer and not more
+        ASSERT_FMT (lz_decompress (packed, len, out, n - 1) == 0,
+                    "tests[dst cap] - %s expanded into n - 1 bytes",
+                    fill_names[fill]);
+        ASSERT_FMT (lz_decompress (packed, len, out, n + 1) == 0,
+                    "tests[dst cap] - %s expanded to n + 1 bytes",
+                    fill_names[fill]);
+    }
+
+    printf ("LZ: [dst cap] All tests passed!\n");
+}
+
+void test_corrupt ()
+{
+    uint32_t n = 4096;
+    for (Fill fill = FILL_RANDOM; fill <= FILL_REPEAT; fill++)
+    {
+        fill_page (fill, n);
+        uint32_t len = lz_compress (src, n, packed, TEST_BOUND (n));
+        for (uint32_t cut = 0; cut < len; cut++)
+        {
+            ASSERT_FMT (lz_decompress (packed, cut, out, n) == 0,
+                        "tests[corrupt] - %s cut to %u of %u bytes decoded",
+                        fill_names[fill], cut, len);
+        }
+    }
+
+    struct
+    {
+        const char *name;
+        uint8_t block[8];
+        uint32_t len;
+    } bad[] = {
+        {"offset 0", {(1 << 4), 'a', 0, 0, 0}, 5},
+        {"offset before start", {(1 << 4), 'a', 2, 0, 0}, 5},
+        {"literals past input", {(9 << 4), 'a', 'b'}, 3},
+        {"literal length past input", {(15 << 4), 255, 255}, 3},
+        {"match length past input", {(1 << 4) | 15, 'a', 1, 0, 255}, 5},
+        {"half an offset", {(1 << 4), 'a', 1}, 3},
+    };
+    for (size_t i = 0; i < sizeof (bad) / sizeof (bad[0]); i++)
+    {
+        ASSERT_FMT (lz_decompress (bad[i].block, bad[i].len, out, 64) == 0,
+                    "tests[corrupt] - %s decoded", bad[i].name);
+    }
+
+    // flipped bits either decode to a page or are caught, never overrun
+    fill_page (FILL_REPEAT, n);
+    uint32_t len = lz_compress (src, n, packed, TEST_BOUND (n));
+    for (int i = 0; i < 10000; i++)
+    {
+        uint8_t copy[TEST_BOUND (4096)];
+        memcpy (copy, packed, len);
+        copy[rng_state % len] ^= (uint8_t) (1 << (rng_byte () % 8));
+        rng_byte ();
+
+        out[n] = 0xaa;
+        uint32_t got = lz_decompress (copy, len, out, n);
+        ASSERT_FMT (got == 0 || got == n,
+                    "tests[corrupt] - flipped block gave %u bytes", got);
+        ASSERT_FMT (out[n] == 0xaa,
+                    "tests[corrupt] - flipped block wrote past the end");
+    }
+
+    printf ("LZ: [corrupt] All tests passed!\n");
+}
+
+int main ()
+{
+    test_round_trip ();
+    test_overlapping_match ();
+    test_dst_cap ();
+    test_corrupt ();
+    return 0;
+}
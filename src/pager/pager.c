@@ -1,24 +1,138 @@
 #include "pager.h"
+#include "../lz/lz.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+uint32_t pager_page_size = PAGE_SIZE_DEFAULT;
+
+/**
+ * pager_page_size_valid - whether a database can be created with pages of
+ * this size
+ */
+bool pager_page_size_valid (uint32_t page_size)
+{
+    return page_size >= PAGE_SIZE_MIN && page_size <= PAGE_SIZE_MAX
+           && (page_size & (page_size - 1)) == 0;
+}
+
+/**
+ * pager_read_header - reads the database header of an existing file
+ *
+ * Return: false if the file is not a database this version can open
+ */
+static bool pager_read_header (int fd, DatabaseHeader *header)
+{
+    if (pread (fd, header, sizeof (*header), 0) != sizeof (*header)
+        || memcmp (header->magic, DB_HEADER_MAGIC, sizeof (header->magic)))
+    {
+        printf ("Error: not a csql database, or one from an older version.\n");
+        return false;
+    }
+    if (header->version != DB_FORMAT_VERSION)
+    {
+        printf ("Error: database format version %u, expected %u.\n",
+                header->version, DB_FORMAT_VERSION);
+        return false;
+    }
+    if (!pager_page_size_valid (header->page_size))
+    {
+        printf ("Error: invalid page size %u in the database header.\n",
+                header->page_size);
+        return false;
+    }
+    return true;
+}
+
+// pins of the calling thread, see BUFFER POOL
+static __thread PagerFrame **pin_stack;
+static __thread uint32_t pin_count;
+static __thread uint32_t pin_cap;
+
+// frees the pin stack of a thread when it exits
+static pthread_key_t pin_stack_key;
+static pthread_once_t pin_stack_once = PTHREAD_ONCE_INIT;
+
+static void pin_stack_key_init (void)
+{
+    if (pthread_key_create (&pin_stack_key, free) != 0)
+    {
+        perror ("Error creating the pin stack key");
+        exit (EXIT_FAILURE);
+    }
+}
+
+/**
+ * pager_pool_init - allocates the frames of the pool and the page table
+ * @cache_size: bytes of pages the pool holds
+ *
+ * Return: false if out of memory
+ */
+static bool pager_pool_init (Pager *pager, Arena *arena, size_t cache_size)
+{
+    size_t count = cache_size / PAGE_SIZE;
+    if (count < PAGER_MIN_FRAMES)
+    {
+        count = PAGER_MIN_FRAMES;
+    }
+    uint32_t bucket_count = 1;
+    while (bucket_count < 2 * count)
+    {
+        bucket_count <<= 1;
+    }
+
+    PagerFrame *frames = push_array_zero (arena, PagerFrame, count);
+    pager->pool = aligned_alloc (PAGER_FRAME_ALIGNMENT, count * PAGE_SIZE);
+    pager->frames = malloc (count * sizeof (PagerFrame *));
+    pager->buckets = calloc (bucket_count, sizeof (PagerFrame *));
+    if (frames == NULL || pager->pool == NULL || pager->frames == NULL
+        || pager->buckets == NULL)
+    {
+        free (pager->pool);
+        free (pager->frames);
+        free (pager->buckets);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        frames[i].buffer = pager->pool + i * PAGE_SIZE;
+        pthread_rwlock_init (&frames[i].latch, NULL);
+        pager->frames[i] = &frames[i];
+    }
+    pager->frame_count = count;
+    pager->frame_cap = count;
+    pager->pool_size = count;
+    pager->bucket_mask = bucket_count - 1;
+    pthread_rwlock_init (&pager->table_lock, NULL);
+    return true;
+}
+
 /**
  * pager_open - opens file and returns a pointer to the pager struct
  *
  * @arena: arena for storing the pager
  * @filename: name of the file to open
+ * @page_size: page size of the database if the file is empty, a size
+ * pager_page_size_valid accepts. An existing database keeps its own
+ * @cache_size: bytes of pages the buffer pool holds
+ *
+ * A new database gets its header on page 0 right away. PAGE_SIZE is set to
+ * the page size of the database.
  *
  * Return: pointer to pager or NULL if could not open
  * */
-Pager *pager_open (Arena *arena, const char *filename)
+Pager *pager_open (Arena *arena, const char *filename, uint32_t page_size,
+                   size_t cache_size)
 {
     int fd = open (filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
 
@@ -28,15 +142,34 @@ Pager *pager_open (Arena *arena, const char *filename)
     }
 
     off_t file_len = lseek (fd, 0, SEEK_END);
-    Pager *pager = push_struct_zero (arena, Pager);
-    pager->fd = fd;
-    pager->file_len = (uint32_t) file_len;
-    pager->num_pages = (file_len / PAGE_SIZE);
+    DatabaseHeader header = {0};
+    if (file_len == 0)
+    {
+        header.node_type = PAGE_DB_HEADER;
+        memcpy (header.magic, DB_HEADER_MAGIC, sizeof (header.magic));
+        header.version = DB_FORMAT_VERSION;
+        header.page_size = page_size;
+    }
+    else if (!pager_read_header (fd, &header))
+    {
+        close (fd);
+        return NULL;
+    }
+    pager_page_size = header.page_size;
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    Pager *pager = push_struct_zero (arena, Pager);
+    if (pager == NULL || !pager_pool_init (pager, arena, cache_size))
     {
-        pager->pages[i] = NULL;
+        printf ("Error: not enough memory for a cache of %zu bytes.\n",
+                cache_size);
+        close (fd);
+        return NULL;
     }
+    pager->fd = fd;
+    pager->file_len = (uint64_t) file_len;
+    pager->num_pages = (file_len / PAGE_SIZE);
+    pager->max_pages = UINT32_MAX;
+    pthread_mutex_init (&pager->lock, NULL);
 
     if (file_len % PAGE_SIZE != 0)
     {
@@ -44,100 +177,944 @@ Pager *pager_open (Arena *arena, const char *filename)
             "Warning: File length is not a multiple of page size. Corrupt?n");
     }
 
+    if (file_len == 0)
+    {
+        uint32_t mark = pager_pin_mark (pager);
+        pager->num_pages = 1;
+        void *page_zero = pager_get_page (pager, 0);
+        memcpy (page_zero, &header, sizeof (header));
+        pager_flush (pager, 0);
+        pager_unpin_to (pager, mark);
+    }
+
     return pager;
 }
 
 /**
- * pager_open - opens file and returns a pointer to the page
+ * pager_map - maps the pages of the file for pager_get_page to read
  *
- * @arena: arena for storing the pager
- * @pager: contains pages
- * @page_num: page number of page to get
+ * Pages already in the cache stay where they are.
  *
- * Return: pointer to page
- * */
-void *pager_get_page (Arena *arena, Pager *pager, uint32_t page_num)
+ * Return: false if the file could not be mapped
+ */
+bool pager_map (Pager *pager)
+{
+    uint32_t map_pages = pager->file_len / PAGE_SIZE;
+    void *map = mmap (NULL, (size_t) map_pages * PAGE_SIZE,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE, pager->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    pager->map = (uint8_t *) map;
+    pager->map_pages = map_pages;
+    pager->access = PAGER_ACCESS_NORMAL;
+    return true;
+}
+
+/**
+ * pager_direct_io - reads and writes pages past the kernel's page cache
+ *
+ * Return: false if the file system does not support O_DIRECT
+ */
+bool pager_direct_io (Pager *pager)
+{
+    int flags = fcntl (pager->fd, F_GETFL);
+    if (flags == -1 || fcntl (pager->fd, F_SETFL, flags | O_DIRECT) == -1)
+    {
+        return false;
+    }
+    pager->direct_io = true;
+    return true;
+}
+
+/**
+ * pager_advise - tells the kernel how the mapped pages are about to be read,
+ * nothing without a mapping
+ */
+void pager_advise (Pager *pager, PagerAccess access)
+{
+    if (pager->map == NULL
+        || __atomic_exchange_n (&pager->access, access, __ATOMIC_RELAXED)
+               == access)
+    {
+        return;
+    }
+
+    int advice = access == PAGER_ACCESS_SCAN ? MADV_SEQUENTIAL : MADV_NORMAL;
+    madvise (pager->map, (size_t) pager->map_pages * PAGE_SIZE, advice);
+}
+
+/**
+ * pager_lookup - the frame that holds a page, NULL if it is not cached
+ *
+ * Called with the page table locked.
+ */
+static PagerFrame *pager_lookup (Pager *pager, uint32_t page_num)
+{
+    PagerFrame *frame = pager->buckets[page_num & pager->bucket_mask];
+    while (frame != NULL && frame->page_num != page_num)
+    {
+        frame = frame->next;
+    }
+    return frame;
+}
+
+/**
+ * pager_find - looks a page up without pinning it, the caller has it
+ * pinned or latched
+ */
+static PagerFrame *pager_find (Pager *pager, uint32_t page_num)
+{
+    pthread_rwlock_rdlock (&pager->table_lock);
+    PagerFrame *frame = pager_lookup (pager, page_num);
+    pthread_rwlock_unlock (&pager->table_lock);
+    return frame;
+}
+
+/**
+ * pager_find_pinned - looks a page up and pins its frame if it is cached,
+ * the caller unpins it
+ */
+static PagerFrame *pager_find_pinned (Pager *pager, uint32_t page_num)
+{
+    pthread_rwlock_rdlock (&pager->table_lock);
+    PagerFrame *frame = pager_lookup (pager, page_num);
+    if (frame != NULL)
+    {
+        __atomic_fetch_add (&frame->pins, 1, __ATOMIC_ACQUIRE);
+    }
+    pthread_rwlock_unlock (&pager->table_lock);
+    return frame;
+}
+
+static void pager_unpin (PagerFrame *frame)
+{
+    __atomic_fetch_sub (&frame->pins, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * pager_prefetch - starts reading a page in the background, nothing if it
+ * is cached or past the end of the file
+ */
+void pager_prefetch (Pager *pager, uint32_t page_num)
+{
+    if (page_num == 0
+        || page_num >= __atomic_load_n (&pager->file_len, __ATOMIC_RELAXED)
+                           / PAGE_SIZE
+        || pager_find (pager, page_num) != NULL)
+    {
+        return;
+    }
+
+    if (page_num < pager->map_pages)
+    {
+        madvise (pager->map + (size_t) page_num * PAGE_SIZE, PAGE_SIZE,
+                 MADV_WILLNEED);
+    }
+    else if (!pager->direct_io)
+    {
+        posix_fadvise (pager->fd, (off_t) page_num * PAGE_SIZE, PAGE_SIZE,
+                       POSIX_FADV_WILLNEED);
+    }
+}
+
+/**
+ * pager_compressed_put - records whether a page is written compressed
+ *
+ * The bits of a chunk of pages are allocated when one of them is first
+ * compressed.
+ */
+static void pager_compressed_put (Pager *pager, uint32_t page_num,
+                                  bool compressed)
+{
+    uint64_t **slot = &pager->compressed[page_num >> PAGER_CHUNK_BITS];
+    uint64_t *chunk = __atomic_load_n (slot, __ATOMIC_ACQUIRE);
+    if (chunk == NULL)
+    {
+        if (!compressed)
+        {
+            return;
+        }
+        uint64_t *fresh =
+            calloc ((1u << PAGER_CHUNK_BITS) / 64, sizeof (uint64_t));
+        if (fresh == NULL)
+        {
+            perror ("Error allocating compression flags");
+            exit (EXIT_FAILURE);
+        }
+        // another thread may allocate the chunk first
+        if (__atomic_compare_exchange_n (slot, &chunk, fresh, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            chunk = fresh;
+        }
+        else
+        {
+            free (fresh);
+        }
+    }
+
+    uint32_t bit = page_num & ((1u << PAGER_CHUNK_BITS) - 1);
+    uint64_t mask = (uint64_t) 1 << (bit % 64);
+    if (compressed)
+    {
+        __atomic_fetch_or (&chunk[bit / 64], mask, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_and (&chunk[bit / 64], ~mask, __ATOMIC_RELAXED);
+    }
+}
+
+bool pager_is_compressed (Pager *pager, uint32_t page_num)
+{
+    uint64_t *chunk = __atomic_load_n (
+        &pager->compressed[page_num >> PAGER_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    if (chunk == NULL)
+    {
+        return false;
+    }
+    uint32_t bit = page_num & ((1u << PAGER_CHUNK_BITS) - 1);
+    return (__atomic_load_n (&chunk[bit / 64], __ATOMIC_RELAXED) >> (bit % 64))
+           & 1;
+}
+
+/**
+ * pager_inflate - expands an extent read into a frame to the page it holds
+ */
+static void pager_inflate (Pager *pager, uint32_t page_num, void *page)
 {
-    if (page_num >= TABLE_MAX_PAGES)
+    PageExtent extent;
+    memcpy (&extent, page, sizeof (extent));
+
+    uint8_t packed[PAGE_SIZE_MAX];
+    if (extent.codec != PAGE_CODEC_LZ
+        || extent.length > PAGE_SIZE - sizeof (PageExtent))
+    {
+        printf ("Error: page %u has an unknown extent.\n", page_num);
+        exit (EXIT_FAILURE);
+    }
+    memcpy (packed, (uint8_t *) page + sizeof (extent), extent.length);
+    if (lz_decompress (packed, extent.length, page, PAGE_SIZE) != PAGE_SIZE)
     {
-        printf ("Error: Page number %d out of bounds for cache (Max %d).\n",
-                page_num, TABLE_MAX_PAGES);
+        printf ("Error: compressed page %u is corrupt.\n", page_num);
         exit (EXIT_FAILURE);
     }
+    pager_compressed_put (pager, page_num, true);
+}
+
+/**
+ * pager_deflate - compresses a page into an extent
+ * @extent: PAGE_SIZE bytes
+ *
+ * Return: length of the extent, a multiple of PAGER_FRAME_ALIGNMENT, or 0
+ * if it would not save a block
+ */
+static uint32_t pager_deflate (void *page, uint8_t *extent)
+{
+    if (PAGE_SIZE <= PAGER_FRAME_ALIGNMENT)
+    {
+        return 0;
+    }
+
+    uint32_t cap = PAGE_SIZE - PAGER_FRAME_ALIGNMENT - sizeof (PageExtent);
+    uint32_t length =
+        lz_compress (page, PAGE_SIZE, extent + sizeof (PageExtent), cap);
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    PageExtent header = {0};
+    header.node_type = PAGE_COMPRESSED;
+    header.codec = PAGE_CODEC_LZ;
+    header.length = length;
+    memcpy (extent, &header, sizeof (header));
+
+    uint32_t used = sizeof (header) + length;
+    uint32_t extent_len = (used + PAGER_FRAME_ALIGNMENT - 1)
+                          & ~(uint32_t) (PAGER_FRAME_ALIGNMENT - 1);
+    memset (extent + used, 0, extent_len - used);
+    return extent_len;
+}
+
+/**
+ * pager_write_extent - writes an extent to the slot of a page and punches
+ * the rest of the slot out of the file
+ *
+ * A slot past the end of the file gets its last block written first, the
+ * file then covers it and the hole stays inside the file. A file system
+ * without holes keeps the old bytes, the extent says where the page ends.
+ *
+ * Return: bytes of the file the slot covers, -1 on error
+ */
+static ssize_t pager_write_extent (Pager *pager, off_t offset,
+                                   uint8_t *extent, uint32_t extent_len)
+{
+    static const uint8_t zero_block[PAGER_FRAME_ALIGNMENT]
+        __attribute__ ((aligned (PAGER_FRAME_ALIGNMENT))) = {0};
+
+    if (pwrite (pager->fd, extent, extent_len, offset) == -1)
+    {
+        return -1;
+    }
+    if ((uint64_t) offset + PAGE_SIZE
+            > __atomic_load_n (&pager->file_len, __ATOMIC_RELAXED)
+        && pwrite (pager->fd, zero_block, sizeof (zero_block),
+                   offset + PAGE_SIZE - sizeof (zero_block))
+               == -1)
+    {
+        return -1;
+    }
+    if (fallocate (pager->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   offset + extent_len, PAGE_SIZE - extent_len)
+        == -1)
+    {
+        // the extent is written and read back either way, it only saves
+        // no space
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+        {
+            perror ("Warning: could not punch a hole after a compressed page");
+        }
+        else if (!__atomic_exchange_n (&pager->no_holes, true,
+                                       __ATOMIC_RELAXED))
+        {
+            printf ("Warning: the file system has no holes, compressed "
+                    "pages are written whole.\n");
+        }
+    }
+    return PAGE_SIZE;
+}
 
-    if (pager->pages[page_num] != NULL)
+/**
+ * pager_fault - reads the page of a frame that was just taken for it
+ *
+ * Called with the write latch of the frame held.
+ *
+ * Return: the buffer of the frame, or the page in the mapping
+ */
+static void *pager_fault (Pager *pager, PagerFrame *frame)
+{
+    uint32_t page_num = frame->page_num;
+    if (page_num < pager->map_pages && !pager_is_compressed (pager, page_num))
     {
-        return pager->pages[page_num];
+        uint8_t *mapped = pager->map + (size_t) page_num * PAGE_SIZE;
+        if (__atomic_load_n (&pager->access, __ATOMIC_RELAXED)
+            == PAGER_ACCESS_NORMAL)
+        {
+            madvise (mapped, PAGE_SIZE, MADV_WILLNEED);
+        }
+        // an extent is expanded into the frame
+        if (mapped[0] != PAGE_COMPRESSED)
+        {
+            return mapped;
+        }
     }
-    void *page = push_array_zero (arena, void, PAGE_SIZE);
 
-    uint32_t num_pages = pager->file_len / PAGE_SIZE;
+    void *page = frame->buffer;
+    memset (page, 0, PAGE_SIZE);
 
-    if (pager->file_len % PAGE_SIZE)
+    uint64_t file_len = __atomic_load_n (&pager->file_len, __ATOMIC_RELAXED);
+    uint32_t num_pages = file_len / PAGE_SIZE;
+
+    if (file_len % PAGE_SIZE)
     {
         num_pages += 1;
     }
 
     if (page_num < num_pages)
     {
-        lseek (pager->fd, page_num * PAGE_SIZE, SEEK_SET);
-        ssize_t bytes_read = read (pager->fd, page, PAGE_SIZE);
+        ssize_t bytes_read =
+            pread (pager->fd, page, PAGE_SIZE, (off_t) page_num * PAGE_SIZE);
         if (bytes_read == -1)
         {
             printf ("Error reading file: %d\n", errno);
             exit (EXIT_FAILURE);
         }
+        if (*(uint8_t *) page == PAGE_COMPRESSED)
+        {
+            pager_inflate (pager, page_num, page);
+        }
     }
-
-    pager->pages[page_num] = page;
     return page;
 }
 
+/**
+ * pager_write_frame - writes the page of a pinned frame to disk
+ *
+ * The page is latched shared while it is written, so it is not changed half
+ * way through. It is marked clean first, a change made after the write
+ * marks it dirty again. A compressed page is written as an extent.
+ */
+static void pager_write_frame (Pager *pager, PagerFrame *frame)
+{
+    off_t offset = (off_t) frame->page_num * PAGE_SIZE;
+    uint8_t extent[PAGE_SIZE_MAX]
+        __attribute__ ((aligned (PAGER_FRAME_ALIGNMENT)));
+    uint32_t extent_len = 0;
+
+    pthread_rwlock_rdlock (&frame->latch);
+    void *page = __atomic_load_n (&frame->page, __ATOMIC_ACQUIRE);
+    __atomic_store_n (&frame->dirty, false, __ATOMIC_RELAXED);
+    if (page == frame->buffer && pager_is_compressed (pager, frame->page_num)
+        && !__atomic_load_n (&pager->no_holes, __ATOMIC_RELAXED))
+    {
+        extent_len = pager_deflate (page, extent);
+    }
+    ssize_t bytes_written =
+        extent_len > 0
+            ? pager_write_extent (pager, offset, extent, extent_len)
+            : pwrite (pager->fd, page, PAGE_SIZE, offset);
+    pthread_rwlock_unlock (&frame->latch);
+    if (bytes_written == -1)
+    {
+        perror ("Error flushing page to disk");
+        exit (EXIT_FAILURE);
+    }
+
+    uint64_t file_end = (uint64_t) offset + bytes_written;
+    uint64_t file_len = __atomic_load_n (&pager->file_len, __ATOMIC_RELAXED);
+    while (file_end > file_len
+           && !__atomic_compare_exchange_n (&pager->file_len, &file_len,
+                                            file_end, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+    {
+    }
+}
+
+// takes a frame out of the chain of its bucket
+static void pager_unlink (Pager *pager, PagerFrame *frame)
+{
+    PagerFrame **link = &pager->buckets[frame->page_num & pager->bucket_mask];
+    while (*link != frame)
+    {
+        link = &(*link)->next;
+    }
+    *link = frame->next;
+}
+
+/**
+ * pager_grow - adds a frame past the size of the pool, every frame is
+ * pinned or latched
+ *
+ * Called with the page table locked for writing.
+ *
+ * Return: the frame, latched exclusive
+ */
+static PagerFrame *pager_grow (Pager *pager)
+{
+    if (pager->frame_count == pager->frame_cap)
+    {
+        uint32_t cap = 2 * pager->frame_cap;
+        PagerFrame **frames =
+            realloc (pager->frames, cap * sizeof (PagerFrame *));
+        if (frames == NULL)
+        {
+            perror ("Error growing the page cache");
+            exit (EXIT_FAILURE);
+        }
+        pager->frames = frames;
+        pager->frame_cap = cap;
+    }
+
+    PagerFrame *frame = calloc (1, sizeof (PagerFrame));
+    uint8_t *buffer = aligned_alloc (PAGER_FRAME_ALIGNMENT, PAGE_SIZE);
+    if (frame == NULL || buffer == NULL)
+    {
+        perror ("Error growing the page cache");
+        exit (EXIT_FAILURE);
+    }
+    frame->buffer = buffer;
+    frame->overflow = true;
+    pthread_rwlock_init (&frame->latch, NULL);
+    pthread_rwlock_wrlock (&frame->latch);
+    pager->frames[pager->frame_count++] = frame;
+    return frame;
+}
+
+/**
+ * pager_sweep - finds a frame to read a page into with the clock hand
+ * @dirty: set to the frame to write out first if the one found is dirty
+ *
+ * A frame used since the hand last passed it is skipped once. An overflow
+ * frame that can be evicted is freed instead of reused.
+ *
+ * Called with the page table locked for writing, so no frame gains a pin.
+ *
+ * Return: a frame out of the page table and latched exclusive, or NULL with
+ * @dirty pinned, the caller writes it and sweeps again
+ */
+static PagerFrame *pager_sweep (Pager *pager, PagerFrame **dirty)
+{
+    for (uint32_t n = 0; n < 2 * pager->frame_count; n++)
+    {
+        if (pager->hand >= pager->frame_count)
+        {
+            pager->hand = 0;
+        }
+        PagerFrame *frame = pager->frames[pager->hand];
+        bool cached =
+            __atomic_load_n (&frame->page, __ATOMIC_RELAXED) != NULL;
+
+        if (cached
+            && (__atomic_load_n (&frame->pins, __ATOMIC_ACQUIRE) != 0
+                || (!frame->overflow
+                    && __atomic_exchange_n (&frame->referenced, false,
+                                            __ATOMIC_RELAXED))))
+        {
+            pager->hand++;
+            continue;
+        }
+        if (pthread_rwlock_trywrlock (&frame->latch) != 0)
+        {
+            pager->hand++;
+            continue;
+        }
+        if (cached && __atomic_load_n (&frame->dirty, __ATOMIC_RELAXED))
+        {
+            pthread_rwlock_unlock (&frame->latch);
+            __atomic_fetch_add (&frame->pins, 1, __ATOMIC_ACQUIRE);
+            *dirty = frame;
+            pager->hand++;
+            return NULL;
+        }
+
+        if (cached)
+        {
+            pager_unlink (pager, frame);
+            frame->page = NULL;
+        }
+        if (frame->overflow)
+        {
+            // the frame at the end takes its place under the hand
+            pager->frames[pager->hand] = pager->frames[--pager->frame_count];
+            pthread_rwlock_unlock (&frame->latch);
+            pthread_rwlock_destroy (&frame->latch);
+            free (frame->buffer);
+            free (frame);
+            continue;
+        }
+        pager->hand++;
+        return frame;
+    }
+    return pager_grow (pager);
+}
+
+/**
+ * pager_load - takes a frame for a page that is not cached and reads it in
+ *
+ * The frame goes into the page table before the page is read, latched
+ * exclusive, so a thread that finds it waits for the latch. A thread that
+ * took a frame for the page first wins.
+ *
+ * Return: the frame, pinned
+ */
+static PagerFrame *pager_load (Pager *pager, uint32_t page_num)
+{
+    pthread_rwlock_wrlock (&pager->table_lock);
+    PagerFrame *frame;
+    while (true)
+    {
+        frame = pager_lookup (pager, page_num);
+        if (frame != NULL)
+        {
+            __atomic_fetch_add (&frame->pins, 1, __ATOMIC_ACQUIRE);
+            pthread_rwlock_unlock (&pager->table_lock);
+            return frame;
+        }
+
+        PagerFrame *dirty = NULL;
+        frame = pager_sweep (pager, &dirty);
+        if (frame != NULL)
+        {
+            break;
+        }
+
+        // a dirty victim is written with the page table unlocked
+        pthread_rwlock_unlock (&pager->table_lock);
+        pager_write_frame (pager, dirty);
+        pager_unpin (dirty);
+        pthread_rwlock_wrlock (&pager->table_lock);
+    }
+
+    frame->page_num = page_num;
+    frame->pins = 1;
+    frame->dirty = false;
+    frame->referenced = true;
+    __atomic_store_n (&frame->loading, true, __ATOMIC_RELAXED);
+    PagerFrame **bucket = &pager->buckets[page_num & pager->bucket_mask];
+    frame->next = *bucket;
+    *bucket = frame;
+    pthread_rwlock_unlock (&pager->table_lock);
+
+    __atomic_store_n (&frame->page, pager_fault (pager, frame),
+                      __ATOMIC_RELEASE);
+    __atomic_store_n (&frame->loading, false, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock (&frame->latch);
+    return frame;
+}
+
+static void pager_push_pin (PagerFrame *frame)
+{
+    if (pin_count == pin_cap)
+    {
+        uint32_t cap = pin_cap ? 2 * pin_cap : 64;
+        PagerFrame **stack = realloc (pin_stack, cap * sizeof (PagerFrame *));
+        if (stack == NULL)
+        {
+            perror ("Error growing the pin stack");
+            exit (EXIT_FAILURE);
+        }
+        pin_stack = stack;
+        pin_cap = cap;
+        pthread_once (&pin_stack_once, pin_stack_key_init);
+        pthread_setspecific (pin_stack_key, stack);
+    }
+    pin_stack[pin_count++] = frame;
+}
+
+/**
+ * pager_pin - pins the frame of a page for the calling thread, reading the
+ * page in on a miss
+ *
+ * Return: the frame, its page is read in
+ */
+static PagerFrame *pager_pin (Pager *pager, uint32_t page_num)
+{
+    if (page_num >= __atomic_load_n (&pager->num_pages, __ATOMIC_RELAXED))
+    {
+        printf ("Error: Page number %u out of bounds (%u pages).\n", page_num,
+                pager->num_pages);
+        exit (EXIT_FAILURE);
+    }
+
+    PagerFrame *frame = pager_find_pinned (pager, page_num);
+    if (frame == NULL)
+    {
+        frame = pager_load (pager, page_num);
+    }
+    else
+    {
+        __atomic_store_n (&frame->referenced, true, __ATOMIC_RELAXED);
+    }
+    pager_push_pin (frame);
+
+    if (__atomic_load_n (&frame->loading, __ATOMIC_ACQUIRE))
+    {
+        // the thread reading it in holds the write latch
+        pthread_rwlock_rdlock (&frame->latch);
+        pthread_rwlock_unlock (&frame->latch);
+    }
+    return frame;
+}
+
+/**
+ * pager_get_page - returns a pointer to a page, reading it on a miss
+ *
+ * @pager: contains pages
+ * @page_num: page number of page to get
+ *
+ * Safe to call from several threads. The page is pinned until the thread
+ * unpins to a mark taken before, see BUFFER POOL. The latch of the page is
+ * not held once it returns, see pager_latch.
+ *
+ * Return: pointer to page
+ * */
+void *pager_get_page (Pager *pager, uint32_t page_num)
+{
+    return __atomic_load_n (&pager_pin (pager, page_num)->page,
+                            __ATOMIC_ACQUIRE);
+}
+
+/**
+ * pager_pin_mark - the number of pins the calling thread holds, to unpin
+ * back to with pager_unpin_to
+ */
+uint32_t pager_pin_mark (Pager *pager)
+{
+    return pin_count;
+}
+
+/**
+ * pager_unpin_to - releases the pins the calling thread took since a mark,
+ * their pages may be evicted from then on
+ */
+void pager_unpin_to (Pager *pager, uint32_t mark)
+{
+    while (pin_count > mark)
+    {
+        pager_unpin (pin_stack[--pin_count]);
+    }
+}
+
+/**
+ * pager_latch - pins a page and latches it, shared to read it, exclusive to
+ * change it
+ */
+void pager_latch (Pager *pager, uint32_t page_num, bool exclusive)
+{
+    PagerFrame *frame = pager_pin (pager, page_num);
+    if (exclusive)
+    {
+        pthread_rwlock_wrlock (&frame->latch);
+    }
+    else
+    {
+        pthread_rwlock_rdlock (&frame->latch);
+    }
+}
+
+void pager_unlatch (Pager *pager, uint32_t page_num)
+{
+    pthread_rwlock_unlock (&pager_find (pager, page_num)->latch);
+}
+
 /**
  * pager_flush - writes page to disk
  * @pager: pointer to pager
  * @page_num: page number
+ *
+ * A page that is not cached was written when it was evicted.
  */
 void pager_flush (Pager *pager, uint32_t page_num)
 {
-    if (pager->pages[page_num] == NULL)
+    PagerFrame *frame = pager_find_pinned (pager, page_num);
+    if (frame != NULL)
     {
-        printf ("Error: Tried to flush page %d which is not in cache.\n",
-                page_num);
-        exit (EXIT_FAILURE);
+        pager_write_frame (pager, frame);
+        pager_unpin (frame);
     }
+}
 
-    off_t offset = page_num * PAGE_SIZE;
+/**
+ * pager_allocate_page - reserves a page, the head of the free list or a new
+ * page at the end of the file
+ * @pager: pointer to pager
+ *
+ * The caller initializes the page, it is not written until it is flushed.
+ *
+ * Return: page number, or 0 if the file has max_pages pages and the free
+ * list is empty
+ */
+uint32_t pager_allocate_page (Pager *pager)
+{
+    uint32_t mark = pager_pin_mark (pager);
+    DatabaseHeader *db_header = (DatabaseHeader *) pager_get_page (pager, 0);
+    uint32_t page_num = 0;
+
+    pthread_mutex_lock (&pager->lock);
+    if (db_header->free_head != 0)
+    {
+        page_num = db_header->free_head;
+        SlottedPageHeader *page =
+            (SlottedPageHeader *) pager_get_page (pager, page_num);
+        db_header->free_head = page->next_leaf;
+        pager_mark_dirty (pager, 0);
+        pager_mark_dirty (pager, page_num);
+    }
+    else if (pager->num_pages < pager->max_pages)
+    {
+        page_num = pager->num_pages;
+        __atomic_store_n (&pager->num_pages, page_num + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock (&pager->lock);
+    pager_unpin_to (pager, mark);
+    return page_num;
+}
 
-    if (lseek (pager->fd, offset, SEEK_SET) == -1)
+/**
+ * pager_allocate_page_like - allocates a page that is compressed if the
+ * page @like is, the page of the same table it is added to
+ *
+ * Return: page number, or 0 if the database is out of pages
+ */
+uint32_t pager_allocate_page_like (Pager *pager, uint32_t like)
+{
+    uint32_t page_num = pager_allocate_page (pager);
+    if (page_num != 0)
     {
-        perror ("Error seeking in pager_flush");
+        pager_set_compressed (pager, page_num,
+                              pager_is_compressed (pager, like));
+    }
+    return page_num;
+}
+
+/**
+ * pager_set_compressed - sets whether a page is written compressed
+ *
+ * A cached page served from the mapping is copied into its frame, nobody
+ * may hold a pointer to it.
+ */
+void pager_set_compressed (Pager *pager, uint32_t page_num, bool compressed)
+{
+    pager_compressed_put (pager, page_num, compressed);
+
+    PagerFrame *frame = pager_find_pinned (pager, page_num);
+    if (frame == NULL)
+    {
+        return;
+    }
+    pthread_rwlock_wrlock (&frame->latch);
+    if (compressed && frame->page != frame->buffer)
+    {
+        memcpy (frame->buffer, frame->page, PAGE_SIZE);
+        __atomic_store_n (&frame->page, frame->buffer, __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock (&frame->latch);
+    pager_unpin (frame);
+}
+
+/**
+ * pager_free_page - puts a page that is no longer used on the free list
+ * @pager: pointer to pager
+ * @page_num: page number, never 0
+ */
+void pager_free_page (Pager *pager, uint32_t page_num)
+{
+    uint32_t mark = pager_pin_mark (pager);
+    DatabaseHeader *db_header = (DatabaseHeader *) pager_get_page (pager, 0);
+    SlottedPageHeader *page =
+        (SlottedPageHeader *) pager_get_page (pager, page_num);
+
+    pthread_mutex_lock (&pager->lock);
+    uint32_t free_count = 0;
+    if (db_header->free_head != 0)
+    {
+        SlottedPageHeader *head = (SlottedPageHeader *) pager_get_page (
+            pager, db_header->free_head);
+        free_count = head->data_start;
+    }
+
+    page->node_type = PAGE_FREE;
+    page->is_root = 0;
+    page->num_cells = 0;
+    page->data_start = free_count + 1;
+    page->next_leaf = db_header->free_head;
+    db_header->free_head = page_num;
+    pager_compressed_put (pager, page_num, false);
+    pager_mark_dirty (pager, page_num);
+    pager_mark_dirty (pager, 0);
+    __atomic_fetch_add (&pager->free_epoch, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock (&pager->lock);
+    pager_unpin_to (pager, mark);
+}
+
+// see CONCURRENCY in pager.h
+uint32_t pager_free_epoch (Pager *pager)
+{
+    return __atomic_load_n (&pager->free_epoch, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * pager_pages_left - number of pages pager_allocate_page can still hand out
+ */
+uint32_t pager_pages_left (Pager *pager)
+{
+    uint32_t mark = pager_pin_mark (pager);
+    DatabaseHeader *db_header = (DatabaseHeader *) pager_get_page (pager, 0);
+
+    pthread_mutex_lock (&pager->lock);
+    uint32_t left = pager->num_pages < pager->max_pages
+                        ? pager->max_pages - pager->num_pages
+                        : 0;
+    if (db_header->free_head != 0)
+    {
+        SlottedPageHeader *head = (SlottedPageHeader *) pager_get_page (
+            pager, db_header->free_head);
+        left += head->data_start;
+    }
+    pthread_mutex_unlock (&pager->lock);
+    pager_unpin_to (pager, mark);
+    return left;
+}
+
+/**
+ * pager_mark_dirty - records that a cached page was modified
+ * @pager: pointer to pager
+ * @page_num: page number, pinned by the caller
+ *
+ * Dirty pages are written once by pager_flush_dirty or when they are
+ * evicted, no matter how many times they were modified.
+ */
+void pager_mark_dirty (Pager *pager, uint32_t page_num)
+{
+    PagerFrame *frame = pager_find (pager, page_num);
+    if (frame == NULL)
+    {
+        printf ("Error: page %u was changed while it was not pinned.\n",
+                page_num);
         exit (EXIT_FAILURE);
     }
+    __atomic_store_n (&frame->dirty, true, __ATOMIC_RELAXED);
+}
 
-    ssize_t bytes_written =
-        write (pager->fd, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1)
+/**
+ * pager_flush_dirty - writes every dirty page to disk
+ * @pager: pointer to pager
+ *
+ * The dirty frames are pinned while the page table is locked and written
+ * once it is not.
+ */
+void pager_flush_dirty (Pager *pager)
+{
+    pthread_rwlock_rdlock (&pager->table_lock);
+    PagerFrame **dirty = malloc (pager->frame_count * sizeof (PagerFrame *));
+    uint32_t count = 0;
+    for (uint32_t i = 0; dirty != NULL && i < pager->frame_count; i++)
     {
-        perror ("Error flushing page to disk");
+        PagerFrame *frame = pager->frames[i];
+        if (__atomic_load_n (&frame->page, __ATOMIC_RELAXED) != NULL
+            && __atomic_load_n (&frame->dirty, __ATOMIC_RELAXED))
+        {
+            __atomic_fetch_add (&frame->pins, 1, __ATOMIC_ACQUIRE);
+            dirty[count++] = frame;
+        }
+    }
+    pthread_rwlock_unlock (&pager->table_lock);
+    if (dirty == NULL)
+    {
+        perror ("Error flushing the page cache");
         exit (EXIT_FAILURE);
     }
 
-    uint32_t file_end = offset + bytes_written;
-    if (file_end > pager->file_len)
+    for (uint32_t i = 0; i < count; i++)
     {
-        pager->file_len = file_end;
-        pager->num_pages = pager->file_len / PAGE_SIZE;
+        pager_write_frame (pager, dirty[i]);
+        pager_unpin (dirty[i]);
     }
+    free (dirty);
 }
 
 void pager_close (Pager *pager)
 {
+    pager_flush_dirty (pager);
+    if (pager->map != NULL)
+    {
+        munmap (pager->map, (size_t) pager->map_pages * PAGE_SIZE);
+    }
     if (close (pager->fd) == -1)
     {
         perror ("Error closing db file");
         exit (EXIT_FAILURE);
     }
+
+    for (uint32_t i = 0; i < pager->frame_count; i++)
+    {
+        if (pager->frames[i]->overflow)
+        {
+            free (pager->frames[i]->buffer);
+            free (pager->frames[i]);
+        }
+    }
+    for (uint32_t i = 0; i < PAGER_CHUNKS; i++)
+    {
+        free (pager->compressed[i]);
+    }
+    free (pager->frames);
+    free (pager->buckets);
+    free (pager->pool);
 }
 /**
  * pager_slotted_insert - Inserts a Key-Value pair into the node
@@ -182,6 +1159,152 @@ bool pager_slotted_insert (void *node, void *key, uint32_t key_size, void *val,
     return true;
 }
 
+/**
+ * pager_slotted_insert_at - Inserts a Key-Value pair at a slot position
+ * @slot_index: position in the slot directory, later slots shift right
+ *
+ * Used by the btree to keep the slot directory sorted by key.
+ *
+ * Return: false if the page is full
+ */
+bool pager_slotted_insert_at (void *node, uint16_t slot_index, void *key,
+                              uint32_t key_size, void *val, uint32_t val_size)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    uint16_t last = header->num_cells;
+
+    if (!pager_slotted_insert (node, key, key_size, val, val_size))
+    {
+        return false;
+    }
+
+    Slot *slots = PAGE_SLOTS (node);
+    Slot new_slot = slots[last];
+    memmove (&slots[slot_index + 1], &slots[slot_index],
+             (last - slot_index) * sizeof (Slot));
+    slots[slot_index] = new_slot;
+
+    return true;
+}
+
+/**
+ * pager_slotted_insert_into - writes a cell into a deleted slot, so the
+ * slot number is used again
+ * @slot_index: a slot of size 0
+ *
+ * Return: false if the page is full
+ */
+bool pager_slotted_insert_into (void *node, uint16_t slot_index, void *key,
+                                uint32_t key_size, void *val,
+                                uint32_t val_size)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    uint32_t total_payload = sizeof (uint32_t) + key_size + val_size;
+
+    if (pager_slotted_free_space (node) < total_payload)
+    {
+        return false;
+    }
+
+    header->data_start -= total_payload;
+    uint8_t *heap_ptr = (uint8_t *) node + header->data_start;
+    memcpy (heap_ptr, &key_size, sizeof (uint32_t));
+    memcpy (heap_ptr + 4, key, key_size);
+    memcpy (heap_ptr + 4 + key_size, val, val_size);
+
+    Slot *slots = PAGE_SLOTS (node);
+    slots[slot_index].offset = header->data_start;
+    slots[slot_index].size = total_payload;
+    return true;
+}
+
+/**
+ * pager_slotted_dead_space - bytes of the data region no live cell uses,
+ * the cells of tombstones and the tails of cells that shrank
+ */
+uint32_t pager_slotted_dead_space (void *node)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    Slot *slots = PAGE_SLOTS (node);
+
+    uint32_t live = 0;
+    for (int i = 0; i < header->num_cells; i++)
+    {
+        live += slots[i].size;
+    }
+    return PAGE_SIZE - header->data_start - live;
+}
+
+/**
+ * pager_slotted_compact - moves the live cells together at the end of the
+ * page, the dead space becomes free space
+ * @keep_slots: tombstones keep their place so every live cell keeps its
+ * slot number, only trailing ones are dropped. Otherwise all tombstones are
+ * dropped and the slots after them move down
+ *
+ * The order of the slots is kept. A tombstone that stays loses its key.
+ */
+void pager_slotted_compact (void *node, bool keep_slots)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    Slot *slots = PAGE_SLOTS (node);
+
+    uint8_t image[PAGE_SIZE_MAX];
+    memcpy (image, node, PAGE_SIZE);
+
+    uint32_t data_start = PAGE_SIZE;
+    uint16_t count = 0;
+    for (int i = 0; i < header->num_cells; i++)
+    {
+        Slot s = slots[i];
+        if (s.size == 0)
+        {
+            if (keep_slots)
+            {
+                slots[count++] = (Slot) {0, 0};
+            }
+            continue;
+        }
+
+        data_start -= s.size;
+        memcpy ((uint8_t *) node + data_start, image + s.offset, s.size);
+        slots[count++] = (Slot) {(uint16_t) data_start, s.size};
+    }
+
+    while (count > 0 && slots[count - 1].size == 0)
+    {
+        count--;
+    }
+    header->num_cells = count;
+    header->data_start = data_start;
+}
+
+/**
+ * pager_slotted_free_space - bytes between the slot directory and the data
+ */
+uint32_t pager_slotted_free_space (void *node)
+{
+    SlottedPageHeader *header = (SlottedPageHeader *) node;
+    uint32_t used_upper =
+        sizeof (SlottedPageHeader) + (header->num_cells * sizeof (Slot));
+    return header->data_start - used_upper;
+}
+
+/**
+ * slot_get_key - reads only the key of a slot
+ *
+ * Also works on deleted slots, whose key bytes stay in place.
+ */
+void slot_get_key (void *node, uint16_t slot_index, void **key_out,
+                   uint32_t *key_len_out)
+{
+    Slot s = PAGE_SLOTS (node)[slot_index];
+    uint8_t *ptr = (uint8_t *) node + s.offset;
+
+    memcpy (key_len_out, ptr, sizeof (uint32_t));
+    *key_out = ptr + 4;
+}
+
 void slot_get_content (void *node, uint16_t slot_index, void **key_out,
                        uint32_t *key_len_out, void **val_out,
                        uint32_t *val_len_out)
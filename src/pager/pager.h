@@ -4,15 +4,24 @@
 #include "../arena/arena.h"
 #include "stdint.h"
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-// 32 KiB - should be 4096(4KiB) since computers read in this block size,
-// but since we don't have page splitting yet and our tables take one page, we
-// increase this.
-// TODO  implement page splitting later
-#define PAGE_SIZE       32768
-#define TABLE_MAX_PAGES 100
+/*
+ * PAGE SIZE
+ * ---------
+ * Chosen when the database is created, a power of two from PAGE_SIZE_MIN to
+ * PAGE_SIZE_MAX, and kept in the database header. PAGE_SIZE is the size of
+ * the open database, pager_open sets it, so the server opens one database at
+ * a time. Buffers that hold a page or a cell are sized for PAGE_SIZE_MAX.
+ */
+#define PAGE_SIZE_MIN     4096
+#define PAGE_SIZE_MAX     65536
+#define PAGE_SIZE_DEFAULT 32768
+#define PAGE_SIZE         pager_page_size
+extern uint32_t pager_page_size;
 
 /**
  * PAGE STRUCTURE
@@ -22,6 +31,9 @@
  *  ------------------------------------------------------------------------
  */
 
+// A deleted slot keeps its offset and has size 0 (tombstone), so its key
+// can still be read until the page is rebuilt or compacted. A cell starts
+// below PAGE_SIZE_MAX and is smaller than a page, so both fit in 16 bits.
 typedef struct
 {
     uint16_t offset;
@@ -33,26 +45,242 @@ typedef struct
     uint8_t node_type; // LEAF or INTERNAL
     uint8_t is_root;
     uint16_t num_cells;  // Number of active slots
-    uint16_t data_start; // Offset to data
-    uint16_t next_leaf;  // next page number
+    uint32_t data_start; // Offset to data, PAGE_SIZE when the page is empty
+    uint32_t next_leaf;  // next page number
 } SlottedPageHeader;
 
+#define PAGE_SLOTS(node)                                                       \
+    ((Slot *) ((uint8_t *) (node) + sizeof (SlottedPageHeader)))
+
+/*
+ * DATABASE HEADER
+ * ---------------
+ * Page 0 of the file holds the header, the rest of the page is unused. It is
+ * written when the database is created and read back by pager_open before
+ * any other page, the page size of the file comes from it.
+ */
+#define DB_HEADER_MAGIC    "csql db" // 8 bytes with its NUL
+#define DB_FORMAT_VERSION  2
+#define PAGE_DB_HEADER     0xfe // node_type byte of page 0
+
+typedef struct
+{
+    uint8_t node_type; // PAGE_DB_HEADER
+    char magic[sizeof (DB_HEADER_MAGIC)];
+    uint8_t reserved[7];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t free_head; // first page of the free list, 0 if it is empty
+} DatabaseHeader;
+
+/*
+ * FREE LIST
+ * ---------
+ * Pages given back with pager_free_page are handed out again before the
+ * file grows. They are chained through next_leaf, the head is free_head of
+ * the database header. data_start of a free page holds the length of the
+ * list from it on, num_cells stays 0.
+ */
+#define PAGE_FREE 0xff // node_type of a page on the free list
+
+/*
+ * MMAP MODE
+ * ---------
+ * pager_map maps the pages the file holds at that point, pager_get_page then
+ * returns pointers into the mapping instead of reading them into frames.
+ * The mapping is private and writable: callers change pages in place, the
+ * kernel copies a page on its first write and pager_flush writes it back
+ * like any other. Pages the file gains later are read into frames.
+ *
+ * Scans set PAGER_ACCESS_SCAN so the kernel reads ahead and drops pages
+ * behind them. Otherwise a mapped page is asked for whole on its first use,
+ * so a descent reads each node with one I/O instead of a fault per 4 KiB.
+ */
+typedef enum
+{
+    PAGER_ACCESS_NORMAL,
+    PAGER_ACCESS_SCAN,
+} PagerAccess;
+
+/*
+ * DIRECT I/O
+ * ----------
+ * pager_direct_io turns on O_DIRECT, pages then go between the file and the
+ * page cache without a copy in the kernel's cache, so the memory a database
+ * takes is the memory of its own cache. O_DIRECT needs buffers, offsets and
+ * lengths aligned to the block size, so cached pages are allocated at
+ * PAGER_FRAME_ALIGNMENT and every read and write is a whole page.
+ */
+#define PAGER_FRAME_ALIGNMENT 4096
+
+/*
+ * BUFFER POOL
+ * -----------
+ * Pages are cached in a pool of frames sized by pager_open, at least
+ * PAGER_MIN_FRAMES. A hashed page table maps a page number to its frame, a
+ * miss takes a frame from a clock sweep: frames used since the hand last
+ * passed them get another round, a dirty victim is written out first.
+ *
+ * pager_get_page pins the frame of the page and the pointer stays valid
+ * while it is pinned. Pins are kept on a stack per thread: pager_pin_mark
+ * returns its depth, pager_unpin_to releases the pins taken since a mark.
+ * Code that takes a mark releases to it once no pointer it took is used
+ * any more, and nothing below it. The worker releases every pin once its
+ * statement is done. A page is changed and marked dirty while it is pinned.
+ *
+ * A frame is evicted only when it is unpinned, clean and its latch is free.
+ * If every frame is pinned the pool grows by a frame, the frames past the
+ * size of the pool are freed again once they are unpinned.
+ */
+#define PAGER_MIN_FRAMES    64
+#define PAGER_CACHE_DEFAULT (16u * 1024 * 1024) // bytes of pool by default
+
+/*
+ * CONCURRENCY
+ * -----------
+ * The pager can be used from several threads at once. The page table is
+ * guarded by a reader-writer lock: a hit looks the page up and pins its
+ * frame in read mode, a miss takes a frame in write mode. The page is read
+ * with pread outside of it, under the write latch of the frame, threads
+ * that find the frame while it is read wait for that latch. Reads and
+ * writes are positional, the file offset is not shared.
+ *
+ * Each frame has a reader-writer latch, pager_latch takes it shared to read
+ * the page and exclusive to change it. pager_flush holds it shared while the
+ * page is written out. The sweep only tries latches, so a thread that holds
+ * one may miss. num_pages and the free list are guarded by the pager's
+ * mutex, a miss under it may evict, so file_len is raised with a compare
+ * and swap instead.
+ *
+ * free_epoch counts the pages freed. Code that keeps a page number without
+ * a latch, e.g. a cursor between moves, trusts it again only if no page was
+ * freed meanwhile. A btree frees a node while it is latched exclusive, so
+ * a thread that latches it after sees the count go up.
+ */
+
+/*
+ * READ-AHEAD
+ * ----------
+ * pager_prefetch asks the kernel to start reading a page that is not cached
+ * yet, the pager_get_page that follows finds it in memory. Scans use it for
+ * the pages they are about to visit. With O_DIRECT the kernel's cache is
+ * bypassed, there is nothing to read into and it does nothing.
+ */
+
+/*
+ * COMPRESSION
+ * -----------
+ * Pages of a compressed table are cached as they are and written as an
+ * extent at the start of their slot in the file: a PageExtent header, then
+ * the page compressed with lz_compress, padded to PAGER_FRAME_ALIGNMENT.
+ * The rest of the slot is punched out of the file, only the extent takes
+ * space on disk and is read back, while page N still starts at N * PAGE_SIZE
+ * for the mapping, read-ahead and O_DIRECT. A page that does not shrink by
+ * a block is written whole. On a file system that cannot punch holes an
+ * extent saves nothing, pages are written whole once the first punch fails.
+ *
+ * Which pages to compress is kept in memory. A table sets it on its root
+ * page when it is created, the pages allocated for it with
+ * pager_allocate_page_like inherit it and a page read back as an extent is
+ * compressed again. A compressed table that is loaded sets it on all of its
+ * pages, see btree_mark_compressed and heap_mark_compressed. A compressed
+ * page is never served from the mapping, writing its extent changes the
+ * file under it.
+ */
+#define PAGE_COMPRESSED 0xfd // node_type byte of an extent
+#define PAGE_CODEC_LZ   1
+
+typedef struct
+{
+    uint8_t node_type; // PAGE_COMPRESSED
+    uint8_t codec;
+    uint16_t reserved;
+    uint32_t length; // bytes of compressed page after the header
+} PageExtent;
+
+typedef struct PagerFrame
+{
+    uint32_t page_num;
+    uint32_t pins;
+    bool dirty;
+    bool referenced; // used since the clock hand last passed it
+    bool loading;    // the page is being read in under the latch
+    bool overflow;   // past the size of the pool, freed once unpinned
+    struct PagerFrame *next; // in the chain of its page table bucket
+    pthread_rwlock_t latch;
+    void *page;      // the buffer, or the page in the mapping
+    uint8_t *buffer; // PAGE_SIZE bytes at PAGER_FRAME_ALIGNMENT
+} PagerFrame;
+
+// one bit per page, in chunks allocated once a page of theirs is compressed
+#define PAGER_CHUNK_BITS 20
+#define PAGER_CHUNKS     (1u << (32 - PAGER_CHUNK_BITS))
+
 typedef struct
 {
     int fd;
-    uint32_t file_len;
-    uint32_t num_pages;
-    void *pages[TABLE_MAX_PAGES];
+    uint64_t file_len;
+    uint32_t num_pages; // page numbers are 32 bits, 16 TiB of 4 KiB pages
+    uint32_t max_pages; // pages the file may grow to, UINT32_MAX by default
+    uint32_t free_epoch; // pages freed so far, see CONCURRENCY
+    pthread_mutex_t lock;
+
+    pthread_rwlock_t table_lock;
+    PagerFrame **buckets;
+    uint32_t bucket_mask;
+    PagerFrame **frames;
+    uint32_t frame_count;
+    uint32_t frame_cap;
+    uint32_t pool_size; // frames the pool keeps
+    uint32_t hand;      // next frame the clock sweep looks at
+    uint8_t *pool;      // buffers of the first pool_size frames
+
+    uint64_t *compressed[PAGER_CHUNKS];
+
+    uint8_t *map; // NULL unless pager_map was called
+    uint32_t map_pages;
+    PagerAccess access;
+    bool direct_io;
+    bool no_holes; // the file system cannot punch holes, see COMPRESSION
 } Pager;
 
-Pager *pager_open (Arena *arena, const char *filename);
-void *pager_get_page (Arena *arena, Pager *pager, uint32_t page_num);
+bool pager_page_size_valid (uint32_t page_size);
+Pager *pager_open (Arena *arena, const char *filename, uint32_t page_size,
+                  size_t cache_size);
+bool pager_map (Pager *pager);
+bool pager_direct_io (Pager *pager);
+void pager_advise (Pager *pager, PagerAccess access);
+void pager_prefetch (Pager *pager, uint32_t page_num);
+void *pager_get_page (Pager *pager, uint32_t page_num);
+uint32_t pager_pin_mark (Pager *pager);
+void pager_unpin_to (Pager *pager, uint32_t mark);
+void pager_latch (Pager *pager, uint32_t page_num, bool exclusive);
+void pager_unlatch (Pager *pager, uint32_t page_num);
+uint32_t pager_allocate_page (Pager *pager);
+uint32_t pager_allocate_page_like (Pager *pager, uint32_t like);
+void pager_set_compressed (Pager *pager, uint32_t page_num, bool compressed);
+bool pager_is_compressed (Pager *pager, uint32_t page_num);
+void pager_free_page (Pager *pager, uint32_t page_num);
+uint32_t pager_free_epoch (Pager *pager);
+uint32_t pager_pages_left (Pager *pager);
 void pager_flush (Pager *pager, uint32_t page_num);
+void pager_mark_dirty (Pager *pager, uint32_t page_num);
+void pager_flush_dirty (Pager *pager);
 void pager_close (Pager *pager);
 bool pager_slotted_insert (void *node, void *key, uint32_t key_size, void *val,
                            uint32_t val_size);
+bool pager_slotted_insert_at (void *node, uint16_t slot_index, void *key,
+                              uint32_t key_size, void *val, uint32_t val_size);
+bool pager_slotted_insert_into (void *node, uint16_t slot_index, void *key,
+                                uint32_t key_size, void *val,
+                                uint32_t val_size);
+uint32_t pager_slotted_free_space (void *node);
+uint32_t pager_slotted_dead_space (void *node);
+void pager_slotted_compact (void *node, bool keep_slots);
 void slot_get_content (void *node, uint16_t slot_index, void **key_out,
                        uint32_t *key_len_out, void **val_out,
                        uint32_t *val_len_out);
+void slot_get_key (void *node, uint16_t slot_index, void **key_out,
+                   uint32_t *key_len_out);
 
 #endif /* PAGER_H */
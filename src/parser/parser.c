@@ -10,12 +10,18 @@ static Statement parser_parse_insert (Parser *p);
 static Statement parser_parse_select (Parser *p);
 static Statement parser_parse_delete (Parser *p);
 static Statement parser_parse_update (Parser *p);
+static Statement parser_parse_copy (Parser *p);
+static Statement parser_parse_vacuum (Parser *p);
 static Statement stmt_error (const char *msg);
 static bool parser_expect (Parser *p, TokenType type);
 static ColumnRef parser_parse_column_ref (Parser *p);
+static const char *parser_parse_where (Parser *p, WhereClause *where);
+static const char *parser_parse_column_list (Parser *p, str8 *names,
+                                             int max, int *count);
 
-void parser_init (Parser *p, const char *input)
+void parser_init (Parser *p, Arena *arena, const char *input)
 {
+    p->arena = arena;
     lexer_init (&p->l, input);
     parser_next_token (p); // fill curr
     parser_next_token (p); // fill peek
@@ -53,17 +59,24 @@ Statement parser_parse_statement (Parser *p)
         return parser_parse_update (p);
     case TOKEN_DELETE:
         return parser_parse_delete (p);
+    case TOKEN_COPY:
+        return parser_parse_copy (p);
+    case TOKEN_VACUUM:
+        return parser_parse_vacuum (p);
     default:
         return stmt_error ("Unexpected token");
     }
 }
 
-// Syntax: CREATE TABLE <name> ( <col> <type>, ... );
+// Syntax: CREATE TABLE <name> ( <col> <type>, ... )
+//         [WITH (organization = btree | heap, compression = lz | none)];
 static Statement parser_parse_create_table (Parser *p)
 {
     Statement s;
     s.type = STMT_CREATE_TABLE;
     s.create.col_count = 0;
+    s.create.organization = TABLE_BTREE;
+    s.create.compression = COMPRESSION_NONE;
 
     parser_next_token (p); // skip CREATE
     if (!parser_expect (p, TOKEN_TABLE))
@@ -160,6 +173,63 @@ static Statement parser_parse_create_table (Parser *p)
         return stmt_error ("Expected ')' after columns");
     }
 
+    if (parser_expect (p, TOKEN_WITH))
+    {
+        if (!parser_expect (p, TOKEN_LPAREN))
+        {
+            return stmt_error ("Expected '(' after WITH");
+        }
+
+        do
+        {
+            if (p->curr.type != TOKEN_IDENT)
+            {
+                return stmt_error ("Expected 'organization' or 'compression'");
+            }
+            str8 option = p->curr.literal;
+            parser_next_token (p);
+
+            if (!parser_expect (p, TOKEN_ASSIGN) || p->curr.type != TOKEN_IDENT)
+            {
+                return stmt_error ("Expected '= <value>' after the option");
+            }
+            str8 value = p->curr.literal;
+
+            if (str8_match (option, str8_lit ("organization"), true))
+            {
+                if (str8_match (value, str8_lit ("heap"), true))
+                {
+                    s.create.organization = TABLE_HEAP;
+                }
+                else if (!str8_match (value, str8_lit ("btree"), true))
+                {
+                    return stmt_error ("Expected '= btree' or '= heap'");
+                }
+            }
+            else if (str8_match (option, str8_lit ("compression"), true))
+            {
+                if (str8_match (value, str8_lit ("lz"), true))
+                {
+                    s.create.compression = COMPRESSION_LZ;
+                }
+                else if (!str8_match (value, str8_lit ("none"), true))
+                {
+                    return stmt_error ("Expected '= lz' or '= none'");
+                }
+            }
+            else
+            {
+                return stmt_error ("Expected 'organization' or 'compression'");
+            }
+            parser_next_token (p);
+        } while (parser_expect (p, TOKEN_COMMA));
+
+        if (!parser_expect (p, TOKEN_RPAREN))
+        {
+            return stmt_error ("Expected ')' after the options");
+        }
+    }
+
     if (!parser_expect (p, TOKEN_SEMICOLON))
     {
         return stmt_error ("Expected ';' at end");
@@ -168,10 +238,15 @@ static Statement parser_parse_create_table (Parser *p)
     return s;
 }
 
+// Syntax: CREATE INDEX [CONCURRENTLY] <name> ON <table>
+//         [USING BTREE | HASH] ( <col>, ... ) [INCLUDE ( <col>, ... )]
+//         [WITH (fillfactor = <n>)] [WHERE <col> = <val> [AND ...]];
 static Statement parser_parse_create_index (Parser *p)
 {
     Statement s;
     s.type = STMT_CREATE_INDEX;
+    s.create_index.method = INDEX_BTREE;
+    s.create_index.fill_factor = 0;
 
     parser_next_token (p); // skip create
     if (!parser_expect (p, TOKEN_INDEX))
@@ -179,6 +254,8 @@ static Statement parser_parse_create_index (Parser *p)
         return stmt_error ("Expected 'INDEX'");
     }
 
+    s.create_index.concurrently = parser_expect (p, TOKEN_CONCURRENTLY);
+
     if (p->curr.type != TOKEN_IDENT)
     {
         return stmt_error ("Expected index name");
@@ -199,32 +276,90 @@ static Statement parser_parse_create_index (Parser *p)
     s.create_index.table_name = p->curr.literal;
     parser_next_token (p);
 
-    if (!parser_expect (p, TOKEN_LPAREN))
+    if (parser_expect (p, TOKEN_USING))
     {
-        return stmt_error ("Expected '('");
+        if (p->curr.type == TOKEN_IDENT
+            && str8_match (p->curr.literal, str8_lit ("hash"), true))
+        {
+            s.create_index.method = INDEX_HASH;
+        }
+        else if (p->curr.type != TOKEN_IDENT
+                 || !str8_match (p->curr.literal, str8_lit ("btree"), true))
+        {
+            return stmt_error ("Expected 'BTREE' or 'HASH' after USING");
+        }
+        parser_next_token (p);
     }
 
-    if (p->curr.type != TOKEN_IDENT)
+    const char *err =
+        parser_parse_column_list (p, s.create_index.col_names,
+                                  MAX_INDEX_COLUMNS, &s.create_index.col_count);
+    if (err)
     {
-        return stmt_error ("Expected column name");
+        return stmt_error (err);
     }
-    s.create_index.col_name = p->curr.literal;
-    parser_next_token (p);
 
-    if (!parser_expect (p, TOKEN_RPAREN))
+    s.create_index.include_count = 0;
+    if (parser_expect (p, TOKEN_INCLUDE))
+    {
+        err = parser_parse_column_list (p, s.create_index.include_names,
+                                        MAX_COLUMNS,
+                                        &s.create_index.include_count);
+        if (err)
+        {
+            return stmt_error (err);
+        }
+    }
+
+    if (parser_expect (p, TOKEN_WITH))
     {
-        return stmt_error ("Expected ')'");
+        if (!parser_expect (p, TOKEN_LPAREN))
+        {
+            return stmt_error ("Expected '(' after WITH");
+        }
+
+        if (p->curr.type != TOKEN_IDENT
+            || !str8_match (p->curr.literal, str8_lit ("fillfactor"), true))
+        {
+            return stmt_error ("Expected 'fillfactor'");
+        }
+        parser_next_token (p);
+
+        if (!parser_expect (p, TOKEN_ASSIGN) || p->curr.type != TOKEN_INT)
+        {
+            return stmt_error ("Expected '= <percent>' after fillfactor");
+        }
+
+        int fill_factor = atoi ((char *) p->curr.literal.str);
+        if (fill_factor < 10 || fill_factor > 100)
+        {
+            return stmt_error ("fillfactor must be between 10 and 100");
+        }
+        s.create_index.fill_factor = fill_factor;
+        parser_next_token (p);
+
+        if (!parser_expect (p, TOKEN_RPAREN))
+        {
+            return stmt_error ("Expected ')' after fillfactor");
+        }
+    }
+
+    err = parser_parse_where (p, &s.create_index.where);
+    if (err)
+    {
+        return stmt_error (err);
     }
 
     return s;
 }
 
-// Syntax: INSERT INTO <table_name> VALUES ( <value>, ... );
+// Syntax: INSERT INTO <table_name> VALUES ( <value>, ... ) [, ( ... ) ...];
 static Statement parser_parse_insert (Parser *p)
 {
     Statement s;
     s.type = STMT_INSERT;
     s.insert.val_count = 0;
+    s.insert.row_count = 0;
 
     parser_next_token (p); // skip INSERT
 
@@ -246,47 +381,86 @@ static Statement parser_parse_insert (Parser *p)
         return stmt_error ("Expected 'VALUES' after table name");
     }
 
-    if (!parser_expect (p, TOKEN_LPAREN))
+    // values grow by doubling, they are the last allocation in the arena
+    uint32_t capacity = MAX_COLUMNS;
+    uint32_t total = 0;
+    s.insert.values = push_array_no_zero (p->arena, str8, capacity);
+    if (!s.insert.values)
     {
-        return stmt_error ("Expected '(' after VALUES");
+        return stmt_error ("Out of memory");
     }
 
-    bool first = true;
-    while (p->curr.type != TOKEN_RPAREN && p->curr.type != TOKEN_EOF)
+    do
     {
-        if (!first && !parser_expect (p, TOKEN_COMMA))
+        if (s.insert.row_count > 0)
         {
-            break;
+            parser_next_token (p); // skip ',' between rows
         }
 
-        first = false;
+        if (!parser_expect (p, TOKEN_LPAREN))
+        {
+            return stmt_error ("Expected '(' after VALUES");
+        }
 
-        if (p->curr.type == TOKEN_RPAREN)
+        int row_vals = 0;
+        bool first = true;
+        while (p->curr.type != TOKEN_RPAREN && p->curr.type != TOKEN_EOF)
         {
-            return stmt_error (
-                "Trailing comma or unexpected end in VALUE list");
+            if (!first && !parser_expect (p, TOKEN_COMMA))
+            {
+                break;
+            }
+
+            first = false;
+
+            if (p->curr.type == TOKEN_RPAREN)
+            {
+                return stmt_error (
+                    "Trailing comma or unexpected end in VALUE list");
+            }
+
+            if (row_vals >= MAX_COLUMNS)
+            {
+                return stmt_error ("Too many values");
+            }
+
+            if (p->curr.type != TOKEN_INT && p->curr.type != TOKEN_STRING)
+            {
+                return stmt_error ("Expected integer or string literal");
+            }
+
+            if (total == capacity)
+            {
+                s.insert.values = arena_resize (
+                    p->arena, s.insert.values, capacity * sizeof (str8),
+                    capacity * 2 * sizeof (str8), ArenaFlag_NoZero);
+                if (!s.insert.values)
+                {
+                    return stmt_error ("Out of memory");
+                }
+                capacity *= 2;
+            }
+
+            s.insert.values[total++] = p->curr.literal;
+            row_vals++;
+            parser_next_token (p);
         }
 
-        if (s.insert.val_count >= MAX_COLUMNS)
+        if (!parser_expect (p, TOKEN_RPAREN))
         {
-            return stmt_error ("Too many values");
+            return stmt_error ("Expected ')' after values");
         }
 
-        if (p->curr.type == TOKEN_INT || p->curr.type == TOKEN_STRING)
+        if (s.insert.row_count == 0)
         {
-            s.insert.values[s.insert.val_count++] = p->curr.literal;
-            parser_next_token (p);
+            s.insert.val_count = row_vals;
         }
-        else
+        else if (row_vals != s.insert.val_count)
         {
-            return stmt_error ("Expected integer or string literal");
+            return stmt_error ("All VALUES rows must have the same length");
         }
-    }
-
-    if (!parser_expect (p, TOKEN_RPAREN))
-    {
-        return stmt_error ("Expected ')' after values");
-    }
+        s.insert.row_count++;
+    } while (p->curr.type == TOKEN_COMMA);
 
     if (!parser_expect (p, TOKEN_SEMICOLON))
     {
@@ -297,14 +471,13 @@ static Statement parser_parse_insert (Parser *p)
 }
 
 // Syntax: SELECT <* | col, ...> FROM <table_name> [JOIN <table_name> ON
-// <col> = <col>] [WHERE <col> = <val>];
+// <col> = <col>] [WHERE <col> = <val> [AND ...]];
 static Statement parser_parse_select (Parser *p)
 {
     Statement s;
     s.type = STMT_SELECT;
     s.select.field_count = 0;
     s.select.has_join = false;
-    s.select.has_where = false;
 
     parser_next_token (p);
 
@@ -385,31 +558,10 @@ static Statement parser_parse_select (Parser *p)
         }
     }
 
-    if (p->curr.type == TOKEN_WHERE)
+    const char *err = parser_parse_where (p, &s.select.where);
+    if (err)
     {
-        s.select.has_where = true;
-        parser_next_token (p);
-
-        s.select.where_column = parser_parse_column_ref (p);
-        if (s.select.where_column.col_name.str == NULL)
-        {
-            return stmt_error ("Expected column in WHERE");
-        }
-
-        if (!parser_expect (p, TOKEN_ASSIGN))
-        {
-            return stmt_error ("Expected '=' in WHERE");
-        }
-
-        if (p->curr.type == TOKEN_INT || p->curr.type == TOKEN_STRING)
-        {
-            s.select.where_value = p->curr.literal;
-            parser_next_token (p);
-        }
-        else
-        {
-            return stmt_error ("Expected value in WHERE");
-        }
+        return stmt_error (err);
     }
 
     if (!parser_expect (p, TOKEN_SEMICOLON))
@@ -450,12 +602,90 @@ static ColumnRef parser_parse_column_ref (Parser *p)
     return ref;
 }
 
-// Syntax: DELETE FROM <table_name> [WHERE <col> = <val>];
+/**
+ * parser_parse_column_list - parses ( <col>, ... ) into at most max names
+ *
+ * Return: an error message, NULL on success
+ */
+static const char *parser_parse_column_list (Parser *p, str8 *names,
+                                             int max, int *count)
+{
+    if (!parser_expect (p, TOKEN_LPAREN))
+    {
+        return "Expected '('";
+    }
+
+    *count = 0;
+    do
+    {
+        if (p->curr.type != TOKEN_IDENT)
+        {
+            return "Expected column name";
+        }
+        if (*count >= max)
+        {
+            return "Too many index columns";
+        }
+        names[(*count)++] = p->curr.literal;
+        parser_next_token (p);
+    } while (parser_expect (p, TOKEN_COMMA));
+
+    if (!parser_expect (p, TOKEN_RPAREN))
+    {
+        return "Expected ')'";
+    }
+    return NULL;
+}
+
+/**
+ * parser_parse_where - parses an optional WHERE clause, equalities joined
+ * by AND
+ *
+ * Return: an error message, NULL on success
+ */
+static const char *parser_parse_where (Parser *p, WhereClause *where)
+{
+    where->count = 0;
+    if (!parser_expect (p, TOKEN_WHERE))
+    {
+        return NULL;
+    }
+
+    do
+    {
+        if (where->count >= MAX_WHERE_CONDS)
+        {
+            return "Too many conditions in WHERE";
+        }
+        WhereCond *cond = &where->conds[where->count++];
+
+        cond->col = parser_parse_column_ref (p);
+        if (cond->col.col_name.str == NULL)
+        {
+            return "Expected column in WHERE";
+        }
+
+        if (!parser_expect (p, TOKEN_ASSIGN))
+        {
+            return "Expected '=' in WHERE";
+        }
+
+        if (p->curr.type != TOKEN_INT && p->curr.type != TOKEN_STRING)
+        {
+            return "Expected value in WHERE";
+        }
+        cond->value = p->curr.literal;
+        parser_next_token (p);
+    } while (parser_expect (p, TOKEN_AND));
+
+    return NULL;
+}
+
+// Syntax: DELETE FROM <table_name> [WHERE <col> = <val> [AND ...]];
 static Statement parser_parse_delete (Parser *p)
 {
     Statement s;
     s.type = STMT_DELETE;
-    s.delete.has_where = false;
 
     parser_next_token (p);
     if (!parser_expect (p, TOKEN_FROM))
@@ -471,30 +701,10 @@ static Statement parser_parse_delete (Parser *p)
     s.delete.table_name = p->curr.literal;
     parser_next_token (p);
 
-    if (p->curr.type == TOKEN_WHERE)
+    const char *err = parser_parse_where (p, &s.delete.where);
+    if (err)
     {
-        s.delete.has_where = true;
-        parser_next_token (p);
-
-        s.delete.where_col = parser_parse_column_ref (p);
-        if (s.delete.where_col.col_name.str == NULL)
-        {
-            return stmt_error ("Expected column in WHERE");
-        }
-
-        if (!parser_expect (p, TOKEN_ASSIGN))
-        {
-            return stmt_error ("Expected '=' in WHERE");
-        }
-        if (p->curr.type == TOKEN_INT || p->curr.type == TOKEN_STRING)
-        {
-            s.delete.where_value = p->curr.literal;
-            parser_next_token (p);
-        }
-        else
-        {
-            return stmt_error ("Expected value in WHERE");
-        }
+        return stmt_error (err);
     }
 
     if (!parser_expect (p, TOKEN_SEMICOLON))
@@ -505,13 +715,13 @@ static Statement parser_parse_delete (Parser *p)
     return s;
 }
 
-// Syntax: UPDATE <table_name> SET <col> = <val>, ... [WHERE <col> = <val>];
+// Syntax: UPDATE <table_name> SET <col> = <val>, ...
+//         [WHERE <col> = <val> [AND ...]];
 static Statement parser_parse_update (Parser *p)
 {
     Statement s;
     s.type = STMT_UPDATE;
     s.update.assign_col_count = 0;
-    s.update.has_where = false;
 
     parser_next_token (p);
     if (p->curr.type != TOKEN_IDENT)
@@ -565,35 +775,84 @@ static Statement parser_parse_update (Parser *p)
         s.update.assignments[i].value = val;
     }
 
-    if (p->curr.type == TOKEN_WHERE)
+    const char *err = parser_parse_where (p, &s.update.where);
+    if (err)
     {
-        s.update.has_where = true;
-        parser_next_token (p);
+        return stmt_error (err);
+    }
 
-        s.update.where_col = parser_parse_column_ref (p);
-        if (s.update.where_col.col_name.str == NULL)
-        {
-            return stmt_error ("Expected column in WHERE");
-        }
-        if (!parser_expect (p, TOKEN_ASSIGN))
-        {
-            return stmt_error ("Expected '='");
-        }
+    if (!parser_expect (p, TOKEN_SEMICOLON))
+    {
+        return stmt_error ("Expected ';' at end");
+    }
 
-        if (p->curr.type == TOKEN_INT || p->curr.type == TOKEN_STRING)
-        {
-            s.update.where_value = p->curr.literal;
-            parser_next_token (p);
-        }
-        else
-        {
-            return stmt_error ("Expected value in WHERE");
-        }
+    return s;
+}
+
+// Syntax: COPY <table_name> FROM|TO '<file_path>';
+static Statement parser_parse_copy (Parser *p)
+{
+    Statement s;
+    s.type = STMT_COPY;
+
+    parser_next_token (p); // skip COPY
+
+    if (p->curr.type != TOKEN_IDENT)
+    {
+        return stmt_error ("Expected table name after COPY");
+    }
+
+    s.copy.table_name = p->curr.literal;
+    parser_next_token (p);
+
+    if (p->curr.type == TOKEN_FROM)
+    {
+        s.copy.is_from = true;
+    }
+    else if (p->curr.type == TOKEN_TO)
+    {
+        s.copy.is_from = false;
+    }
+    else
+    {
+        return stmt_error ("Expected 'FROM' or 'TO' after table name");
+    }
+    parser_next_token (p);
+
+    if (p->curr.type != TOKEN_STRING || p->curr.literal.len == 0)
+    {
+        return stmt_error ("Expected file path");
     }
 
+    s.copy.file_path = p->curr.literal;
+    parser_next_token (p);
+
     if (!parser_expect (p, TOKEN_SEMICOLON))
     {
-        return stmt_error ("Expected ';' at end");
+        return stmt_error ("Expected ';'");
+    }
+
+    return s;
+}
+
+// Syntax: VACUUM [<table_name>];
+static Statement parser_parse_vacuum (Parser *p)
+{
+    Statement s;
+    s.type = STMT_VACUUM;
+    s.vacuum.table_name = (str8) {0};
+
+    parser_next_token (p); // skip VACUUM
+
+    if (p->curr.type == TOKEN_IDENT)
+    {
+        s.vacuum.table_name = p->curr.literal;
+        parser_next_token (p);
+    }
+
+    if (!parser_expect (p, TOKEN_SEMICOLON))
+    {
+        return stmt_error ("Expected ';'");
     }
 
     return s;
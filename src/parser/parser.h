@@ -6,7 +6,9 @@
 #include "../token/token.h"
 #include "stdbool.h"
 
-#define MAX_COLUMNS 16
+#define MAX_COLUMNS       16
+#define MAX_INDEX_COLUMNS 4
+#define MAX_WHERE_CONDS   8
 
 typedef enum
 {
@@ -16,6 +18,8 @@ typedef enum
     STMT_CREATE_INDEX,
     STMT_UPDATE,
     STMT_DELETE,
+    STMT_COPY,
+    STMT_VACUUM,
 
     STMT_ERROR,
 } StatementType;
@@ -26,6 +30,24 @@ typedef enum
     TYPE_TEXT,
 } DataType;
 
+typedef enum
+{
+    INDEX_BTREE,
+    INDEX_HASH, // equality lookups only
+} IndexMethod;
+
+typedef enum
+{
+    TABLE_BTREE, // rows kept in primary key order
+    TABLE_HEAP,  // rows appended in no order, addressed by row ID
+} TableOrganization;
+
+typedef enum
+{
+    COMPRESSION_NONE,
+    COMPRESSION_LZ, // pages written compressed, see COMPRESSION in pager.h
+} TableCompression;
+
 // CREATE TABLE users (id int, name text);
 typedef struct
 {
@@ -36,35 +58,63 @@ typedef struct
     bool is_unique;
 } ColumnDef;
 
+// CREATE TABLE logs (at int, msg text)
+//     WITH (organization = heap, compression = lz);
 typedef struct
 {
     str8 table_name;
     int col_count;
     ColumnDef columns[MAX_COLUMNS];
+    TableOrganization organization;
+    TableCompression compression;
 } CreateStmt;
 
+// users.id or id
 typedef struct
 {
-    str8 index_name;
     str8 table_name;
     str8 col_name;
-} CreateIndexStmt;
+} ColumnRef;
 
-// INSERT INTO users VALUES (1, 'john');
+// WHERE a = 1 AND b = 'x'
 typedef struct
 {
+    ColumnRef col;
+    str8 value;
+} WhereCond;
+
+typedef struct
+{
+    int count; // 0 without a WHERE clause
+    WhereCond conds[MAX_WHERE_CONDS];
+} WhereClause;
+
+// CREATE INDEX [CONCURRENTLY] idx ON orders [USING HASH] (user_id, id)
+//     INCLUDE (item) WITH (fillfactor = 70) WHERE status = 'open';
+typedef struct
+{
+    str8 index_name;
     str8 table_name;
-    int val_count;
-    str8 values[MAX_COLUMNS];
-} InsertStmt;
+    int col_count;
+    str8 col_names[MAX_INDEX_COLUMNS]; // the key is their values in order
+    int include_count;
+    str8 include_names[MAX_COLUMNS]; // stored in the entries, not the key
+    IndexMethod method;
+    int fill_factor;   // percent of each page to fill, 0 for the default
+    bool concurrently; // build without blocking writes to the table
+    WhereClause where; // a partial index only has the rows that match
+} CreateIndexStmt;
 
-// SELECT * FROM users WHERE id = 1;
+// INSERT INTO users VALUES (1, 'john'), (2, 'jane');
 typedef struct
 {
     str8 table_name;
-    str8 col_name;
-} ColumnRef;
+    int val_count; // values per row
+    int row_count;
+    str8 *values;  // row_count * val_count values, row after row
+} InsertStmt;
 
+// SELECT * FROM users WHERE id = 1;
 typedef struct
 {
     str8 table_name;
@@ -77,9 +127,7 @@ typedef struct
     ColumnRef left_join_col;
     ColumnRef right_join_col;
 
-    bool has_where;
-    ColumnRef where_column;
-    str8 where_value;
+    WhereClause where;
 } SelectStmt;
 
 // Update
@@ -96,9 +144,7 @@ typedef struct
     int assign_col_count;
     AssignCol assignments[MAX_COLUMNS];
 
-    bool has_where;
-    ColumnRef where_col;
-    str8 where_value;
+    WhereClause where;
 } UpdateStmt;
 
 // Delete
@@ -106,11 +152,23 @@ typedef struct
 {
     str8 table_name;
 
-    bool has_where;
-    ColumnRef where_col;
-    str8 where_value;
+    WhereClause where;
 } DeleteStmt;
 
+// COPY users FROM '/tmp/users.csv';
+typedef struct
+{
+    str8 table_name;
+    bool is_from; // FROM loads the file, TO exports the table
+    str8 file_path;
+} CopyStmt;
+
+// VACUUM users;
+typedef struct
+{
+    str8 table_name; // empty for every table
+} VacuumStmt;
+
 // Error
 typedef struct
 {
@@ -128,6 +186,8 @@ typedef struct
         SelectStmt select;
         UpdateStmt update;
         DeleteStmt delete;
+        CopyStmt copy;
+        VacuumStmt vacuum;
         ErrorStmt error;
     };
 } Statement;
@@ -137,9 +197,10 @@ typedef struct
     Lexer l;
     Token curr;
     Token peek;
+    Arena *arena; // statement lifetime storage, e.g. INSERT rows
 } Parser;
 
-void parser_init (Parser *p, const char *input);
+void parser_init (Parser *p, Arena *arena, const char *input);
 Statement parser_parse_statement (Parser *p);
 
 const char *data_type_to_string (DataType type);
@@ -10,12 +10,15 @@
 
 #include <stdio.h>
 
+unsigned char test_buffer[SIZE_MB];
+Arena test_arena;
+
 void test_create_stmt ()
 {
     char *input = "CREATE TABLE users (id int PRIMARY KEY, email text UNIQUE);";
 
     Parser p;
-    parser_init (&p, input);
+    parser_init (&p, &test_arena, input);
 
     Statement s = parser_parse_statement (&p);
 
@@ -61,15 +64,186 @@ void test_create_stmt ()
                     expected_columns[i].is_unique ? "true" : "false",
                     s.create.columns[i].is_unique ? "true" : "false");
     }
+    ASSERT_FMT (s.create.organization == TABLE_BTREE,
+                "tests[create] - expected a btree table by default");
+
+    parser_init (&p, &test_arena,
+                 "CREATE TABLE logs (at int, msg text) "
+                 "WITH (organization = heap);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_TABLE
+                    && s.create.organization == TABLE_HEAP,
+                "tests[create] - expected a heap table. msg=%s",
+                s.type == STMT_ERROR ? s.error.msg : "");
+
+    parser_init (&p, &test_arena,
+                 "CREATE TABLE logs (at int) WITH (organization = pile);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create] - unknown organization should be rejected");
+
+    parser_init (&p, &test_arena,
+                 "CREATE TABLE logs (at int, msg text) "
+                 "WITH (organization = heap, compression = lz);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_TABLE
+                    && s.create.organization == TABLE_HEAP
+                    && s.create.compression == COMPRESSION_LZ,
+                "tests[create] - expected a compressed heap table. msg=%s",
+                s.type == STMT_ERROR ? s.error.msg : "");
+
+    parser_init (&p, &test_arena,
+                 "CREATE TABLE logs (at int) WITH (compression = none);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_TABLE
+                    && s.create.organization == TABLE_BTREE
+                    && s.create.compression == COMPRESSION_NONE,
+                "tests[create] - expected an uncompressed btree table");
+
+    parser_init (&p, &test_arena,
+                 "CREATE TABLE logs (at int) WITH (compression = zip);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create] - unknown compression should be rejected");
+
+    parser_init (&p, &test_arena,
+                 "CREATE TABLE logs (at int) WITH (compression = lz,);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create] - trailing comma in WITH should be rejected");
     printf ("PARSER: [create] All tests passed!\n");
 }
 
+void test_create_index_stmt ()
+{
+    char *input = "CREATE INDEX idx_email ON users (email) "
+                  "WITH (fillfactor = 70);";
+
+    Parser p;
+    parser_init (&p, &test_arena, input);
+    Statement s = parser_parse_statement (&p);
+
+    ASSERT_FMT (s.type == STMT_CREATE_INDEX,
+                "tests[create index] - statement type wrong. msg=%s",
+                s.type == STMT_ERROR ? s.error.msg : "");
+
+    ASSERT_FMT (str8_equals (s.create_index.index_name, str8_lit ("idx_email")),
+                "tests[create index] - index name wrong. got=%.*s",
+                STR_FMT (s.create_index.index_name));
+    ASSERT_FMT (str8_equals (s.create_index.table_name, str8_lit ("users")),
+                "tests[create index] - table name wrong. got=%.*s",
+                STR_FMT (s.create_index.table_name));
+    ASSERT_FMT (s.create_index.col_count == 1,
+                "tests[create index] - column count wrong. expected=1, got=%d",
+                s.create_index.col_count);
+    ASSERT_FMT (
+        str8_equals (s.create_index.col_names[0], str8_lit ("email")),
+        "tests[create index] - column name wrong. got=%.*s",
+        STR_FMT (s.create_index.col_names[0]));
+    ASSERT_FMT (s.create_index.fill_factor == 70,
+                "tests[create index] - fill factor wrong. expected=70, got=%d",
+                s.create_index.fill_factor);
+    ASSERT_FMT (!s.create_index.concurrently,
+                "tests[create index] - should not be concurrent");
+    ASSERT_FMT (s.create_index.method == INDEX_BTREE,
+                "tests[create index] - default method should be btree");
+    ASSERT_FMT (s.create_index.where.count == 0,
+                "tests[create index] - should not be partial");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX CONCURRENTLY idx_email ON users (email);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_INDEX && s.create_index.concurrently,
+                "tests[create index] - expected a concurrent build");
+    ASSERT_FMT (str8_equals (s.create_index.index_name, str8_lit ("idx_email")),
+                "tests[create index] - concurrent index name wrong. got=%.*s",
+                STR_FMT (s.create_index.index_name));
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX idx_id ON users USING HASH (id);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_INDEX
+                    && s.create_index.method == INDEX_HASH,
+                "tests[create index] - expected a hash index");
+    ASSERT_FMT (str8_equals (s.create_index.col_names[0], str8_lit ("id")),
+                "tests[create index] - hash column name wrong. got=%.*s",
+                STR_FMT (s.create_index.col_names[0]));
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON orders (user_id, id);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_INDEX && s.create_index.col_count == 2,
+                "tests[create index] - expected two columns");
+    ASSERT_FMT (str8_equals (s.create_index.col_names[0], str8_lit ("user_id"))
+                    && str8_equals (s.create_index.col_names[1],
+                                    str8_lit ("id")),
+                "tests[create index] - composite column names wrong");
+    ASSERT_FMT (s.create_index.include_count == 0,
+                "tests[create index] - expected no included columns");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON orders (user_id) INCLUDE (item, qty) "
+                 "WITH (fillfactor = 90);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_INDEX
+                    && s.create_index.include_count == 2,
+                "tests[create index] - expected two included columns. msg=%s",
+                s.type == STMT_ERROR ? s.error.msg : "");
+    ASSERT_FMT (str8_equals (s.create_index.include_names[0], str8_lit ("item"))
+                    && str8_equals (s.create_index.include_names[1],
+                                    str8_lit ("qty"))
+                    && s.create_index.fill_factor == 90,
+                "tests[create index] - included columns wrong");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON orders (user_id) "
+                 "WHERE status = 'open' AND region = 2;");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_CREATE_INDEX
+                    && s.create_index.where.count == 2,
+                "tests[create index] - expected a partial index. msg=%s",
+                s.type == STMT_ERROR ? s.error.msg : "");
+    ASSERT_FMT (
+        str8_equals (s.create_index.where.conds[0].col.col_name,
+                     str8_lit ("status"))
+            && str8_equals (s.create_index.where.conds[0].value,
+                            str8_lit ("open")),
+        "tests[create index] - index predicate wrong");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON orders (user_id) WHERE status;");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create index] - incomplete predicate should be "
+                "rejected");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON orders (user_id) INCLUDE ();");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create index] - empty INCLUDE should be rejected");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON users USING gist (email);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create index] - unknown method should be rejected");
+
+    parser_init (&p, &test_arena,
+                 "CREATE INDEX i ON users (email) WITH (fillfactor = 5);");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[create index] - fill factor 5 should be rejected");
+
+    printf ("PARSER: [create index] All tests passed!\n");
+}
+
 void test_insert_stmt ()
 {
     char *input = "INSERT INTO users VALUES (1, 'John Doe', 30);";
 
     Parser p;
-    parser_init (&p, input);
+    parser_init (&p, &test_arena, input);
 
     Statement s = parser_parse_statement (&p);
 
@@ -83,6 +257,10 @@ void test_insert_stmt ()
                 "tests[insert] - table name wrong. expected=%s, got=%.*s",
                 "users", STR_FMT (s.insert.table_name));
 
+    ASSERT_FMT (s.insert.row_count == 1,
+                "tests[insert] - row count wrong. expected=%d, got=%d", 1,
+                s.insert.row_count);
+
     ASSERT_FMT (s.insert.val_count == 3,
                 "tests[insert] - value count wrong. expected=%d, got=%d", 3,
                 s.insert.val_count);
@@ -104,12 +282,58 @@ void test_insert_stmt ()
     printf ("PARSER: [insert] All tests passed!\n");
 }
 
+void test_insert_multi_row_stmt ()
+{
+    char *input =
+        "INSERT INTO users VALUES (1, 'John'), (2, 'Jane'), (3, 'Doe');";
+
+    Parser p;
+    parser_init (&p, &test_arena, input);
+
+    Statement s = parser_parse_statement (&p);
+
+    ASSERT_FMT (s.type == STMT_INSERT,
+                "tests[insert multi] - statement type wrong. (Error: %s)",
+                s.type == STMT_ERROR ? s.error.msg : "none");
+
+    ASSERT_FMT (s.insert.row_count == 3,
+                "tests[insert multi] - row count wrong. expected=%d, got=%d", 3,
+                s.insert.row_count);
+
+    ASSERT_FMT (s.insert.val_count == 2,
+                "tests[insert multi] - value count wrong. expected=%d, got=%d",
+                2, s.insert.val_count);
+
+    str8 expected_values[6] = {
+        str8_lit ("1"), str8_lit ("John"), str8_lit ("2"),
+        str8_lit ("Jane"), str8_lit ("3"), str8_lit ("Doe"),
+    };
+
+    for (int i = 0; i < 6; i++)
+    {
+        ASSERT_FMT (str8_equals (s.insert.values[i], expected_values[i]),
+                    "tests[insert multi] - value at index %d wrong. "
+                    "expected=%.*s, got=%.*s",
+                    i, STR_FMT (expected_values[i]),
+                    STR_FMT (s.insert.values[i]));
+    }
+
+    input = "INSERT INTO users VALUES (1, 'John'), (2);";
+    parser_init (&p, &test_arena, input);
+    s = parser_parse_statement (&p);
+
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "tests[insert multi] - rows of different lengths accepted");
+
+    printf ("PARSER: [insert multi row] All tests passed!\n");
+}
+
 void test_select_stmt ()
 {
     char *input = "SELECT users.name, posts.title FROM users JOIN posts ON "
                   "users.id = posts.user_id WHERE users.id = 1;";
     Parser p;
-    parser_init (&p, input);
+    parser_init (&p, &test_arena, input);
 
     Statement s = parser_parse_statement (&p);
 
@@ -145,7 +369,7 @@ void test_delete_stmt ()
     char *input = "DELETE FROM users WHERE id = 5;";
 
     Parser p;
-    parser_init (&p, input);
+    parser_init (&p, &test_arena, input);
     Statement s = parser_parse_statement (&p);
 
     ASSERT_FMT (s.type == STMT_DELETE,
@@ -155,16 +379,33 @@ void test_delete_stmt ()
                 "test[delete] - Table name wrong. Expected=users, Got=%.*s",
                 STR_FMT (s.delete.table_name));
 
-    ASSERT_FMT (s.delete.has_where == true,
-                "test[delete] - Should have WHERE clause");
+    ASSERT_FMT (s.delete.where.count == 1,
+                "test[delete] - Should have one WHERE condition");
 
-    ASSERT_FMT (str8_equals (s.delete.where_col.col_name, str8_lit ("id")),
+    WhereCond *cond = &s.delete.where.conds[0];
+    ASSERT_FMT (str8_equals (cond->col.col_name, str8_lit ("id")),
                 "test[delete] - Where column wrong. Expected=id, Got=%.*s",
-                STR_FMT (s.delete.where_col.col_name));
+                STR_FMT (cond->col.col_name));
 
-    ASSERT_FMT (str8_equals (s.delete.where_value, str8_lit ("5")),
+    ASSERT_FMT (str8_equals (cond->value, str8_lit ("5")),
                 "test[delete] - Where value wrong. Expected=5, Got=%.*s",
-                STR_FMT (s.delete.where_value));
+                STR_FMT (cond->value));
+
+    parser_init (&p, &test_arena,
+                 "DELETE FROM orders WHERE user_id = 3 AND item = 'pen';");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_DELETE && s.delete.where.count == 2,
+                "test[delete] - Expected two WHERE conditions");
+    cond = &s.delete.where.conds[1];
+    ASSERT_FMT (str8_equals (cond->col.col_name, str8_lit ("item"))
+                    && str8_equals (cond->value, str8_lit ("pen")),
+                "test[delete] - Second condition wrong. Got=%.*s = %.*s",
+                STR_FMT (cond->col.col_name), STR_FMT (cond->value));
+
+    parser_init (&p, &test_arena, "DELETE FROM orders WHERE user_id = 3 AND;");
+    s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "test[delete] - Dangling AND should be rejected");
 
     printf ("PARSER: [delete] All tests passed!\n");
 }
@@ -175,7 +416,7 @@ void test_update_stmt ()
         "UPDATE users SET name = 'Jane', age = 30 WHERE users.id = 1;";
 
     Parser p;
-    parser_init (&p, input);
+    parser_init (&p, &test_arena, input);
     Statement s = parser_parse_statement (&p);
 
     ASSERT_FMT (s.type == STMT_UPDATE,
@@ -200,25 +441,95 @@ void test_update_stmt ()
     ASSERT_FMT (str8_equals (s.update.assignments[1].value, str8_lit ("30")),
                 "test[update] - Assign 1 val");
 
-    ASSERT_FMT (s.update.has_where == true, "test[update] - Should have WHERE");
+    ASSERT_FMT (s.update.where.count == 1, "test[update] - Should have WHERE");
 
-    ASSERT_FMT (str8_equals (s.update.where_col.table_name, str8_lit ("users")),
+    WhereCond *cond = &s.update.where.conds[0];
+    ASSERT_FMT (str8_equals (cond->col.table_name, str8_lit ("users")),
                 "test[update] - Where table part");
-    ASSERT_FMT (str8_equals (s.update.where_col.col_name, str8_lit ("id")),
+    ASSERT_FMT (str8_equals (cond->col.col_name, str8_lit ("id")),
                 "test[update] - Where col part");
 
-    ASSERT_FMT (str8_equals (s.update.where_value, str8_lit ("1")),
+    ASSERT_FMT (str8_equals (cond->value, str8_lit ("1")),
                 "test[update] - Where value check");
 
     printf ("PARSER: [update] All tests passed!\n");
 }
 
+void test_copy_stmt ()
+{
+    char *inputs[2] = {"COPY users FROM '/tmp/users.csv';",
+                       "COPY users TO '/tmp/out.csv';"};
+    bool expected_from[2] = {true, false};
+    str8 expected_path[2] = {str8_lit ("/tmp/users.csv"),
+                             str8_lit ("/tmp/out.csv")};
+
+    for (int i = 0; i < 2; i++)
+    {
+        Parser p;
+        parser_init (&p, &test_arena, inputs[i]);
+        Statement s = parser_parse_statement (&p);
+
+        ASSERT_FMT (s.type == STMT_COPY,
+                    "test[copy] - Type should be STMT_COPY. msg=%s",
+                    s.type == STMT_ERROR ? s.error.msg : "");
+
+        ASSERT_FMT (str8_equals (s.copy.table_name, str8_lit ("users")),
+                    "test[copy] - Table name wrong. Expected=users, Got=%.*s",
+                    STR_FMT (s.copy.table_name));
+
+        ASSERT_FMT (s.copy.is_from == expected_from[i],
+                    "test[copy] - Direction wrong for '%s'", inputs[i]);
+
+        ASSERT_FMT (str8_equals (s.copy.file_path, expected_path[i]),
+                    "test[copy] - File path wrong. Expected=%.*s, Got=%.*s",
+                    STR_FMT (expected_path[i]), STR_FMT (s.copy.file_path));
+    }
+
+    printf ("PARSER: [copy] All tests passed!\n");
+}
+
+void test_vacuum_stmt ()
+{
+    char *inputs[2] = {"VACUUM users;", "VACUUM;"};
+    str8 expected_table[2] = {str8_lit ("users"), str8_lit ("")};
+
+    for (int i = 0; i < 2; i++)
+    {
+        Parser p;
+        parser_init (&p, &test_arena, inputs[i]);
+        Statement s = parser_parse_statement (&p);
+
+        ASSERT_FMT (s.type == STMT_VACUUM,
+                    "test[vacuum] - Type should be STMT_VACUUM. msg=%s",
+                    s.type == STMT_ERROR ? s.error.msg : "");
+
+        ASSERT_FMT (str8_equals (s.vacuum.table_name, expected_table[i]),
+                    "test[vacuum] - Table name wrong. Expected=%.*s, Got=%.*s",
+                    STR_FMT (expected_table[i]),
+                    STR_FMT (s.vacuum.table_name));
+    }
+
+    Parser p;
+    parser_init (&p, &test_arena, "VACUUM users orders;");
+    Statement s = parser_parse_statement (&p);
+    ASSERT_FMT (s.type == STMT_ERROR,
+                "test[vacuum] - Two table names should be rejected");
+
+    printf ("PARSER: [vacuum] All tests passed!\n");
+}
+
 int main ()
 {
+    arena_init (&test_arena, test_buffer, sizeof (test_buffer));
+
     test_create_stmt ();
+    test_create_index_stmt ();
     test_insert_stmt ();
+    test_insert_multi_row_stmt ();
     test_select_stmt ();
     test_delete_stmt ();
     test_update_stmt ();
+    test_copy_stmt ();
+    test_vacuum_stmt ();
     return 0;
 }
@@ -12,6 +12,49 @@
 
 #define BUFFER_SIZE 4096
 
+/**
+ * count_statements - counts statement terminators the server will frame
+ * @line: input line
+ * @quote: quote character open across lines, updated in place
+ * @partial: set to true if non blank text follows the last terminator
+ *
+ * Return: number of ';' outside of quotes, one response arrives for each
+ */
+static int count_statements (const char *line, char *quote, bool *partial)
+{
+    int count = 0;
+
+    for (const char *c = line; *c; c++)
+    {
+        if (*quote)
+        {
+            if (*c == *quote)
+            {
+                *quote = 0;
+            }
+            *partial = true;
+            continue;
+        }
+
+        if (*c == '\'' || *c == '"')
+        {
+            *quote = *c;
+            *partial = true;
+        }
+        else if (*c == ';')
+        {
+            count++;
+            *partial = false;
+        }
+        else if (*c != ' ' && *c != '\t')
+        {
+            *partial = true;
+        }
+    }
+
+    return count;
+}
+
 int main ()
 {
     struct sockaddr_in server_sockaddr;
@@ -40,9 +83,13 @@ int main ()
     printf ("--- CSQL REPL ---\n");
     printf ("Type 'exit' to quit\n\n");
 
+    char quote = 0;
+    bool partial = false;
+
     while (1)
     {
-        fputs ("csql> ", stdout);
+        // statements without a ';' continue on the next line
+        fputs (partial ? "   ...> " : "csql> ", stdout);
 
         memset (buffer, 0, BUFFER_SIZE);
         if (fgets (buffer, BUFFER_SIZE, stdin) == NULL)
@@ -50,14 +97,21 @@ int main ()
 
         buffer[strcspn (buffer, "\n")] = 0;
 
-        if (strcmp (buffer, "exit") == 0)
+        if (!partial && strcmp (buffer, "exit") == 0)
             break;
-        if (strlen (buffer) == 0)
+        if (!partial && strlen (buffer) == 0)
             continue;
 
-        send (socket_fd, buffer, strlen (buffer), 0);
+        int pending = count_statements (buffer, &quote, &partial);
+
+        size_t len = strlen (buffer);
+        buffer[len++] = '\n';
+        send (socket_fd, buffer, len, 0);
 
-        while (1)
+        // one '\0' terminated response per ';' sent, blank statements get
+        // an empty one
+        bool printed = false;
+        while (pending > 0)
         {
             int bytes_received = read (socket_fd, buffer, BUFFER_SIZE - 1);
             if (bytes_received <= 0)
@@ -67,22 +121,25 @@ int main ()
                 return 0;
             }
 
-            buffer[bytes_received] = '\0';
-            bool done = false;
-            if (strlen (buffer) < bytes_received)
-            {
-                done = true;
-            }
-
-            printf ("%s", buffer);
-            if (done)
+            for (int i = 0; i < bytes_received; i++)
             {
-                break;
+                if (buffer[i] == '\0')
+                {
+                    pending--;
+                    if (printed)
+                    {
+                        printf ("\n");
+                    }
+                    printed = false;
+                }
+                else
+                {
+                    putchar (buffer[i]);
+                    printed = true;
+                }
             }
             memset (buffer, 0, BUFFER_SIZE);
         }
-
-        printf ("\n");
     }
 
     close (socket_fd);
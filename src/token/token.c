@@ -76,6 +76,20 @@ const char *token_type_to_string (TokenType type)
         return "KEY";
     case TOKEN_UNIQUE:
         return "UNIQUE";
+    case TOKEN_COPY:
+        return "COPY";
+    case TOKEN_TO:
+        return "TO";
+    case TOKEN_WITH:
+        return "WITH";
+    case TOKEN_CONCURRENTLY:
+        return "CONCURRENTLY";
+    case TOKEN_USING:
+        return "USING";
+    case TOKEN_INCLUDE:
+        return "INCLUDE";
+    case TOKEN_VACUUM:
+        return "VACUUM";
 
     case TOKEN_INT_TYPE:
         return "INT_TYPE";
@@ -38,7 +38,15 @@ typedef enum
     TOKEN_ON,
     TOKEN_PRIMARY,
     TOKEN_KEY,
-    TOKEN_UNIQUE
+    TOKEN_UNIQUE,
+
+    TOKEN_COPY,
+    TOKEN_TO,
+    TOKEN_WITH,
+    TOKEN_CONCURRENTLY,
+    TOKEN_USING,
+    TOKEN_INCLUDE,
+    TOKEN_VACUUM
 } TokenType;
 
 typedef struct